@@ -6,7 +6,11 @@
         'target_name': "tervela",
         'sources': [ "src/Tervela.cpp", "src/Session.cpp", "src/Session_Create.cpp", 
                      "src/Publication.cpp", "src/Subscription.cpp", "src/Replay.cpp", 
-                     "src/EventEmitter.cpp", "src/Logger.cpp", "src/compat.cpp" ],
+                     "src/EventEmitter.cpp", "src/Logger.cpp", "src/compat.cpp",
+                     "src/GdAcker.cpp",
+                     "src/Dispatcher.cpp",
+                     "src/ReplayCache.cpp",
+                     "src/Aggregator.cpp" ],
         'include_dirs': [ "./gyp/include/cvv8" ],
         'conditions': [
             ['OS=="win"',
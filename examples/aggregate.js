@@ -0,0 +1,196 @@
+/**
+ * aggregate.js
+ *
+ * This application sends trades on a wildcard GD topic (it is assumed the TPE is subscribed to it) and
+ * aggregates them natively into per-symbol time buckets (open, high, low, close, volume and VWAP), first
+ * live from a subscription and then from a replay of the same messages.  No 'message' listener is
+ * added, so the messages are never converted to JavaScript objects.
+ *
+ * Usage:
+ *   node aggregate.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: AggregateJs)
+ *      --topic=topic                    (optional, default: TEST.GD.TRADES.*)
+ *      --duration=send_duration_s       (optional, default: 5)
+ *      --interval=bucket_interval       (optional, default: 1s)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "AggregateJs";
+var _topic = "TEST.GD.TRADES.*";
+var _duration = 5;
+var _interval = "1s";
+var _exit = false;
+var _closing = false;
+
+var _symbols = [ "IBM", "VOD", "MSFT" ];
+var _spec = {
+    interval: _interval,
+    key: "topic",
+    fields: {
+        price: [ "first", "max", "min", "last", "wmean:quantity" ],
+        quantity: [ "sum" ]
+    }
+};
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--duration") {
+            _duration = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--interval") {
+            _interval = keyval[1];
+            _spec.interval = _interval;
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        run(session);
+    }
+}
+
+function run(session) {
+    var subscription = session.createSubscriptionSync(_topic, { qos: "GC" });
+    var publication = session.createPublicationSync(_topic);
+    if ((typeof subscription === "string") || (typeof publication === "string")) {
+        console.log("Failed to create the subscription and publication");
+        shutdown(session);
+        return;
+    }
+
+    subscription.aggregate(_spec);
+    subscription.on('aggregate', function (buckets) {
+        printBuckets("Live", buckets);
+    });
+
+    console.log("Sending trades for %d seconds...", _duration);
+    var startTime = new Date();
+    var sequence = 0;
+    var timer = setInterval(function () {
+        for (var i = 0; i < 100; i++, sequence++) {
+            var symbol = _symbols[sequence % _symbols.length];
+            var trade = { price: 100 + Math.random() * 10, quantity: 1 + (sequence % 500) };
+            publication.sendMessage(_topic.replace("*", symbol), trade, { selfdescribe: true });
+        }
+    }, 10);
+
+    setTimeout(function () {
+        clearInterval(timer);
+        var endTime = new Date();
+
+        // The buckets still open are delivered when the subscription stops
+        subscription.stop(function (err) {
+            startReplay(session, startTime, endTime);
+        });
+    }, _duration * 1000);
+}
+
+function startReplay(session, startTime, endTime) {
+    console.log("Replaying the trades...");
+    var replay = session.createReplaySync(_topic, { startTime: startTime, endTime: endTime });
+    if (typeof replay === "string") {
+        console.log("Failed to create replay on topic %s: %s", _topic, replay);
+        shutdown(session);
+        return;
+    }
+
+    replay.aggregate(_spec);
+    replay.on('aggregate', function (buckets) {
+        printBuckets("Replayed", buckets);
+    }).on('error', function (err, range) {
+        console.log("Replay failed: " + err);
+        shutdown(session);
+    }).on('finish', function () {
+        console.log("Replay complete.");
+        shutdown(session);
+    });
+}
+
+function printBuckets(source, buckets) {
+    buckets.forEach(function (bucket) {
+        var price = bucket.fields.price;
+        var quantity = bucket.fields.quantity;
+        console.log("%s %s %s: %d trades, O %s H %s L %s C %s, volume %d, VWAP %s", source, bucket.key,
+                    bucket.start.toLocaleTimeString(), bucket.count, price.first.toFixed(2), price.max.toFixed(2),
+                    price.min.toFixed(2), price.last.toFixed(2), quantity.sum, price["wmean:quantity"].toFixed(3));
+    });
+}
+
+function shutdown(session) {
+    if (_closing) {
+        return;
+    }
+    _closing = true;
+
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node aggregate.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: AggregateJs)");
+    console.log("  --topic=topic                    (optional, default: TEST.GD.TRADES.*)");
+    console.log("  --duration=send_duration_s       (optional, default: 5)");
+    console.log("  --interval=bucket_interval       (optional, default: 1s)");
+}
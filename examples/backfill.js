@@ -0,0 +1,207 @@
+/**
+ * backfill.js
+ *
+ * This application sends messages on a GD topic (it is assumed the TPE is subscribed to this topic), then
+ * subscribes to the topic with a backfill from the time the first message was sent while it keeps on
+ * sending.  The subscription delivers the history then the live messages as one stream, and the
+ * application checks every sequence number is received exactly once.
+ *
+ * Usage:
+ *   node backfill.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: BackfillJs)
+ *      --topic=topic                    (optional, default: TEST.GD.JS)
+ *      --history=history_msg_count      (optional, default: 10000)
+ *      --live=live_msg_count            (optional, default: 10000)
+ *      --holdlimit=held_live_msgs       (optional, default: 100000)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "BackfillJs";
+var _topic = "TEST.GD.JS";
+var _historyCount = 10000;
+var _liveCount = 10000;
+var _holdLimit = 100000;
+var _exit = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--history") {
+            _historyCount = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--live") {
+            _liveCount = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--holdlimit") {
+            _holdLimit = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        run(session);
+    }
+}
+
+function run(session) {
+    var publication = session.createPublicationSync(_topic);
+    if (typeof publication === "string") {
+        console.log("Failed to create publication on topic %s: %s", _topic, publication);
+        shutdown(session);
+        return;
+    }
+
+    var total = _historyCount + _liveCount;
+    var startTime = new Date();
+    var sequence = 0;
+    var sent = 0;
+
+    function sendMessage() {
+        publication.sendMessage(_topic, { sequence: sequence++ }, { selfdescribe: true }, function (err) {
+            if (err) {
+                console.log("Error sending message: " + err);
+            }
+
+            if (++sent == _historyCount) {
+                setTimeout(function () { subscribe(session, startTime, total); }, 0);
+            }
+        });
+    }
+
+    console.log("Sending %d messages of history...", _historyCount);
+    for (var i = 0; i < _historyCount; i++) {
+        sendMessage();
+    }
+
+    // Live messages keep coming while the history is replayed
+    var timer = setInterval(function () {
+        for (var i = 0; (i < 100) && (sequence < total); i++) {
+            sendMessage();
+        }
+        if (sequence == total) {
+            clearInterval(timer);
+        }
+    }, 10);
+}
+
+function subscribe(session, startTime, total) {
+    console.log("Subscribing with a backfill from %s...", startTime.toLocaleTimeString());
+    var subscription = session.createSubscriptionSync(_topic, {
+        qos: "GC",
+        backfill: { since: startTime, holdLimit: _holdLimit }
+    });
+    if (typeof subscription === "string") {
+        console.log("Failed to create subscription on topic %s: %s", _topic, subscription);
+        shutdown(session);
+        return;
+    }
+
+    var seen = {};
+    var received = 0;
+    var duplicates = 0;
+    subscription.on('message', function (msg) {
+        var sequence = msg.fields.sequence;
+        if (seen[sequence]) {
+            duplicates++;
+        }
+        seen[sequence] = true;
+
+        if (++received == total) {
+            var stats = subscription.stats();
+            console.log("Received %d messages, %d duplicates: %d from the history, %d live duplicates dropped natively",
+                        received, duplicates, stats.backfilledMessages, stats.backfillDuplicates);
+            clearTimeout(timeout);
+            shutdown(session);
+        }
+    }).on('error', function (err) {
+        // Part of the history is missing, the subscription carries on live
+        console.log("Backfill failed: " + err);
+    });
+
+    var timeout = setTimeout(function () {
+        if (received < total) {
+            var missing = 0;
+            for (var i = 0; i < total; i++) {
+                if (!seen[i]) {
+                    missing++;
+                }
+            }
+            console.log("Timed out, %d messages received, %d missing", received, missing);
+            shutdown(session);
+        }
+    }, 60000);
+}
+
+function shutdown(session) {
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node backfill.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: BackfillJs)");
+    console.log("  --topic=topic                    (optional, default: TEST.GD.JS)");
+    console.log("  --history=history_msg_count      (optional, default: 10000)");
+    console.log("  --live=live_msg_count            (optional, default: 10000)");
+    console.log("  --holdlimit=held_live_msgs       (optional, default: 100000)");
+}
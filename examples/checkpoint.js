@@ -0,0 +1,238 @@
+/**
+ * checkpoint.js
+ *
+ * This application sends messages on a GD topic (it is assumed the TPE is subscribed to this topic), then:
+ *   - replays them, takes a checkpoint a third of the way through and stops the replay, then resumes a
+ *     new replay from the checkpoint (saved as JSON) and checks no message is skipped or repeated
+ *   - replays them again and seeks to the middle of the time range after the first message
+ *
+ * Usage:
+ *   node checkpoint.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: CheckpointJs)
+ *      --topic=topic                    (optional, default: TEST.GD.JS)
+ *      --count=msg_count                (optional, default: 10000)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "CheckpointJs";
+var _topic = "TEST.GD.JS";
+var _count = 10000;
+var _exit = false;
+var _closing = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        sendMessages(session, function (startTime, endTime) {
+            replayWithCheckpoint(session, startTime, endTime, function () {
+                replayWithSeek(session, startTime, endTime);
+            });
+        });
+    }
+}
+
+function sendMessages(session, sendAllComplete) {
+    var publication = session.createPublicationSync(_topic);
+    if (typeof publication === "string") {
+        console.log("Failed to create publication on topic %s: %s", _topic, publication);
+        shutdown(session);
+        return;
+    }
+
+    console.log("Sending %d messages...", _count);
+    var startTime = new Date();
+    var sent = 0;
+    for (var i = 0; i < _count; i++) {
+        publication.sendMessage(_topic, { sequence: i }, { selfdescribe: true }, function (err) {
+            if (err) {
+                console.log("Error sending message: " + err);
+            }
+
+            if (++sent == _count) {
+                var endTime = new Date();
+                setTimeout(function () { sendAllComplete(startTime, endTime); }, 0);
+            }
+        });
+    }
+}
+
+function createReplay(session, options) {
+    var replay = session.createReplaySync(_topic, options);
+    if (typeof replay === "string") {
+        console.log("Failed to create replay on topic %s: %s", _topic, replay);
+        shutdown(session);
+        return null;
+    }
+
+    replay.on('error', function (err, range) {
+        console.log("Replay failed: " + err);
+        shutdown(session);
+    });
+    return replay;
+}
+
+function replayWithCheckpoint(session, startTime, endTime, replayComplete) {
+    var replay = createReplay(session, { startTime: startTime, endTime: endTime });
+    if (!replay) {
+        return;
+    }
+
+    var delivered = 0;
+    var lastSequence = -1;
+    var saved = null;
+    replay.on('message', function (msg) {
+        // Messages delivered until the stop completes are replayed again by the resumed replay
+        if (saved !== null) {
+            return;
+        }
+
+        delivered++;
+        lastSequence = msg.fields.sequence;
+
+        if (delivered == Math.floor(_count / 3)) {
+            // The checkpoint includes the message being delivered, and can be stored anywhere as JSON
+            saved = JSON.stringify(replay.checkpoint());
+            console.log("Stopping after %d messages, checkpoint %s", delivered, saved);
+            replay.stop(function (err) {
+                resume(session, startTime, endTime, JSON.parse(saved), lastSequence, delivered, replayComplete);
+            });
+        }
+    });
+}
+
+function resume(session, startTime, endTime, checkpoint, lastSequence, delivered, replayComplete) {
+    var replay = createReplay(session, { startTime: startTime, endTime: endTime, resumeFrom: checkpoint });
+    if (!replay) {
+        return;
+    }
+
+    var firstSequence = -1;
+    replay.on('message', function (msg) {
+        if (firstSequence < 0) {
+            firstSequence = msg.fields.sequence;
+        }
+        delivered++;
+    }).on('finish', function () {
+        console.log("Resumed at sequence %d after %d, %d messages delivered in total (%s)", firstSequence,
+                    lastSequence, delivered, ((firstSequence == lastSequence + 1) && (delivered == _count)) ?
+                    "none skipped or repeated" : "MISMATCH");
+        replayComplete();
+    });
+}
+
+function replayWithSeek(session, startTime, endTime) {
+    var replay = createReplay(session, { startTime: startTime, endTime: endTime });
+    if (!replay) {
+        return;
+    }
+
+    var middle = new Date(startTime.getTime() + Math.floor((endTime.getTime() - startTime.getTime()) / 2));
+    var isSeeking = false;
+    var afterSeek = 0;
+    var firstSequence = -1;
+    replay.on('message', function (msg) {
+        if (!isSeeking) {
+            // The same replay object carries on from the new time, with the same listeners
+            isSeeking = true;
+            console.log("Seeking to %s after the first message...", middle.toLocaleTimeString());
+            replay.seek(middle, function (err) {
+                if (!err) {
+                    console.log("Seek complete");
+                }
+            });
+            return;
+        }
+
+        if (firstSequence < 0) {
+            firstSequence = msg.fields.sequence;
+        }
+        afterSeek++;
+    }).on('finish', function () {
+        console.log("Replayed %d messages after the seek, from sequence %d", afterSeek, firstSequence);
+        shutdown(session);
+    });
+}
+
+function shutdown(session) {
+    if (_closing) {
+        return;
+    }
+    _closing = true;
+
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node checkpoint.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: CheckpointJs)");
+    console.log("  --topic=topic                    (optional, default: TEST.GD.JS)");
+    console.log("  --count=msg_count                (optional, default: 10000)");
+}
@@ -0,0 +1,141 @@
+/**
+ * columnar.js
+ *
+ * This application subscribes with columnar delivery and sends messages of two schemas on a wildcard
+ * topic, then prints the 'batch' events: one array per field, one batch per schema.
+ *
+ * Usage:
+ *   node columnar.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --topic=topic                    (optional, default: TEST.COLUMNAR.*)
+ *      --count=msg_count                (optional, default: 1000)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _topic = "TEST.COLUMNAR.*";
+var _count = 1000;
+var _exit = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ]
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+
+        var subscription = session.createSubscriptionSync(_topic, { qos: "GC", columnar: true });
+        var publication = session.createPublicationSync(_topic);
+        if (typeof subscription === "string") {
+            console.log("Failed to create subscription on topic %s: %s", _topic, subscription);
+            shutdown(session);
+        }
+        else if (typeof publication === "string") {
+            console.log("Failed to create publication on topic %s: %s", _topic, publication);
+            shutdown(session);
+        }
+        else {
+            var received = 0;
+            subscription.on('batch', function (batch) {
+                // Every message of a batch has the same fields, so the columns can be processed as arrays
+                var fieldNames = Object.keys(batch.fields);
+                var prices = batch.fields.price;
+                var total = 0;
+                for (var i = 0; i < batch.count; i++) {
+                    total += prices[i];
+                }
+
+                received += batch.count;
+                console.log("Batch of %d messages, fields [%s], first topic %s, mean price %s",
+                            batch.count, fieldNames.join(", "), batch.topic[0], (total / batch.count).toFixed(3));
+
+                if (received == _count) {
+                    console.log("Received all %d messages.", received);
+                    shutdown(session);
+                }
+            });
+
+            // Quotes and trades, two schemas on the same wildcard topic
+            console.log("Sending %d messages...", _count);
+            for (var i = 0; i < _count; i++) {
+                var message;
+                if ((i % 4) == 0) {
+                    message = { price: 100 + (i % 10), quantity: i % 100, side: (i % 8) ? "BUY" : "SELL" };
+                }
+                else {
+                    message = { price: 100 + (i % 10), bid: 99.5, ask: 100.5 };
+                }
+                publication.sendMessage(_topic.replace("*", "T" + (i % 4)), message, { selfdescribe: true });
+            }
+        }
+    }
+}
+
+function shutdown(session) {
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node columnar.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --topic=topic                    (optional, default: TEST.COLUMNAR.*)");
+    console.log("  --count=msg_count                (optional, default: 1000)");
+}
@@ -0,0 +1,189 @@
+/**
+ * flowcontrol.js
+ *
+ * This application receives a burst of bulk messages alongside a high priority control topic, pauses
+ * and resumes the bulk subscription, then prints the runtime statistics: subscription and publication
+ * counters, per-stage receive latency histograms and the session's dispatch waits per priority class.
+ *
+ * Usage:
+ *   node flowcontrol.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --topic=topic                    (optional, default: TEST.FLOW.DATA)
+ *      --control=topic                  (optional, default: TEST.FLOW.CONTROL)
+ *      --count=msg_count                (optional, default: 100000)
+ *      --pause=pause_ms                 (optional, default: 2000)
+ *      --spin                           (optional, poll for messages instead of waking up for them)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _topic = "TEST.FLOW.DATA";
+var _controlTopic = "TEST.FLOW.CONTROL";
+var _count = 100000;
+var _pause = 2000;
+var _spin = false;
+var _exit = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--control") {
+            _controlTopic = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--pause") {
+            _pause = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+    }
+    else if (keyval.length == 1) {
+        if (keyval[0] == "--spin") {
+            _spin = true;
+        }
+        else if (keyval[0] == "--help") {
+            _exit = true;
+        }
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        drainMessages: 500,                         // per subscription and weight, per turn
+        drainTime: 5000,                            // usec per turn, so timers and I/O keep running
+        latencyMode: (_spin) ? "spin" : "async"
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        run(session);
+    }
+}
+
+function run(session) {
+    // Bulk data gets twice the share of each turn, control messages always go first
+    var data = session.createSubscriptionSync(_topic, { qos: "GC", weight: 2, pauseBufferLimit: _count });
+    var control = session.createSubscriptionSync(_controlTopic, { qos: "GC", priority: "high" });
+    var publication = session.createPublicationSync(_topic);
+    var controlPublication = session.createPublicationSync(_controlTopic);
+    if ((typeof data === "string") || (typeof control === "string") ||
+        (typeof publication === "string") || (typeof controlPublication === "string")) {
+        console.log("Failed to create the subscriptions and publications");
+        shutdown(session);
+        return;
+    }
+
+    var received = 0;
+    var isPaused = false;
+    data.on('message', function (msg) {
+        received++;
+        if ((received == Math.floor(_count / 2)) && !isPaused) {
+            // Received messages are held natively while paused
+            isPaused = true;
+            data.pause();
+            console.log("Paused after %d messages, resuming in %d ms", received, _pause);
+            setTimeout(function () {
+                console.log("Resuming, %d messages held", data.stats().queueDepth);
+                data.resume();
+            }, _pause);
+        }
+
+        if (received == _count) {
+            printStats(session, data, publication);
+            shutdown(session);
+        }
+    });
+
+    control.on('message', function (msg) {
+        console.log("Control message %s, %d data messages waiting", msg.fields.command, data.stats().queueDepth);
+    });
+
+    console.log("Sending %d messages...", _count);
+    for (var i = 0; i < _count; i++) {
+        publication.sendMessage(_topic, { sequence: i, payload: "bulk data" }, { selfdescribe: true });
+        if ((i % 10000) == 0) {
+            controlPublication.sendMessage(_controlTopic, { command: "checkpoint " + i }, { selfdescribe: true });
+        }
+    }
+}
+
+function printStats(session, subscription, publication) {
+    var stats = subscription.stats();
+    console.log("Subscription: %d messages in, %d bytes, %d dropped, peak queue depth %d",
+                stats.messagesIn, stats.bytesIn, stats.drops, stats.peakQueueDepth);
+
+    stats = publication.stats();
+    console.log("Publication: %d messages out, %d bytes", stats.messagesOut, stats.bytesOut);
+
+    var latency = subscription.latencyStats();
+    [ "fabric", "decode", "queue", "handler", "total" ].forEach(function (stage) {
+        var histogram = latency[stage];
+        console.log("  %s latency (usec): p50 %d, p99 %d, max %d", stage, histogram.p50, histogram.p99, histogram.max);
+    });
+
+    var dispatch = session.dispatchStats();
+    [ "high", "normal", "low" ].forEach(function (priority) {
+        var histogram = dispatch[priority];
+        console.log("  %s priority dispatch wait (usec): count %d, p99 %d", priority, histogram.count, histogram.p99);
+    });
+}
+
+function shutdown(session) {
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node flowcontrol.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --topic=topic                    (optional, default: TEST.FLOW.DATA)");
+    console.log("  --control=topic                  (optional, default: TEST.FLOW.CONTROL)");
+    console.log("  --count=msg_count                (optional, default: 100000)");
+    console.log("  --pause=pause_ms                 (optional, default: 2000)");
+    console.log("  --spin                           (optional, poll for messages instead of waking up for them)");
+}
@@ -0,0 +1,209 @@
+/**
+ * gdack.js
+ *
+ * This application sends GD messages to itself and acknowledges them in one of four ways:
+ *   auto     the native acker thread acknowledges each message when the listener returns
+ *   resolve  each message is acknowledged when the listener calls 'done', here after an asynchronous step
+ *   batch    messages are acknowledged in arrays of --batch messages with subscription.acknowledge
+ *   upto     every --batch messages, all the outstanding messages are acknowledged with subscription.ackUpTo
+ *
+ * Usage:
+ *   node gdack.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: GdAckJs)
+ *      --subname=subscription_name      (optional, default: GdAckJsSub)
+ *      --topic=topic                    (optional, default: TEST.GD.ACK)
+ *      --count=msg_count                (optional, default: 10000)
+ *      --ack=( "auto" | "resolve" | "batch" | "upto" )  (optional, default: "auto")
+ *      --batch=ack_batch_size           (optional, default: 100)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "GdAckJs";
+var _subName = "GdAckJsSub";
+var _topic = "TEST.GD.ACK";
+var _count = 10000;
+var _ack = "auto";
+var _batch = 100;
+var _exit = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--ack") {
+            _ack = keyval[1];
+        }
+        else if (keyval[0] == "--batch") {
+            _batch = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+        else if (keyval[0] == "--subname") {
+            _subName = keyval[1];
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if ((!_exit) && ([ "auto", "resolve", "batch", "upto" ].indexOf(_ack) < 0)) {
+    console.log("Unknown ack mode " + _ack);
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        run(session);
+    }
+}
+
+function run(session) {
+    var options = { qos: "GD", name: _subName };
+    if ((_ack == "batch") || (_ack == "upto")) {
+        options.ackMode = "manual";
+    }
+    else if (_ack == "resolve") {
+        options.ackOn = "resolve";
+    }
+
+    var subscription = session.createSubscriptionSync(_topic, options);
+    if (typeof subscription === "string") {
+        console.log("Failed to create subscription on topic %s: %s", _topic, subscription);
+        shutdown(session);
+        return;
+    }
+
+    var received = 0;
+    var acknowledged = 0;
+    var pending = [];
+
+    function messageAcknowledged(count) {
+        acknowledged += count;
+        if (acknowledged == _count) {
+            var stats = subscription.stats();
+            console.log("Acknowledged all %d messages, %d outstanding", acknowledged, stats.outstandingGd);
+            shutdown(session);
+        }
+    }
+
+    subscription.on('message', function (msg, done) {
+        received++;
+
+        if (_ack == "auto") {
+            // Queued for the acker thread once this listener returns
+            messageAcknowledged(1);
+        }
+        else if (_ack == "resolve") {
+            setTimeout(function () {
+                done();
+                messageAcknowledged(1);
+            }, 0);
+        }
+        else if (_ack == "batch") {
+            pending.push(msg);
+            if ((pending.length == _batch) || (received == _count)) {
+                var messages = pending;
+                pending = [];
+                subscription.acknowledge(messages, function (err, messages) {
+                    if (err) {
+                        console.log("Acknowledge failed: " + err);
+                    }
+                    messageAcknowledged(messages.length);
+                });
+            }
+        }
+        else if (((received % _batch) == 0) || (received == _count)) {
+            // Everything delivered up to this message
+            subscription.ackUpTo(msg, function (err, count) {
+                if (err) {
+                    console.log("Acknowledge failed: " + err);
+                }
+                messageAcknowledged(count);
+            });
+        }
+    });
+
+    var publication = session.createPublicationSync(_topic);
+    if (typeof publication === "string") {
+        console.log("Failed to create publication on topic %s: %s", _topic, publication);
+        shutdown(session);
+        return;
+    }
+
+    console.log("Sending %d messages, acknowledged with mode %s...", _count, _ack);
+    for (var i = 0; i < _count; i++) {
+        publication.sendMessage(_topic, { sequence: i }, { selfdescribe: true });
+    }
+}
+
+function shutdown(session) {
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node gdack.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: GdAckJs)");
+    console.log("  --subname=subscription_name      (optional, default: GdAckJsSub)");
+    console.log("  --topic=topic                    (optional, default: TEST.GD.ACK)");
+    console.log("  --count=msg_count                (optional, default: 10000)");
+    console.log("  --ack=( \"auto\" | \"resolve\" | \"batch\" | \"upto\" )  (optional, default: \"auto\")");
+    console.log("  --batch=ack_batch_size           (optional, default: 100)");
+}
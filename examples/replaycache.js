@@ -0,0 +1,215 @@
+/**
+ * replaycache.js
+ *
+ * This application sends messages on a GD topic (it is assumed the TPE is subscribed to this topic),
+ * recording the publisher sessions they are received from, then:
+ *   - replays them twice with a replay cache directory: the first replay is recorded to the cache,
+ *     the second one is read back from it without any request to the TPE
+ *   - replays only the messages of the first publisher session received, by sequence number range
+ *
+ * Usage:
+ *   node replaycache.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: ReplayCacheJs)
+ *      --topic=topic                    (optional, default: TEST.GD.JS)
+ *      --count=msg_count                (optional, default: 10000)
+ *      --cachedir=directory             (optional, default: ./replay-cache)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "ReplayCacheJs";
+var _topic = "TEST.GD.JS";
+var _count = 10000;
+var _cacheDir = "./replay-cache";
+var _exit = false;
+var _closing = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--cachedir") {
+            _cacheDir = keyval[1];
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        run(session);
+    }
+}
+
+function run(session) {
+    var subscription = session.createSubscriptionSync(_topic, { qos: "GC", trackOrigins: true });
+    var publication = session.createPublicationSync(_topic);
+    if ((typeof subscription === "string") || (typeof publication === "string")) {
+        console.log("Failed to create the subscription and publication");
+        shutdown(session);
+        return;
+    }
+
+    var startTime = new Date();
+    var received = 0;
+    subscription.on('message', function (msg) {
+        if (++received < _count) {
+            return;
+        }
+
+        var endTime = new Date();
+        var origins = subscription.origins();
+        subscription.stop();
+
+        // The cache is recorded by the first replay and read by the second, once the background
+        // writer has published the segment
+        replayCached(session, startTime, endTime, 1, function () {
+            setTimeout(function () {
+                replayCached(session, startTime, endTime, 2, function () {
+                    replayOrigin(session, startTime, endTime, origins);
+                });
+            }, 1000);
+        });
+    });
+
+    console.log("Sending %d messages...", _count);
+    for (var i = 0; i < _count; i++) {
+        publication.sendMessage(_topic, { sequence: i }, { selfdescribe: true });
+    }
+}
+
+function replayCached(session, startTime, endTime, pass, replayComplete) {
+    var startDate = new Date();
+    var replay = session.createReplaySync(_topic, { startTime: startTime, endTime: endTime, cacheDir: _cacheDir });
+    if (typeof replay === "string") {
+        console.log("Failed to create replay on topic %s: %s", _topic, replay);
+        shutdown(session);
+        return;
+    }
+
+    var replayed = 0;
+    replay.on('message', function (msg) {
+        replayed++;
+    }).on('error', function (err, range) {
+        console.log("Replay failed: " + err);
+        shutdown(session);
+    }).on('finish', function () {
+        var stats = replay.stats();
+        console.log("Replay %d: %d messages in %d ms, %d from the TPE and %d from the cache",
+                    pass, replayed, new Date().getTime() - startDate.getTime(), stats.messagesIn, stats.cachedMessagesIn);
+        replayComplete();
+    });
+}
+
+function replayOrigin(session, startTime, endTime, origins) {
+    if (origins.length == 0) {
+        console.log("The Tervela API does not expose the publisher sessions of messages");
+        shutdown(session);
+        return;
+    }
+
+    // Narrowed on the TPE to one publisher session and sequence number range
+    var origin = origins[0];
+    var replay = session.createReplaySync(_topic, {
+        startTime: startTime,
+        endTime: endTime,
+        pubId: origin.pubId,
+        sessionId: origin.sessionId,
+        tsnStart: origin.firstTsn,
+        tsnEnd: origin.lastTsn
+    });
+    if (typeof replay === "string") {
+        console.log("Failed to create replay on topic %s: %s", _topic, replay);
+        shutdown(session);
+        return;
+    }
+
+    var replayed = 0;
+    replay.on('message', function (msg) {
+        replayed++;
+    }).on('error', function (err, range) {
+        console.log("Replay failed: " + err);
+        shutdown(session);
+    }).on('finish', function () {
+        console.log("Replayed %d of the %d messages received from publisher %d session %d (TSN %d to %d)",
+                    replayed, origin.messages, origin.pubId, origin.sessionId, origin.firstTsn, origin.lastTsn);
+        shutdown(session);
+    });
+}
+
+function shutdown(session) {
+    if (_closing) {
+        return;
+    }
+    _closing = true;
+
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node replaycache.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: ReplayCacheJs)");
+    console.log("  --topic=topic                    (optional, default: TEST.GD.JS)");
+    console.log("  --count=msg_count                (optional, default: 10000)");
+    console.log("  --cachedir=directory             (optional, default: ./replay-cache)");
+}
@@ -0,0 +1,224 @@
+/**
+ * replayflow.js
+ *
+ * This application sends messages on a GD topic (it is assumed the TPE is subscribed to this topic) and
+ * replays them back paced at --speed times real time, split in --parallelism concurrent sub-ranges and
+ * with backpressure bounding the messages waiting to be delivered.  The replay's progress is printed
+ * every second, and it is paused and resumed from within its 'message' listener half way through.
+ *
+ * Usage:
+ *   node replayflow.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: ReplayFlowJs)
+ *      --topic=topic                    (optional, default: TEST.GD.JS)
+ *      --count=msg_count                (optional, default: 10000)
+ *      --speed=( multiplier | "max" )   (optional, default: "max")
+ *      --parallelism=sub_replays        (optional, default: 4)
+ *      --unordered                      (optional, deliver sub-ranges as they are received)
+ *      --highwatermark=queued_msgs      (optional, default: 1000)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "ReplayFlowJs";
+var _topic = "TEST.GD.JS";
+var _count = 10000;
+var _speed = "max";
+var _parallelism = 4;
+var _ordered = true;
+var _highWaterMark = 1000;
+var _exit = false;
+var _closing = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topic = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--speed") {
+            _speed = (keyval[1] == "max") ? "max" : parseFloat(keyval[1]);
+        }
+        else if (keyval[0] == "--parallelism") {
+            _parallelism = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--highwatermark") {
+            _highWaterMark = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+    }
+    else if (keyval.length == 1) {
+        if (keyval[0] == "--unordered") {
+            _ordered = false;
+        }
+        else if (keyval[0] == "--help") {
+            _exit = true;
+        }
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if ((!_exit) && !_ordered && (_speed != "max")) {
+    console.log("Unordered replays can not be paced");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        sendMessages(session, function (startTime, endTime) {
+            startReplay(session, startTime, endTime);
+        });
+    }
+}
+
+function sendMessages(session, sendAllComplete) {
+    var publication = session.createPublicationSync(_topic);
+    if (typeof publication === "string") {
+        console.log("Failed to create publication on topic %s: %s", _topic, publication);
+        shutdown(session);
+        return;
+    }
+
+    console.log("Sending %d messages...", _count);
+    var startTime = new Date();
+    var sent = 0;
+    for (var i = 0; i < _count; i++) {
+        publication.sendMessage(_topic, { sequence: i, timestamp: new Date() }, { selfdescribe: true }, function (err) {
+            if (err) {
+                console.log("Error sending message: " + err);
+            }
+
+            if (++sent == _count) {
+                var endTime = new Date();
+                setTimeout(function () { sendAllComplete(startTime, endTime); }, 0);
+            }
+        });
+    }
+}
+
+function startReplay(session, startTime, endTime) {
+    console.log("Replaying at speed %s, %d sub-ranges, %s...", _speed, _parallelism, (_ordered) ? "ordered" : "unordered");
+
+    var replay = session.createReplaySync(_topic, {
+        startTime: startTime,
+        endTime: endTime,
+        speed: _speed,
+        parallelism: _parallelism,
+        ordered: _ordered,
+        highWaterMark: _highWaterMark,
+        lowWaterMark: Math.floor(_highWaterMark / 10),
+        progressInterval: 1000
+    });
+    if (typeof replay === "string") {
+        console.log("Failed to create replay on topic %s: %s", _topic, replay);
+        shutdown(session);
+        return;
+    }
+
+    var replayed = 0;
+    var lastSequence = -1;
+    var outOfOrder = 0;
+    replay.on('message', function (msg) {
+        replayed++;
+        if (msg.fields.sequence < lastSequence) {
+            outOfOrder++;
+        }
+        lastSequence = msg.fields.sequence;
+
+        if (replayed == Math.floor(_count / 2)) {
+            // Listeners can be added while the event is being emitted
+            replay.pause(function (err) {
+                console.log("Paused by the application for a second");
+                setTimeout(function () { replay.resume(); }, 1000);
+            });
+        }
+    }).on('progress', function (stats) {
+        var eta = (stats.eta === null) ? "unknown" : (stats.eta / 1000000).toFixed(1) + "s";
+        console.log("  %s%% done, %d in/s, %d delivered/s, %d queued, ETA %s",
+                    stats.percentDone.toFixed(1), stats.inRate.toFixed(0), stats.deliveredRate.toFixed(0),
+                    stats.queueDepth, eta);
+    }).on('error', function (err, range) {
+        console.log("Replay of %s from %s failed: %s", range.topic, range.startTime.toLocaleTimeString(), err);
+        shutdown(session);
+    }).on('finish', function () {
+        var stats = replay.stats();
+        console.log("Replay complete, replayed %d messages (%d out of order).", replayed, outOfOrder);
+        console.log("Throttled %d times for %d ms, paused for %d ms", stats.throttles,
+                    Math.round(stats.throttledTime / 1000), Math.round(stats.pausedTime / 1000));
+        shutdown(session);
+    });
+}
+
+function shutdown(session) {
+    // Each failed sub-range emits its own 'error'
+    if (_closing) {
+        return;
+    }
+    _closing = true;
+
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node replayflow.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: ReplayFlowJs)");
+    console.log("  --topic=topic                    (optional, default: TEST.GD.JS)");
+    console.log("  --count=msg_count                (optional, default: 10000)");
+    console.log("  --speed=( multiplier | \"max\" )   (optional, default: \"max\")");
+    console.log("  --parallelism=sub_replays        (optional, default: 4)");
+    console.log("  --unordered                      (optional, deliver sub-ranges as they are received)");
+    console.log("  --highwatermark=queued_msgs      (optional, default: 1000)");
+}
@@ -0,0 +1,174 @@
+/**
+ * replaymerge.js
+ *
+ * This application sends messages on several GD topics (it is assumed the TPE is subscribed to them)
+ * and replays them all in a single replay, merged natively into one stream in generation time order.
+ *
+ * Usage:
+ *   node replaymerge.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --gdname=gd_client_name          (optional, default: ReplayMergeJs)
+ *      --topic=topic[:topic]            (optional, default: TEST.GD.A:TEST.GD.B:TEST.GD.C)
+ *      --count=msg_count                (optional, default: 1000 per topic)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _gdName = "ReplayMergeJs";
+var _topicList = [ "TEST.GD.A", "TEST.GD.B", "TEST.GD.C" ];
+var _count = 1000;
+var _exit = false;
+var _closing = false;
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--topic") {
+            _topicList = keyval[1].split(":");
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+        else if (keyval[0] == "--gdname") {
+            _gdName = keyval[1];
+        }
+    }
+    else if ((keyval.length == 1) && (keyval[0] == "--help")) {
+        _exit = true;
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ],
+        name: _gdName
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        sendMessages(session, function (startTime, endTime) {
+            startReplay(session, startTime, endTime);
+        });
+    }
+}
+
+function sendMessages(session, sendAllComplete) {
+    var publications = [];
+    for (var i = 0; i < _topicList.length; i++) {
+        var publication = session.createPublicationSync(_topicList[i]);
+        if (typeof publication === "string") {
+            console.log("Failed to create publication on topic %s: %s", _topicList[i], publication);
+            shutdown(session);
+            return;
+        }
+        publications.push(publication);
+    }
+
+    // Interleaved, the topics overlap in time
+    var total = _count * _topicList.length;
+    console.log("Sending %d messages on %d topics...", total, _topicList.length);
+    var startTime = new Date();
+    var sent = 0;
+    for (var i = 0; i < total; i++) {
+        var index = i % _topicList.length;
+        publications[index].sendMessage(_topicList[index], { sequence: i }, { selfdescribe: true }, function (err) {
+            if (err) {
+                console.log("Error sending message: " + err);
+            }
+
+            if (++sent == total) {
+                var endTime = new Date();
+                setTimeout(function () { sendAllComplete(startTime, endTime); }, 0);
+            }
+        });
+    }
+}
+
+function startReplay(session, startTime, endTime) {
+    console.log("Replaying %s as one stream...", _topicList.join(", "));
+    var replay = session.createReplaySync(_topicList, { startTime: startTime, endTime: endTime, ordered: true });
+    if (typeof replay === "string") {
+        console.log("Failed to create replay: %s", replay);
+        shutdown(session);
+        return;
+    }
+
+    var replayed = {};
+    var lastTime = 0;
+    var outOfOrder = 0;
+    replay.on('message', function (msg) {
+        replayed[msg.topic] = (replayed[msg.topic] || 0) + 1;
+        if (msg.generationTime.getTime() < lastTime) {
+            outOfOrder++;
+        }
+        lastTime = msg.generationTime.getTime();
+    }).on('error', function (err, range) {
+        console.log("Replay of %s failed: %s", range.topic, err);
+        shutdown(session);
+    }).on('finish', function () {
+        _topicList.forEach(function (topic) {
+            console.log("  %s: %d messages", topic, replayed[topic] || 0);
+        });
+        console.log("Replay complete, %d messages out of generation time order.", outOfOrder);
+        shutdown(session);
+    });
+}
+
+function shutdown(session) {
+    if (_closing) {
+        return;
+    }
+    _closing = true;
+
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node replaymerge.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --gdname=gd_client_name          (optional, default: ReplayMergeJs)");
+    console.log("  --topic=topic[:topic]            (optional, default: TEST.GD.A:TEST.GD.B:TEST.GD.C)");
+    console.log("  --count=msg_count                (optional, default: 1000 per topic)");
+}
@@ -0,0 +1,160 @@
+/**
+ * routing.js
+ *
+ * This application subscribes to a wildcard topic and has the messages of some of its topics routed
+ * natively to their own listeners with subscription.onTopic; the other topics go to the 'message'
+ * listener.  Half way through, one route is removed with subscription.offTopic.  With --cursor the
+ * listeners are given the subscription's reused cursor instead of message objects, and read the
+ * fields without creating any garbage.
+ *
+ * Usage:
+ *   node routing.js --tmx=tmx[:tmx] [options]
+ *      --user=username                  (optional, default: tervela)
+ *      --pass=password                  (optional, default: tva123ma1)
+ *      --tmx=tmx[:tmx]                  (required)
+ *      --count=msg_count                (optional, default: 10000)
+ *      --cursor                         (optional, deliver a cursor instead of message objects)
+ */
+
+// Set NODE_PATH environment variable to include location of tervela.node file
+var tervela = require("tervela");
+
+process.on('uncaughtException', function (err) {
+    console.log(err.stack);
+});
+
+var _username = "tervela";
+var _password = "tva123ma1";
+var _primaryTmx = "";
+var _secondaryTmx = "";
+var _count = 10000;
+var _cursor = false;
+var _exit = false;
+
+// Messages are sent to TEST.ROUTE.<exchange>.<symbol>
+var _exchanges = [ "NYSE", "LSE" ];
+var _symbols = [ "IBM", "VOD", "MSFT" ];
+
+var args = process.argv.splice(2);
+args.forEach(function (val, index, array) {
+    var keyval = val.split("=");
+    if (keyval.length == 2) {
+        if (keyval[0] == "--user") {
+            _username = keyval[1];
+        }
+        else if (keyval[0] == "--pass") {
+            _password = keyval[1];
+        }
+        else if (keyval[0] == "--count") {
+            _count = parseInt(keyval[1]);
+        }
+        else if (keyval[0] == "--tmx") {
+            var ps = keyval[1].split(":");
+            _primaryTmx = ps[0];
+            if (ps.length > 1) {
+                _secondaryTmx = ps[1];
+            }
+        }
+    }
+    else if (keyval.length == 1) {
+        if (keyval[0] == "--cursor") {
+            _cursor = true;
+        }
+        else if (keyval[0] == "--help") {
+            _exit = true;
+        }
+    }
+});
+
+if ((!_exit) && (_primaryTmx.length == 0)) {
+    console.log("Missing TMX");
+    _exit = true;
+}
+
+if (_exit) {
+    printUsage();
+}
+else {
+    console.log("Connecting to %s...", (_secondaryTmx) ? "TMXs" : "TMX");
+    var session = tervela.connectSync({
+        username: _username,
+        password: _password,
+        tmx: [ _primaryTmx, _secondaryTmx ]
+    });
+    if (typeof session === "string") {
+        console.log("Connect failed: " + session);
+    }
+    else {
+        console.log("Connected.");
+        run(session);
+    }
+}
+
+function run(session) {
+    var subscription = session.createSubscriptionSync("TEST.ROUTE.>", { qos: "GC", cursor: _cursor });
+    var publication = session.createPublicationSync("TEST.ROUTE.>");
+    if ((typeof subscription === "string") || (typeof publication === "string")) {
+        console.log("Failed to create the subscription and publication");
+        shutdown(session);
+        return;
+    }
+
+    var counts = { ibm: 0, nyse: 0, other: 0 };
+    var total = 0;
+    var high = 0;
+
+    // A cursor is only valid until the listener returns, values are copied out as numbers
+    function getPrice(msg) {
+        return (_cursor) ? msg.getNumber("price") : msg.fields.price;
+    }
+
+    function messageHandled() {
+        if (++total == _count) {
+            console.log("Routed: %d to TEST.ROUTE.*.IBM (high %d), %d to TEST.ROUTE.NYSE.>, %d to 'message'",
+                        counts.ibm, high, counts.nyse, counts.other);
+            shutdown(session);
+        }
+        else if (total == Math.floor(_count / 2)) {
+            // NYSE messages other than IBM now go to the 'message' listener
+            subscription.offTopic("TEST.ROUTE.NYSE.>");
+        }
+    }
+
+    // The most specific pattern wins: TEST.ROUTE.NYSE.IBM goes to the first listener
+    subscription.onTopic("TEST.ROUTE.*.IBM", function (msg) {
+        counts.ibm++;
+        high = Math.max(high, getPrice(msg));
+        messageHandled();
+    });
+
+    subscription.onTopic("TEST.ROUTE.NYSE.>", function (msg) {
+        counts.nyse++;
+        messageHandled();
+    });
+
+    subscription.on('message', function (msg) {
+        counts.other++;
+        messageHandled();
+    });
+
+    console.log("Sending %d messages...", _count);
+    for (var i = 0; i < _count; i++) {
+        var topic = "TEST.ROUTE." + _exchanges[i % _exchanges.length] + "." + _symbols[i % _symbols.length];
+        publication.sendMessage(topic, { price: 100 + (i % 50), quantity: i % 1000 }, { selfdescribe: true });
+    }
+}
+
+function shutdown(session) {
+    console.log("Disconnecting from TMX...");
+    session.close(function (err) {
+        console.log("Session closed");
+    });
+}
+
+function printUsage() {
+    console.log("Usage: node routing.js --tmx=tmx[:tmx] [options]");
+    console.log("  --user=username                  (optional, default: tervela)");
+    console.log("  --pass=password                  (optional, default: tva123ma1)");
+    console.log("  --count=msg_count                (optional, default: 10000)");
+    console.log("  --cursor                         (optional, deliver a cursor instead of message objects)");
+}
@@ -0,0 +1,664 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#include <stdlib.h>
+#include "Helpers.h"
+#include "Aggregator.h"
+
+using namespace v8;
+
+/*-----------------------------------------------------------------------------
+ * Interval units, in microseconds
+ */
+static const struct
+{
+  const char* name;
+  TVA_UINT64 scale;
+} intervalUnits[] =
+{
+  { "us", 1ULL },
+  { "ms", 1000ULL },
+  { "s",  1000000ULL },
+  { "m",  60000000ULL },
+  { "h",  3600000000ULL }
+};
+
+Aggregator::Aggregator(size_t sourceCount)
+  : _sourceWatermarks(sourceCount, 0),
+    _isSourceFinished(sourceCount, false)
+{
+  _interval = 0;
+  _grace = AGGREGATOR_DEFAULT_GRACE;
+  _completedBefore = 0;
+  _lateMessages = 0;
+  _isKeyed = false;
+  _isTopicKey = false;
+  uv_mutex_init(&_lock);
+}
+
+Aggregator::~Aggregator()
+{
+  uv_mutex_destroy(&_lock);
+}
+
+
+/*****     Specification     *****/
+
+/*-----------------------------------------------------------------------------
+ * Read the aggregation specification
+ *
+ * spec = {
+ *    interval : [bucket length] (Number (ms) | String, e.g. '500ms', '1s', '5m')
+ *    grace    : [wait for late messages after an interval] (Number (ms) | String, optional)
+ *    key      : ['topic' or a field name to group by] (String, optional)
+ *    fields   : { name: [ops] } (Object)
+ * }
+ */
+bool Aggregator::Parse(Local<Object> spec)
+{
+  if (!ParseInterval(spec->Get(String::NewSymbol("interval")), _interval, false))
+  {
+    return false;
+  }
+
+  Local<Value> grace = spec->Get(String::NewSymbol("grace"));
+  if (!grace->IsUndefined() && !ParseInterval(grace, _grace, true))
+  {
+    return false;
+  }
+
+  Local<Value> key = spec->Get(String::NewSymbol("key"));
+  if (key->IsString())
+  {
+    String::AsciiValue keyName(key);
+    _isKeyed = true;
+    _isTopicKey = (tva_str_casecmp(*keyName, "topic") == 0);
+    _keyField = *keyName;
+  }
+  else if (!key->IsUndefined() && !key->IsNull())
+  {
+    return false;
+  }
+
+  Local<Value> fields = spec->Get(String::NewSymbol("fields"));
+  if (!fields->IsObject())
+  {
+    return false;
+  }
+
+  const Local<Array> fieldNames = fields->ToObject()->GetPropertyNames();
+  for (uint32_t i = 0; i < fieldNames->Length(); i++)
+  {
+    const Local<Value> fieldName = fieldNames->Get(i);
+    const Local<Value> fieldOps = fields->ToObject()->Get(fieldName);
+
+    FieldSpec fieldSpec;
+    fieldSpec.name = *String::AsciiValue(fieldName);
+    fieldSpec.valueIndex = GetValueIndex(fieldSpec.name);
+    fieldSpec.ops = 0;
+
+    if (fieldOps->IsString())
+    {
+      if (!ParseOp(fieldSpec, *String::AsciiValue(fieldOps)))
+      {
+        return false;
+      }
+    }
+    else if (fieldOps->IsArray())
+    {
+      const Local<Array> ops = Local<Array>::Cast(fieldOps);
+      for (uint32_t j = 0; j < ops->Length(); j++)
+      {
+        if (!ops->Get(j)->IsString() || !ParseOp(fieldSpec, *String::AsciiValue(ops->Get(j))))
+        {
+          return false;
+        }
+      }
+    }
+    else
+    {
+      return false;
+    }
+
+    _fields.push_back(fieldSpec);
+  }
+
+  _values.resize(_valueNames.size());
+  _isPresent.resize(_valueNames.size());
+
+  return !_fields.empty();
+}
+
+/*-----------------------------------------------------------------------------
+ * Read an interval, in milliseconds or as a string with a unit
+ */
+bool Aggregator::ParseInterval(Local<Value> value, TVA_UINT64& interval, bool isZeroAllowed)
+{
+  if (value->IsNumber())
+  {
+    double ms = value->NumberValue();
+    if (!(ms > 0) && !(isZeroAllowed && (ms == 0)))
+    {
+      return false;
+    }
+
+    interval = (TVA_UINT64)(ms * 1000);
+    return (interval > 0) || isZeroAllowed;
+  }
+
+  if (!value->IsString())
+  {
+    return false;
+  }
+
+  String::AsciiValue text(value);
+  char* unit = NULL;
+  double count = strtod(*text, &unit);
+  if ((!(count > 0) && !(isZeroAllowed && (count == 0))) || (unit == *text))
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < sizeof(intervalUnits) / sizeof(intervalUnits[0]); i++)
+  {
+    if (tva_str_casecmp(unit, intervalUnits[i].name) == 0)
+    {
+      interval = (TVA_UINT64)(count * intervalUnits[i].scale);
+      return (interval > 0) || isZeroAllowed;
+    }
+  }
+
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+ * Add an operation to a field: count, first, last, min, max, sum, mean, or
+ * wsum:<weight field> and wmean:<weight field>
+ */
+bool Aggregator::ParseOp(FieldSpec& fieldSpec, const char* op)
+{
+  static const struct
+  {
+    const char* name;
+    int op;
+  } ops[] =
+  {
+    { "count",  AggregateOpCount },
+    { "first",  AggregateOpFirst },
+    { "last",   AggregateOpLast  },
+    { "min",    AggregateOpMin   },
+    { "max",    AggregateOpMax   },
+    { "sum",    AggregateOpSum   },
+    { "mean",   AggregateOpMean  }
+  };
+
+  for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+  {
+    if (tva_str_casecmp(op, ops[i].name) == 0)
+    {
+      fieldSpec.ops |= ops[i].op;
+      return true;
+    }
+  }
+
+  const char* weightField = strchr(op, ':');
+  if ((weightField == NULL) || (weightField[1] == '\0'))
+  {
+    return false;
+  }
+
+  std::string opName(op, weightField - op);
+  WeightSpec weightSpec;
+  weightSpec.name = op;
+  weightSpec.weightIndex = GetValueIndex(weightField + 1);
+  if (tva_str_casecmp(opName.c_str(), "wsum") == 0)
+  {
+    weightSpec.isMean = false;
+  }
+  else if (tva_str_casecmp(opName.c_str(), "wmean") == 0)
+  {
+    weightSpec.isMean = true;
+  }
+  else
+  {
+    return false;
+  }
+
+  fieldSpec.weights.push_back(weightSpec);
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Index of a field in the values read from each message
+ */
+int Aggregator::GetValueIndex(const std::string& name)
+{
+  for (size_t i = 0; i < _valueNames.size(); i++)
+  {
+    if (_valueNames[i] == name)
+    {
+      return (int)i;
+    }
+  }
+
+  _valueNames.push_back(name);
+  return (int)(_valueNames.size() - 1);
+}
+
+
+/*****     Accumulation     *****/
+
+/*-----------------------------------------------------------------------------
+ * Numeric value of a message field, false when it has none
+ */
+bool Aggregator::GetFieldNumber(MessageFieldData& field, double& value)
+{
+  switch (field.type)
+  {
+  case MessageFieldDataTypeInt32:
+    value = (double)field.value.int32Value;
+    return true;
+
+  case MessageFieldDataTypeNumber:
+    value = field.value.numberValue;
+    return true;
+
+  case MessageFieldDataTypeDate:
+    value = (double)field.value.dateValue.timeInMicroSecs / 1000;
+    return true;
+
+  case MessageFieldDataTypeBoolean:
+    value = (field.value.boolValue) ? 1 : 0;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Read the key and the aggregated values of a message (lock held).  There
+ * are only a few aggregated fields, a scan beats a map lookup.
+ */
+void Aggregator::ReadValues(MessageEvent& messageEvent)
+{
+  std::string& key = _bucketId.second;
+  key.clear();
+  if (_isTopicKey && messageEvent.topicName)
+  {
+    key.assign(messageEvent.topicName);
+  }
+
+  _isPresent.assign(_isPresent.size(), false);
+
+  std::list<MessageFieldData>::iterator it;
+  for (it = messageEvent.fieldData.begin(); it != messageEvent.fieldData.end(); it++)
+  {
+    MessageFieldData& field = *it;
+    if (_isKeyed && !_isTopicKey && (strcmp(_keyField.c_str(), field.name) == 0))
+    {
+      char buffer[32];
+      double number;
+      if (field.type == MessageFieldDataTypeString)
+      {
+        key.assign(field.value.stringValue);
+      }
+      else if (GetFieldNumber(field, number))
+      {
+        snprintf(buffer, sizeof(buffer), "%.15g", number);
+        key.assign(buffer);
+      }
+    }
+
+    for (size_t i = 0; i < _valueNames.size(); i++)
+    {
+      if ((strcmp(_valueNames[i].c_str(), field.name) == 0) && GetFieldNumber(field, _values[i]))
+      {
+        _isPresent[i] = true;
+        break;
+      }
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * The bucket of the message being added, created with the field storage of a
+ * delivered bucket when there is one (lock held)
+ */
+Aggregator::Bucket& Aggregator::GetBucket()
+{
+  std::map<BucketId, Bucket>::iterator it = _buckets.find(_bucketId);
+  if (it != _buckets.end())
+  {
+    return it->second;
+  }
+
+  Bucket& bucket = _buckets[_bucketId];
+  if (!_freeBuckets.empty())
+  {
+    bucket.fields.swap(_freeBuckets.back().fields);
+    _freeBuckets.pop_back();
+  }
+
+  bucket.key = _bucketId.second;
+  bucket.startTime = _bucketId.first;
+  bucket.count = 0;
+  bucket.fields.resize(_fields.size());
+  for (size_t i = 0; i < _fields.size(); i++)
+  {
+    FieldState& state = bucket.fields[i];
+    state.count = 0;
+    state.first = state.last = state.min = state.max = state.sum = 0;
+    state.weightedSum.assign(_fields[i].weights.size(), 0);
+    state.weightTotal.assign(_fields[i].weights.size(), 0);
+  }
+
+  return bucket;
+}
+
+/*-----------------------------------------------------------------------------
+ * Accumulate a decoded message into its bucket
+ */
+void Aggregator::Add(MessageEvent& messageEvent, size_t source)
+{
+  TVA_UINT64 startTime = messageEvent.generationTime - (messageEvent.generationTime % _interval);
+
+  uv_mutex_lock(&_lock);
+
+  // Its interval was already delivered, it would only start a duplicate
+  if (startTime < _completedBefore)
+  {
+    _lateMessages++;
+    uv_mutex_unlock(&_lock);
+    return;
+  }
+
+  ReadValues(messageEvent);
+  _bucketId.first = startTime;
+
+  Bucket& bucket = GetBucket();
+  bucket.count++;
+  for (size_t i = 0; i < _fields.size(); i++)
+  {
+    FieldSpec& spec = _fields[i];
+    if (!_isPresent[spec.valueIndex])
+    {
+      continue;
+    }
+
+    FieldState& state = bucket.fields[i];
+    double value = _values[spec.valueIndex];
+    if (state.count == 0)
+    {
+      state.first = state.min = state.max = value;
+    }
+    else
+    {
+      if (value < state.min) state.min = value;
+      if (value > state.max) state.max = value;
+    }
+    state.last = value;
+    state.sum += value;
+    state.count++;
+
+    for (size_t j = 0; j < spec.weights.size(); j++)
+    {
+      int weightIndex = spec.weights[j].weightIndex;
+      if (_isPresent[weightIndex])
+      {
+        state.weightedSum[j] += value * _values[weightIndex];
+        state.weightTotal[j] += _values[weightIndex];
+      }
+    }
+  }
+
+  if (source < _sourceWatermarks.size() && (startTime > _sourceWatermarks[source]))
+  {
+    _sourceWatermarks[source] = startTime;
+  }
+
+  CompleteBuckets();
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * No more messages from the source, it no longer holds buckets back
+ */
+void Aggregator::FinishSource(size_t source)
+{
+  uv_mutex_lock(&_lock);
+  if (source < _isSourceFinished.size())
+  {
+    _isSourceFinished[source] = true;
+  }
+  CompleteBuckets();
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Complete the buckets of the intervals that ended, with the grace period,
+ * before time (JavaScript thread, live subscriptions)
+ */
+void Aggregator::Expire(TVA_UINT64 time)
+{
+  if (time <= _grace)
+  {
+    return;
+  }
+
+  TVA_UINT64 endTime = time - _grace;
+
+  uv_mutex_lock(&_lock);
+  CompleteBucketsBefore(endTime - (endTime % _interval));
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Complete every bucket
+ */
+void Aggregator::Flush()
+{
+  uv_mutex_lock(&_lock);
+  if (!_buckets.empty())
+  {
+    CompleteBucketsBefore(_buckets.rbegin()->first.first + _interval);
+  }
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Start over with new sources
+ */
+void Aggregator::Reset(size_t sourceCount)
+{
+  uv_mutex_lock(&_lock);
+  _buckets.clear();
+  _sourceWatermarks.assign(sourceCount, 0);
+  _isSourceFinished.assign(sourceCount, false);
+  _completedBefore = 0;
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Complete the buckets every unfinished source has moved past (lock held)
+ */
+void Aggregator::CompleteBuckets()
+{
+  // Live, only the clock completes buckets
+  if (_sourceWatermarks.empty())
+  {
+    return;
+  }
+
+  TVA_UINT64 watermark = 0;
+  bool isLimited = false;
+  for (size_t i = 0; i < _sourceWatermarks.size(); i++)
+  {
+    if (!_isSourceFinished[i] && (!isLimited || (_sourceWatermarks[i] < watermark)))
+    {
+      watermark = _sourceWatermarks[i];
+      isLimited = true;
+    }
+  }
+
+  if (!isLimited)
+  {
+    watermark = (_buckets.empty()) ? 0 : _buckets.rbegin()->first.first + _interval;
+  }
+
+  CompleteBucketsBefore(watermark);
+}
+
+/*-----------------------------------------------------------------------------
+ * Move the buckets of the intervals starting before time to the completed
+ * list, later messages for them are late (lock held)
+ */
+void Aggregator::CompleteBucketsBefore(TVA_UINT64 time)
+{
+  while (!_buckets.empty() && (_buckets.begin()->first.first < time))
+  {
+    Bucket& bucket = _buckets.begin()->second;
+
+    // Moved without copying the field storage
+    _completed.push_back(Bucket());
+    Bucket& completed = _completed.back();
+    completed.key.swap(bucket.key);
+    completed.startTime = bucket.startTime;
+    completed.count = bucket.count;
+    completed.fields.swap(bucket.fields);
+
+    _buckets.erase(_buckets.begin());
+  }
+
+  if (time > _completedBefore)
+  {
+    _completedBefore = time;
+  }
+}
+
+
+/*****     JavaScript     *****/
+
+/*-----------------------------------------------------------------------------
+ * A statistic, null when there is none
+ */
+Handle<Value> Aggregator::CreateJsNumber(bool isSet, double value)
+{
+  if (!isSet)
+  {
+    return Null();
+  }
+
+  return Number::New(value);
+}
+
+uint64_t Aggregator::GetLateMessages()
+{
+  uv_mutex_lock(&_lock);
+  uint64_t lateMessages = _lateMessages;
+  uv_mutex_unlock(&_lock);
+
+  return lateMessages;
+}
+
+bool Aggregator::HasCompleted()
+{
+  uv_mutex_lock(&_lock);
+  bool hasCompleted = !_completed.empty();
+  uv_mutex_unlock(&_lock);
+
+  return hasCompleted;
+}
+
+/*-----------------------------------------------------------------------------
+ * Take the complete buckets
+ *
+ * buckets = [{
+ *     key,                   (String : topic or key field value, null when not keyed)
+ *     start,                 (Date : start of the interval)
+ *     end,                   (Date : end of the interval)
+ *     count,                 (Number : messages in the bucket)
+ *     fields                 (Object : { name: { op: value } })
+ * }]
+ */
+Local<Array> Aggregator::TakeCompleted()
+{
+  HandleScope scope;
+
+  std::vector<Bucket> completed;
+  uv_mutex_lock(&_lock);
+  completed.swap(_completed);
+  uv_mutex_unlock(&_lock);
+
+  Local<Array> result = Array::New((int)completed.size());
+  for (size_t i = 0; i < completed.size(); i++)
+  {
+    Bucket& bucket = completed[i];
+    Local<Object> jsBucket = Object::New();
+    if (_isKeyed)
+    {
+      jsBucket->Set(String::NewSymbol("key"), String::New(bucket.key.c_str()));
+    }
+    else
+    {
+      jsBucket->Set(String::NewSymbol("key"), Null());
+    }
+    jsBucket->Set(String::NewSymbol("start"), Date::New((double)(bucket.startTime / 1000)));
+    jsBucket->Set(String::NewSymbol("end"), Date::New((double)((bucket.startTime + _interval) / 1000)));
+    jsBucket->Set(String::NewSymbol("count"), Number::New((double)bucket.count));
+
+    Local<Object> jsFields = Object::New();
+    for (size_t j = 0; j < _fields.size(); j++)
+    {
+      FieldSpec& spec = _fields[j];
+      FieldState& state = bucket.fields[j];
+
+      // Statistics of a field missing from the whole bucket are null
+      Local<Object> jsField = Object::New();
+      bool isSet = (state.count > 0);
+      if (spec.ops & AggregateOpCount) jsField->Set(String::NewSymbol("count"), Number::New((double)state.count));
+      if (spec.ops & AggregateOpFirst) jsField->Set(String::NewSymbol("first"), CreateJsNumber(isSet, state.first));
+      if (spec.ops & AggregateOpLast) jsField->Set(String::NewSymbol("last"), CreateJsNumber(isSet, state.last));
+      if (spec.ops & AggregateOpMin) jsField->Set(String::NewSymbol("min"), CreateJsNumber(isSet, state.min));
+      if (spec.ops & AggregateOpMax) jsField->Set(String::NewSymbol("max"), CreateJsNumber(isSet, state.max));
+      if (spec.ops & AggregateOpSum) jsField->Set(String::NewSymbol("sum"), Number::New(state.sum));
+      if (spec.ops & AggregateOpMean)
+      {
+        jsField->Set(String::NewSymbol("mean"), CreateJsNumber(isSet, (isSet) ? state.sum / state.count : 0));
+      }
+
+      for (size_t k = 0; k < spec.weights.size(); k++)
+      {
+        WeightSpec& weight = spec.weights[k];
+        Handle<Value> value;
+        if (!weight.isMean)
+        {
+          value = Number::New(state.weightedSum[k]);
+        }
+        else
+        {
+          bool hasWeight = (state.weightTotal[k] != 0);
+          value = CreateJsNumber(hasWeight, (hasWeight) ? state.weightedSum[k] / state.weightTotal[k] : 0);
+        }
+        jsField->Set(String::New(weight.name.c_str()), value);
+      }
+
+      jsFields->Set(String::New(spec.name.c_str()), jsField);
+    }
+    jsBucket->Set(String::NewSymbol("fields"), jsFields);
+
+    result->Set((uint32_t)i, jsBucket);
+  }
+
+  // The field storage is reused by the next buckets
+  uv_mutex_lock(&_lock);
+  for (size_t i = 0; (i < completed.size()) && (_freeBuckets.size() < AGGREGATOR_MAX_FREE_BUCKETS); i++)
+  {
+    _freeBuckets.push_back(Bucket());
+    _freeBuckets.back().fields.swap(completed[i].fields);
+  }
+  uv_mutex_unlock(&_lock);
+
+  return scope.Close(result);
+}
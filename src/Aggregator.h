@@ -0,0 +1,141 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <v8.h>
+#include <node.h>
+#include "DataTypes.h"
+
+#define AGGREGATOR_DEFAULT_GRACE      1000000         // microseconds a live interval waits after its end
+#define AGGREGATOR_MAX_FREE_BUCKETS   1024
+
+/*-----------------------------------------------------------------------------
+ * Time bucket aggregation of received messages
+ *
+ * Messages are grouped by interval of their generation time and by key, and
+ * the requested statistics of their numeric fields are accumulated as they
+ * are decoded, so only the complete buckets reach JavaScript.
+ *
+ * Each source (a replay shard) is expected in generation time order: a
+ * bucket is complete once every unfinished source has moved on to a later
+ * interval, once the clock is past its interval and the grace period (live
+ * subscriptions), or once the aggregation is flushed.  Messages for an
+ * interval already completed are dropped and counted as late, so a bucket is
+ * never delivered twice.
+ */
+class Aggregator
+{
+public:
+  enum AggregateOp
+  {
+    AggregateOpCount      = 0x01,
+    AggregateOpFirst      = 0x02,
+    AggregateOpLast       = 0x04,
+    AggregateOpMin        = 0x08,
+    AggregateOpMax        = 0x10,
+    AggregateOpSum        = 0x20,
+    AggregateOpMean       = 0x40
+  };
+
+  /* Live aggregations have no sources, buckets are completed by Expire */
+  Aggregator(size_t sourceCount);
+  ~Aggregator();
+
+  /* Read the aggregation specification (JavaScript thread) */
+  bool Parse(v8::Local<v8::Object> spec);
+
+  /* Accumulate a decoded message, from any source when live */
+  void Add(MessageEvent& messageEvent, size_t source);
+
+  /* No more messages from the source */
+  void FinishSource(size_t source);
+
+  /* Complete the buckets whose interval and grace period ended before time */
+  void Expire(TVA_UINT64 time);
+
+  /* Complete every bucket */
+  void Flush();
+
+  /* Start over with new sources, dropping the buckets not yet complete */
+  void Reset(size_t sourceCount);
+
+  /* Take the complete buckets, as a JavaScript array (JavaScript thread) */
+  bool HasCompleted();
+  v8::Local<v8::Array> TakeCompleted();
+
+  inline TVA_UINT64 GetInterval() { return _interval; }
+  uint64_t GetLateMessages();
+
+private:
+  /* Weighted sum of a field by another, e.g. price by quantity for a VWAP */
+  struct WeightSpec
+  {
+    std::string name;             // as requested, e.g. "wmean:qty"
+    int weightIndex;
+    bool isMean;
+  };
+
+  struct FieldSpec
+  {
+    std::string name;
+    int valueIndex;
+    int ops;
+    std::vector<WeightSpec> weights;
+  };
+
+  struct FieldState
+  {
+    uint64_t count;
+    double first;
+    double last;
+    double min;
+    double max;
+    double sum;
+    std::vector<double> weightedSum;
+    std::vector<double> weightTotal;
+  };
+
+  struct Bucket
+  {
+    std::string key;
+    TVA_UINT64 startTime;
+    uint64_t count;
+    std::vector<FieldState> fields;
+  };
+
+  typedef std::pair<TVA_UINT64, std::string> BucketId;
+
+  static bool ParseInterval(v8::Local<v8::Value> value, TVA_UINT64& interval, bool isZeroAllowed);
+  static bool GetFieldNumber(MessageFieldData& field, double& value);
+  static v8::Handle<v8::Value> CreateJsNumber(bool isSet, double value);
+  bool ParseOp(FieldSpec& fieldSpec, const char* op);
+  int GetValueIndex(const std::string& name);
+  void ReadValues(MessageEvent& messageEvent);
+  Bucket& GetBucket();
+  void CompleteBuckets();
+  void CompleteBucketsBefore(TVA_UINT64 time);
+
+  TVA_UINT64 _interval;           // microseconds
+  TVA_UINT64 _grace;              // microseconds
+  bool _isKeyed;
+  bool _isTopicKey;
+  std::string _keyField;
+  std::vector<FieldSpec> _fields;
+  std::vector<std::string> _valueNames;         // aggregated and weight fields, by value index
+  std::map<BucketId, Bucket> _buckets;
+  std::vector<Bucket> _completed;
+  std::vector<Bucket> _freeBuckets;             // delivered, their field storage is reused
+  std::vector<TVA_UINT64> _sourceWatermarks;    // start of the latest interval seen
+  std::vector<bool> _isSourceFinished;
+  TVA_UINT64 _completedBefore;                  // every earlier interval was completed
+  uint64_t _lateMessages;
+  std::vector<double> _values;                  // of the message being added (lock held)
+  std::vector<bool> _isPresent;
+  BucketId _bucketId;
+  uv_mutex_t _lock;
+};
@@ -5,6 +5,8 @@
 #pragma once
 
 #include <list>
+#include <string.h>
+#include <stdint.h>
 #include "tvaClientAPIInterface.h"
 
 /*-----------------------------------------------------------------------------
@@ -47,13 +49,87 @@ struct MessageFieldData
   } value;
 };
 
+/*-----------------------------------------------------------------------------
+ * Size of the decoded value of a message field, in bytes
+ */
+inline size_t GetMessageFieldDataSize(MessageFieldData& field)
+{
+  switch (field.type)
+  {
+  case MessageFieldDataTypeBoolean:       return 1;
+  case MessageFieldDataTypeInt32:         return sizeof(TVA_INT32);
+  case MessageFieldDataTypeNumber:        return sizeof(TVA_DOUBLE);
+  case MessageFieldDataTypeDate:          return sizeof(TVA_DATE);
+  case MessageFieldDataTypeString:        return strlen(field.value.stringValue);
+  case MessageFieldDataTypeBooleanArray:  return field.count * sizeof(TVA_BOOLEAN);
+  case MessageFieldDataTypeInt16Array:    return field.count * sizeof(TVA_INT16);
+  case MessageFieldDataTypeInt32Array:    return field.count * sizeof(TVA_INT32);
+  case MessageFieldDataTypeInt64Array:    return field.count * sizeof(TVA_INT64);
+  case MessageFieldDataTypeFloatArray:    return field.count * sizeof(TVA_FLOAT);
+  case MessageFieldDataTypeDoubleArray:   return field.count * sizeof(TVA_DOUBLE);
+  case MessageFieldDataTypeDateArray:     return field.count * sizeof(TVA_DATE);
+  case MessageFieldDataTypeStringArray:
+    {
+      size_t size = 0;
+      for (int i = 0; i < field.count; i++)
+      {
+        size += strlen(((TVA_STRING*)field.value.arrayValue)[i]);
+      }
+      return size;
+    }
+  default:                                return 0;
+  }
+}
+
 /*-----------------------------------------------------------------------------
  * Message received event
  */
 struct MessageEvent
 {
-  TVA_MESSAGE* tvaMessage;
+  TVA_MESSAGE* tvaMessage;    // NULL when read from a replay cache segment
+  const char* topicName;
+  TVA_UINT64 generationTime;  // microseconds
+  TVA_UINT64 receiveTime;     // microseconds
+  int lossGap;
+  bool isCached;              // field data points into a replay cache segment
+  bool hasOrigin;             // pubId, sessionId and tsn are set (live replays)
+  TVA_UINT32 pubId;
+  TVA_UINT32 sessionId;
+  TVA_UINT64 tsn;
   std::list<MessageFieldData> fieldData;
   int jmsMessageType;
   bool isLastMessage;
+  size_t payloadSize;         // decoded size of the message fields, in bytes
+  uint64_t callbackTime;      // uv_hrtime() when the Tervela callback was entered
+  uint64_t postTime;          // uv_hrtime() when the message was queued for JavaScript
+};
+
+/*-----------------------------------------------------------------------------
+ * Context of a Tervela replay handle.  Replay notifications go to a single
+ * callback for the whole session, the type tells what the context is.
+ */
+enum ReplayContextType
+{
+  ReplayContextShard,                 // a ReplayShard of a Replay
+  ReplayContextBackfill               // the backfill of a Subscription
 };
+
+struct ReplayContext
+{
+  ReplayContextType contextType;
+};
+
+/*-----------------------------------------------------------------------------
+ * Replay notification statuses ending a range without error, the range may
+ * have held no messages
+ */
+inline bool IsReplayEndStatus(TVA_STATUS status)
+{
+#ifdef TVA_ERR_PE_NO_DATA
+  if (status == TVA_ERR_PE_NO_DATA)
+  {
+    return true;
+  }
+#endif
+  return (status == TVA_OK);
+}
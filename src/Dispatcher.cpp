@@ -0,0 +1,291 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#include "Dispatcher.h"
+
+/*-----------------------------------------------------------------------------
+ * Constructor & Destructor
+ */
+Dispatcher::Dispatcher()
+{
+  _async.data = this;
+  _idle.data = this;
+  _drainMessages = DISPATCHER_DEFAULT_DRAIN_MESSAGES;
+  _drainTime = DISPATCHER_DEFAULT_DRAIN_TIME_US * 1000;
+  _spinIdleTime = DISPATCHER_DEFAULT_SPIN_IDLE_US * 1000;
+  _lastActiveTime = 0;
+  _isSpinMode = false;
+  _isSpinning = false;
+  _isStarted = false;
+  uv_mutex_init(&_lock);
+}
+
+Dispatcher::~Dispatcher()
+{
+  uv_mutex_destroy(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Start dispatching (JavaScript thread)
+ */
+void Dispatcher::Start()
+{
+  uv_mutex_lock(&_lock);
+  if (!_isStarted)
+  {
+    uv_async_init(uv_default_loop(), &_async, Dispatcher::DispatchAsyncEvent);
+    uv_idle_init(uv_default_loop(), &_idle);
+    _isStarted = true;
+  }
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Stop dispatching, pending targets release their events (JavaScript thread)
+ */
+void Dispatcher::Stop()
+{
+  std::list<DispatchTarget*> discarded;
+
+  uv_mutex_lock(&_lock);
+  if (_isStarted)
+  {
+    for (int priority = 0; priority < DispatchPriorityCount; priority++)
+    {
+      std::list<DispatchTarget*>::iterator targetIterator;
+      for (targetIterator = _readyList[priority].begin(); targetIterator != _readyList[priority].end(); targetIterator++)
+      {
+        (*targetIterator)->_isScheduled = false;
+      }
+      discarded.splice(discarded.end(), _readyList[priority]);
+    }
+
+    if (_isSpinning)
+    {
+      uv_idle_stop(&_idle);
+      _isSpinning = false;
+    }
+
+    uv_close((uv_handle_t*)&_async, Dispatcher::DispatcherHandleCloseComplete);
+    uv_close((uv_handle_t*)&_idle, Dispatcher::DispatcherHandleCloseComplete);
+    _isStarted = false;
+  }
+  uv_mutex_unlock(&_lock);
+
+  // Outside the lock, targets schedule themselves with their own lock held
+  std::list<DispatchTarget*>::iterator targetIterator;
+  for (targetIterator = discarded.begin(); targetIterator != discarded.end(); targetIterator++)
+  {
+    (*targetIterator)->DiscardEvents();
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Set the per target message budget and the time budget (in microseconds) of
+ * a drain, 0 means unlimited
+ */
+void Dispatcher::SetDrainBudget(size_t messages, uint64_t timeUs)
+{
+  _drainMessages = (messages) ? messages : (size_t)-1;
+  _drainTime = (timeUs) ? (timeUs * 1000) : (uint64_t)-1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Enable or disable spin mode, idleTimeUs is how long to keep polling once
+ * no target is ready (microseconds)
+ */
+void Dispatcher::SetSpinMode(bool spin, uint64_t idleTimeUs)
+{
+  _isSpinMode = spin;
+  _spinIdleTime = idleTimeUs * 1000;
+}
+
+/*-----------------------------------------------------------------------------
+ * Put a target with pending events on the ready list (any thread), false
+ * when the dispatcher is stopped and the events will never be dispatched
+ */
+bool Dispatcher::Schedule(DispatchTarget* target)
+{
+  bool signal = false;
+
+  uv_mutex_lock(&_lock);
+  bool isStarted = _isStarted;
+  if (isStarted && !target->_isScheduled)
+  {
+    target->_isScheduled = true;
+    target->_scheduleTime = uv_hrtime();
+    _readyList[target->_priority].push_back(target);
+
+    // A spinning dispatcher polls the ready lists, no need for a wakeup
+    signal = !_isSpinning;
+  }
+  uv_mutex_unlock(&_lock);
+
+  if (signal)
+  {
+    uv_async_send(&_async);
+  }
+
+  return isStarted;
+}
+
+/*-----------------------------------------------------------------------------
+ * Remove a target from the ready list (JavaScript thread)
+ */
+void Dispatcher::Cancel(DispatchTarget* target)
+{
+  uv_mutex_lock(&_lock);
+  if (target->_isScheduled)
+  {
+    target->_isScheduled = false;
+    _readyList[target->_priority].remove(target);
+  }
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Number of targets on the ready lists (lock held)
+ */
+size_t Dispatcher::GetReadyCount()
+{
+  size_t count = 0;
+  for (int priority = 0; priority < DispatchPriorityCount; priority++)
+  {
+    count += _readyList[priority].size();
+  }
+
+  return count;
+}
+
+/*-----------------------------------------------------------------------------
+ * Drain the ready lists, highest priority first, returns the number of
+ * targets dispatched
+ */
+size_t Dispatcher::Drain()
+{
+  uint64_t startTime = uv_hrtime();
+  uint64_t deadline = ((uint64_t)-1 - startTime > _drainTime) ? (startTime + _drainTime) : (uint64_t)-1;
+
+  // Only dispatch as many targets as were ready when the callback started,
+  // targets scheduled again while dispatching are picked up by the next
+  // callback unless they are ahead of the remaining ones
+  uv_mutex_lock(&_lock);
+  size_t count = GetReadyCount();
+  uv_mutex_unlock(&_lock);
+
+  size_t dispatched = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    DispatchTarget* target = NULL;
+    uint64_t scheduleTime = 0;
+
+    uv_mutex_lock(&_lock);
+    for (int priority = 0; priority < DispatchPriorityCount; priority++)
+    {
+      if (!_readyList[priority].empty())
+      {
+        target = _readyList[priority].front();
+        _readyList[priority].pop_front();
+        target->_isScheduled = false;
+        scheduleTime = target->_scheduleTime;
+        break;
+      }
+    }
+    uv_mutex_unlock(&_lock);
+
+    if (target == NULL)
+    {
+      break;
+    }
+
+    uint64_t dispatchTime = uv_hrtime();
+    if (dispatchTime > scheduleTime)
+    {
+      _queueDelay[target->_priority].Record(dispatchTime - scheduleTime);
+    }
+
+    size_t maxEvents = _drainMessages;
+    if (maxEvents <= ((size_t)-1 / target->_weight))
+    {
+      maxEvents *= target->_weight;
+    }
+
+    target->Dispatch(maxEvents, deadline);
+    dispatched++;
+
+    if (uv_hrtime() >= deadline)
+    {
+      break;
+    }
+  }
+
+  // Targets left on the ready list get their turn on the next loop iteration
+  bool signal;
+  uv_mutex_lock(&_lock);
+  signal = _isStarted && !_isSpinning && (GetReadyCount() > 0);
+  uv_mutex_unlock(&_lock);
+
+  if (signal)
+  {
+    uv_async_send(&_async);
+  }
+
+  return dispatched;
+}
+
+/*-----------------------------------------------------------------------------
+ * Targets are ready, drain them and start spinning in spin mode
+ */
+void Dispatcher::DispatchAsyncEvent(uv_async_t* async, int status)
+{
+  Dispatcher* dispatcher = (Dispatcher*)async->data;
+
+  dispatcher->Drain();
+
+  if (dispatcher->_isSpinMode)
+  {
+    uv_mutex_lock(&dispatcher->_lock);
+    if (dispatcher->_isStarted && !dispatcher->_isSpinning)
+    {
+      dispatcher->_isSpinning = true;
+      dispatcher->_lastActiveTime = uv_hrtime();
+      uv_idle_start(&dispatcher->_idle, Dispatcher::DispatchIdleEvent);
+    }
+    uv_mutex_unlock(&dispatcher->_lock);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Poll the ready lists while spinning, stop once idle for long enough
+ */
+void Dispatcher::DispatchIdleEvent(uv_idle_t* idle, int status)
+{
+  Dispatcher* dispatcher = (Dispatcher*)idle->data;
+  uint64_t now = uv_hrtime();
+
+  if (dispatcher->Drain() > 0)
+  {
+    dispatcher->_lastActiveTime = now;
+    return;
+  }
+
+  if ((now - dispatcher->_lastActiveTime) >= dispatcher->_spinIdleTime)
+  {
+    // Targets scheduled from now on signal the async handle again
+    uv_mutex_lock(&dispatcher->_lock);
+    if (dispatcher->_isSpinning && (dispatcher->GetReadyCount() == 0))
+    {
+      dispatcher->_isSpinning = false;
+      uv_idle_stop(&dispatcher->_idle);
+    }
+    uv_mutex_unlock(&dispatcher->_lock);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Async handle closed
+ */
+void Dispatcher::DispatcherHandleCloseComplete(uv_handle_t* handle)
+{
+}
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <list>
+#include <uv.h>
+#include "compat.h"
+#include "LatencyHistogram.h"
+
+#define DISPATCHER_DEFAULT_DRAIN_MESSAGES   1000
+#define DISPATCHER_DEFAULT_DRAIN_TIME_US    10000
+#define DISPATCHER_DEFAULT_SPIN_IDLE_US     1000
+
+class Dispatcher;
+
+enum DispatchPriority
+{
+  DispatchPriorityHigh = 0,
+  DispatchPriorityNormal,
+  DispatchPriorityLow,
+  DispatchPriorityCount
+};
+
+/*-----------------------------------------------------------------------------
+ * Object with pending events to be delivered to JavaScript by a Dispatcher
+ */
+class DispatchTarget
+{
+public:
+  DispatchTarget()
+  {
+    _isScheduled = false;
+    _weight = 1;
+    _priority = DispatchPriorityNormal;
+    _scheduleTime = 0;
+  }
+
+  virtual ~DispatchTarget()
+  {
+  }
+
+  /*
+   * Deliver pending events to JavaScript, called on the JavaScript thread.
+   * At most maxEvents events are delivered, and delivery stops early once
+   * uv_hrtime() passes deadline (at least one event is always delivered).
+   * A target with events left must schedule itself again.
+   */
+  virtual void Dispatch(size_t maxEvents, uint64_t deadline) = 0;
+
+  /*
+   * Release the pending events without delivering them, called on the
+   * JavaScript thread when the dispatcher stops with the target scheduled.
+   */
+  virtual void DiscardEvents() = 0;
+
+  inline void SetDispatchWeight(int weight) { _weight = (weight > 0) ? weight : 1; }
+  inline int GetDispatchWeight() { return _weight; }
+  inline void SetDispatchPriority(DispatchPriority priority) { _priority = priority; }
+  inline DispatchPriority GetDispatchPriority() { return _priority; }
+
+private:
+  friend class Dispatcher;
+  bool _isScheduled;
+  int _weight;
+  DispatchPriority _priority;
+  uint64_t _scheduleTime;
+};
+
+/*-----------------------------------------------------------------------------
+ * Session wide dispatcher
+ *
+ * Targets with pending events are put on a ready list and a single async
+ * handle is signaled; the async callback drains the ready list on the
+ * JavaScript thread.  Wakeups from any number of targets coalesce into one
+ * event loop callback.
+ *
+ * Draining is budgeted: each target delivers at most (drain messages x its
+ * weight) events per turn and goes to the back of the ready list if it has
+ * more, and a callback returns to the event loop once the drain time is
+ * spent.  A burst on one target can't starve the others, timers or I/O.
+ *
+ * Every priority class has its own ready list, a turn always goes to the
+ * highest priority target ready.  The time targets wait on the ready lists
+ * is recorded per priority.
+ *
+ * Once stopped, the targets that were ready discard their events and nothing
+ * can be scheduled any more: targets must not queue events they can't
+ * schedule.
+ *
+ * In spin mode the ready lists are also polled by an idle handle, which keeps
+ * the event loop from blocking, while traffic is flowing.  Targets scheduled
+ * while spinning don't signal the async handle at all.  Once nothing has been
+ * ready for the spin idle time the dispatcher goes back to async wakeups.
+ */
+class Dispatcher
+{
+public:
+  Dispatcher();
+  ~Dispatcher();
+
+  void Start();
+  void Stop();
+  void SetDrainBudget(size_t messages, uint64_t timeUs);
+  void SetSpinMode(bool spin, uint64_t idleTimeUs);
+  bool Schedule(DispatchTarget* target);
+  void Cancel(DispatchTarget* target);
+  inline bool IsStarted() { return _isStarted; }
+
+  /* Ready list wait time in nanoseconds, JavaScript thread only */
+  inline LatencyHistogram& GetQueueDelay(DispatchPriority priority) { return _queueDelay[priority]; }
+
+private:
+  static void DispatchAsyncEvent(uv_async_t* async, int status);
+  static void DispatchIdleEvent(uv_idle_t* idle, int status);
+  static void DispatcherHandleCloseComplete(uv_handle_t* handle);
+  size_t GetReadyCount();
+  size_t Drain();
+
+  uv_async_t _async;
+  uv_idle_t _idle;
+  uv_mutex_t _lock;
+  std::list<DispatchTarget*> _readyList[DispatchPriorityCount];
+  LatencyHistogram _queueDelay[DispatchPriorityCount];
+  size_t _drainMessages;
+  uint64_t _drainTime;
+  uint64_t _spinIdleTime;
+  uint64_t _lastActiveTime;
+  bool _isSpinMode;
+  bool _isSpinning;
+  bool _isStarted;
+};
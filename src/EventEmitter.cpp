@@ -3,6 +3,7 @@
  */
 
 #include <stdarg.h>
+#include <string.h>
 #include <math.h>
 #include "EventEmitter.h"
 
@@ -15,7 +16,9 @@ using namespace std;
  */
 EventEmitter::EventEmitter()
 {
-  uv_mutex_init(&_eventLock);
+  _listeners = NULL;
+  _maxEventId = 0;
+  _emitDepth = 0;
 }
 
 /*-----------------------------------------------------------------------------
@@ -23,12 +26,13 @@ EventEmitter::EventEmitter()
  */
 EventEmitter::~EventEmitter()
 {
-  for (int i = 1; i < _maxEventId; i++)
+  for (int i = 0; i < _maxEventId; i++)
   {
     RemoveAllListeners(i);
   }
+  ReleaseRetired();
 
-  uv_mutex_destroy(&_eventLock);
+  delete[] _listeners;
 }
 
 /*-----------------------------------------------------------------------------
@@ -37,39 +41,43 @@ EventEmitter::~EventEmitter()
 void EventEmitter::SetValidEvents(int numEvents, EventEmitterConfiguration events[])
 {
   int maxEventId = 0;
-  uv_mutex_lock(&_eventLock);
   for (int i = 0; i < numEvents; i++)
   {
-    std::string evtstr(events[i].eventName);
-    _eventMap[evtstr] = events[i].eventId + 1;
+    _events.push_back(events[i]);
     maxEventId = max(maxEventId, events[i].eventId + 1);
   }
 
-  _listenerMap = new vector<EventEmitterListener>[maxEventId];
+  _listeners = new EventEmitterListeners*[maxEventId];
+  for (int i = 0; i < maxEventId; i++)
+  {
+    _listeners[i] = NULL;
+  }
   _maxEventId = maxEventId;
-  uv_mutex_unlock(&_eventLock);
 }
 
 /*-----------------------------------------------------------------------------
- * Add a new listener for the event
+ * Get the ID of an event from its name, -1 if the event is not valid.  There
+ * are only a handful of events, a scan beats a map lookup.
  */
-bool EventEmitter::AddListener(char* eventName, Persistent<Function> handler)
+int EventEmitter::GetEventId(const char* eventName)
 {
-  std::string evtstr(eventName);
-  bool validEvent = false;
-
-  uv_mutex_lock(&_eventLock);
-  int eventId = _eventMap[evtstr];
-  if (eventId)
+  for (size_t i = 0; i < _events.size(); i++)
   {
-    eventId--;
-    EventEmitterListener listener = { handler, false };
-    _listenerMap[eventId].push_back(listener);
-    validEvent = true;
+    if (strcmp(_events[i].eventName, eventName) == 0)
+    {
+      return _events[i].eventId;
+    }
   }
-  uv_mutex_unlock(&_eventLock);
 
-  return validEvent;
+  return -1;
+}
+
+/*-----------------------------------------------------------------------------
+ * Add a new listener for the event
+ */
+bool EventEmitter::AddListener(char* eventName, Persistent<Function> handler)
+{
+  return AddListener(GetEventId(eventName), handler, false);
 }
 
 /*-----------------------------------------------------------------------------
@@ -77,17 +85,7 @@ bool EventEmitter::AddListener(char* eventName, Persistent<Function> handler)
  */
 bool EventEmitter::AddOnceListener(char* eventName, Persistent<Function> handler)
 {
-  std::string evtstr(eventName);
-  bool validEvent = false;
-
-  int eventId = _eventMap[evtstr];
-  if (eventId)
-  {
-    eventId--;
-    validEvent = AddOnceListener(eventId, handler);
-  }
-
-  return validEvent;
+  return AddListener(GetEventId(eventName), handler, true);
 }
 
 /*-----------------------------------------------------------------------------
@@ -95,20 +93,34 @@ bool EventEmitter::AddOnceListener(char* eventName, Persistent<Function> handler
  */
 bool EventEmitter::AddOnceListener(int eventId, Persistent<Function> handler)
 {
-  bool validEvent = false;
+  return AddListener(eventId, handler, true);
+}
 
-  uv_mutex_lock(&_eventLock);
+/*-----------------------------------------------------------------------------
+ * Add a listener, publishing a copy of the event's listeners with it
+ */
+bool EventEmitter::AddListener(int eventId, Persistent<Function> handler, bool onetime)
+{
+  if ((eventId < 0) || (eventId >= _maxEventId))
+  {
+    return false;
+  }
 
-  if (eventId < this->_maxEventId)
+  EventEmitterListeners* current = _listeners[eventId];
+  EventEmitterListeners* updated = new EventEmitterListeners();
+  updated->hasOnetime = onetime;
+  if (current)
   {
-    EventEmitterListener listener = { handler, true };
-    _listenerMap[eventId].push_back(listener);
-    validEvent = true;
+    updated->listeners.reserve(current->listeners.size() + 1);
+    updated->listeners = current->listeners;
+    updated->hasOnetime = updated->hasOnetime || current->hasOnetime;
   }
 
-  uv_mutex_unlock(&_eventLock);
+  EventEmitterListener listener = { handler, onetime };
+  updated->listeners.push_back(listener);
 
-  return validEvent;
+  Publish(eventId, updated);
+  return true;
 }
 
 
@@ -117,31 +129,42 @@ bool EventEmitter::AddOnceListener(int eventId, Persistent<Function> handler)
  */
 bool EventEmitter::RemoveListener(char* eventName, Persistent<Function> handler)
 {
-  std::string evtstr(eventName);
-  bool validEvent = false;
-
-  uv_mutex_lock(&_eventLock);
+  int eventId = GetEventId(eventName);
+  if (eventId < 0)
+  {
+    return false;
+  }
 
-  int eventId = _eventMap[evtstr];
-  if (eventId)
+  EventEmitterListeners* current = _listeners[eventId];
+  if (current)
   {
-    eventId--;
-    for (int i = 0; i < _listenerMap[eventId].size(); i++)
+    for (size_t i = 0; i < current->listeners.size(); i++)
     {
-      if (_listenerMap[eventId][i].handler == handler)
+      if (current->listeners[i].handler == handler)
       {
-        _listenerMap[eventId][i].handler.Dispose();
-        _listenerMap[eventId].erase(_listenerMap[eventId].begin() + i);
+        EventEmitterListeners* updated = NULL;
+        if (current->listeners.size() > 1)
+        {
+          updated = new EventEmitterListeners();
+          updated->hasOnetime = false;
+          for (size_t j = 0; j < current->listeners.size(); j++)
+          {
+            if (j != i)
+            {
+              updated->listeners.push_back(current->listeners[j]);
+              updated->hasOnetime = updated->hasOnetime || current->listeners[j].onetime;
+            }
+          }
+        }
+
+        ReleaseHandler(current->listeners[i].handler);
+        Publish(eventId, updated);
         break;
       }
     }
-
-    validEvent = true;
   }
 
-  uv_mutex_unlock(&_eventLock);
-
-  return validEvent;
+  return true;
 }
 
 /*-----------------------------------------------------------------------------
@@ -149,16 +172,7 @@ bool EventEmitter::RemoveListener(char* eventName, Persistent<Function> handler)
  */
 bool EventEmitter::RemoveAllListeners(char* eventName)
 {
-  bool validEvent = false;
-  std::string evtstr(eventName);
-  int eventId = _eventMap[evtstr];
-  if (eventId)
-  {
-    eventId--;
-    validEvent = RemoveAllListeners(eventId);
-  }
-
-  return validEvent;
+  return RemoveAllListeners(GetEventId(eventName));
 }
 
 /*-----------------------------------------------------------------------------
@@ -166,24 +180,22 @@ bool EventEmitter::RemoveAllListeners(char* eventName)
  */
 bool EventEmitter::RemoveAllListeners(int eventId)
 {
-  bool validEvent = false;
-
-  uv_mutex_lock(&_eventLock);
+  if ((eventId < 0) || (eventId >= _maxEventId))
+  {
+    return false;
+  }
 
-  if (eventId < _maxEventId)
+  EventEmitterListeners* current = _listeners[eventId];
+  if (current)
   {
-    while (_listenerMap[eventId].size() > 0)
+    for (size_t i = 0; i < current->listeners.size(); i++)
     {
-      _listenerMap[eventId].back().handler.Dispose();
-      _listenerMap[eventId].pop_back();
+      ReleaseHandler(current->listeners[i].handler);
     }
-
-    validEvent = true;
+    Publish(eventId, NULL);
   }
 
-  uv_mutex_unlock(&_eventLock);
-
-  return validEvent;
+  return true;
 }
 
 /*-----------------------------------------------------------------------------
@@ -191,16 +203,7 @@ bool EventEmitter::RemoveAllListeners(int eventId)
  */
 int EventEmitter::Emit(char* eventName, int argc, Handle<Value> argv[])
 {
-  int emitCount = 0;
-  std::string evtstr(eventName);
-  int eventId = _eventMap[evtstr];
-  if (eventId)
-  {
-    eventId--;
-    emitCount = Emit(eventId, argc, argv);
-  }
-
-  return emitCount;
+  return Emit(GetEventId(eventName), argc, argv);
 }
 
 /*-----------------------------------------------------------------------------
@@ -208,38 +211,118 @@ int EventEmitter::Emit(char* eventName, int argc, Handle<Value> argv[])
  */
 int EventEmitter::Emit(int eventId, int argc, Handle<Value> argv[])
 {
+  if ((eventId < 0) || (eventId >= _maxEventId) || !_listeners[eventId])
+  {
+    return 0;
+  }
+
   HandleScope scope;
   Local<Object> context = Context::GetCurrent()->Global();
 
-  int emitCount = 0;
+  // The snapshot stays valid until the outermost emit returns, whatever the
+  // listeners add or remove
+  EventEmitterListeners* current = _listeners[eventId];
+  int emitCount = (int)current->listeners.size();
 
-  uv_mutex_lock(&_eventLock);
+  _emitDepth++;
 
-  if (eventId < _maxEventId)
+  if ((emitCount == 1) && !current->hasOnetime)
   {
-    std::vector<size_t> onetimeEvents;
-
-    emitCount = (int)_listenerMap[eventId].size();
-    for (size_t i = 0; i < _listenerMap[eventId].size(); i++)
+    current->listeners[0].handler->Call(context, argc, argv);
+  }
+  else
+  {
+    // One-time listeners are removed before they are called, so an emit from
+    // a listener does not call them again
+    if (current->hasOnetime)
     {
-      _listenerMap[eventId][i].handler->Call(context, argc, argv);
-      if (_listenerMap[eventId][i].onetime)
+      EventEmitterListeners* updated = NULL;
+      for (size_t i = 0; i < current->listeners.size(); i++)
       {
-        onetimeEvents.push_back(i);
+        if (current->listeners[i].onetime)
+        {
+          ReleaseHandler(current->listeners[i].handler);
+        }
+        else
+        {
+          if (!updated)
+          {
+            updated = new EventEmitterListeners();
+            updated->hasOnetime = false;
+          }
+          updated->listeners.push_back(current->listeners[i]);
+        }
       }
+
+      Publish(eventId, updated);
     }
 
-    while (onetimeEvents.size() > 0)
+    for (size_t i = 0; i < current->listeners.size(); i++)
     {
-      size_t idx = onetimeEvents.back();
-      onetimeEvents.pop_back();
-
-      _listenerMap[eventId][idx].handler.Dispose();
-      _listenerMap[eventId].erase(_listenerMap[eventId].begin() + idx);
+      current->listeners[i].handler->Call(context, argc, argv);
     }
   }
 
-  uv_mutex_unlock(&_eventLock);
+  _emitDepth--;
+  if ((_emitDepth == 0) && !(_retiredListeners.empty() && _retiredHandlers.empty()))
+  {
+    ReleaseRetired();
+  }
 
   return emitCount;
 }
+
+/*-----------------------------------------------------------------------------
+ * Replace the listeners of an event, the previous array is released at once
+ * unless an emit may be calling it
+ */
+void EventEmitter::Publish(int eventId, EventEmitterListeners* listeners)
+{
+  EventEmitterListeners* previous = _listeners[eventId];
+  _listeners[eventId] = listeners;
+
+  if (previous)
+  {
+    if (_emitDepth > 0)
+    {
+      _retiredListeners.push_back(previous);
+    }
+    else
+    {
+      delete previous;
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Dispose of a removed listener's handler, once no emit may be calling it
+ */
+void EventEmitter::ReleaseHandler(Persistent<Function> handler)
+{
+  if (_emitDepth > 0)
+  {
+    _retiredHandlers.push_back(handler);
+  }
+  else
+  {
+    handler.Dispose();
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Release the listener arrays and handlers replaced during emits
+ */
+void EventEmitter::ReleaseRetired()
+{
+  for (size_t i = 0; i < _retiredListeners.size(); i++)
+  {
+    delete _retiredListeners[i];
+  }
+  _retiredListeners.clear();
+
+  for (size_t i = 0; i < _retiredHandlers.size(); i++)
+  {
+    _retiredHandlers[i].Dispose();
+  }
+  _retiredHandlers.clear();
+}
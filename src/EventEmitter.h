@@ -5,8 +5,6 @@
 #pragma once
 
 #include <vector>
-#include <map>
-#include <string>
 #include <v8.h>
 #include <node.h>
 
@@ -22,6 +20,25 @@ struct EventEmitterListener
   bool onetime;
 };
 
+/*-----------------------------------------------------------------------------
+ * The listeners of one event, never modified once published: adding or
+ * removing a listener replaces the array
+ */
+struct EventEmitterListeners
+{
+  std::vector<EventEmitterListener> listeners;
+  bool hasOnetime;
+};
+
+/*-----------------------------------------------------------------------------
+ * Event listeners, by event ID
+ *
+ * Listeners are JavaScript functions, so they are only ever added, removed
+ * and called on the JavaScript thread and need no locking.  Emit calls a
+ * snapshot of the event's listeners, listeners added or removed by a
+ * listener take effect from the next emit, and the arrays and handlers they
+ * replaced are released once no emit is in progress.
+ */
 class EventEmitter
 {
 public:
@@ -38,9 +55,23 @@ public:
   int Emit(char* eventName, int argc, v8::Handle<v8::Value> argv[]);
   int Emit(int eventId, int argc, v8::Handle<v8::Value> argv[]);
 
+  inline int GetListenerCount(int eventId)
+  {
+    EventEmitterListeners* current = ((eventId >= 0) && (eventId < _maxEventId)) ? _listeners[eventId] : NULL;
+    return (current) ? (int)current->listeners.size() : 0;
+  }
+
 private:
-  uv_mutex_t _eventLock;
-  std::map<std::string, int> _eventMap;
-  std::vector<EventEmitterListener> * _listenerMap;
+  int GetEventId(const char* eventName);
+  bool AddListener(int eventId, v8::Persistent<v8::Function> handler, bool onetime);
+  void Publish(int eventId, EventEmitterListeners* listeners);
+  void ReleaseHandler(v8::Persistent<v8::Function> handler);
+  void ReleaseRetired();
+
+  std::vector<EventEmitterConfiguration> _events;
+  EventEmitterListeners** _listeners;           // NULL for an event without listeners
   int _maxEventId;
+  int _emitDepth;                               // emits in progress, nested by listeners
+  std::vector<EventEmitterListeners*> _retiredListeners;
+  std::vector<v8::Persistent<v8::Function> > _retiredHandlers;
 };
@@ -0,0 +1,290 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#include "GdAcker.h"
+
+/*-----------------------------------------------------------------------------
+ * Constructor & Destructor
+ */
+GdAcker::GdAcker()
+{
+  _head = 0;
+  _tail = 0;
+  _isParked = 0;
+  _isSpilling = false;
+  _isRunning = false;
+  _isStopped = false;
+  _flushHead = 0;
+  _flushWaiters = 0;
+  uv_mutex_init(&_lock);
+  uv_mutex_init(&_spillLock);
+  uv_sem_init(&_signal, 0);
+  uv_sem_init(&_flushSignal, 0);
+}
+
+GdAcker::~GdAcker()
+{
+  Stop();
+
+  uv_sem_destroy(&_flushSignal);
+  uv_sem_destroy(&_signal);
+  uv_mutex_destroy(&_spillLock);
+  uv_mutex_destroy(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Queue a message to be acknowledged (JavaScript thread only)
+ */
+void GdAcker::Ack(TVA_MESSAGE* message)
+{
+  if (!_isRunning)
+  {
+    uv_mutex_lock(&_lock);
+    if (!_isStopped)
+    {
+      Start();
+    }
+    bool isStopped = _isStopped;
+    uv_mutex_unlock(&_lock);
+
+    if (isStopped)
+    {
+      tvagdMsgACK(message);
+      return;
+    }
+  }
+
+  // Once spilling, messages keep to the spill list until the acker empties
+  // it, so they are acknowledged in order
+  if (_isSpilling || !Push(message))
+  {
+    Spill(message);
+  }
+
+  Wake();
+}
+
+/*-----------------------------------------------------------------------------
+ * Push a message into the ring, false when it is full
+ */
+bool GdAcker::Push(TVA_MESSAGE* message)
+{
+  unsigned int head = _head;
+  if ((head - _tail) >= GDACKER_QUEUE_SIZE)
+  {
+    return false;
+  }
+
+  _queue[head % GDACKER_QUEUE_SIZE] = message;
+
+  // The message must be visible before the acker thread sees the new head
+  tva_memory_barrier();
+  _head = head + 1;
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Queue a message that does not fit in the ring
+ */
+void GdAcker::Spill(TVA_MESSAGE* message)
+{
+  uv_mutex_lock(&_spillLock);
+  // The acker may have emptied the spill list and the ring meanwhile
+  if (_isSpilling || !Push(message))
+  {
+    _spilled.push_back(message);
+    _isSpilling = true;
+  }
+  uv_mutex_unlock(&_spillLock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Wake the acker thread if it is parked, a single post per park
+ */
+void GdAcker::Wake()
+{
+  tva_memory_barrier();
+  if (_isParked && tva_atomic_cas32(&_isParked, 1, 0))
+  {
+    uv_sem_post(&_signal);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Park the acker thread until a message is queued (acker thread)
+ */
+void GdAcker::Park()
+{
+  _isParked = 1;
+  tva_memory_barrier();
+
+  // A message pushed before the flag was seen would not wake it
+  if (IsEmpty())
+  {
+    uv_sem_wait(&_signal);
+  }
+
+  _isParked = 0;
+  tva_memory_barrier();
+}
+
+/*-----------------------------------------------------------------------------
+ * Check whether nothing is queued
+ */
+bool GdAcker::IsEmpty()
+{
+  return (_head == _tail) && !_isSpilling;
+}
+
+/*-----------------------------------------------------------------------------
+ * Wait until every message queued so far has been acknowledged
+ */
+void GdAcker::Flush()
+{
+  uv_mutex_lock(&_lock);
+  if (!_isRunning || IsEmpty())
+  {
+    uv_mutex_unlock(&_lock);
+    return;
+  }
+
+  _flushHead = _head;
+  _flushWaiters++;
+  uv_mutex_unlock(&_lock);
+
+  uv_sem_post(&_signal);
+  uv_sem_wait(&_flushSignal);
+}
+
+/*-----------------------------------------------------------------------------
+ * Acknowledge all queued messages and stop the acker thread, for good
+ */
+void GdAcker::Stop()
+{
+  uv_mutex_lock(&_lock);
+  bool isRunning = _isRunning;
+  _isStopped = true;
+  _isRunning = false;
+  uv_mutex_unlock(&_lock);
+
+  if (isRunning)
+  {
+    uv_sem_post(&_signal);
+    uv_thread_join(&_thread);
+  }
+
+  // Nothing is queued after _isStopped, the thread may not have been started
+  AckPending();
+  AckSpilled();
+}
+
+/*-----------------------------------------------------------------------------
+ * Start the acker thread (lock held)
+ */
+void GdAcker::Start()
+{
+  _isRunning = true;
+  if (uv_thread_create(&_thread, GdAcker::AckerThread, this) != 0)
+  {
+    _isRunning = false;
+    _isStopped = true;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Acknowledge the messages currently in the ring
+ */
+int GdAcker::AckPending()
+{
+  unsigned int head = _head;
+  unsigned int tail = _tail;
+
+  // Read the messages only after the head they were published with
+  tva_memory_barrier();
+
+  int count = (int)(head - tail);
+  while (tail != head)
+  {
+    tvagdMsgACK(_queue[tail % GDACKER_QUEUE_SIZE]);
+    tail++;
+  }
+
+  tva_memory_barrier();
+  _tail = tail;
+
+  return count;
+}
+
+/*-----------------------------------------------------------------------------
+ * Acknowledge the spilled messages, newer than those of the ring before them
+ */
+int GdAcker::AckSpilled()
+{
+  std::vector<TVA_MESSAGE*> spilled;
+  if (!_isSpilling)
+  {
+    return 0;
+  }
+
+  uv_mutex_lock(&_spillLock);
+  spilled.swap(_spilled);
+  _isSpilling = false;
+  uv_mutex_unlock(&_spillLock);
+
+  for (size_t i = 0; i < spilled.size(); i++)
+  {
+    tvagdMsgACK(spilled[i]);
+  }
+
+  return (int)spilled.size();
+}
+
+/*-----------------------------------------------------------------------------
+ * Wake the flushes waiting for messages that have now been acknowledged, or
+ * all of them when stopping
+ */
+void GdAcker::ReleaseFlushWaiters()
+{
+  uv_mutex_lock(&_lock);
+  if ((_flushWaiters > 0) && (!_isRunning || (((int)(_flushHead - _tail) <= 0) && !_isSpilling)))
+  {
+    for (int i = 0; i < _flushWaiters; i++)
+    {
+      uv_sem_post(&_flushSignal);
+    }
+    _flushWaiters = 0;
+  }
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Acker thread, acknowledges everything queued each time it wakes, parks once
+ * the queue is empty, until stopped
+ */
+void GdAcker::AckerThread(void* arg)
+{
+  GdAcker* acker = (GdAcker*)arg;
+
+  for (;;)
+  {
+    uv_mutex_lock(&acker->_lock);
+    bool isRunning = acker->_isRunning;
+    uv_mutex_unlock(&acker->_lock);
+
+    // The ring first, its messages are older than the spilled ones
+    int count = acker->AckPending();
+    count += acker->AckSpilled();
+    acker->ReleaseFlushWaiters();
+
+    if (!isRunning)
+    {
+      break;
+    }
+
+    if (count == 0)
+    {
+      acker->Park();
+    }
+  }
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <vector>
+#include <uv.h>
+#include "tvaClientAPI.h"
+#include "tvaClientAPIInterface.h"
+#include "tvaGDAPI.h"
+#include "compat.h"
+
+#define GDACKER_QUEUE_SIZE          4096
+
+/*-----------------------------------------------------------------------------
+ * Acknowledges GD messages on a native thread
+ *
+ * Messages are pushed by the JavaScript thread (the only producer) into a
+ * lock-free single producer / single consumer ring, and the acker thread (the
+ * only consumer) acknowledges everything queued each time it wakes.  When the
+ * ring is full messages are spilled to a locked list the acker thread
+ * empties after the ring, so the JavaScript thread never acknowledges itself
+ * while the acker runs.
+ *
+ * The acker thread parks on a semaphore once the queue is empty, and is only
+ * posted by a push that finds it parked.  Starting and stopping are done
+ * under a lock; once stopped, messages are acknowledged synchronously.
+ */
+class GdAcker
+{
+public:
+  GdAcker();
+  ~GdAcker();
+
+  void Ack(TVA_MESSAGE* message);
+  void Flush();
+  void Stop();
+
+private:
+  static void AckerThread(void* arg);
+  void Start();
+  bool Push(TVA_MESSAGE* message);
+  void Spill(TVA_MESSAGE* message);
+  void Wake();
+  void Park();
+  bool IsEmpty();
+  int AckPending();
+  int AckSpilled();
+
+  void ReleaseFlushWaiters();
+
+  TVA_MESSAGE* _queue[GDACKER_QUEUE_SIZE];
+  volatile unsigned int _head;
+  volatile unsigned int _tail;
+  volatile long _isParked;          // the acker thread waits for _signal
+  volatile bool _isSpilling;        // newer messages go to the spill list
+  std::vector<TVA_MESSAGE*> _spilled;
+  uv_mutex_t _spillLock;
+  bool _isRunning;
+  bool _isStopped;
+  uv_thread_t _thread;
+  uv_mutex_t _lock;                 // start, stop and flush waiters
+  uv_sem_t _signal;                 // messages queued while parked, flushing or stopping
+  uv_sem_t _flushSignal;
+  unsigned int _flushHead;          // head the flush waiters wait for
+  int _flushWaiters;
+};
@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+ * Table of native pointers addressed by generation tagged handles
+ *
+ * A handle is made of a slot index (low 24 bits) and the generation of the
+ * slot when the item was added (upper bits), and is small enough to be stored
+ * exactly in a JavaScript number.  Removing an item bumps the generation of the
+ * slot, so a stale handle (double remove, remove after clear) or a forged
+ * handle never resolves to a live item.
+ *
+ * Not thread safe, only use from the JavaScript thread.
+ */
+template <class T>
+class HandleTable
+{
+public:
+  inline double Add(T* item)
+  {
+    unsigned int index;
+
+    if (_freeSlots.empty())
+    {
+      if (_slots.size() > HANDLE_INDEX_MASK)
+      {
+        return 0;
+      }
+
+      Slot slot;
+      slot.item = NULL;
+      slot.generation = 1;
+
+      index = (unsigned int)_slots.size();
+      _slots.push_back(slot);
+    }
+    else
+    {
+      index = _freeSlots.back();
+      _freeSlots.pop_back();
+    }
+
+    _slots[index].item = item;
+    return ((double)_slots[index].generation * (HANDLE_INDEX_MASK + 1)) + index;
+  }
+
+  inline T* Get(double handle)
+  {
+    Slot* slot = Lookup(handle);
+    return (slot) ? slot->item : NULL;
+  }
+
+  inline T* Remove(double handle)
+  {
+    T* item = NULL;
+
+    Slot* slot = Lookup(handle);
+    if (slot)
+    {
+      item = slot->item;
+      Release(slot);
+    }
+
+    return item;
+  }
+
+  inline void Clear()
+  {
+    for (size_t i = 0; i < _slots.size(); i++)
+    {
+      if (_slots[i].item)
+      {
+        Release(&_slots[i]);
+      }
+    }
+  }
+
+  inline size_t GetCount() { return (_slots.size() - _freeSlots.size()); }
+
+private:
+  static const unsigned int HANDLE_INDEX_MASK = 0x00FFFFFF;
+  static const unsigned int HANDLE_GENERATION_MAX = 0x0FFFFFFF;
+
+  struct Slot
+  {
+    T* item;
+    unsigned int generation;
+  };
+
+  inline Slot* Lookup(double handle)
+  {
+    if ((handle < 1) || (handle != (double)((long long)handle)))
+    {
+      return NULL;
+    }
+
+    long long value = (long long)handle;
+    unsigned int index = (unsigned int)(value & HANDLE_INDEX_MASK);
+    long long generation = value / (HANDLE_INDEX_MASK + 1);
+
+    if ((index >= _slots.size()) || (_slots[index].item == NULL) || (_slots[index].generation != generation))
+    {
+      return NULL;
+    }
+
+    return &_slots[index];
+  }
+
+  inline void Release(Slot* slot)
+  {
+    slot->item = NULL;
+    slot->generation = (slot->generation < HANDLE_GENERATION_MAX) ? (slot->generation + 1) : 1;
+    _freeSlots.push_back((unsigned int)(slot - &_slots[0]));
+  }
+
+  std::vector<Slot> _slots;
+  std::vector<unsigned int> _freeSlots;
+};
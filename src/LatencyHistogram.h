@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <string.h>
+#include <stdint.h>
+
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS   3
+#define LATENCY_HISTOGRAM_SUB_BUCKETS       (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_BUCKETS           (64 * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+/*-----------------------------------------------------------------------------
+ * Log bucketed latency histogram
+ *
+ * Every power of two range is split in LATENCY_HISTOGRAM_SUB_BUCKETS linear
+ * buckets, so recorded values keep ~12% precision over the full 64 bit range
+ * with a fixed amount of memory and constant time recording.
+ *
+ * A histogram has a single writer; reading it from another thread while
+ * values are being recorded gives approximate results.
+ */
+class LatencyHistogram
+{
+public:
+  LatencyHistogram()
+  {
+    Reset();
+  }
+
+  inline void Record(uint64_t value)
+  {
+    _counts[GetBucketIndex(value)]++;
+    _count++;
+    _sum += value;
+
+    if (value < _min) _min = value;
+    if (value > _max) _max = value;
+  }
+
+  inline void Reset()
+  {
+    memset(_counts, 0, sizeof(_counts));
+    _count = 0;
+    _sum = 0;
+    _min = (uint64_t)-1;
+    _max = 0;
+  }
+
+  inline uint64_t GetCount() { return _count; }
+  inline uint64_t GetMin() { return (_count) ? _min : 0; }
+  inline uint64_t GetMax() { return _max; }
+  inline double GetMean() { return (_count) ? ((double)_sum / (double)_count) : 0; }
+
+  /*---------------------------------------------------------------------------
+   * Get the value at the given percentile (0 - 100), the highest value of the
+   * bucket the percentile falls in
+   */
+  inline uint64_t GetPercentile(double percentile)
+  {
+    uint64_t count = _count;
+    if (count == 0)
+    {
+      return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * (double)count);
+    if (target < 1) target = 1;
+    if (target > count) target = count;
+
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+    {
+      total += _counts[i];
+      if (total >= target)
+      {
+        uint64_t value = GetBucketHighestValue(i);
+        return (value < _max) ? value : _max;
+      }
+    }
+
+    return _max;
+  }
+
+private:
+  static inline int GetBucketIndex(uint64_t value)
+  {
+    if (value < LATENCY_HISTOGRAM_SUB_BUCKETS)
+    {
+      return (int)value;
+    }
+
+    // Position of the most significant bit
+    int msb = 0;
+    uint64_t v = value;
+    if (v >> 32) { v >>= 32; msb += 32; }
+    if (v >> 16) { v >>= 16; msb += 16; }
+    if (v >> 8)  { v >>= 8;  msb += 8;  }
+    if (v >> 4)  { v >>= 4;  msb += 4;  }
+    if (v >> 2)  { v >>= 2;  msb += 2;  }
+    if (v >> 1)  { msb += 1; }
+
+    int shift = msb - LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+    return ((shift + 1) << LATENCY_HISTOGRAM_SUB_BUCKET_BITS) +
+           (int)((value >> shift) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+  }
+
+  static inline uint64_t GetBucketHighestValue(int index)
+  {
+    int major = index >> LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+    uint64_t minor = (uint64_t)(index & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+
+    if (major == 0)
+    {
+      return minor;
+    }
+
+    return ((LATENCY_HISTOGRAM_SUB_BUCKETS + minor + 1) << (major - 1)) - 1;
+  }
+
+  uint64_t _counts[LATENCY_HISTOGRAM_BUCKETS];
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _min;
+  uint64_t _max;
+};
@@ -33,6 +33,7 @@ void Publication::Init(Handle<Object> target)
 
   t->PrototypeTemplate()->Set(String::NewSymbol("on"), FunctionTemplate::New(On)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("sendMessage"), FunctionTemplate::New(SendMessage)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("stats"), FunctionTemplate::New(Stats)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("stop"), FunctionTemplate::New(Stop)->GetFunction());
 
   constructor = Persistent<Function>::New(t->GetFunction());
@@ -85,6 +86,7 @@ Publication::Publication(Session* session)
   _topic = NULL;
   _qos = TVA_QOS_BEST_EFFORT;
   uv_mutex_init(&_sendLock);
+  uv_mutex_init(&_statsLock);
 
   EventEmitterConfiguration events[] = 
   {
@@ -105,6 +107,7 @@ Publication::~Publication()
     free(_topic);
   }
   uv_mutex_destroy(&_sendLock);
+  uv_mutex_destroy(&_statsLock);
 }
 
 
@@ -313,6 +316,13 @@ void Publication::SendMessageWorker(uv_work_t* req)
 
   TVA_PUBLISH_MESSAGE_DATA_HANDLE messageData = TVA_INVALID_HANDLE;
   TVA_STATUS rc = TVA_ERROR;
+  size_t payloadSize = 0;
+
+  std::list<MessageFieldData>::iterator fieldIterator;
+  for (fieldIterator = request->fieldData.begin(); fieldIterator != request->fieldData.end(); fieldIterator++)
+  {
+    payloadSize += GetMessageFieldDataSize(*fieldIterator);
+  }
 
   do
   {
@@ -408,6 +418,20 @@ void Publication::SendMessageWorker(uv_work_t* req)
     tvaReleasePublishData(messageData);
   }
 
+  if (rc == TVA_OK)
+  {
+    publication->_messagesOut.Increment();
+    publication->_bytesOut.Add(payloadSize);
+    if (publication->GetQos() == TVA_QOS_GUARANTEED_DELIVERY)
+    {
+      publication->_outstandingGd.Increment();
+    }
+  }
+  else
+  {
+    publication->RecordSendFailure(rc);
+  }
+
   request->result = rc;
 }
 
@@ -460,12 +484,51 @@ void Publication::SendMessageWorkerComplete(uv_work_t* req)
 /*-----------------------------------------------------------------------------
  * Send of message has completed.
  */
-void Publication::SendMessageComplete(int argc, v8::Handle<v8::Value> argv[])
+void Publication::SendMessageComplete(TVA_STATUS rc, int argc, v8::Handle<v8::Value> argv[])
 {
+  _outstandingGd.Decrement();
+  if (rc != TVA_EVT_GD_ACK_RECV)
+  {
+    RecordSendFailure(rc);
+  }
+
   Emit(EVT_MESSAGE, argc, argv);
 }
 
 
+/*****     Statistics     *****/
+
+/*-----------------------------------------------------------------------------
+ * Get the publication's runtime statistics
+ *
+ * var stats = publication.stats();
+ */
+Handle<Value> Publication::Stats(const Arguments& args)
+{
+  HandleScope scope;
+  Publication* publication = ObjectWrap::Unwrap<Publication>(args.This());
+
+  Local<Object> sendFailures = Object::New();
+  uv_mutex_lock(&publication->_statsLock);
+  std::map<TVA_STATUS, int64_t>::iterator failureIterator;
+  for (failureIterator = publication->_sendFailures.begin(); 
+       failureIterator != publication->_sendFailures.end(); 
+       failureIterator++)
+  {
+    sendFailures->Set(String::New(tvaErrToStr(failureIterator->first)), Number::New((double)failureIterator->second));
+  }
+  uv_mutex_unlock(&publication->_statsLock);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("messagesOut"), Number::New((double)publication->_messagesOut.Get()));
+  result->Set(String::NewSymbol("bytesOut"), Number::New((double)publication->_bytesOut.Get()));
+  result->Set(String::NewSymbol("sendFailures"), sendFailures);
+  result->Set(String::NewSymbol("outstandingGd"), Number::New((double)publication->_outstandingGd.Get()));
+
+  return scope.Close(result);
+}
+
+
 /*****     Stop     *****/
 
 struct StopPublicationRequest
@@ -4,11 +4,13 @@
 
 #pragma once
 
+#include <map>
 #include <v8.h>
 #include <node.h>
 #include "tvaClientAPI.h"
 #include "tvaClientAPIInterface.h"
 #include "EventEmitter.h"
+#include "StatCounter.h"
 
 class Publication: node::ObjectWrap, EventEmitter
 {
@@ -36,6 +38,20 @@ public:
    */
   static v8::Handle<v8::Value> SendMessage(const v8::Arguments& args);
 
+  /*-----------------------------------------------------------------------------
+   * Get the publication's runtime statistics
+   *
+   * var stats = publication.stats();
+   *
+   * stats = {
+   *     messagesOut,           (Number : messages sent)
+   *     bytesOut,              (Number : size of the sent messages' fields)
+   *     sendFailures,          (Object : failed sends by error ([error]=count))
+   *     outstandingGd          (Number : GD messages sent and not yet acknowledged)
+   * }
+   */
+  static v8::Handle<v8::Value> Stats(const v8::Arguments& args);
+
   /*-----------------------------------------------------------------------------
    * Stop the publication
    *
@@ -51,7 +67,7 @@ public:
   static void Init(v8::Handle<v8::Object> target);
   static v8::Handle<v8::Value> New(const v8::Arguments& args);
   static v8::Handle<v8::Value> NewInstance(Publication* publication);
-  void SendMessageComplete(int argc, v8::Handle<v8::Value> argv[]);
+  void SendMessageComplete(TVA_STATUS rc, int argc, v8::Handle<v8::Value> argv[]);
 
   inline Session* GetSession() { return _session; }
 
@@ -62,6 +78,13 @@ public:
   inline void SetQos(int qos) { _qos = qos; }
   inline int GetQos() { return _qos; }
 
+  inline void RecordSendFailure(TVA_STATUS rc)
+  {
+    uv_mutex_lock(&_statsLock);
+    _sendFailures[rc]++;
+    uv_mutex_unlock(&_statsLock);
+  }
+
   inline void Lock()
   {
     uv_mutex_lock(&_sendLock);
@@ -84,4 +107,9 @@ private:
   char* _topic;
   int _qos;
   uv_mutex_t _sendLock;
+  StatCounter _messagesOut;
+  StatCounter _bytesOut;
+  StatCounter _outstandingGd;
+  std::map<TVA_STATUS, int64_t> _sendFailures;
+  uv_mutex_t _statsLock;
 };
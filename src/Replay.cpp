@@ -19,7 +19,10 @@ enum ReplayEvent
   EVT_RESUME,
   EVT_STOP,
   EVT_FINISH,
-  EVT_ERROR
+  EVT_ERROR,
+  EVT_AGGREGATE,
+  EVT_SEEK,
+  EVT_PROGRESS
 };
 
 Persistent<Function> Replay::constructor;
@@ -39,9 +42,15 @@ void Replay::Init(Handle<Object> target)
   t->PrototypeTemplate()->Set(String::NewSymbol("on"), FunctionTemplate::New(On)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("pause"), FunctionTemplate::New(Pause)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("resume"), FunctionTemplate::New(Resume)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("stats"), FunctionTemplate::New(Stats)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("aggregate"), FunctionTemplate::New(Aggregate)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("checkpoint"), FunctionTemplate::New(Checkpoint)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("seek"), FunctionTemplate::New(Seek)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("stop"), FunctionTemplate::New(Stop)->GetFunction());
 
   constructor = Persistent<Function>::New(t->GetFunction());
+
+  ReplayCacheWriter::Init();
 }
 
 /*-----------------------------------------------------------------------------
@@ -70,13 +79,55 @@ Handle<Value> Replay::NewInstance(Replay* replay)
  */
 Replay::Replay(Session* session)
 {
-  _msgAsync.data = this;
-  _notifyAsync.data = this;
   _session = session;
-  _handle = TVA_INVALID_HANDLE;
+  _dispatcher = session->GetDispatcher();
+  _startTime = 0;
+  _endTime = 0;
+  _parallelism = 1;
+  memset(&_replayReq, 0, sizeof(_replayReq));
+  _isSeeking = false;
+  _isStopPending = false;
+  _seekCount = 0;
+  _currentShard = 0;
+  _completeShards = 0;
+  _isOrdered = true;
+  _queueDepth = 0;
+  _peakQueueDepth = 0;
+  _speed = 0;
+  _paceBaseTime = 0;
+  _paceBaseGenerationTime = 0;
+  _paceTimer.data = this;
+  _isPaceStarted = false;
+  _isPaceTimerOpen = false;
+  _isUserPaused = false;
+  _highWaterMark = REPLAY_DEFAULT_HIGH_WATER;
+  _lowWaterMark = REPLAY_DEFAULT_LOW_WATER;
+  _throttledTime = 0;
+  _throttles = 0;
+  _pausedTime = 0;
+  _pauseStartTime = 0;
+  _progressTimer.data = this;
+  _progressInterval = 0;
+  _isProgressTimerOpen = false;
+  _rateSampleTime = 0;
+  _rateSampleIn = 0;
+  _rateSampleDelivered = 0;
+  _rateSampleRemaining = 0;
+  _inRate = 0;
+  _deliveredRate = 0;
+  _progressRate = 0;
+  _hasRates = false;
+  _aggregator = NULL;
+  _isAggregationHeld = false;
+  _checkpointTime = 0;
+  _hasCheckpoint = false;
+  _resumeTime = 0;
+  _isResuming = false;
   _isInUse = false;
   uv_mutex_init(&_messageEventLock);
-  uv_mutex_init(&_notificationEventLock);
+  uv_mutex_init(&_resumeLock);
+  uv_mutex_init(&_pauseLock);
+  uv_mutex_init(&_pauseStateLock);
 
   EventEmitterConfiguration events[] = 
   {
@@ -85,20 +136,204 @@ Replay::Replay(Session* session)
     { EVT_RESUME,   "resume"  },
     { EVT_STOP,     "stop"    },
     { EVT_FINISH,   "finish"  },
-    { EVT_ERROR,    "error"   }
+    { EVT_ERROR,    "error"   },
+    { EVT_AGGREGATE,"aggregate" },
+    { EVT_SEEK,     "seek"    },
+    { EVT_PROGRESS, "progress" }
   };
-  SetValidEvents(6, events);
+  SetValidEvents(9, events);
 }
 
 Replay::~Replay()
 {
-  if (_handle != TVA_INVALID_HANDLE)
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    DeleteShard(_shards[i]);
+  }
+  for (size_t i = 0; i < _retiredShards.size(); i++)
+  {
+    DeleteShard(_retiredShards[i]);
+  }
+
+  if (_aggregator)
   {
-    tvaReplayRelease(_handle);
+    delete _aggregator;
   }
 
   uv_mutex_destroy(&_messageEventLock);
-  uv_mutex_destroy(&_notificationEventLock);
+  uv_mutex_destroy(&_resumeLock);
+  uv_mutex_destroy(&_pauseLock);
+  uv_mutex_destroy(&_pauseStateLock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Release a shard's replay handle and resources
+ */
+void Replay::DeleteShard(ReplayShard* shard)
+{
+  if (shard->handle != TVA_INVALID_HANDLE)
+  {
+    tvaReplayRelease(shard->handle);
+  }
+
+  // No callback queues more once the handle is released
+  std::vector<MessageEvent> discarded;
+  while (!shard->messageEventQueue.empty())
+  {
+    discarded.push_back(shard->messageEventQueue.front());
+    shard->messageEventQueue.pop();
+  }
+  ReleaseMessageEvents(discarded);
+  if (shard->segment)
+  {
+    delete shard->segment;
+  }
+  if (shard->cacheWriter)
+  {
+    delete shard->cacheWriter;
+  }
+  delete shard;
+}
+
+/*-----------------------------------------------------------------------------
+ * Perform create replay, the time range of every topic is replayed from
+ * startTime (the replay request holds the other filters)
+ */
+TVA_STATUS Replay::Start(std::vector<std::string>& topics, TVA_UINT64 startTime, TVA_UINT64 endTime,
+                         int parallelism, const char* cacheDir, TVA_REPLAY_REQ& replayReq)
+{
+  _topics = topics;
+  _startTime = startTime;
+  _endTime = endTime;
+  _parallelism = (TVA_UINT64)parallelism;
+  _cacheDir = (cacheDir) ? cacheDir : "";
+  _replayReq = replayReq;
+
+  return StartShards(startTime, _shards, _streams);
+}
+
+/*-----------------------------------------------------------------------------
+ * Add a shard, shards are added topic after topic, each topic's in time order
+ */
+ReplayShard* Replay::AddShard(std::vector<ReplayShard*>& shards, std::vector<ReplayStream>& streams, size_t stream)
+{
+  if (stream == streams.size())
+  {
+    streams.push_back(ReplayStream(shards.size()));
+  }
+
+  ReplayShard* shard = new ReplayShard(this, shards.size(), stream);
+  shards.push_back(shard);
+  streams[stream].endShard = shards.size();
+  return shard;
+}
+
+/*-----------------------------------------------------------------------------
+ * Create the shards replaying from startTime to the end of the time range,
+ * and start them.  On failure the shards already started are left to the
+ * caller to release.  Seek shards are only counted by the aggregator once
+ * they take over.
+ */
+TVA_STATUS Replay::StartShards(TVA_UINT64 startTime, std::vector<ReplayShard*>& shards,
+                               std::vector<ReplayStream>& streams)
+{
+  const char* cacheDir = (_cacheDir.empty()) ? NULL : _cacheDir.c_str();
+  TVA_REPLAY_REQ replayReq = _replayReq;
+
+  // Split the time range of each topic into one consecutive sub-range per
+  // shard, the shards of all the topics replay concurrently
+  TVA_UINT64 span = (_endTime > startTime) ? _endTime - startTime : 0;
+  TVA_UINT64 shardCount = (span >= _parallelism) ? _parallelism : 1;
+
+  std::vector<ReplayCacheRange> shardRanges;
+  for (size_t stream = 0; stream < _topics.size(); stream++)
+  {
+    const char* topic = _topics[stream].c_str();
+    for (TVA_UINT64 i = 0; i < shardCount; i++)
+    {
+      TVA_UINT64 rangeStart = startTime + ((span / shardCount) * i) + ((span % shardCount) * i) / shardCount;
+      TVA_UINT64 rangeEnd = _endTime;
+      if (i < (shardCount - 1))
+      {
+        rangeEnd = startTime + ((span / shardCount) * (i + 1)) + ((span % shardCount) * (i + 1)) / shardCount - 1;
+      }
+
+      // With a cache, the parts already cached are read from their segments
+      std::vector<ReplayCacheRange> ranges;
+      if (cacheDir)
+      {
+        ReplayCachePlan(cacheDir, topic, rangeStart, rangeEnd, ranges);
+      }
+      else
+      {
+        ReplayCacheRange range;
+        range.startTime = rangeStart;
+        range.endTime = rangeEnd;
+        ranges.push_back(range);
+      }
+
+      for (size_t j = 0; j < ranges.size(); j++)
+      {
+        ReplayShard* shard = AddShard(shards, streams, stream);
+        shardRanges.push_back(ranges[j]);
+        shard->startTime = ranges[j].startTime;
+        shard->endTime = ranges[j].endTime;
+        shard->positionTime = ranges[j].startTime;
+
+        if (!ranges[j].segmentPath.empty())
+        {
+          ReplayCacheSegment* segment = new ReplayCacheSegment();
+          if (segment->Open(ranges[j].segmentPath.c_str(), topic))
+          {
+            segment->Seek(ranges[j].startTime, ranges[j].endTime);
+            shard->segment = segment;
+            continue;
+          }
+
+          // Unreadable segment, replay the range instead
+          delete segment;
+        }
+
+        if (cacheDir)
+        {
+          ReplayCacheWriter* cacheWriter = new ReplayCacheWriter(cacheDir, topic,
+                                                                 ranges[j].startTime, ranges[j].endTime);
+          if (cacheWriter->Open())
+          {
+            shard->cacheWriter = cacheWriter;
+          }
+          else
+          {
+            delete cacheWriter;
+          }
+        }
+      }
+    }
+  }
+
+  TVA_STATUS rc = TVA_OK;
+  for (size_t i = 0; (i < shards.size()) && (rc == TVA_OK); i++)
+  {
+    ReplayShard* shard = shards[i];
+    if (shard->segment)
+    {
+      continue;
+    }
+
+    tva_strncpy(replayReq.topic, _topics[shard->stream].c_str(), sizeof(replayReq.topic));
+    replayReq.timeStart = shardRanges[i].startTime;
+    replayReq.timeEnd = shardRanges[i].endTime;
+
+    TVA_REPLAY_HANDLE replayHandle;
+    rc = tvaReplayHistCbNew(_session->GetHandle(), Replay::MessageReceivedEvent, shard,
+                            &replayReq, 0, &replayHandle);
+    if (rc == TVA_OK)
+    {
+      shard->handle = replayHandle;
+    }
+  }
+
+  return rc;
 }
 
 
@@ -116,6 +351,8 @@ Replay::~Replay()
  *   'pause'                - Replay paused                           - function (err) { }
  *   'resume'               - Replay resumed                          - function (err) { }
  *   'stop'                 - Replay stopped                          - function (err) { }
+ *   'aggregate'            - Aggregation buckets complete            - function (buckets) { }
+ *   'seek'                 - Replay moved to another time            - function (err) { }
  *
  * message = {
  *     topic,                 (string : message topic)
@@ -153,104 +390,527 @@ Handle<Value> Replay::On(const Arguments& args)
  */
 void Replay::MessageReceivedEvent(TVA_MESSAGE* message, void* context)
 {
-  Replay* replay = (Replay*)context;
+  ReplayShard* shard = (ReplayShard*)context;
+  Replay* replay = shard->replay;
   MessageEvent messageEvent;
 
+  // Left behind by a seek
+  if (shard->isRetired)
+  {
+    tvaReleaseMessageData(message);
+    return;
+  }
+
   TVA_STATUS rc = Subscription::ProcessRecievedMessage(message, messageEvent);
   if (rc == TVA_OK)
   {
-    if (!replay->PostMessageEvent(messageEvent))
+    messageEvent.hasOrigin = Subscription::GetMessageOrigin(message, messageEvent.pubId,
+                                                            messageEvent.sessionId, messageEvent.tsn);
+
+    replay->_messagesIn.Increment();
+    replay->_bytesIn.Add(messageEvent.payloadSize);
+    replay->_lossGap.Add(message->topicSeqGap);
+
+    // Record the range, it is only kept once complete
+    if (shard->cacheWriter)
+    {
+      shard->cacheWriter->Append(messageEvent);
+      if (messageEvent.isLastMessage)
+      {
+        shard->cacheWriter->Complete();
+      }
+    }
+
+    // Already delivered before the checkpoint resumed from
+    if (replay->IsDelivered(messageEvent))
+    {
+      Subscription::ReleaseMessageEvent(messageEvent);
+      tvaReleaseMessageData(message);
+      return;
+    }
+
+    if (!replay->PostMessageEvent(shard, messageEvent))
     {
       // Post failed, need to release the message
+      replay->_drops.Increment();
+      Subscription::ReleaseMessageEvent(messageEvent);
       tvaReleaseMessageData(message);
     }
   }
+  else
+  {
+    replay->_decodeErrors.Increment();
+    tvaReleaseMessageData(message);
+
+    if (shard->cacheWriter)
+    {
+      shard->cacheWriter->Fail();
+    }
+  }
 }
 
 /*-----------------------------------------------------------------------------
- * Post async message received event to JavaScript
+ * Release the queued messages without delivering them, the replay or the
+ * session's dispatcher stopped
+ */
+void Replay::DiscardEvents()
+{
+  std::vector<MessageEvent> discarded;
+
+  uv_mutex_lock(&_messageEventLock);
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    ReplayShard* shard = _shards[i];
+    while (!shard->messageEventQueue.empty())
+    {
+      discarded.push_back(shard->messageEventQueue.front());
+      shard->messageEventQueue.pop();
+    }
+  }
+  _queueDepth = 0;
+  uv_mutex_unlock(&_messageEventLock);
+
+  _drops.Add(discarded.size());
+  ReleaseMessageEvents(discarded);
+}
+
+/*-----------------------------------------------------------------------------
+ * Deliver received messages and notifications to JavaScript (called by the
+ * session dispatcher)
  */
-void Replay::MessageAsyncEvent(uv_async_t* async, int status)
+void Replay::Dispatch(size_t maxEvents, uint64_t deadline)
 {
   HandleScope scope;
-  Replay* replay = (Replay*)async->data;
   MessageEvent messageEvent;
+  ReplayShard* shard;
 
   Local<Object> context = Context::GetCurrent()->Global();
-  while (replay->GetNextMessageEvent(messageEvent))
+  if (_aggregator && _aggregator->HasCompleted())
+  {
+    InvokeJsAggregateEvent(context);
+  }
+
+  size_t count = 0;
+  bool isWaiting = false;
+  while (count < maxEvents)
+  {
+    if (!PeekNextMessageEvent(messageEvent, shard))
+    {
+      // Nothing received, complete the shards that ended without a last
+      // message and read more from the cached ranges
+      if (!EndShards() && !ReadCachedMessages())
+      {
+        break;
+      }
+      continue;
+    }
+
+    // When pacing, wait (on the pace timer) until the message is due
+    if ((_speed > 0) && !IsMessageDue(messageEvent))
+    {
+      isWaiting = true;
+      break;
+    }
+
+    PopMessageEvent(shard);
+    InvokeJsMessageEvent(context, messageEvent, shard);
+    count++;
+
+    // Out of time, the rest is delivered on a later turn
+    if (uv_hrtime() >= deadline)
+    {
+      break;
+    }
+  }
+
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    UpdateThrottle(_shards[i]);
+  }
+
+  if (HasPendingMessages() && _isInUse && !isWaiting)
   {
-    replay->InvokeJsMessageEvent(context, messageEvent);
+    _dispatcher->Schedule(this);
   }
 }
 
 /*-----------------------------------------------------------------------------
  * Post async message received event to JavaScript
  */
-void Replay::InvokeJsMessageEvent(Local<Object> context, MessageEvent& messageEvent)
+void Replay::InvokeJsMessageEvent(Local<Object> context, MessageEvent& messageEvent, ReplayShard* shard)
 {
-  Local<Object> message = Subscription::CreateJsMessageObject(messageEvent);
-  Handle<Value> argv[] = { message };
+  std::vector<void*> cacheAllocations;
+  if (messageEvent.isCached)
+  {
+    ReplayCacheSegment::GetAllocations(messageEvent, cacheAllocations);
+  }
 
-  TryCatch tryCatch;
+  RecordPosition(messageEvent);
+  unsigned int seekCount = _seekCount;
 
-  Emit(EVT_MESSAGE, 1, argv);
-  if (tryCatch.HasCaught())
+  _messagesDelivered.Increment();
+  if (messageEvent.generationTime > shard->positionTime)
   {
-    node::FatalException(tryCatch);
+    shard->positionTime = (messageEvent.generationTime < shard->endTime) ? messageEvent.generationTime : shard->endTime;
   }
 
-  if (messageEvent.isLastMessage)
+  // Messages nobody listens to (e.g. only aggregated) are never converted
+  if (GetListenerCount(EVT_MESSAGE) == 0)
   {
-    Emit(EVT_FINISH, 1, argv);
+    if (!messageEvent.isCached)
+    {
+      Subscription::ReleaseMessageEvent(messageEvent);
+    }
 
-    MarkInUse(false);
+    if (messageEvent.isLastMessage)
+    {
+      CompleteShard(shard, 0, NULL);
+    }
+  }
+  else
+  {
+    Local<Object> message = Subscription::CreateJsMessageObject(messageEvent);
+    Handle<Value> argv[] = { message };
+
+    TryCatch tryCatch;
+
+    Emit(EVT_MESSAGE, 1, argv);
+    if (tryCatch.HasCaught())
+    {
+      node::FatalException(tryCatch);
+    }
+
+    // A seek from the listener frees the shard
+    if (messageEvent.isLastMessage && (seekCount == _seekCount))
+    {
+      CompleteShard(shard, 1, argv);
+    }
   }
 
   // All messages must be released.
-  tvaReleaseMessageData(messageEvent.tvaMessage);
+  if (messageEvent.isCached)
+  {
+    for (size_t i = 0; i < cacheAllocations.size(); i++)
+    {
+      free(cacheAllocations[i]);
+    }
+  }
+  else
+  {
+    tvaReleaseMessageData(messageEvent.tvaMessage);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * A shard has delivered all its messages, the replay is finished once every
+ * shard has
+ */
+void Replay::CompleteShard(ReplayShard* shard, int argc, Handle<Value> argv[])
+{
+  // Already complete, or replaced by a seek from the message listener
+  if (shard->isComplete || shard->isRetired)
+  {
+    return;
+  }
+
+  shard->isComplete = true;
+  shard->positionTime = shard->endTime;
+  _completeShards++;
+
+  if (_aggregator)
+  {
+    _aggregator->FinishSource(shard->index);
+  }
+
+  if (_completeShards == _shards.size())
+  {
+    // The last buckets are delivered before 'finish'
+    if (_aggregator)
+    {
+      _aggregator->Flush();
+      InvokeJsAggregateEvent(Context::GetCurrent()->Global());
+    }
+
+    TryCatch tryCatch;
+
+    Emit(EVT_FINISH, argc, argv);
+    if (tryCatch.HasCaught())
+    {
+      node::FatalException(tryCatch);
+    }
+
+    MarkInUse(false);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Find the shard to deliver the next message from (lock held).  In order, the
+ * shards of a topic are delivered one after the other, each starting once the
+ * previous one is complete, and the topics are merged by generation time.
+ * Otherwise shards are delivered round-robin.
+ */
+ReplayShard* Replay::GetDeliverableShard()
+{
+  if (_isOrdered)
+  {
+    ReplayShard* next = NULL;
+    for (size_t i = 0; i < _streams.size(); i++)
+    {
+      // Shards that ended without error have nothing more to wait for, a
+      // topic without data in the range does not hold the others back
+      ReplayStream& stream = _streams[i];
+      while ((stream.currentShard < stream.endShard) && IsShardFinished(_shards[stream.currentShard]))
+      {
+        stream.currentShard++;
+      }
+
+      if (stream.currentShard == stream.endShard)
+      {
+        continue;
+      }
+
+      // A topic with nothing received yet may still have the earliest message
+      ReplayShard* shard = _shards[stream.currentShard];
+      if (shard->messageEventQueue.empty())
+      {
+        return NULL;
+      }
+
+      if ((next == NULL) ||
+          (shard->messageEventQueue.front().generationTime < next->messageEventQueue.front().generationTime))
+      {
+        next = shard;
+      }
+    }
+
+    return next;
+  }
+
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    ReplayShard* shard = _shards[_currentShard];
+    _currentShard = (_currentShard + 1) % _shards.size();
+
+    if (!shard->messageEventQueue.empty())
+    {
+      return shard;
+    }
+  }
+
+  return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Check whether a shard has delivered everything it ever will (lock held),
+ * complete or ended without error, with an empty queue
+ */
+bool Replay::IsShardFinished(ReplayShard* shard)
+{
+  return ((shard->isComplete || (shard->isEnded && IsReplayEndStatus(shard->endStatus))) &&
+          shard->messageEventQueue.empty());
+}
+
+/*-----------------------------------------------------------------------------
+ * Check whether a cached shard must be read from (lock held), in order only
+ * the shard being delivered of each topic is
+ */
+bool Replay::IsCacheReadable(ReplayShard* shard)
+{
+  if ((shard->segment == NULL) || shard->isComplete || !shard->messageEventQueue.empty())
+  {
+    return false;
+  }
+
+  return (!_isOrdered || (_streams[shard->stream].currentShard == shard->index));
+}
+
+/*-----------------------------------------------------------------------------
+ * Queue the next messages of the cached shards that ran out, returns false
+ * when there was nothing to read
+ */
+bool Replay::ReadCachedMessages()
+{
+  std::vector<ReplayShard*> exhausted;
+  bool isRead = false;
+
+  uv_mutex_lock(&_messageEventLock);
+  for (size_t i = 0; (i < _shards.size()) && _isInUse; i++)
+  {
+    ReplayShard* shard = _shards[i];
+    if (!IsCacheReadable(shard))
+    {
+      continue;
+    }
+
+    MessageEvent messageEvent;
+    for (int j = 0; (j < REPLAY_CACHE_READ_BATCH) && shard->segment->Next(messageEvent); j++)
+    {
+      _cachedMessagesIn.Increment();
+      _bytesIn.Add(messageEvent.payloadSize);
+      _lossGap.Add(messageEvent.lossGap);
+
+      if (IsDelivered(messageEvent))
+      {
+        std::vector<void*> cacheAllocations;
+        ReplayCacheSegment::GetAllocations(messageEvent, cacheAllocations);
+        for (size_t k = 0; k < cacheAllocations.size(); k++)
+        {
+          free(cacheAllocations[k]);
+        }
+        continue;
+      }
+
+      if (_aggregator)
+      {
+        _aggregator->Add(messageEvent, shard->index);
+      }
+
+      shard->messageEventQueue.push(messageEvent);
+      _queueDepth++;
+      isRead = true;
+    }
+
+    if (shard->messageEventQueue.empty() && shard->segment->IsExhausted())
+    {
+      exhausted.push_back(shard);
+    }
+  }
+
+  if (_queueDepth > _peakQueueDepth)
+  {
+    _peakQueueDepth = _queueDepth;
+  }
+  uv_mutex_unlock(&_messageEventLock);
+
+  // Emits 'finish' once the last shard is complete, a corrupt segment ends
+  // the replay like a failed range
+  unsigned int seekCount = _seekCount;
+  for (size_t i = 0; (i < exhausted.size()) && _isInUse && (seekCount == _seekCount); i++)
+  {
+    if (exhausted[i]->segment->IsCorrupt())
+    {
+      InvokeJsErrorEvent(exhausted[i], "Corrupt replay cache segment");
+      MarkInUse(false);
+    }
+    else
+    {
+      CompleteShard(exhausted[i], 0, NULL);
+    }
+    isRead = true;
+  }
+
+  return isRead && _isInUse;
 }
 
 
 /*****     ReplayEvent     *****/
 
 /*-----------------------------------------------------------------------------
- * Replay message received callback
+ * Replay notification callback, for every replay of the session: the end of
+ * a shard's range, which may hold no messages, or an error
  */
 void Replay::ReplayNotificationEvent(TVA_REPLAY_HANDLE replayHndl, void* context,
                                      TVA_STATUS replayStatus, TVA_BOOLEAN replayHndlValid)
 {
-  Replay* replay = (Replay*)context;
-  replay->PostNotificationEvent(replayStatus);
+  // Subscriptions replay their backfill
+  if (((ReplayContext*)context)->contextType == ReplayContextBackfill)
+  {
+    Subscription::BackfillNotificationEvent((SubscriptionBackfill*)context, replayStatus);
+    return;
+  }
+
+  ReplayShard* shard = (ReplayShard*)context;
+  Replay* replay = shard->replay;
+
+  // Left behind by a seek
+  if (shard->isRetired)
+  {
+    return;
+  }
+
+  // The range is only cached when it was completely received
+  if (shard->cacheWriter)
+  {
+    if (IsReplayEndStatus(replayStatus))
+    {
+      shard->cacheWriter->Complete();
+    }
+    else
+    {
+      shard->cacheWriter->Fail();
+    }
+  }
+
+  uv_mutex_lock(&replay->_messageEventLock);
+  if (!shard->isEnded)
+  {
+    shard->isEnded = true;
+    shard->endStatus = replayStatus;
+    if (replay->_isInUse)
+    {
+      replay->_dispatcher->Schedule(replay);
+    }
+  }
+  uv_mutex_unlock(&replay->_messageEventLock);
 }
 
 /*-----------------------------------------------------------------------------
- * Post async notification event to JavaScript
+ * Complete the shards whose replay ended without a last message, once their
+ * messages are delivered.  A failed shard ends the replay with an 'error'.
+ * Returns false when no shard ended.
  */
-void Replay::NotificationAsyncEvent(uv_async_t* async, int status)
+bool Replay::EndShards()
 {
-  HandleScope scope;
-  Replay* replay = (Replay*)async->data;
-  TVA_STATUS rc;
+  std::vector<ReplayShard*> ended;
 
-  Local<Object> context = Context::GetCurrent()->Global();
-  while (replay->GetNextNotificationEvent(rc))
+  uv_mutex_lock(&_messageEventLock);
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    ReplayShard* shard = _shards[i];
+    if (shard->isEnded && !shard->isComplete && shard->messageEventQueue.empty())
+    {
+      ended.push_back(shard);
+    }
+  }
+  uv_mutex_unlock(&_messageEventLock);
+
+  // A seek from a 'finish' or 'error' listener frees the shards
+  unsigned int seekCount = _seekCount;
+  for (size_t i = 0; (i < ended.size()) && _isInUse && (seekCount == _seekCount); i++)
   {
-    replay->InvokeJsNotificationEvent(context, rc);
-    replay->MarkInUse(false);
+    if (IsReplayEndStatus(ended[i]->endStatus))
+    {
+      CompleteShard(ended[i], 0, NULL);
+    }
+    else
+    {
+      InvokeJsErrorEvent(ended[i], tvaErrToStr(ended[i]->endStatus));
+      MarkInUse(false);
+    }
   }
+
+  return !ended.empty() && _isInUse;
 }
 
 /*-----------------------------------------------------------------------------
- * Post async notification event to JavaScript
+ * Post a shard's replay error to JavaScript, with the range that failed
  */
-void Replay::InvokeJsNotificationEvent(Local<Object> context, TVA_STATUS rc)
+void Replay::InvokeJsErrorEvent(ReplayShard* shard, const char* error)
 {
-  Handle<Value> argv[1];
-  argv[0] = String::New(tvaErrToStr(rc));
+  HandleScope scope;
+
+  Local<Object> range = Object::New();
+  range->Set(String::NewSymbol("topic"), String::New(_topics[shard->stream].c_str()));
+  range->Set(String::NewSymbol("startTime"), Date::New((double)(shard->startTime / 1000)));
+  range->Set(String::NewSymbol("endTime"), Date::New((double)(shard->endTime / 1000)));
+
+  Handle<Value> argv[2];
+  argv[0] = String::New(error);
+  argv[1] = range;
 
   TryCatch tryCatch;
 
-  Emit(EVT_ERROR, 1, argv);
+  Emit(EVT_ERROR, 2, argv);
   if (tryCatch.HasCaught())
   {
     node::FatalException(tryCatch);
@@ -263,6 +923,8 @@ void Replay::InvokeJsNotificationEvent(Local<Object> context, TVA_STATUS rc)
 struct ReplayPauseResumeRequest
 {
   Replay* replay;
+  ReplayShard* shard;
+  unsigned int seekCount;           // the shard is freed once seeked away from
   bool isPause;
   TVA_STATUS result;
 };
@@ -284,15 +946,15 @@ Handle<Value> Replay::Pause(const Arguments& args)
     replay->AddOnceListener(EVT_PAUSE, Persistent<Function>::New(complete));
   }
 
-  // Send data to worker thread
-  ReplayPauseResumeRequest* request = new ReplayPauseResumeRequest;
-  request->replay = replay;
-  request->isPause = true;
-
-  uv_work_t* req = new uv_work_t();
-  req->data = request;
+  if (!replay->_isUserPaused)
+  {
+    replay->_pauseStartTime = uv_hrtime();
+  }
+  uv_mutex_lock(&replay->_pauseStateLock);
+  replay->_isUserPaused = true;
+  uv_mutex_unlock(&replay->_pauseStateLock);
 
-  uv_queue_work(uv_default_loop(), req, Replay::PauseResumeWorker, Replay::PauseResumeWorkerComplete);
+  replay->QueuePauseResume(NULL, true, Replay::PauseResumeWorkerComplete);
 
   return scope.Close(args.This());
 }
@@ -314,45 +976,988 @@ Handle<Value> Replay::Resume(const Arguments& args)
     replay->AddOnceListener(EVT_RESUME, Persistent<Function>::New(complete));
   }
 
-  // Send data to worker thread
-  ReplayPauseResumeRequest* request = new ReplayPauseResumeRequest;
-  request->replay = replay;
-  request->isPause = false;
-
-  uv_work_t* req = new uv_work_t();
+  // Pacing carries on from where it was paused, not bursting to catch up
+  if (replay->_isUserPaused)
+  {
+    uint64_t pausedTime = uv_hrtime() - replay->_pauseStartTime;
+    replay->_pausedTime += pausedTime;
+    replay->_paceBaseTime += pausedTime;
+  }
+  uv_mutex_lock(&replay->_pauseStateLock);
+  replay->_isUserPaused = false;
+  uv_mutex_unlock(&replay->_pauseStateLock);
+  for (size_t i = 0; i < replay->_shards.size(); i++)
+  {
+    replay->EndThrottle(replay->_shards[i]);
+  }
+
+  replay->QueuePauseResume(NULL, false, Replay::PauseResumeWorkerComplete);
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Send a pause/resume request to the worker thread
+ */
+void Replay::QueuePauseResume(ReplayShard* shard, bool isPause, uv_after_work_cb afterWork)
+{
+  ReplayPauseResumeRequest* request = new ReplayPauseResumeRequest;
+  request->replay = this;
+  request->shard = shard;
+  request->seekCount = _seekCount;
+  request->isPause = isPause;
+
+  uv_work_t* req = new uv_work_t();
+  req->data = request;
+
+  uv_queue_work(uv_default_loop(), req, Replay::PauseResumeWorker, afterWork);
+}
+
+/*-----------------------------------------------------------------------------
+ * Perform replay pause/resume
+ */
+void Replay::PauseResumeWorker(uv_work_t* req)
+{
+  ReplayPauseResumeRequest* request = (ReplayPauseResumeRequest*)req->data;
+  request->result = request->replay->ApplyPauseState();
+}
+
+/*-----------------------------------------------------------------------------
+ * Pause upstream the shards paused by the application or throttled, resume
+ * the others.  Requests apply the state asked for when they run, one at a
+ * time, so requests that run out of order still leave the last state asked.
+ */
+TVA_STATUS Replay::ApplyPauseState()
+{
+  TVA_STATUS result = TVA_OK;
+
+  uv_mutex_lock(&_pauseLock);
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    // Cached shards have no replay handle
+    ReplayShard* shard = _shards[i];
+    if (shard->handle == TVA_INVALID_HANDLE)
+    {
+      continue;
+    }
+
+    uv_mutex_lock(&_pauseStateLock);
+    bool isPaused = _isUserPaused || shard->isThrottled;
+    uv_mutex_unlock(&_pauseStateLock);
+
+    if (isPaused == shard->isUpstreamPaused)
+    {
+      continue;
+    }
+
+    TVA_STATUS rc;
+    if (isPaused)
+    {
+      rc = tvaReplayPause(shard->handle);
+    }
+    else
+    {
+      rc = tvaReplayResume(shard->handle);
+    }
+
+    if (rc == TVA_OK)
+    {
+      shard->isUpstreamPaused = isPaused;
+    }
+    else if (result == TVA_OK)
+    {
+      result = rc;
+    }
+  }
+  uv_mutex_unlock(&_pauseLock);
+
+  return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * Check whether the replay handles are paused as asked (pause lock held)
+ */
+bool Replay::IsPauseStateApplied()
+{
+  bool isApplied = true;
+
+  uv_mutex_lock(&_pauseStateLock);
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    ReplayShard* shard = _shards[i];
+    if ((shard->handle != TVA_INVALID_HANDLE) && (shard->isUpstreamPaused != (_isUserPaused || shard->isThrottled)))
+    {
+      isApplied = false;
+      break;
+    }
+  }
+  uv_mutex_unlock(&_pauseStateLock);
+
+  return isApplied;
+}
+
+/*-----------------------------------------------------------------------------
+ * Replay pause complete
+ */
+void Replay::PauseResumeWorkerComplete(uv_work_t* req)
+{
+  HandleScope scope;
+
+  ReplayPauseResumeRequest* request = (ReplayPauseResumeRequest*)req->data;
+  delete req;
+
+  Handle<Value> argv[1];
+  if (request->result == TVA_OK)
+  {
+    argv[0] = Undefined();
+  }
+  else
+  {
+    argv[0] = String::New(tvaErrToStr(request->result));
+  }
+
+  TryCatch tryCatch;
+
+  if (request->isPause)
+  {
+    request->replay->Emit(EVT_PAUSE, 1, argv);
+  }
+  else
+  {
+    request->replay->Emit(EVT_RESUME, 1, argv);
+  }
+
+  if (tryCatch.HasCaught())
+  {
+    node::FatalException(tryCatch);
+  }
+
+  delete request;
+}
+
+
+/*****     Pacing     *****/
+
+/*-----------------------------------------------------------------------------
+ * Check whether a message is due when pacing, the messages keep the gaps
+ * between their generation times divided by the replay speed.  Starts the
+ * pace timer when the message is not due yet.
+ */
+bool Replay::IsMessageDue(MessageEvent& messageEvent)
+{
+  uint64_t now = uv_hrtime();
+  TVA_UINT64 generationTime = messageEvent.generationTime;
+
+  if (!_isPaceStarted)
+  {
+    _paceBaseTime = now;
+    _paceBaseGenerationTime = generationTime;
+    _isPaceStarted = true;
+  }
+
+  // Generation times are in microseconds
+  uint64_t dueTime = _paceBaseTime;
+  if (generationTime > _paceBaseGenerationTime)
+  {
+    dueTime += (uint64_t)(((double)(generationTime - _paceBaseGenerationTime) * 1000.0) / _speed);
+  }
+
+  if (dueTime <= now)
+  {
+    return true;
+  }
+
+  if (_isPaceTimerOpen)
+  {
+    uint64_t timeout = (dueTime - now + 999999) / 1000000;
+    uv_timer_start(&_paceTimer, Replay::PaceTimerEvent, (int64_t)timeout, 0);
+  }
+
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+ * Next paced message is due
+ */
+void Replay::PaceTimerEvent(uv_timer_t* timer, int status)
+{
+  Replay* replay = (Replay*)timer->data;
+  if (replay->IsInUse())
+  {
+    replay->_dispatcher->Schedule(replay);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Pace timer closed
+ */
+void Replay::ReplayHandleCloseComplete(uv_handle_t* handle)
+{
+}
+
+
+/*****     Backpressure     *****/
+
+/*-----------------------------------------------------------------------------
+ * Pause a shard upstream once its queue reaches the high water mark, resume it
+ * once the queue has drained to the low water mark
+ */
+void Replay::UpdateThrottle(ReplayShard* shard)
+{
+  // Paused by the application anyway, resuming ends the throttles
+  if (shard->isThrottlePending || _isUserPaused || !_isInUse || (_highWaterMark == 0) ||
+      (shard->handle == TVA_INVALID_HANDLE))
+  {
+    return;
+  }
+
+  uv_mutex_lock(&_messageEventLock);
+  size_t depth = shard->messageEventQueue.size();
+  uv_mutex_unlock(&_messageEventLock);
+
+  bool throttle;
+  if (!shard->isThrottled && (depth >= _highWaterMark))
+  {
+    throttle = true;
+  }
+  else if (shard->isThrottled && (depth <= _lowWaterMark))
+  {
+    throttle = false;
+  }
+  else
+  {
+    return;
+  }
+
+  // Applied with the application's pause/resume requests, in order
+  if (throttle)
+  {
+    BeginThrottle(shard);
+  }
+  else
+  {
+    EndThrottle(shard);
+  }
+  shard->isThrottlePending = true;
+
+  QueuePauseResume(shard, throttle, Replay::ThrottleWorkerComplete);
+}
+
+/*-----------------------------------------------------------------------------
+ * Replay throttle complete, no events are emitted.  A throttle that failed is
+ * undone, to be retried at the next water mark.
+ */
+void Replay::ThrottleWorkerComplete(uv_work_t* req)
+{
+  ReplayPauseResumeRequest* request = (ReplayPauseResumeRequest*)req->data;
+  delete req;
+
+  Replay* replay = request->replay;
+  ReplayShard* shard = (request->seekCount == replay->_seekCount) ? request->shard : NULL;
+  if (shard)
+  {
+    shard->isThrottlePending = false;
+  }
+  if (shard && (request->result != TVA_OK))
+  {
+    if (request->isPause)
+    {
+      replay->EndThrottle(shard);
+    }
+    else
+    {
+      replay->BeginThrottle(shard);
+    }
+  }
+
+  // The queue may have crossed a water mark while the request was running
+  if (replay->IsInUse())
+  {
+    replay->_dispatcher->Schedule(replay);
+  }
+
+  delete request;
+}
+
+/*-----------------------------------------------------------------------------
+ * The shard is throttled, from the next pause/resume request
+ */
+void Replay::BeginThrottle(ReplayShard* shard)
+{
+  if (!shard->isThrottled)
+  {
+    shard->throttleStartTime = uv_hrtime();
+    _throttles++;
+
+    uv_mutex_lock(&_pauseStateLock);
+    shard->isThrottled = true;
+    uv_mutex_unlock(&_pauseStateLock);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * The shard is no longer throttled, account for the time spent paused
+ */
+void Replay::EndThrottle(ReplayShard* shard)
+{
+  if (shard->isThrottled)
+  {
+    _throttledTime += uv_hrtime() - shard->throttleStartTime;
+
+    uv_mutex_lock(&_pauseStateLock);
+    shard->isThrottled = false;
+    uv_mutex_unlock(&_pauseStateLock);
+  }
+}
+
+
+/*****     Statistics     *****/
+
+/*-----------------------------------------------------------------------------
+ * Get the replay's runtime statistics
+ *
+ * var stats = replay.stats();
+ */
+Handle<Value> Replay::Stats(const Arguments& args)
+{
+  HandleScope scope;
+  Replay* replay = ObjectWrap::Unwrap<Replay>(args.This());
+
+  return scope.Close(replay->CreateJsStats());
+}
+
+/*-----------------------------------------------------------------------------
+ * Create the statistics object of stats() and the 'progress' event
+ */
+Local<Object> Replay::CreateJsStats()
+{
+  size_t queueDepth;
+  size_t peakQueueDepth;
+  GetQueueDepth(queueDepth, peakQueueDepth);
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("messagesIn"), Number::New((double)_messagesIn.Get()));
+  result->Set(String::NewSymbol("cachedMessagesIn"), Number::New((double)_cachedMessagesIn.Get()));
+  result->Set(String::NewSymbol("bytesIn"), Number::New((double)_bytesIn.Get()));
+  result->Set(String::NewSymbol("decodeErrors"), Number::New((double)_decodeErrors.Get()));
+  result->Set(String::NewSymbol("lossGap"), Number::New((double)_lossGap.Get()));
+  result->Set(String::NewSymbol("drops"), Number::New((double)_drops.Get()));
+  if (_aggregator)
+  {
+    result->Set(String::NewSymbol("aggregateLateMessages"), Number::New((double)_aggregator->GetLateMessages()));
+  }
+  result->Set(String::NewSymbol("queueDepth"), Number::New((double)queueDepth));
+  result->Set(String::NewSymbol("peakQueueDepth"), Number::New((double)peakQueueDepth));
+
+  uint64_t now = uv_hrtime();
+  uint64_t throttledTime = _throttledTime;
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    if (_shards[i]->isThrottled)
+    {
+      throttledTime += now - _shards[i]->throttleStartTime;
+    }
+  }
+  result->Set(String::NewSymbol("throttles"), Number::New((double)_throttles));
+  result->Set(String::NewSymbol("throttledTime"), Number::New((double)(throttledTime / 1000)));
+
+  uint64_t pausedTime = _pausedTime;
+  if (_isUserPaused)
+  {
+    pausedTime += now - _pauseStartTime;
+  }
+  result->Set(String::NewSymbol("pausedTime"), Number::New((double)(pausedTime / 1000)));
+
+  UpdateRates();
+  result->Set(String::NewSymbol("messagesDelivered"), Number::New((double)_messagesDelivered.Get()));
+  result->Set(String::NewSymbol("inRate"), Number::New(_inRate));
+  result->Set(String::NewSymbol("deliveredRate"), Number::New(_deliveredRate));
+
+  // Every shard has been delivered up to the position, the slowest one sets it
+  TVA_UINT64 position = _endTime;
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    if (!_shards[i]->isComplete && (_shards[i]->positionTime < position))
+    {
+      position = _shards[i]->positionTime;
+    }
+  }
+  result->Set(String::NewSymbol("position"), Date::New((double)(position / 1000)));
+
+  TVA_UINT64 remaining = GetRemainingTime();
+  double total = (_endTime > _startTime) ? (double)(_endTime - _startTime) * (double)_streams.size() : 0;
+  double percentDone = (total > 0) ? 100.0 * (1.0 - ((double)remaining / total)) : 100.0;
+  result->Set(String::NewSymbol("percentDone"), Number::New(percentDone));
+
+  if (remaining == 0)
+  {
+    result->Set(String::NewSymbol("eta"), Number::New(0));
+  }
+  else if (_progressRate > 0)
+  {
+    result->Set(String::NewSymbol("eta"), Number::New(((double)remaining / _progressRate) * 1000000.0));
+  }
+  else
+  {
+    result->Set(String::NewSymbol("eta"), Null());
+  }
+
+  return result;
+}
+
+/*-----------------------------------------------------------------------------
+ * Generation time left to deliver, summed over every shard (microseconds)
+ */
+TVA_UINT64 Replay::GetRemainingTime()
+{
+  TVA_UINT64 remaining = 0;
+  for (size_t i = 0; i < _shards.size(); i++)
+  {
+    ReplayShard* shard = _shards[i];
+    if (!shard->isComplete && (shard->endTime > shard->positionTime))
+    {
+      remaining += shard->endTime - shard->positionTime;
+    }
+  }
+  return remaining;
+}
+
+/*-----------------------------------------------------------------------------
+ * Start measuring the rates, once the replay is in use
+ */
+void Replay::StartRates()
+{
+  _rateSampleTime = uv_hrtime();
+  _rateSampleIn = _messagesIn.Get() + _cachedMessagesIn.Get();
+  _rateSampleDelivered = _messagesDelivered.Get();
+  _rateSampleRemaining = GetRemainingTime();
+}
+
+/*-----------------------------------------------------------------------------
+ * Update the rates, measured over samples of at least REPLAY_RATE_SAMPLE_TIME
+ */
+void Replay::UpdateRates()
+{
+  uint64_t now = uv_hrtime();
+  uint64_t elapsed = now - _rateSampleTime;
+
+  // Until the first sample completes the rates are measured since the start
+  if ((_rateSampleTime == 0) || (elapsed == 0) || (_hasRates && (elapsed < REPLAY_RATE_SAMPLE_TIME)))
+  {
+    return;
+  }
+
+  int64_t messagesIn = _messagesIn.Get() + _cachedMessagesIn.Get();
+  int64_t messagesDelivered = _messagesDelivered.Get();
+  TVA_UINT64 remaining = GetRemainingTime();
+  double seconds = (double)elapsed / 1000000000.0;
+
+  _inRate = (double)(messagesIn - _rateSampleIn) / seconds;
+  _deliveredRate = (double)(messagesDelivered - _rateSampleDelivered) / seconds;
+
+  // A seek back in time adds to the remaining time, that's no progress
+  _progressRate = (remaining < _rateSampleRemaining) ? (double)(_rateSampleRemaining - remaining) / seconds : 0;
+
+  if (elapsed >= REPLAY_RATE_SAMPLE_TIME)
+  {
+    _hasRates = true;
+    _rateSampleTime = now;
+    _rateSampleIn = messagesIn;
+    _rateSampleDelivered = messagesDelivered;
+    _rateSampleRemaining = remaining;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Progress interval elapsed, emit the statistics
+ */
+void Replay::ProgressTimerEvent(uv_timer_t* timer, int status)
+{
+  HandleScope scope;
+  Replay* replay = (Replay*)timer->data;
+
+  if (!replay->IsInUse() || (replay->GetListenerCount(EVT_PROGRESS) == 0))
+  {
+    return;
+  }
+
+  Handle<Value> argv[] = { replay->CreateJsStats() };
+
+  TryCatch tryCatch;
+
+  replay->Emit(EVT_PROGRESS, 1, argv);
+  if (tryCatch.HasCaught())
+  {
+    node::FatalException(tryCatch);
+  }
+}
+
+
+/*****     Aggregation     *****/
+
+/*-----------------------------------------------------------------------------
+ * Aggregate the replayed messages into time buckets
+ *
+ * replay.aggregate(spec);
+ */
+Handle<Value> Replay::Aggregate(const Arguments& args)
+{
+  HandleScope scope;
+  Replay* replay = ObjectWrap::Unwrap<Replay>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(1, args.Length());
+  PARAM_REQ_OBJECT(0, args);        // spec
+
+  if (replay->_aggregator)
+  {
+    ThrowException(Exception::Error(String::New("Already aggregating")));
+    return scope.Close(Undefined());
+  }
+
+  // Each shard is in time order on its own, buckets wait for all of them
+  Aggregator* aggregator = new Aggregator(replay->_shards.size());
+  if (!aggregator->Parse(args[0]->ToObject()))
+  {
+    delete aggregator;
+    ThrowException(Exception::TypeError(String::New("Invalid aggregation")));
+    return scope.Close(Undefined());
+  }
+
+  for (size_t i = 0; i < replay->_shards.size(); i++)
+  {
+    if (replay->_shards[i]->isComplete)
+    {
+      aggregator->FinishSource(i);
+    }
+  }
+
+  // Fully built before the Tervela threads see it
+  tva_memory_barrier();
+  replay->_aggregator = aggregator;
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Post the complete aggregation buckets to JavaScript
+ */
+void Replay::InvokeJsAggregateEvent(Local<Object> context)
+{
+  HandleScope scope;
+
+  Local<Array> buckets = _aggregator->TakeCompleted();
+  if (buckets->Length() == 0)
+  {
+    return;
+  }
+
+  Handle<Value> argv[] = { buckets };
+
+  TryCatch tryCatch;
+
+  Emit(EVT_AGGREGATE, 1, argv);
+  if (tryCatch.HasCaught())
+  {
+    node::FatalException(tryCatch);
+  }
+}
+
+
+/*****     Checkpoints     *****/
+
+/*-----------------------------------------------------------------------------
+ * Get the position of the last delivered message
+ *
+ * var checkpoint = replay.checkpoint();
+ */
+Handle<Value> Replay::Checkpoint(const Arguments& args)
+{
+  HandleScope scope;
+  Replay* replay = ObjectWrap::Unwrap<Replay>(args.This());
+
+  // Out of order, the messages delivered are not all those before a position
+  if (!replay->_isOrdered)
+  {
+    ThrowException(Exception::Error(String::New("Checkpoints require an ordered replay")));
+    return scope.Close(Undefined());
+  }
+
+  if (!replay->_hasCheckpoint)
+  {
+    return scope.Close(Null());
+  }
+
+  std::vector<ReplayPosition>& delivered = replay->_checkpointDelivered;
+  Local<Array> jsDelivered = Array::New((int)delivered.size());
+  for (size_t i = 0; i < delivered.size(); i++)
+  {
+    Local<Object> position = Object::New();
+    position->Set(String::NewSymbol("topic"), String::New(delivered[i].topic.c_str()));
+    if (delivered[i].hasOrigin)
+    {
+      position->Set(String::NewSymbol("pubId"), Number::New((double)delivered[i].pubId));
+      position->Set(String::NewSymbol("sessionId"), Number::New((double)delivered[i].sessionId));
+      position->Set(String::NewSymbol("tsn"), Number::New((double)delivered[i].tsn));
+    }
+    jsDelivered->Set((uint32_t)i, position);
+  }
+
+  Local<Object> checkpoint = Object::New();
+  // Microseconds, a Date would lose the precision the checkpoint is matched with
+  checkpoint->Set(String::NewSymbol("generationTimeUs"), Number::New((double)replay->_checkpointTime));
+  checkpoint->Set(String::NewSymbol("delivered"), jsDelivered);
+
+  return scope.Close(checkpoint);
+}
+
+/*-----------------------------------------------------------------------------
+ * Skip the messages delivered up to a checkpoint, the replay starts at its
+ * generation time
+ */
+void Replay::SetResumeFrom(TVA_UINT64 generationTime, std::vector<ReplayPosition>& delivered)
+{
+  _resumeTime = generationTime;
+  _resumeDelivered = delivered;
+  _isResuming = true;
+
+  // Resumed again before delivering anything, from the same position
+  _checkpointTime = generationTime;
+  _checkpointDelivered = delivered;
+  _hasCheckpoint = true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Check whether a message was delivered before the checkpoint resumed from
+ * (any thread).  The messages of the checkpoint's generation time are matched
+ * by publisher session and sequence number, or by topic and order when those
+ * are unknown.  The last message of a range is always kept, it completes the
+ * range.
+ */
+bool Replay::IsDelivered(MessageEvent& messageEvent)
+{
+  if (!_isResuming || (messageEvent.generationTime > _resumeTime) || messageEvent.isLastMessage)
+  {
+    return false;
+  }
+
+  if (messageEvent.generationTime < _resumeTime)
+  {
+    return true;
+  }
+
+  bool isDelivered = false;
+  uv_mutex_lock(&_resumeLock);
+  std::vector<ReplayPosition>::iterator it;
+  for (it = _resumeDelivered.begin(); it != _resumeDelivered.end(); it++)
+  {
+    if ((it->topic != messageEvent.topicName) ||
+        (it->hasOrigin && messageEvent.hasOrigin &&
+         ((it->pubId != messageEvent.pubId) || (it->sessionId != messageEvent.sessionId) || (it->tsn != messageEvent.tsn))))
+    {
+      continue;
+    }
+
+    _resumeDelivered.erase(it);
+    isDelivered = true;
+    break;
+  }
+  uv_mutex_unlock(&_resumeLock);
+
+  return isDelivered;
+}
+
+/*-----------------------------------------------------------------------------
+ * Record the position of a message being delivered
+ */
+void Replay::RecordPosition(MessageEvent& messageEvent)
+{
+  if (!_hasCheckpoint || (messageEvent.generationTime != _checkpointTime))
+  {
+    _checkpointTime = messageEvent.generationTime;
+    _checkpointDelivered.clear();
+    _hasCheckpoint = true;
+  }
+
+  ReplayPosition position;
+  position.topic = messageEvent.topicName;
+  position.hasOrigin = messageEvent.hasOrigin;
+  position.pubId = messageEvent.pubId;
+  position.sessionId = messageEvent.sessionId;
+  position.tsn = messageEvent.tsn;
+  _checkpointDelivered.push_back(position);
+}
+
+
+/*****     Seek     *****/
+
+struct ReplaySeekRequest
+{
+  Replay* replay;
+  TVA_UINT64 time;
+  TVA_STATUS result;
+};
+
+struct ReplayReleaseShardsRequest
+{
+  Replay* replay;
+  std::vector<ReplayShard*> shards;
+};
+
+/*-----------------------------------------------------------------------------
+ * Move the replay to another time of its time range
+ *
+ * replay.seek(time, [callback]);
+ */
+Handle<Value> Replay::Seek(const Arguments& args)
+{
+  HandleScope scope;
+  Replay* replay = ObjectWrap::Unwrap<Replay>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(1, args.Length());
+
+  if (!args[0]->IsNumber() && !args[0]->IsDate())
+  {
+    ThrowException(Exception::TypeError(String::New("Incorrect arguments format - arg 0 should be of type Date")));
+    return scope.Close(Undefined());
+  }
+
+  TVA_UINT64 time = (TVA_UINT64)(args[0]->NumberValue() * 1000);
+  if ((time < replay->_startTime) || (time > replay->_endTime))
+  {
+    ThrowException(Exception::RangeError(String::New("Seek time outside of the replay time range")));
+    return scope.Close(Undefined());
+  }
+
+  if (!replay->_isInUse || replay->_isSeeking)
+  {
+    ThrowException(Exception::Error(String::New("Replay can't seek, it is complete or already seeking")));
+    return scope.Close(Undefined());
+  }
+
+  if ((args.Length() > 1) && args[1]->IsFunction())
+  {
+    Local<Function> complete = Local<Function>::Cast(args[1]);
+    replay->AddOnceListener(EVT_SEEK, Persistent<Function>::New(complete));
+  }
+
+  // The buckets of the previous position are complete
+  if (replay->_aggregator)
+  {
+    replay->_aggregator->Flush();
+    replay->InvokeJsAggregateEvent(Context::GetCurrent()->Global());
+  }
+
+  replay->RetireShards();
+
+  // Send data to worker thread
+  ReplaySeekRequest* request = new ReplaySeekRequest;
+  request->replay = replay;
+  request->time = time;
+  replay->_isSeeking = true;
+
+  uv_work_t* req = new uv_work_t();
   req->data = request;
 
-  uv_queue_work(uv_default_loop(), req, Replay::PauseResumeWorker, Replay::PauseResumeWorkerComplete);
+  uv_queue_work(uv_default_loop(), req, Replay::SeekWorker, Replay::SeekWorkerComplete);
 
   return scope.Close(args.This());
 }
 
 /*-----------------------------------------------------------------------------
- * Perform replay pause
+ * Set the shards aside, discarding the messages they queued.  Their Tervela
+ * callbacks may still run, they are freed by the seek worker once their
+ * replay handles are released.
  */
-void Replay::PauseResumeWorker(uv_work_t* req)
+void Replay::RetireShards()
 {
-  ReplayPauseResumeRequest* request = (ReplayPauseResumeRequest*)req->data;
-  if (request->isPause)
+  std::vector<MessageEvent> discarded;
+
+  uv_mutex_lock(&_messageEventLock);
+  for (size_t i = 0; i < _shards.size(); i++)
   {
-    request->result = tvaReplayPause(request->replay->GetHandle());
+    ReplayShard* shard = _shards[i];
+    shard->isRetired = true;
+    if (shard->cacheWriter)
+    {
+      shard->cacheWriter->Fail();
+    }
+
+    while (!shard->messageEventQueue.empty())
+    {
+      discarded.push_back(shard->messageEventQueue.front());
+      shard->messageEventQueue.pop();
+    }
+
+    _retiredShards.push_back(shard);
   }
-  else
+  uv_mutex_lock(&_pauseLock);
+  _shards.clear();
+  uv_mutex_unlock(&_pauseLock);
+  _streams.clear();
+  _currentShard = 0;
+  _completeShards = 0;
+  _queueDepth = 0;
+  _isAggregationHeld = true;
+  _seekCount++;
+  uv_mutex_unlock(&_messageEventLock);
+
+  ReleaseMessageEvents(discarded);
+
+  // Pacing starts over from the new position, checkpoints too
+  _isPaceStarted = false;
+  _hasCheckpoint = false;
+  uv_mutex_lock(&_resumeLock);
+  _isResuming = false;
+  uv_mutex_unlock(&_resumeLock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Count the shards that took over from a seek in the aggregator, adding the
+ * messages they queued before (lock held)
+ */
+void Replay::ResetAggregator()
+{
+  _aggregator->Reset(_shards.size());
+
+  for (size_t i = 0; i < _shards.size(); i++)
   {
-    request->result = tvaReplayResume(request->replay->GetHandle());
+    ReplayShard* shard = _shards[i];
+    for (size_t j = shard->messageEventQueue.size(); j > 0; j--)
+    {
+      MessageEvent messageEvent = shard->messageEventQueue.front();
+      shard->messageEventQueue.pop();
+
+      _aggregator->Add(messageEvent, shard->index);
+      if (messageEvent.isLastMessage)
+      {
+        _aggregator->FinishSource(shard->index);
+      }
+      shard->messageEventQueue.push(messageEvent);
+    }
   }
 }
 
 /*-----------------------------------------------------------------------------
- * Replay pause complete
+ * Release messages that will not be delivered
  */
-void Replay::PauseResumeWorkerComplete(uv_work_t* req)
+void Replay::ReleaseMessageEvents(std::vector<MessageEvent>& messageEvents)
+{
+  for (size_t i = 0; i < messageEvents.size(); i++)
+  {
+    if (messageEvents[i].isCached)
+    {
+      std::vector<void*> cacheAllocations;
+      ReplayCacheSegment::GetAllocations(messageEvents[i], cacheAllocations);
+      for (size_t j = 0; j < cacheAllocations.size(); j++)
+      {
+        free(cacheAllocations[j]);
+      }
+    }
+    else
+    {
+      Subscription::ReleaseMessageEvent(messageEvents[i]);
+      tvaReleaseMessageData(messageEvents[i].tvaMessage);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Perform replay seek: release and free the retired shards and start new
+ * shards from the seek time.  Cached ranges are only reopened, so seeking
+ * within the cache costs no replay request.
+ */
+void Replay::SeekWorker(uv_work_t* req)
+{
+  ReplaySeekRequest* request = (ReplaySeekRequest*)req->data;
+  Replay* replay = request->replay;
+
+  // No callback runs for a released handle, the shards can go
+  for (size_t i = 0; i < replay->_retiredShards.size(); i++)
+  {
+    DeleteShard(replay->_retiredShards[i]);
+  }
+  replay->_retiredShards.clear();
+
+  request->result = replay->StartShards(request->time, replay->_seekShards, replay->_seekStreams);
+
+  // Paused by the application, stays paused
+  uv_mutex_lock(&replay->_pauseLock);
+  uv_mutex_lock(&replay->_pauseStateLock);
+  bool isPaused = replay->_isUserPaused;
+  uv_mutex_unlock(&replay->_pauseStateLock);
+  if ((request->result == TVA_OK) && isPaused)
+  {
+    for (size_t i = 0; i < replay->_seekShards.size(); i++)
+    {
+      ReplayShard* shard = replay->_seekShards[i];
+      if ((shard->handle != TVA_INVALID_HANDLE) && (tvaReplayPause(shard->handle) == TVA_OK))
+      {
+        shard->isUpstreamPaused = true;
+      }
+    }
+  }
+  uv_mutex_unlock(&replay->_pauseLock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Replay seek complete, the new shards take over
+ */
+void Replay::SeekWorkerComplete(uv_work_t* req)
 {
   HandleScope scope;
 
-  ReplayPauseResumeRequest* request = (ReplayPauseResumeRequest*)req->data;
+  ReplaySeekRequest* request = (ReplaySeekRequest*)req->data;
+  Replay* replay = request->replay;
   delete req;
 
+  // Stopped or finished while seeking, the new shards are dropped
+  bool isPauseStateApplied = true;
+  uv_mutex_lock(&replay->_messageEventLock);
+  if ((request->result == TVA_OK) && replay->_isInUse)
+  {
+    // Paused or resumed while seeking, the new shards may not follow yet
+    uv_mutex_lock(&replay->_pauseLock);
+    replay->_shards.swap(replay->_seekShards);
+    isPauseStateApplied = replay->IsPauseStateApplied();
+    uv_mutex_unlock(&replay->_pauseLock);
+    replay->_streams.swap(replay->_seekStreams);
+
+    // Counted from here, with the messages the new shards queued meanwhile
+    if (replay->_aggregator)
+    {
+      replay->ResetAggregator();
+    }
+  }
+  else
+  {
+    // Released at once, the replays started by the seek would stream on
+    ReplayReleaseShardsRequest* releaseRequest = new ReplayReleaseShardsRequest;
+    releaseRequest->replay = replay;
+    for (size_t i = 0; i < replay->_seekShards.size(); i++)
+    {
+      replay->_seekShards[i]->isRetired = true;
+      releaseRequest->shards.push_back(replay->_seekShards[i]);
+    }
+
+    uv_work_t* releaseReq = new uv_work_t();
+    releaseReq->data = releaseRequest;
+
+    replay->Ref();
+    uv_queue_work(uv_default_loop(), releaseReq, Replay::ReleaseShardsWorker, Replay::ReleaseShardsWorkerComplete);
+  }
+  replay->_seekShards.clear();
+  replay->_seekStreams.clear();
+  replay->_isSeeking = false;
+  replay->_isAggregationHeld = false;
+  uv_mutex_unlock(&replay->_messageEventLock);
+
+  if (!isPauseStateApplied)
+  {
+    replay->QueuePauseResume(NULL, replay->_isUserPaused, Replay::ThrottleWorkerComplete);
+  }
+
   Handle<Value> argv[1];
   if (request->result == TVA_OK)
   {
@@ -365,19 +1970,58 @@ void Replay::PauseResumeWorkerComplete(uv_work_t* req)
 
   TryCatch tryCatch;
 
-  if (request->isPause)
+  replay->Emit(EVT_SEEK, 1, argv);
+
+  if (tryCatch.HasCaught())
   {
-    request->replay->Emit(EVT_PAUSE, 1, argv);
+    node::FatalException(tryCatch);
   }
-  else
+
+  // The messages received meanwhile are delivered, a failed seek ends the replay
+  if (replay->_isInUse)
   {
-    request->replay->Emit(EVT_RESUME, 1, argv);
+    if (request->result != TVA_OK)
+    {
+      replay->MarkInUse(false);
+    }
+    else if (!replay->_isStopPending)
+    {
+      replay->_dispatcher->Schedule(replay);
+    }
   }
 
-  if (tryCatch.HasCaught())
+  // Stopped while seeking, the shards the seek started are stopped too
+  if (replay->_isStopPending)
   {
-    node::FatalException(tryCatch);
+    replay->_isStopPending = false;
+    replay->QueueStop();
+  }
+
+  delete request;
+}
+
+/*-----------------------------------------------------------------------------
+ * Release the replay handles of shards dropped by a seek, and free them
+ */
+void Replay::ReleaseShardsWorker(uv_work_t* req)
+{
+  ReplayReleaseShardsRequest* request = (ReplayReleaseShardsRequest*)req->data;
+
+  for (size_t i = 0; i < request->shards.size(); i++)
+  {
+    DeleteShard(request->shards[i]);
   }
+}
+
+/*-----------------------------------------------------------------------------
+ * Shards released, their callbacks no longer reach the replay
+ */
+void Replay::ReleaseShardsWorkerComplete(uv_work_t* req)
+{
+  ReplayReleaseShardsRequest* request = (ReplayReleaseShardsRequest*)req->data;
+  delete req;
+
+  request->replay->Unref();
 
   delete request;
 }
@@ -408,16 +2052,31 @@ Handle<Value> Replay::Stop(const Arguments& args)
     replay->AddOnceListener(EVT_STOP, Persistent<Function>::New(complete));
   }
 
-  // Send data to worker thread
+  // The shards are only known once the seek completes
+  if (replay->_isSeeking)
+  {
+    replay->_isStopPending = true;
+  }
+  else
+  {
+    replay->QueueStop();
+  }
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Send a stop request to the worker thread
+ */
+void Replay::QueueStop()
+{
   ReplayStopRequest* request = new ReplayStopRequest;
-  request->replay = replay;
+  request->replay = this;
 
   uv_work_t* req = new uv_work_t();
   req->data = request;
 
   uv_queue_work(uv_default_loop(), req, Replay::StopWorker, Replay::StopWorkerComplete);
-
-  return scope.Close(args.This());
 }
 
 /*-----------------------------------------------------------------------------
@@ -426,8 +2085,26 @@ Handle<Value> Replay::Stop(const Arguments& args)
 void Replay::StopWorker(uv_work_t* req)
 {
   ReplayStopRequest* request = (ReplayStopRequest*)req->data;
-  request->result = tvaReplayRelease(request->replay->GetHandle());
-  request->replay->SetHandle(TVA_INVALID_HANDLE);
+  Replay* replay = request->replay;
+  std::vector<ReplayShard*>& shards = replay->_shards;
+
+  // Not while a pause/resume is using the handles
+  uv_mutex_lock(&replay->_pauseLock);
+  request->result = TVA_OK;
+  for (size_t i = 0; i < shards.size(); i++)
+  {
+    if (shards[i]->handle != TVA_INVALID_HANDLE)
+    {
+      TVA_STATUS rc = tvaReplayRelease(shards[i]->handle);
+      shards[i]->handle = TVA_INVALID_HANDLE;
+
+      if (request->result == TVA_OK)
+      {
+        request->result = rc;
+      }
+    }
+  }
+  uv_mutex_unlock(&replay->_pauseLock);
 }
 
 /*-----------------------------------------------------------------------------
@@ -450,6 +2127,13 @@ void Replay::StopWorkerComplete(uv_work_t* req)
     argv[0] = String::New(tvaErrToStr(request->result));
   }
 
+  // Buckets still open are complete once the replay is stopped
+  if (request->replay->_aggregator)
+  {
+    request->replay->_aggregator->Flush();
+    request->replay->InvokeJsAggregateEvent(Context::GetCurrent()->Global());
+  }
+
   TryCatch tryCatch;
 
   request->replay->Emit(EVT_STOP, 1, argv);
@@ -459,11 +2143,11 @@ void Replay::StopWorkerComplete(uv_work_t* req)
     node::FatalException(tryCatch);
   }
 
-  request->replay->MarkInUse(false);
+  // Already complete when stopped after a finish or a failed seek
+  if (request->replay->IsInUse())
+  {
+    request->replay->MarkInUse(false);
+  }
 
   delete request;
 }
-
-void Replay::SubscriptionHandleCloseComplete(uv_handle_t* handle)
-{
-}
@@ -6,14 +6,103 @@
 
 #include <v8.h>
 #include <node.h>
+#include <vector>
+#include <string>
 #include "tvaClientAPI.h"
 #include "tvaClientAPIInterface.h"
 #include "tvaPEAPI.h"
 #include "DataTypes.h"
 #include "EventEmitter.h"
+#include "StatCounter.h"
+#include "Dispatcher.h"
+#include "ReplayCache.h"
+#include "Aggregator.h"
 #include "Session.h"
 
-class Replay: node::ObjectWrap, EventEmitter
+#define REPLAY_DEFAULT_HIGH_WATER   10000
+#define REPLAY_DEFAULT_LOW_WATER    1000
+#define REPLAY_CACHE_READ_BATCH     256
+#define REPLAY_RATE_SAMPLE_TIME     1000000000ULL     // nanoseconds
+
+class Replay;
+
+/*-----------------------------------------------------------------------------
+ * One time range of a replay, with its own Tervela replay handle and queue
+ */
+struct ReplayShard: ReplayContext
+{
+  Replay* replay;
+  size_t index;
+  size_t stream;
+  TVA_REPLAY_HANDLE handle;
+  ReplayCacheSegment* segment;      // cached range, read instead of replayed
+  ReplayCacheWriter* cacheWriter;   // live range being recorded to the cache
+  TVA_UINT64 startTime;
+  TVA_UINT64 endTime;
+  TVA_UINT64 positionTime;          // generation time of the last delivered message
+  std::queue<MessageEvent> messageEventQueue;
+  uint64_t throttleStartTime;
+  bool isThrottled;
+  bool isThrottlePending;
+  bool isUpstreamPaused;            // paused with tvaReplayPause (pause lock held)
+  bool isComplete;
+  bool isEnded;                     // notified that no more messages will be received
+  TVA_STATUS endStatus;
+  bool isRetired;                   // replaced by a seek, its messages are discarded
+
+  ReplayShard(Replay* owner, size_t shardIndex, size_t streamIndex)
+  {
+    contextType = ReplayContextShard;
+    replay = owner;
+    index = shardIndex;
+    stream = streamIndex;
+    handle = TVA_INVALID_HANDLE;
+    segment = NULL;
+    cacheWriter = NULL;
+    startTime = 0;
+    endTime = 0;
+    positionTime = 0;
+    throttleStartTime = 0;
+    isThrottled = false;
+    isThrottlePending = false;
+    isUpstreamPaused = false;
+    isComplete = false;
+    isEnded = false;
+    endStatus = TVA_OK;
+    isRetired = false;
+  }
+};
+
+/*-----------------------------------------------------------------------------
+ * The shards of one topic of a replay, consecutive in the replay's shards and
+ * in time order
+ */
+struct ReplayStream
+{
+  size_t currentShard;              // shard being delivered
+  size_t endShard;
+
+  ReplayStream(size_t firstShard)
+  {
+    currentShard = firstShard;
+    endShard = firstShard;
+  }
+};
+
+/*-----------------------------------------------------------------------------
+ * A message delivered at the generation time of a checkpoint, identified by
+ * its publisher session and sequence number when known
+ */
+struct ReplayPosition
+{
+  std::string topic;
+  bool hasOrigin;
+  TVA_UINT32 pubId;
+  TVA_UINT32 sessionId;
+  TVA_UINT64 tsn;
+};
+
+class Replay: node::ObjectWrap, EventEmitter, DispatchTarget
 {
 public:
   /*-----------------------------------------------------------------------------
@@ -24,10 +113,13 @@ public:
    * Events / Listeners:
    *   'message'              - Message received                        - function (message) { }
    *   'finish'               - Replay finished, all messages received  - function () { }
-   *   'error'                - Replay error occurred                   - function (err) { }
+   *   'error'                - Replay error occurred                   - function (err, range) { }
    *   'pause'                - Replay paused                           - function (err) { }
    *   'resume'               - Replay resumed                          - function (err) { }
    *   'stop'                 - Replay stopped                          - function (err) { }
+   *   'aggregate'            - Aggregation buckets complete            - function (buckets) { }
+   *   'seek'                 - Replay moved to another time            - function (err) { }
+   *   'progress'             - Every progressInterval                  - function (stats) { }
    *
    * message = {
    *     topic,                 (string : message topic)
@@ -35,6 +127,12 @@ public:
    *     receiveTime,           (Date : when the message was received)
    *     fields                 (Array : message fields list ([name]=value))
    * }
+   *
+   * range = {
+   *     topic,                 (string : topic of the range that failed)
+   *     startTime,             (Date : beginning of the range)
+   *     endTime                (Date : end of the range)
+   * }
    */
   static v8::Handle<v8::Value> On(const v8::Arguments& args);
 
@@ -52,6 +150,66 @@ public:
    */
   static v8::Handle<v8::Value> Resume(const v8::Arguments& args);
 
+  /*-----------------------------------------------------------------------------
+   * Get the replay's runtime statistics
+   *
+   * var stats = replay.stats();
+   *
+   * stats = {
+   *     messagesIn,            (Number : messages received)
+   *     cachedMessagesIn,      (Number : messages read from the replay cache)
+   *     bytesIn,               (Number : decoded size of the received messages' fields)
+   *     decodeErrors,          (Number : messages that could not be decoded)
+   *     lossGap,               (Number : sum of the received messages' loss gaps)
+   *     drops,                 (Number : messages discarded before reaching JavaScript)
+   *     queueDepth,            (Number : messages waiting to be delivered to JavaScript)
+   *     peakQueueDepth,        (Number : highest queueDepth seen)
+   *     throttles,             (Number : times the replay was paused by backpressure)
+   *     throttledTime,         (Number : time paused by backpressure (microseconds))
+   *     pausedTime,            (Number : time paused by the application (microseconds))
+   *     messagesDelivered,     (Number : messages delivered to JavaScript)
+   *     inRate,                (Number : messages received per second)
+   *     deliveredRate,         (Number : messages delivered per second)
+   *     position,              (Date : generation time delivered up to)
+   *     percentDone,           (Number : share of the time range delivered (0-100))
+   *     eta                    (Number : estimated time to finish (microseconds), null if unknown)
+   * }
+   */
+  static v8::Handle<v8::Value> Stats(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Aggregate the replayed messages into time buckets of their generation
+   * time, complete buckets are emitted with the 'aggregate' event, the last
+   * ones before 'finish'
+   *
+   * replay.aggregate(spec);
+   *
+   * spec: see subscription.aggregate()
+   */
+  static v8::Handle<v8::Value> Aggregate(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Get the position of the last delivered message (ordered replays), to
+   * resume the replay from with the resumeFrom option, null if none was
+   *
+   * var checkpoint = replay.checkpoint();
+   *
+   * checkpoint = {
+   *     generationTimeUs,      (Number : generation time of the last message (microseconds))
+   *     delivered              (Array : the messages delivered with that generation time,
+   *                             [{ topic, [pubId, sessionId, tsn] }])
+   * }
+   */
+  static v8::Handle<v8::Value> Checkpoint(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Move the replay to another time of its time range, the messages not yet
+   * delivered are discarded and the replay carries on from there
+   *
+   * replay.seek(time, [callback]);
+   */
+  static v8::Handle<v8::Value> Seek(const v8::Arguments& args);
+
   /*-----------------------------------------------------------------------------
    * Stop the replay
    *
@@ -72,69 +230,95 @@ public:
                                       TVA_STATUS replayStatus, TVA_BOOLEAN replayHndlValid);
 
   inline Session* GetSession() { return _session; };
-  inline uv_async_t* GetMessageAsyncObj() { return &_msgAsync; }
-  inline uv_async_t* GetNotifyAsyncObj() { return &_notifyAsync; }
 
-  inline void SetHandle(TVA_REPLAY_HANDLE handle) { _handle = handle; }
-  inline TVA_REPLAY_HANDLE GetHandle() { return _handle; }
+  TVA_STATUS Start(std::vector<std::string>& topics, TVA_UINT64 startTime, TVA_UINT64 endTime,
+                   int parallelism, const char* cacheDir, TVA_REPLAY_REQ& replayReq);
+
+  inline size_t GetShardCount() { return _shards.size(); }
+  inline void SetOrdered(bool ordered) { _isOrdered = ordered; }
+  void SetResumeFrom(TVA_UINT64 generationTime, std::vector<ReplayPosition>& delivered);
 
-  inline bool PostMessageEvent(MessageEvent& messageEvent)
+  inline bool PostMessageEvent(ReplayShard* shard, MessageEvent& messageEvent)
   {
     bool posted = false;
     uv_mutex_lock(&_messageEventLock);
-    if (_isInUse)
+    // Nothing is queued once the session's dispatcher has stopped
+    if (_isInUse && !shard->isRetired && _dispatcher->Schedule(this))
     {
-      _messageEventQueue.push(messageEvent);
-      uv_async_send(GetMessageAsyncObj());
+      // Aggregated once posted, the message is released once delivered
+      if (_aggregator && !_isAggregationHeld)
+      {
+        _aggregator->Add(messageEvent, shard->index);
+        if (messageEvent.isLastMessage)
+        {
+          _aggregator->FinishSource(shard->index);
+        }
+      }
+
+      shard->messageEventQueue.push(messageEvent);
       posted = true;
+
+      _queueDepth++;
+      if (_queueDepth > _peakQueueDepth)
+      {
+        _peakQueueDepth = _queueDepth;
+      }
     }
     uv_mutex_unlock(&_messageEventLock);
     return posted;
   }
 
-  inline bool GetNextMessageEvent(MessageEvent& messageEvent)
+  inline bool PeekNextMessageEvent(MessageEvent& messageEvent, ReplayShard*& shard)
   {
-    bool result = false;
-
     uv_mutex_lock(&_messageEventLock);
-    if (!_messageEventQueue.empty())
+    shard = GetDeliverableShard();
+    if (shard)
     {
-      messageEvent = _messageEventQueue.front();
-      _messageEventQueue.pop();
-      result = true;
+      messageEvent = shard->messageEventQueue.front();
     }
     uv_mutex_unlock(&_messageEventLock);
 
-    return result;
+    return (shard != NULL);
   }
 
-  inline void PostNotificationEvent(TVA_STATUS rc)
+  inline void PopMessageEvent(ReplayShard* shard)
   {
-    if (_isInUse)
-    {
-      uv_mutex_lock(&_notificationEventLock);
-      _notificationEventQueue.push(rc);
-      uv_mutex_unlock(&_notificationEventLock);
-      uv_async_send(GetNotifyAsyncObj());
-    }
+    uv_mutex_lock(&_messageEventLock);
+    shard->messageEventQueue.pop();
+    _queueDepth--;
+    uv_mutex_unlock(&_messageEventLock);
   }
 
-  inline bool GetNextNotificationEvent(TVA_STATUS& rc)
+  inline bool HasPendingMessages()
   {
-    bool result = false;
-
-    uv_mutex_lock(&_notificationEventLock);
-    if (!_notificationEventQueue.empty())
+    uv_mutex_lock(&_messageEventLock);
+    bool result = (GetDeliverableShard() != NULL);
+    for (size_t i = 0; (i < _shards.size()) && !result; i++)
     {
-      rc = _notificationEventQueue.front();
-      _notificationEventQueue.pop();
-      result = true;
+      result = IsCacheReadable(_shards[i]) ||
+               (_shards[i]->isEnded && !_shards[i]->isComplete && _shards[i]->messageEventQueue.empty());
     }
-    uv_mutex_unlock(&_notificationEventLock);
-
+    uv_mutex_unlock(&_messageEventLock);
     return result;
   }
 
+  inline void GetQueueDepth(size_t& depth, size_t& peakDepth)
+  {
+    uv_mutex_lock(&_messageEventLock);
+    depth = _queueDepth;
+    peakDepth = _peakQueueDepth;
+    uv_mutex_unlock(&_messageEventLock);
+  }
+
+  inline void SetWeight(int weight) { SetDispatchWeight(weight); }
+  inline void SetSpeed(double speed) { _speed = speed; }
+  inline void SetProgressInterval(uint64_t interval) { _progressInterval = interval; }
+  inline void SetWaterMarks(size_t highWaterMark, size_t lowWaterMark)
+  {
+    _highWaterMark = highWaterMark;
+    _lowWaterMark = lowWaterMark;
+  }
+
   inline bool IsInUse() { return _isInUse; }
   inline void MarkInUse(bool inUse)
   {
@@ -143,46 +327,165 @@ public:
 
     if (inUse)
     {
-      uv_async_init(uv_default_loop(), GetMessageAsyncObj(), Replay::MessageAsyncEvent);
-      uv_async_init(uv_default_loop(), GetNotifyAsyncObj(), Replay::NotificationAsyncEvent);
-
       Ref();
+
+      if ((_speed > 0) && !_isPaceTimerOpen)
+      {
+        uv_timer_init(uv_default_loop(), &_paceTimer);
+        _isPaceTimerOpen = true;
+      }
+
+      if ((_progressInterval > 0) && !_isProgressTimerOpen)
+      {
+        uv_timer_init(uv_default_loop(), &_progressTimer);
+        uv_timer_start(&_progressTimer, Replay::ProgressTimerEvent, (int64_t)_progressInterval, (int64_t)_progressInterval);
+        _isProgressTimerOpen = true;
+      }
+      StartRates();
+
+      // Cached shards are read by the dispatcher, nothing else schedules it
+      _dispatcher->Schedule(this);
     }
     else
     {
-      uv_close((uv_handle_t*)GetMessageAsyncObj(), Replay::SubscriptionHandleCloseComplete);
-      uv_close((uv_handle_t*)GetNotifyAsyncObj(), Replay::SubscriptionHandleCloseComplete);
+      _dispatcher->Cancel(this);
+
+      if (_isPaceTimerOpen)
+      {
+        uv_close((uv_handle_t*)&_paceTimer, Replay::ReplayHandleCloseComplete);
+        _isPaceTimerOpen = false;
+      }
+
+      if (_isProgressTimerOpen)
+      {
+        uv_timer_stop(&_progressTimer);
+        uv_close((uv_handle_t*)&_progressTimer, Replay::ReplayHandleCloseComplete);
+        _isProgressTimerOpen = false;
+      }
 
       Unref();
       MakeWeak();
     }
 
     uv_mutex_unlock(&_messageEventLock);
-  }
 
-  void InvokeJsFinishEvent(v8::Local<v8::Object> context, TVA_STATUS rc);
-  void InvokeJsErrorEvent(v8::Local<v8::Object> context, TVA_STATUS rc);
+    // Never delivered now, the messages still queued are released
+    if (!inUse)
+    {
+      DiscardEvents();
+    }
+  }
 
 private:
   static void PauseResumeWorker(uv_work_t* req);
   static void PauseResumeWorkerComplete(uv_work_t* req);
   static void StopWorker(uv_work_t* req);
   static void StopWorkerComplete(uv_work_t* req);
-  static void SubscriptionHandleCloseComplete(uv_handle_t* handle);
-  static void MessageAsyncEvent(uv_async_t* async, int status);
-  void InvokeJsMessageEvent(v8::Local<v8::Object> context, MessageEvent& messageEvent);
-  static void NotificationAsyncEvent(uv_async_t* async, int status);
-  void InvokeJsNotificationEvent(v8::Local<v8::Object> context, TVA_STATUS rc);
+  static void ReleaseShardsWorker(uv_work_t* req);
+  static void ReleaseShardsWorkerComplete(uv_work_t* req);
+  static void ThrottleWorkerComplete(uv_work_t* req);
+  static void SeekWorker(uv_work_t* req);
+  static void SeekWorkerComplete(uv_work_t* req);
+  static void PaceTimerEvent(uv_timer_t* timer, int status);
+  static void ProgressTimerEvent(uv_timer_t* timer, int status);
+  static void ReplayHandleCloseComplete(uv_handle_t* handle);
+  virtual void Dispatch(size_t maxEvents, uint64_t deadline);
+  virtual void DiscardEvents();
+  static void ReleaseMessageEvents(std::vector<MessageEvent>& messageEvents);
+  void QueuePauseResume(ReplayShard* shard, bool isPause, uv_after_work_cb afterWork);
+  void QueueStop();
+  TVA_STATUS ApplyPauseState();
+  bool IsPauseStateApplied();
+  ReplayShard* AddShard(std::vector<ReplayShard*>& shards, std::vector<ReplayStream>& streams, size_t stream);
+  TVA_STATUS StartShards(TVA_UINT64 startTime, std::vector<ReplayShard*>& shards, std::vector<ReplayStream>& streams);
+  void RetireShards();
+  void ResetAggregator();
+  static void DeleteShard(ReplayShard* shard);
+  bool IsMessageDue(MessageEvent& messageEvent);
+  ReplayShard* GetDeliverableShard();
+  bool IsShardFinished(ReplayShard* shard);
+  bool IsCacheReadable(ReplayShard* shard);
+  bool ReadCachedMessages();
+  void CompleteShard(ReplayShard* shard, int argc, v8::Handle<v8::Value> argv[]);
+  void UpdateThrottle(ReplayShard* shard);
+  void BeginThrottle(ReplayShard* shard);
+  void EndThrottle(ReplayShard* shard);
+  void InvokeJsMessageEvent(v8::Local<v8::Object> context, MessageEvent& messageEvent, ReplayShard* shard);
+  bool EndShards();
+  void InvokeJsErrorEvent(ReplayShard* shard, const char* error);
+  void InvokeJsAggregateEvent(v8::Local<v8::Object> context);
+  bool IsDelivered(MessageEvent& messageEvent);
+  void RecordPosition(MessageEvent& messageEvent);
+  v8::Local<v8::Object> CreateJsStats();
+  TVA_UINT64 GetRemainingTime();
+  void StartRates();
+  void UpdateRates();
 
   static v8::Persistent<v8::Function> constructor;
 
   Session* _session;
-  TVA_REPLAY_HANDLE _handle;
-  uv_async_t _msgAsync;
-  uv_async_t _notifyAsync;
-  std::queue<MessageEvent> _messageEventQueue;
+  Dispatcher* _dispatcher;
+  std::vector<std::string> _topics;
+  TVA_UINT64 _startTime;
+  TVA_UINT64 _endTime;
+  TVA_UINT64 _parallelism;
+  std::string _cacheDir;            // empty when not caching
+  TVA_REPLAY_REQ _replayReq;
+  std::vector<ReplayShard*> _shards;
+  std::vector<ReplayStream> _streams;
+  std::vector<ReplayShard*> _retiredShards;
+  std::vector<ReplayShard*> _seekShards;
+  std::vector<ReplayStream> _seekStreams;
+  bool _isSeeking;
+  bool _isStopPending;              // stopped while seeking, stops once the seek completes
+  unsigned int _seekCount;          // shards from before a seek may be freed by it
+  size_t _currentShard;             // unordered, round-robin position
+  size_t _completeShards;
+  bool _isOrdered;
   uv_mutex_t _messageEventLock;
-  std::queue<TVA_STATUS> _notificationEventQueue;
-  uv_mutex_t _notificationEventLock;
+  StatCounter _messagesIn;
+  StatCounter _cachedMessagesIn;
+  StatCounter _bytesIn;
+  StatCounter _decodeErrors;
+  StatCounter _lossGap;
+  StatCounter _drops;
+  size_t _queueDepth;
+  size_t _peakQueueDepth;
+  double _speed;
+  uint64_t _paceBaseTime;
+  TVA_UINT64 _paceBaseGenerationTime;
+  uv_timer_t _paceTimer;
+  bool _isPaceStarted;
+  bool _isPaceTimerOpen;
+  bool _isUserPaused;
+  uv_mutex_t _pauseLock;            // one pause/resume upstream at a time, the shard lists
+  uv_mutex_t _pauseStateLock;       // the pause state asked for
+  size_t _highWaterMark;
+  size_t _lowWaterMark;
+  uint64_t _throttledTime;
+  uint64_t _throttles;
+  uint64_t _pausedTime;
+  uint64_t _pauseStartTime;
+  StatCounter _messagesDelivered;
+  uv_timer_t _progressTimer;
+  uint64_t _progressInterval;       // milliseconds, 0 for no 'progress' events
+  bool _isProgressTimerOpen;
+  uint64_t _rateSampleTime;         // start of the current rate sample
+  int64_t _rateSampleIn;
+  int64_t _rateSampleDelivered;
+  TVA_UINT64 _rateSampleRemaining;
+  double _inRate;
+  double _deliveredRate;
+  double _progressRate;             // generation time delivered per second
+  bool _hasRates;                   // a complete sample was measured
+  TVA_UINT64 _checkpointTime;
+  std::vector<ReplayPosition> _checkpointDelivered;
+  bool _hasCheckpoint;
+  TVA_UINT64 _resumeTime;
+  std::vector<ReplayPosition> _resumeDelivered;     // not yet seen again
+  uv_mutex_t _resumeLock;
+  bool _isResuming;
+  Aggregator* _aggregator;
+  bool _isAggregationHeld;          // seeking, the new shards are not counted yet
   bool _isInUse;
 };
@@ -0,0 +1,1015 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <uv.h>
+#include "Helpers.h"
+#include "ReplayCache.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#include <direct.h>
+#define tva_mkdir(path)         _mkdir(path)
+#define PATH_SEPARATOR          "\\"
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define tva_mkdir(path)         mkdir(path, 0777)
+#define PATH_SEPARATOR          "/"
+#endif
+
+#define ALIGN8(n)               (((n) + 7) & ~((uint64_t)7))
+
+static const char _padding[8] = { 0 };
+
+/*-----------------------------------------------------------------------------
+ * Segment files are named after a hash of the topic and their time range
+ */
+static uint64_t HashTopic(const char* topic)
+{
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char* p = topic; *p; p++)
+  {
+    hash ^= (uint8_t)*p;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static std::string GetSegmentPath(const char* directory, const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime)
+{
+  char name[80];
+  snprintf(name, sizeof(name), "%016llx_%llu_%llu.seg", (unsigned long long)HashTopic(topic),
+           (unsigned long long)startTime, (unsigned long long)endTime);
+
+  return std::string(directory) + PATH_SEPARATOR + name;
+}
+
+/*-----------------------------------------------------------------------------
+ * Size of a cached field value, string arrays are stored as consecutive
+ * '\0' terminated strings
+ */
+static size_t GetCachedFieldSize(MessageFieldData& field)
+{
+  switch (field.type)
+  {
+  case MessageFieldDataTypeString:        return strlen(field.value.stringValue) + 1;
+  case MessageFieldDataTypeStringArray:   return GetMessageFieldDataSize(field) + field.count;
+  default:                                return GetMessageFieldDataSize(field);
+  }
+}
+
+
+/*****     Writer     *****/
+
+enum ReplayCacheJobType
+{
+  ReplayCacheJobWrite,
+  ReplayCacheJobComplete,
+  ReplayCacheJobDiscard
+};
+
+/*-----------------------------------------------------------------------------
+ * A segment file being written, only used by the writer thread once open
+ */
+struct ReplayCacheFile
+{
+  std::string path;
+  std::string tempPath;
+  FILE* file;
+  bool isFailed;
+};
+
+struct ReplayCacheJob
+{
+  ReplayCacheJobType type;
+  ReplayCacheFile* file;
+  std::vector<char> data;
+  ReplayCacheHeader header;       // complete only
+};
+
+static uv_mutex_t _jobLock;
+static uv_sem_t _jobSignal;
+static std::deque<ReplayCacheJob*> _jobs;
+static size_t _pendingBytes;
+static bool _isWriterStarted;
+static uv_thread_t _writerThread;   // runs as long as the process
+
+static void WriterThread(void* arg);
+
+/*-----------------------------------------------------------------------------
+ * Hand a job to the writer thread, started with the first one
+ */
+static bool PostJob(ReplayCacheJobType type, ReplayCacheFile* file, std::vector<char>& data,
+                    ReplayCacheHeader* header)
+{
+  ReplayCacheJob* job = new ReplayCacheJob();
+  job->type = type;
+  job->file = file;
+  job->data.swap(data);
+  if (header)
+  {
+    job->header = *header;
+  }
+
+  uv_mutex_lock(&_jobLock);
+  if (!_isWriterStarted)
+  {
+    if (uv_thread_create(&_writerThread, WriterThread, NULL) != 0)
+    {
+      uv_mutex_unlock(&_jobLock);
+      delete job;
+      return false;
+    }
+    _isWriterStarted = true;
+  }
+
+  _jobs.push_back(job);
+  _pendingBytes += job->data.size();
+  uv_mutex_unlock(&_jobLock);
+
+  uv_sem_post(&_jobSignal);
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Initialize the writer thread's queue, once when the module is loaded
+ */
+void ReplayCacheWriter::Init()
+{
+  uv_mutex_init(&_jobLock);
+  uv_sem_init(&_jobSignal, 0);
+  _pendingBytes = 0;
+  _isWriterStarted = false;
+}
+
+/*-----------------------------------------------------------------------------
+ * Writer thread, writes the segment files for all the replays of the process
+ */
+static void WriterThread(void* arg)
+{
+  for (;;)
+  {
+    uv_sem_wait(&_jobSignal);
+
+    uv_mutex_lock(&_jobLock);
+    ReplayCacheJob* job = _jobs.front();
+    _jobs.pop_front();
+    _pendingBytes -= job->data.size();
+    uv_mutex_unlock(&_jobLock);
+
+    ReplayCacheFile* file = job->file;
+    if (!file->isFailed && !job->data.empty() &&
+        (fwrite(&job->data[0], 1, job->data.size(), file->file) != job->data.size()))
+    {
+      file->isFailed = true;
+    }
+
+    if (job->type == ReplayCacheJobComplete)
+    {
+      if (!file->isFailed && ((fseek(file->file, 0, SEEK_SET) != 0) ||
+                              (fwrite(&job->header, 1, sizeof(job->header), file->file) != sizeof(job->header)) ||
+                              (fflush(file->file) != 0)))
+      {
+        file->isFailed = true;
+      }
+    }
+
+    if (job->type != ReplayCacheJobWrite)
+    {
+      fclose(file->file);
+
+      // Another replay may have cached the same range meanwhile
+      if ((job->type == ReplayCacheJobDiscard) || file->isFailed ||
+          (rename(file->tempPath.c_str(), file->path.c_str()) != 0))
+      {
+        remove(file->tempPath.c_str());
+      }
+      delete file;
+    }
+
+    delete job;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Constructor & Destructor
+ */
+ReplayCacheWriter::ReplayCacheWriter(const char* directory, const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime)
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%llu.tmp", (unsigned long long)uv_hrtime());
+
+  _path = GetSegmentPath(directory, topic, startTime, endTime);
+  _tempPath = _path + suffix;
+  _topic = topic;
+  _startTime = startTime;
+  _endTime = endTime;
+  _file = NULL;
+  _offset = 0;
+  _recordCount = 0;
+  _lastGenerationTime = 0;
+  _isOrdered = true;
+  uv_mutex_init(&_lock);
+
+  tva_mkdir(directory);
+}
+
+ReplayCacheWriter::~ReplayCacheWriter()
+{
+  // Never completed, the segment is discarded
+  Discard();
+  uv_mutex_destroy(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Create the segment, under a temporary name (not on a Tervela thread)
+ */
+bool ReplayCacheWriter::Open()
+{
+  if (_topic.length() >= REPLAY_CACHE_MAX_TOPIC)
+  {
+    return false;
+  }
+
+  FILE* file = fopen(_tempPath.c_str(), "wb");
+  if (file == NULL)
+  {
+    return false;
+  }
+
+  // Written again once complete
+  ReplayCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  if (fwrite(&header, 1, sizeof(header), file) != sizeof(header))
+  {
+    fclose(file);
+    remove(_tempPath.c_str());
+    return false;
+  }
+
+  _file = new ReplayCacheFile();
+  _file->path = _path;
+  _file->tempPath = _tempPath;
+  _file->file = file;
+  _file->isFailed = false;
+  _offset = sizeof(header);
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Add to the data not yet handed to the writer thread (lock held)
+ */
+void ReplayCacheWriter::Write(const void* data, size_t size)
+{
+  _buffer.insert(_buffer.end(), (const char*)data, (const char*)data + size);
+  _offset += size;
+}
+
+/*-----------------------------------------------------------------------------
+ * Have the writer thread remove the segment (lock held, or destroying)
+ */
+void ReplayCacheWriter::Discard()
+{
+  if (_file)
+  {
+    _buffer.clear();
+    if (!PostJob(ReplayCacheJobDiscard, _file, _buffer, NULL))
+    {
+      fclose(_file->file);
+      remove(_file->tempPath.c_str());
+      delete _file;
+    }
+    _file = NULL;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * The range will not be completely received, the segment is discarded
+ */
+void ReplayCacheWriter::Fail()
+{
+  uv_mutex_lock(&_lock);
+  Discard();
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Add a received message to the segment (Tervela thread)
+ */
+void ReplayCacheWriter::Append(MessageEvent& messageEvent)
+{
+  uv_mutex_lock(&_lock);
+  if (_file == NULL)
+  {
+    uv_mutex_unlock(&_lock);
+    return;
+  }
+
+  size_t topicSize = ALIGN8(strlen(messageEvent.topicName) + 1);
+
+  ReplayCacheRecord record;
+  record.size = (uint32_t)(sizeof(record) + topicSize);
+  record.fieldCount = 0;
+  record.generationTime = messageEvent.generationTime;
+  record.receiveTime = messageEvent.receiveTime;
+  record.lossGap = messageEvent.lossGap;
+  record.jmsMessageType = messageEvent.jmsMessageType;
+  record.hasOrigin = (messageEvent.hasOrigin) ? 1 : 0;
+  record.pubId = (messageEvent.hasOrigin) ? messageEvent.pubId : 0;
+  record.sessionId = (messageEvent.hasOrigin) ? messageEvent.sessionId : 0;
+  record.reserved = 0;
+  record.tsn = (messageEvent.hasOrigin) ? messageEvent.tsn : 0;
+
+  std::list<MessageFieldData>::iterator it;
+  for (it = messageEvent.fieldData.begin(); it != messageEvent.fieldData.end(); it++)
+  {
+    record.size += (uint32_t)(sizeof(ReplayCacheField) + ALIGN8(GetCachedFieldSize(*it)));
+    record.fieldCount++;
+  }
+
+  // The index is only usable when every record is in generation time order
+  if (record.generationTime < _lastGenerationTime)
+  {
+    _isOrdered = false;
+  }
+  _lastGenerationTime = record.generationTime;
+
+  if ((_recordCount % REPLAY_CACHE_INDEX_INTERVAL) == 0)
+  {
+    ReplayCacheIndexEntry entry;
+    entry.generationTime = record.generationTime;
+    entry.offset = _offset;
+    _index.push_back(entry);
+  }
+
+  size_t topicLength = strlen(messageEvent.topicName) + 1;
+  Write(&record, sizeof(record));
+  Write(messageEvent.topicName, topicLength);
+  Write(_padding, topicSize - topicLength);
+
+  for (it = messageEvent.fieldData.begin(); it != messageEvent.fieldData.end(); it++)
+  {
+    MessageFieldData& field = *it;
+
+    ReplayCacheField cachedField;
+    memset(&cachedField, 0, sizeof(cachedField));
+    tva_strncpy(cachedField.name, field.name, sizeof(cachedField.name));
+    cachedField.type = field.type;
+    cachedField.count = field.count;
+    cachedField.size = (uint32_t)GetCachedFieldSize(field);
+    Write(&cachedField, sizeof(cachedField));
+
+    switch (field.type)
+    {
+    case MessageFieldDataTypeBoolean:
+      {
+        uint8_t value = (field.value.boolValue) ? 1 : 0;
+        Write(&value, sizeof(value));
+      }
+      break;
+
+    case MessageFieldDataTypeInt32:
+      Write(&field.value.int32Value, sizeof(field.value.int32Value));
+      break;
+
+    case MessageFieldDataTypeNumber:
+      Write(&field.value.numberValue, sizeof(field.value.numberValue));
+      break;
+
+    case MessageFieldDataTypeDate:
+      Write(&field.value.dateValue, sizeof(field.value.dateValue));
+      break;
+
+    case MessageFieldDataTypeString:
+      Write(field.value.stringValue, cachedField.size);
+      break;
+
+    case MessageFieldDataTypeStringArray:
+      for (int i = 0; i < field.count; i++)
+      {
+        TVA_STRING value = ((TVA_STRING*)field.value.arrayValue)[i];
+        Write(value, strlen(value) + 1);
+      }
+      break;
+
+    case MessageFieldDataTypeNone:
+      break;
+
+    default:
+      Write(field.value.arrayValue, cachedField.size);
+      break;
+    }
+
+    Write(_padding, (size_t)(ALIGN8(cachedField.size) - cachedField.size));
+  }
+
+  _recordCount++;
+
+  if (_buffer.size() >= REPLAY_CACHE_WRITE_SIZE)
+  {
+    // The disk can't keep up, the range is replayed again next time
+    uv_mutex_lock(&_jobLock);
+    bool isBehind = (_pendingBytes >= REPLAY_CACHE_MAX_PENDING);
+    uv_mutex_unlock(&_jobLock);
+
+    if (isBehind || !PostJob(ReplayCacheJobWrite, _file, _buffer, NULL))
+    {
+      Discard();
+    }
+    _buffer.reserve(REPLAY_CACHE_WRITE_SIZE + (REPLAY_CACHE_WRITE_SIZE / 4));
+  }
+
+  uv_mutex_unlock(&_lock);
+}
+
+/*-----------------------------------------------------------------------------
+ * The range has been fully received, have the writer thread write the index
+ * and publish the segment under its final name (Tervela thread)
+ */
+void ReplayCacheWriter::Complete()
+{
+  uv_mutex_lock(&_lock);
+  if (_file == NULL)
+  {
+    uv_mutex_unlock(&_lock);
+    return;
+  }
+
+  // Read from the first record when the index can't be searched
+  if (!_isOrdered)
+  {
+    _index.clear();
+  }
+
+  ReplayCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = REPLAY_CACHE_MAGIC;
+  header.version = REPLAY_CACHE_VERSION;
+  header.startTime = _startTime;
+  header.endTime = _endTime;
+  header.recordCount = _recordCount;
+  header.indexOffset = _offset;
+  header.indexCount = _index.size();
+  tva_strncpy(header.topic, _topic.c_str(), sizeof(header.topic));
+
+  if (!_index.empty())
+  {
+    Write(&_index[0], _index.size() * sizeof(ReplayCacheIndexEntry));
+  }
+
+  if (!PostJob(ReplayCacheJobComplete, _file, _buffer, &header))
+  {
+    Discard();
+  }
+  _file = NULL;
+
+  uv_mutex_unlock(&_lock);
+}
+
+
+/*****     Segment     *****/
+
+/*-----------------------------------------------------------------------------
+ * Constructor & Destructor
+ */
+ReplayCacheSegment::ReplayCacheSegment()
+{
+  _data = NULL;
+  _size = 0;
+  _header = NULL;
+  _offset = 0;
+  _recordsLeft = 0;
+  _startTime = 0;
+  _endTime = 0;
+  _isOrdered = false;
+  _isExhausted = true;
+  _isCorrupt = false;
+#if defined(WIN32)
+  _fileHandle = INVALID_HANDLE_VALUE;
+  _mappingHandle = NULL;
+#endif
+}
+
+ReplayCacheSegment::~ReplayCacheSegment()
+{
+  Close();
+}
+
+/*-----------------------------------------------------------------------------
+ * Map a segment, check it is complete and holds the topic
+ */
+bool ReplayCacheSegment::Open(const char* path, const char* topic)
+{
+#if defined(WIN32)
+  _fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+  if (_fileHandle == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(_fileHandle, &fileSize) || (fileSize.QuadPart < (LONGLONG)sizeof(ReplayCacheHeader)))
+  {
+    Close();
+    return false;
+  }
+
+  _mappingHandle = CreateFileMappingA(_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (_mappingHandle == NULL)
+  {
+    Close();
+    return false;
+  }
+
+  _data = (const char*)MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+  if (_data == NULL)
+  {
+    Close();
+    return false;
+  }
+  _size = (size_t)fileSize.QuadPart;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  struct stat fileStat;
+  if ((fstat(fd, &fileStat) != 0) || (fileStat.st_size < (off_t)sizeof(ReplayCacheHeader)))
+  {
+    close(fd);
+    return false;
+  }
+
+  // The mapping stays valid once the descriptor is closed
+  void* data = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    return false;
+  }
+
+  _data = (const char*)data;
+  _size = (size_t)fileStat.st_size;
+#endif
+
+  _header = (const ReplayCacheHeader*)_data;
+  if ((_header->magic != REPLAY_CACHE_MAGIC) || (_header->version != REPLAY_CACHE_VERSION) ||
+      (strncmp(_header->topic, topic, sizeof(_header->topic)) != 0) ||
+      (_header->indexOffset < sizeof(ReplayCacheHeader)) || (_header->indexOffset > _size) ||
+      (_header->indexCount > ((_size - _header->indexOffset) / sizeof(ReplayCacheIndexEntry))))
+  {
+    Close();
+    return false;
+  }
+
+  _path = path;
+  _isOrdered = (_header->indexCount > 0);
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Unmap the segment
+ */
+void ReplayCacheSegment::Close()
+{
+#if defined(WIN32)
+  if (_data)
+  {
+    UnmapViewOfFile(_data);
+  }
+  if (_mappingHandle)
+  {
+    CloseHandle(_mappingHandle);
+  }
+  if (_fileHandle != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(_fileHandle);
+  }
+  _mappingHandle = NULL;
+  _fileHandle = INVALID_HANDLE_VALUE;
+#else
+  if (_data)
+  {
+    munmap((void*)_data, _size);
+  }
+#endif
+
+  _data = NULL;
+  _header = NULL;
+  _isExhausted = true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Position the segment on the first message of a time range.  Without index
+ * the messages are not in generation time order, the whole segment is read
+ * and the messages outside the range skipped.
+ */
+void ReplayCacheSegment::Seek(TVA_UINT64 startTime, TVA_UINT64 endTime)
+{
+  if (_header == NULL)
+  {
+    return;
+  }
+
+  _startTime = startTime;
+  _endTime = endTime;
+  _isExhausted = false;
+
+  if (!_isOrdered)
+  {
+    _offset = sizeof(ReplayCacheHeader);
+    _recordsLeft = _header->recordCount;
+    return;
+  }
+
+  const ReplayCacheIndexEntry* index = (const ReplayCacheIndexEntry*)(_data + _header->indexOffset);
+
+  // Last index entry before the start of the range
+  size_t low = 0;
+  size_t high = (size_t)_header->indexCount;
+  while (low < high)
+  {
+    size_t middle = (low + high) / 2;
+    if (index[middle].generationTime < startTime)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  size_t entry = (low > 0) ? (low - 1) : 0;
+  uint64_t skipped = (uint64_t)entry * REPLAY_CACHE_INDEX_INTERVAL;
+  if ((index[entry].offset < sizeof(ReplayCacheHeader)) || (index[entry].offset > _header->indexOffset) ||
+      (skipped > _header->recordCount))
+  {
+    Reject();
+    return;
+  }
+
+  _offset = index[entry].offset;
+  _recordsLeft = _header->recordCount - skipped;
+
+  // Skip to the first message of the range
+  while (_recordsLeft > 0)
+  {
+    const ReplayCacheRecord* record = (const ReplayCacheRecord*)(_data + _offset);
+    if (((_offset + sizeof(ReplayCacheRecord)) > _header->indexOffset) || (record->size < sizeof(ReplayCacheRecord)) ||
+        (record->generationTime >= startTime))
+    {
+      break;
+    }
+
+    _offset += record->size;
+    _recordsLeft--;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * The segment is corrupt, nothing more is read from it and it is removed so
+ * the range is replayed and cached again
+ */
+void ReplayCacheSegment::Reject()
+{
+  _isExhausted = true;
+  _isCorrupt = true;
+  remove(_path.c_str());
+}
+
+/*-----------------------------------------------------------------------------
+ * Read the next message of the range, its data stays in the segment
+ */
+bool ReplayCacheSegment::Next(MessageEvent& messageEvent)
+{
+  while (!_isExhausted)
+  {
+    if (_recordsLeft == 0)
+    {
+      _isExhausted = true;
+      return false;
+    }
+
+    const ReplayCacheRecord* record = (const ReplayCacheRecord*)(_data + _offset);
+    if (((_offset + sizeof(ReplayCacheRecord)) > _header->indexOffset) ||
+        (record->size < sizeof(ReplayCacheRecord)) || ((_offset + record->size) > _header->indexOffset))
+    {
+      Reject();
+      return false;
+    }
+
+    // Ordered, the range ends with the first message after it
+    if (_isOrdered && (record->generationTime > _endTime))
+    {
+      _isExhausted = true;
+      return false;
+    }
+
+    _offset += record->size;
+    _recordsLeft--;
+
+    if ((record->generationTime < _startTime) || (record->generationTime > _endTime))
+    {
+      continue;
+    }
+
+    if (!ReadRecord(record, messageEvent))
+    {
+      Reject();
+      return false;
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+ * Read a message from its record, false if the record does not hold what its
+ * header says (nothing is left allocated then)
+ */
+bool ReplayCacheSegment::ReadRecord(const ReplayCacheRecord* record, MessageEvent& messageEvent)
+{
+  const char* data = (const char*)(record + 1);
+  const char* end = (const char*)record + record->size;
+
+  const char* topicEnd = (const char*)memchr(data, '\0', (size_t)(end - data));
+  if (topicEnd == NULL)
+  {
+    return false;
+  }
+
+  messageEvent.tvaMessage = NULL;
+  messageEvent.topicName = data;
+  messageEvent.generationTime = record->generationTime;
+  messageEvent.receiveTime = record->receiveTime;
+  messageEvent.lossGap = record->lossGap;
+  messageEvent.isCached = true;
+  messageEvent.hasOrigin = (record->hasOrigin != 0);
+  messageEvent.pubId = record->pubId;
+  messageEvent.sessionId = record->sessionId;
+  messageEvent.tsn = record->tsn;
+  messageEvent.jmsMessageType = record->jmsMessageType;
+  messageEvent.isLastMessage = false;
+  messageEvent.payloadSize = 0;
+  messageEvent.fieldData.clear();
+
+  uint32_t fieldCount = 0;
+  data += ALIGN8((size_t)(topicEnd - data) + 1);
+  for (uint32_t i = 0; i < record->fieldCount; i++)
+  {
+    const ReplayCacheField* cachedField = (const ReplayCacheField*)data;
+    const char* value = (const char*)(cachedField + 1);
+    if ((data > end) || ((size_t)(end - data) < sizeof(ReplayCacheField)) ||
+        (ALIGN8((uint64_t)cachedField->size) > (uint64_t)(end - value)) ||
+        (cachedField->type > MessageFieldDataTypeStringArray) || (cachedField->count < 0))
+    {
+      break;
+    }
+
+    MessageFieldData field;
+    tva_strncpy(field.name, cachedField->name, sizeof(field.name));
+    field.type = (MessageFieldDataType)cachedField->type;
+    field.count = cachedField->count;
+
+    bool isValid = true;
+    switch (field.type)
+    {
+    case MessageFieldDataTypeBoolean:
+      isValid = (cachedField->size >= 1);
+      field.value.boolValue = isValid && (*(const uint8_t*)value != 0);
+      break;
+
+    case MessageFieldDataTypeInt32:
+      isValid = (cachedField->size >= sizeof(field.value.int32Value));
+      if (isValid)
+      {
+        memcpy(&field.value.int32Value, value, sizeof(field.value.int32Value));
+      }
+      break;
+
+    case MessageFieldDataTypeNumber:
+      isValid = (cachedField->size >= sizeof(field.value.numberValue));
+      if (isValid)
+      {
+        memcpy(&field.value.numberValue, value, sizeof(field.value.numberValue));
+      }
+      break;
+
+    case MessageFieldDataTypeDate:
+      isValid = (cachedField->size >= sizeof(field.value.dateValue));
+      if (isValid)
+      {
+        memcpy(&field.value.dateValue, value, sizeof(field.value.dateValue));
+      }
+      break;
+
+    case MessageFieldDataTypeString:
+      isValid = (memchr(value, '\0', cachedField->size) != NULL);
+      field.value.stringValue = (char*)value;
+      break;
+
+    case MessageFieldDataTypeStringArray:
+      {
+        // Only the table of pointers is allocated, see GetAllocations
+        TVA_STRING* strings = (TVA_STRING*)malloc((field.count ? field.count : 1) * sizeof(TVA_STRING));
+        const char* string = value;
+        const char* valueEnd = value + cachedField->size;
+        for (int j = 0; j < field.count; j++)
+        {
+          const char* stringEnd = (const char*)memchr(string, '\0', (size_t)(valueEnd - string));
+          if (stringEnd == NULL)
+          {
+            isValid = false;
+            break;
+          }
+          strings[j] = (TVA_STRING)string;
+          string = stringEnd + 1;
+        }
+        field.value.arrayValue = strings;
+
+        if (!isValid)
+        {
+          free(strings);
+        }
+      }
+      break;
+
+    default:
+      field.value.arrayValue = (void*)value;
+      isValid = ((uint64_t)field.count <= cachedField->size) && (GetMessageFieldDataSize(field) <= cachedField->size);
+      break;
+    }
+
+    if (!isValid)
+    {
+      break;
+    }
+
+    messageEvent.payloadSize += GetMessageFieldDataSize(field);
+    messageEvent.fieldData.push_back(field);
+    fieldCount++;
+
+    data = value + ALIGN8(cachedField->size);
+  }
+
+  // A field did not fit in the record
+  if (fieldCount != record->fieldCount)
+  {
+    std::vector<void*> allocations;
+    GetAllocations(messageEvent, allocations);
+    for (size_t i = 0; i < allocations.size(); i++)
+    {
+      free(allocations[i]);
+    }
+    messageEvent.fieldData.clear();
+    return false;
+  }
+
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Get the memory reading a message allocated, to be freed once its fields
+ * have been converted
+ */
+void ReplayCacheSegment::GetAllocations(MessageEvent& messageEvent, std::vector<void*>& allocations)
+{
+  std::list<MessageFieldData>::iterator it;
+  for (it = messageEvent.fieldData.begin(); it != messageEvent.fieldData.end(); it++)
+  {
+    if (it->type == MessageFieldDataTypeStringArray)
+    {
+      allocations.push_back(it->value.arrayValue);
+    }
+  }
+}
+
+
+/*****     Plan     *****/
+
+/*-----------------------------------------------------------------------------
+ * Find the complete segments of a topic in a cache directory
+ */
+static void FindSegments(const char* directory, const char* topic, std::vector<ReplayCacheRange>& segments)
+{
+  char prefix[24];
+  snprintf(prefix, sizeof(prefix), "%016llx_", (unsigned long long)HashTopic(topic));
+
+  std::vector<std::string> names;
+#if defined(WIN32)
+  WIN32_FIND_DATAA findData;
+  std::string pattern = std::string(directory) + PATH_SEPARATOR + prefix + "*.seg";
+  HANDLE findHandle = FindFirstFileA(pattern.c_str(), &findData);
+  if (findHandle != INVALID_HANDLE_VALUE)
+  {
+    do
+    {
+      names.push_back(findData.cFileName);
+    } while (FindNextFileA(findHandle, &findData));
+    FindClose(findHandle);
+  }
+#else
+  DIR* dir = opendir(directory);
+  if (dir)
+  {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+      names.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+#endif
+
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    unsigned long long startTime;
+    unsigned long long endTime;
+    char extension[8];
+
+    // Temporary files of segments being written end in ".tmp"
+    if ((strncmp(names[i].c_str(), prefix, strlen(prefix)) != 0) ||
+        (sscanf(names[i].c_str() + strlen(prefix), "%llu_%llu.%7s", &startTime, &endTime, extension) != 3) ||
+        (strcmp(extension, "seg") != 0) || (startTime > endTime))
+    {
+      continue;
+    }
+
+    ReplayCacheRange segment;
+    segment.startTime = (TVA_UINT64)startTime;
+    segment.endTime = (TVA_UINT64)endTime;
+    segment.segmentPath = std::string(directory) + PATH_SEPARATOR + names[i];
+    segments.push_back(segment);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Split a replay time range into the parts held by the segments of a cache
+ * directory and the parts that must be replayed live, in time order
+ */
+void ReplayCachePlan(const char* directory, const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime,
+                     std::vector<ReplayCacheRange>& ranges)
+{
+  std::vector<ReplayCacheRange> segments;
+  FindSegments(directory, topic, segments);
+
+  TVA_UINT64 time = startTime;
+  for (;;)
+  {
+    // The segment covering the current time the furthest
+    int covering = -1;
+    int next = -1;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+      if ((segments[i].startTime <= time) && (segments[i].endTime >= time))
+      {
+        if ((covering < 0) || (segments[i].endTime > segments[covering].endTime))
+        {
+          covering = (int)i;
+        }
+      }
+      else if ((segments[i].startTime > time) && (segments[i].startTime <= endTime))
+      {
+        if ((next < 0) || (segments[i].startTime < segments[next].startTime))
+        {
+          next = (int)i;
+        }
+      }
+    }
+
+    ReplayCacheRange range;
+    range.startTime = time;
+    if (covering >= 0)
+    {
+      range.endTime = (segments[covering].endTime < endTime) ? segments[covering].endTime : endTime;
+      range.segmentPath = segments[covering].segmentPath;
+    }
+    else
+    {
+      // Live up to the next cached part
+      range.endTime = (next >= 0) ? (segments[next].startTime - 1) : endTime;
+    }
+    ranges.push_back(range);
+
+    if (range.endTime >= endTime)
+    {
+      break;
+    }
+    time = range.endTime + 1;
+  }
+}
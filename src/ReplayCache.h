@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <uv.h>
+#include "tvaClientAPI.h"
+#include "DataTypes.h"
+#include "compat.h"
+
+#define REPLAY_CACHE_MAGIC            0x43525654      // "TVRC"
+#define REPLAY_CACHE_VERSION          3
+#define REPLAY_CACHE_INDEX_INTERVAL   1024            // records per index entry
+#define REPLAY_CACHE_MAX_TOPIC        256
+#define REPLAY_CACHE_WRITE_SIZE       65536           // bytes handed to the writer thread at once
+#define REPLAY_CACHE_MAX_PENDING      (64 * 1024 * 1024)  // unwritten bytes before caching is given up
+
+/*-----------------------------------------------------------------------------
+ * Replay cache segment file layout
+ *
+ * A segment holds every message of one replay of a topic over a time range,
+ * in the order they were received.  The file is written append-only: the
+ * header, the records, then the index, after which the header is rewritten
+ * with the record count and the index location.  The file only gets its
+ * final name once the replay of the range is complete, so incomplete
+ * segments are never read.
+ *
+ * The index is only written when the records were received in generation
+ * time order, a segment without index is read from its first record.
+ *
+ * Segments of another version are not read, their ranges are replayed and
+ * the segments written again.
+ *
+ * All the structures and data are 8 byte aligned so they can be used in place
+ * from the mapped file.
+ */
+struct ReplayCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t startTime;             // microseconds
+  uint64_t endTime;               // microseconds
+  uint64_t recordCount;
+  uint64_t indexOffset;
+  uint64_t indexCount;
+  char topic[REPLAY_CACHE_MAX_TOPIC];
+};
+
+/* Followed by the topic name ('\0' terminated) and the fields */
+struct ReplayCacheRecord
+{
+  uint32_t size;                  // whole record, padding included
+  uint32_t fieldCount;
+  uint64_t generationTime;
+  uint64_t receiveTime;
+  int32_t lossGap;
+  int32_t jmsMessageType;
+  uint32_t hasOrigin;             // pubId, sessionId and tsn are set
+  uint32_t pubId;
+  uint32_t sessionId;
+  uint32_t reserved;
+  uint64_t tsn;
+};
+
+/* Followed by the field value, string array values are '\0' terminated strings */
+struct ReplayCacheField
+{
+  char name[64];
+  uint32_t type;
+  int32_t count;
+  uint32_t size;                  // value size, padding excluded
+  uint32_t reserved;
+};
+
+struct ReplayCacheIndexEntry
+{
+  uint64_t generationTime;
+  uint64_t offset;
+};
+
+/*-----------------------------------------------------------------------------
+ * Part of a replay time range, served from a segment or replayed live
+ */
+struct ReplayCacheRange
+{
+  TVA_UINT64 startTime;
+  TVA_UINT64 endTime;
+  std::string segmentPath;        // empty when not cached
+};
+
+struct ReplayCacheFile;
+
+/*-----------------------------------------------------------------------------
+ * Records the messages of a live replay range into a new segment
+ *
+ * Messages are appended from the Tervela threads into a buffer, the file
+ * itself is only written by the cache writer thread.  A writer falling too
+ * far behind gives up the segment rather than holding messages back.
+ */
+class ReplayCacheWriter
+{
+public:
+  ReplayCacheWriter(const char* directory, const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime);
+  ~ReplayCacheWriter();
+
+  static void Init();
+
+  bool Open();
+  void Append(MessageEvent& messageEvent);
+  void Complete();
+  void Fail();
+
+private:
+  void Write(const void* data, size_t size);
+  void Discard();
+
+  std::string _path;
+  std::string _tempPath;
+  std::string _topic;
+  TVA_UINT64 _startTime;
+  TVA_UINT64 _endTime;
+  ReplayCacheFile* _file;         // handed to the writer thread, NULL once closed
+  std::vector<char> _buffer;
+  uint64_t _offset;
+  uint64_t _recordCount;
+  std::vector<ReplayCacheIndexEntry> _index;
+  TVA_UINT64 _lastGenerationTime;
+  bool _isOrdered;
+  uv_mutex_t _lock;
+};
+
+/*-----------------------------------------------------------------------------
+ * Reads the messages of a time range from a memory mapped segment
+ */
+class ReplayCacheSegment
+{
+public:
+  ReplayCacheSegment();
+  ~ReplayCacheSegment();
+
+  bool Open(const char* path, const char* topic);
+  void Seek(TVA_UINT64 startTime, TVA_UINT64 endTime);
+  bool Next(MessageEvent& messageEvent);
+  inline bool IsExhausted() { return _isExhausted; }
+  inline bool IsCorrupt() { return _isCorrupt; }
+
+  static void GetAllocations(MessageEvent& messageEvent, std::vector<void*>& allocations);
+
+private:
+  void Close();
+  bool ReadRecord(const ReplayCacheRecord* record, MessageEvent& messageEvent);
+  void Reject();
+
+  std::string _path;
+  const char* _data;
+  size_t _size;
+  const ReplayCacheHeader* _header;
+  uint64_t _offset;
+  uint64_t _recordsLeft;
+  TVA_UINT64 _startTime;
+  TVA_UINT64 _endTime;
+  bool _isOrdered;                // indexed, records are in generation time order
+  bool _isExhausted;
+  bool _isCorrupt;
+#if defined(WIN32)
+  void* _fileHandle;
+  void* _mappingHandle;
+#endif
+};
+
+/*-----------------------------------------------------------------------------
+ * Split a replay time range into the parts held by the segments of a cache
+ * directory and the parts that must be replayed live
+ */
+void ReplayCachePlan(const char* directory, const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime,
+                     std::vector<ReplayCacheRange>& ranges);
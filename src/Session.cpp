@@ -46,6 +46,8 @@ void Session::Init(Handle<Object> target)
   t->PrototypeTemplate()->Set(String::NewSymbol("createSubscriptionSync"), FunctionTemplate::New(CreateSubscriptionSync)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("createReplay"), FunctionTemplate::New(CreateReplay)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("createReplaySync"), FunctionTemplate::New(CreateReplaySync)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("dispatchStats"), FunctionTemplate::New(DispatchStats)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("resetDispatchStats"), FunctionTemplate::New(ResetDispatchStats)->GetFunction());
 
   constructor = Persistent<Function>::New(t->GetFunction());
 }
@@ -98,6 +100,8 @@ Session::Session()
 
 Session::~Session()
 {
+  _gdAcker.Stop();
+
   if (_gdHandle != TVA_INVALID_HANDLE)
   {
     tvagdContextTerm(_gdHandle);
@@ -221,6 +225,9 @@ TVA_STATUS Session::Terminate()
     (*subIterator)->Stop(true);
   }
 
+  // Acknowledge outstanding auto-ack messages before the GD context goes away
+  _gdAcker.Stop();
+
   if (_gdHandle != TVA_INVALID_HANDLE)
   {
     tvagdContextTerm(_gdHandle);
@@ -370,7 +377,7 @@ void Session::InvokeJsSessionNotification(Local<Object> context, SessionNotifica
       entry->complete.Dispose();
     }
 
-    entry->publisher->SendMessageComplete(2, argv);
+    entry->publisher->SendMessageComplete(code, 2, argv);
 
     if (tryCatch.HasCaught())
     {
@@ -467,3 +474,44 @@ TVA_STATUS Session::SendGdMessage(Publication* publisher, TVA_PUBLISH_MESSAGE_DA
 
   return rc;
 }
+
+
+/*****     Dispatch statistics     *****/
+
+/*-----------------------------------------------------------------------------
+ * Get the dispatcher ready list wait times per priority (microseconds)
+ *
+ * var stats = session.dispatchStats();
+ */
+Handle<Value> Session::DispatchStats(const Arguments& args)
+{
+  HandleScope scope;
+  Session* session = ObjectWrap::Unwrap<Session>(args.This());
+  Dispatcher* dispatcher = session->GetDispatcher();
+
+  // Wait times are recorded in nanoseconds
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("high"), Subscription::CreateJsLatencyObject(dispatcher->GetQueueDelay(DispatchPriorityHigh), 1000));
+  result->Set(String::NewSymbol("normal"), Subscription::CreateJsLatencyObject(dispatcher->GetQueueDelay(DispatchPriorityNormal), 1000));
+  result->Set(String::NewSymbol("low"), Subscription::CreateJsLatencyObject(dispatcher->GetQueueDelay(DispatchPriorityLow), 1000));
+
+  return scope.Close(result);
+}
+
+/*-----------------------------------------------------------------------------
+ * Reset the dispatch statistics
+ *
+ * session.resetDispatchStats();
+ */
+Handle<Value> Session::ResetDispatchStats(const Arguments& args)
+{
+  HandleScope scope;
+  Session* session = ObjectWrap::Unwrap<Session>(args.This());
+
+  for (int priority = 0; priority < DispatchPriorityCount; priority++)
+  {
+    session->GetDispatcher()->GetQueueDelay((DispatchPriority)priority).Reset();
+  }
+
+  return scope.Close(args.This());
+}
@@ -14,6 +14,8 @@
 #include "tvaClientAPIInterface.h"
 #include "tvaGDAPI.h"
 #include "EventEmitter.h"
+#include "GdAcker.h"
+#include "Dispatcher.h"
 #include "compat.h"
 
 class Publication;
@@ -91,6 +93,15 @@ public:
    *    qos           : [quality of service: 'BE'|'GC'|'GD'],   (string, optional (default: 'GC'))
    *    name          : [subscription name],                    (string, only required when using GD)
    *    ackMode       : [message ack mode: 'auto'|'manual'],    (string, only required when using GD)
+   *    ackOn         : [auto ack when: 'return'|'resolve'],   (string, optional (default: 'return'))
+   *    columnar      : [deliver columnar 'batch' events],      (boolean, optional (default: false))
+   *    cursor        : [deliver a reused message cursor],      (boolean, optional (default: false))
+   *    pauseBufferLimit : [max BE/GC messages held while paused], (number, optional (default: 10000))
+   *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+   *    priority      : [dispatch priority: 'high'|'normal'|'low'], (string, optional (default: 'normal'))
+   *    trackOrigins  : [record publisher sessions, see origins()] (boolean, optional (default: false))
+   *    backfill      : {since: [replay history from, then live]} (Date, optional, not with GD)
+   *                    {holdLimit: [max live messages held meanwhile]} (number, optional (default: 100000))
    * };
    */
   static v8::Handle<v8::Value> CreateSubscription(const v8::Arguments& args);
@@ -104,6 +115,15 @@ public:
    *    qos           : [quality of service: 'BE'|'GC'|'GD'],   (string, optional (default: 'GC'))
    *    name          : [subscription name],                    (string, only required when using GD)
    *    ackMode       : [message ack mode: 'auto'|'manual'],    (string, only required when using GD)
+   *    ackOn         : [auto ack when: 'return'|'resolve'],   (string, optional (default: 'return'))
+   *    columnar      : [deliver columnar 'batch' events],      (boolean, optional (default: false))
+   *    cursor        : [deliver a reused message cursor],      (boolean, optional (default: false))
+   *    pauseBufferLimit : [max BE/GC messages held while paused], (number, optional (default: 10000))
+   *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+   *    priority      : [dispatch priority: 'high'|'normal'|'low'], (string, optional (default: 'normal'))
+   *    trackOrigins  : [record publisher sessions, see origins()] (boolean, optional (default: false))
+   *    backfill      : {since: [replay history from, then live]} (Date, optional, not with GD)
+   *                    {holdLimit: [max live messages held meanwhile]} (number, optional (default: 100000))
    * };
    */
   static v8::Handle<v8::Value> CreateSubscriptionSync(const v8::Arguments& args);
@@ -115,9 +135,24 @@ public:
    *     // Create replay complete
    * });
    *
+   * topic: a topic, or an array of topics merged by generation time
+   *
    * options = {
    *    startTime     : [beginning of the time range]           (Date, required)
    *    endTime       : [end of the time range]                 (Date, required)
+   *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+   *    speed         : [playback speed: x or 'max']            (number|string, optional (default: 'max'))
+   *    highWaterMark : [queue depth that pauses the replay]    (number, optional (default: 10000))
+   *    lowWaterMark  : [queue depth that resumes the replay]   (number, optional (default: 1000))
+   *    parallelism   : [time range split into n replays]       (number, optional (default: 1))
+   *    ordered       : [deliver in time order across ranges]   (boolean, optional (default: true))
+   *    cacheDir      : [replay cache directory]                (string, optional)
+   *    pubId         : [only this publisher's messages]        (number, optional)
+   *    sessionId     : [only this publisher session's messages] (number, optional)
+   *    tsnStart      : [first topic sequence number]           (number, optional)
+   *    tsnEnd        : [last topic sequence number]            (number, optional)
+   *    resumeFrom    : [replay.checkpoint() to resume after]   (Object, optional)
+   *    progressInterval : ['progress' event period, in ms]     (number, optional (default: none))
    * };
    */
   static v8::Handle<v8::Value> CreateReplay(const v8::Arguments& args);
@@ -127,13 +162,49 @@ public:
    *
    * var replay = session.createReplaySync(topic, {options});
    *
+   * topic: a topic, or an array of topics merged by generation time
+   *
    * options = {
    *    startTime     : [beginning of the time range]           (Date, required)
    *    endTime       : [end of the time range]                 (Date, required)
+   *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+   *    speed         : [playback speed: x or 'max']            (number|string, optional (default: 'max'))
+   *    highWaterMark : [queue depth that pauses the replay]    (number, optional (default: 10000))
+   *    lowWaterMark  : [queue depth that resumes the replay]   (number, optional (default: 1000))
+   *    parallelism   : [time range split into n replays]       (number, optional (default: 1))
+   *    ordered       : [deliver in time order across ranges]   (boolean, optional (default: true))
+   *    cacheDir      : [replay cache directory]                (string, optional)
+   *    pubId         : [only this publisher's messages]        (number, optional)
+   *    sessionId     : [only this publisher session's messages] (number, optional)
+   *    tsnStart      : [first topic sequence number]           (number, optional)
+   *    tsnEnd        : [last topic sequence number]            (number, optional)
+   *    resumeFrom    : [replay.checkpoint() to resume after]   (Object, optional)
+   *    progressInterval : ['progress' event period, in ms]     (number, optional (default: none))
    * };
    */
   static v8::Handle<v8::Value> CreateReplaySync(const v8::Arguments& args);
 
+  /*-----------------------------------------------------------------------------
+   * Get the time subscriptions and replays waited to be dispatched, per
+   * priority class (microseconds)
+   *
+   * var stats = session.dispatchStats();
+   *
+   * stats = {
+   *     high,                  (Object : {count, min, max, mean, p50, p90, p99, p999})
+   *     normal,                (Object : same as high)
+   *     low                    (Object : same as high)
+   * }
+   */
+  static v8::Handle<v8::Value> DispatchStats(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Reset the dispatch statistics
+   *
+   * session.resetDispatchStats();
+   */
+  static v8::Handle<v8::Value> ResetDispatchStats(const v8::Arguments& args);
+
 
   /* Internal methods */
   Session();
@@ -149,6 +220,8 @@ public:
   inline void SetHandle(TVA_SESSION_HANDLE handle) { _handle = handle; }
   inline TVAGD_CONTEXT_HANDLE GetGdHandle() { return _gdHandle; }
   inline void SetGdHandle(TVAGD_CONTEXT_HANDLE handle) { _gdHandle = handle; }
+  inline GdAcker* GetGdAcker() { return &_gdAcker; }
+  inline Dispatcher* GetDispatcher() { return &_dispatcher; }
   inline void SetGdMaxOut(int maxOut)
   {
     _gdAckWindow = new GdAckWindowEntry[maxOut];
@@ -209,9 +282,11 @@ public:
     {
       Ref();
       uv_async_init(uv_default_loop(), GetAsyncObj(), Session::SessionNotificationAsyncEvent);
+      _dispatcher.Start();
     }
     else
     {
+      _dispatcher.Stop();
       uv_close((uv_handle_t*)GetAsyncObj(), Session::SessionHandleCloseComplete);
       Unref();
       MakeWeak();
@@ -236,6 +311,8 @@ private:
 
   TVA_SESSION_HANDLE _handle;
   TVAGD_CONTEXT_HANDLE _gdHandle;
+  GdAcker _gdAcker;
+  Dispatcher _dispatcher;
   uv_async_t _async;
   std::queue<SessionNotificaton> _sessionEventQueue;
   uv_mutex_t _sessionEventLock;
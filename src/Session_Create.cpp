@@ -193,6 +193,14 @@ struct CreateSubscriptionRequest
   TVA_UINT32 qos;
   TVA_STATUS result;
   Subscription::GdSubscriptionAckMode gdAckMode;
+  Subscription::GdSubscriptionAckOn gdAckOn;
+  Subscription::SubscriptionDeliveryMode deliveryMode;
+  int pauseBufferLimit;
+  int weight;
+  DispatchPriority priority;
+  bool trackOrigins;
+  TVA_UINT64 backfillSince;
+  int backfillHoldLimit;
   Persistent<Function> complete;
 
   CreateSubscriptionRequest()
@@ -201,6 +209,14 @@ struct CreateSubscriptionRequest
     name = NULL;
     qos = TVA_QOS_GUARANTEED_CONNECTED;
     gdAckMode = Subscription::GdSubscriptionAckModeAuto;
+    gdAckOn = Subscription::GdSubscriptionAckOnReturn;
+    deliveryMode = Subscription::SubscriptionDeliveryModeMessage;
+    pauseBufferLimit = SUBSCRIPTION_DEFAULT_PAUSE_BUFFER_LIMIT;
+    weight = 1;
+    priority = DispatchPriorityNormal;
+    trackOrigins = false;
+    backfillSince = 0;
+    backfillHoldLimit = SUBSCRIPTION_DEFAULT_BACKFILL_HOLD_LIMIT;
   }
 
   ~CreateSubscriptionRequest()
@@ -224,6 +240,15 @@ bool CreateSubscriptionParseOptions(Local<Object> options, CreateSubscriptionReq
  *    qos           : [quality of service: 'BE'|'GC'|'GD'],   (string, optional (default: 'GC'))
  *    name          : [subscription name],                    (string, only required when using GD)
  *    ackMode       : [message ack mode: 'auto'|'manual'],    (string, only required when using GD)
+ *    ackOn         : [auto ack when: 'return'|'resolve'],   (string, optional (default: 'return'))
+ *    columnar      : [deliver columnar 'batch' events],      (boolean, optional (default: false))
+ *    cursor        : [deliver a reused message cursor],      (boolean, optional (default: false))
+ *    pauseBufferLimit : [max BE/GC messages held while paused], (number, optional (default: 10000))
+ *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+ *    priority      : [dispatch priority: 'high'|'normal'|'low'], (string, optional (default: 'normal'))
+ *    trackOrigins  : [record publisher sessions, see origins()] (boolean, optional (default: false))
+ *    backfill      : {since: [replay history from, then live]} (Date, optional, not with GD)
+ *                    {holdLimit: [max live messages held meanwhile]} (number, optional (default: 100000))
  * };
  */
 Handle<Value> Session::CreateSubscription(const Arguments& args)
@@ -283,6 +308,15 @@ Handle<Value> Session::CreateSubscription(const Arguments& args)
  *    qos           : [quality of service: 'BE'|'GC'|'GD'],   (string, optional (default: 'GC'))
  *    name          : [subscription name],                    (string, only required when using GD)
  *    ackMode       : [message ack mode: 'auto'|'manual'],    (string, only required when using GD)
+ *    ackOn         : [auto ack when: 'return'|'resolve'],   (string, optional (default: 'return'))
+ *    columnar      : [deliver columnar 'batch' events],      (boolean, optional (default: false))
+ *    cursor        : [deliver a reused message cursor],      (boolean, optional (default: false))
+ *    pauseBufferLimit : [max BE/GC messages held while paused], (number, optional (default: 10000))
+ *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+ *    priority      : [dispatch priority: 'high'|'normal'|'low'], (string, optional (default: 'normal'))
+ *    trackOrigins  : [record publisher sessions, see origins()] (boolean, optional (default: false))
+ *    backfill      : {since: [replay history from, then live]} (Date, optional, not with GD)
+ *                    {holdLimit: [max live messages held meanwhile]} (number, optional (default: 100000))
  * };
  */
 Handle<Value> Session::CreateSubscriptionSync(const Arguments& args)
@@ -376,6 +410,93 @@ bool CreateSubscriptionParseOptions(Local<Object> options, CreateSubscriptionReq
         request->gdAckMode = Subscription::GdSubscriptionAckModeManual;
       }
     }
+    else if (tva_str_casecmp(optionName, "ackOn") == 0)
+    {
+      String::AsciiValue val(optionValue->ToString());
+      if (tva_str_casecmp(*val, "resolve") == 0)
+      {
+        request->gdAckOn = Subscription::GdSubscriptionAckOnResolve;
+      }
+    }
+    else if (tva_str_casecmp(optionName, "columnar") == 0)
+    {
+      if (optionValue->BooleanValue())
+      {
+        if (request->deliveryMode != Subscription::SubscriptionDeliveryModeMessage)
+        {
+          return false;
+        }
+        request->deliveryMode = Subscription::SubscriptionDeliveryModeColumnar;
+      }
+    }
+    else if (tva_str_casecmp(optionName, "cursor") == 0)
+    {
+      if (optionValue->BooleanValue())
+      {
+        if (request->deliveryMode != Subscription::SubscriptionDeliveryModeMessage)
+        {
+          return false;
+        }
+        request->deliveryMode = Subscription::SubscriptionDeliveryModeCursor;
+      }
+    }
+    else if (tva_str_casecmp(optionName, "pauseBufferLimit") == 0)
+    {
+      request->pauseBufferLimit = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "weight") == 0)
+    {
+      request->weight = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "priority") == 0)
+    {
+      String::AsciiValue val(optionValue->ToString());
+      if (tva_str_casecmp(*val, "high") == 0)
+      {
+        request->priority = DispatchPriorityHigh;
+      }
+      else if (tva_str_casecmp(*val, "normal") == 0)
+      {
+        request->priority = DispatchPriorityNormal;
+      }
+      else if (tva_str_casecmp(*val, "low") == 0)
+      {
+        request->priority = DispatchPriorityLow;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else if (tva_str_casecmp(optionName, "trackOrigins") == 0)
+    {
+      request->trackOrigins = optionValue->BooleanValue();
+    }
+    else if (tva_str_casecmp(optionName, "backfill") == 0)
+    {
+      if (!optionValue->IsObject())
+      {
+        return false;
+      }
+
+      Local<Value> since = optionValue->ToObject()->Get(String::NewSymbol("since"));
+      if (!(since->NumberValue() > 0))
+      {
+        return false;
+      }
+      request->backfillSince = (TVA_UINT64)(since->NumberValue() * 1000);
+
+      Local<Value> holdLimit = optionValue->ToObject()->Get(String::NewSymbol("holdLimit"));
+      if (!holdLimit->IsUndefined())
+      {
+        request->backfillHoldLimit = holdLimit->Int32Value();
+      }
+    }
+  }
+
+  if ((request->pauseBufferLimit < 0) || (request->weight < 1) || (request->backfillHoldLimit < 0))
+  {
+    return false;
   }
 
   if ((request->qos == TVA_QOS_GUARANTEED_DELIVERY) && !(request->name))
@@ -383,6 +504,20 @@ bool CreateSubscriptionParseOptions(Local<Object> options, CreateSubscriptionReq
     return false;
   }
 
+  // GD subscriptions already resume from their last acknowledged message
+  if ((request->qos == TVA_QOS_GUARANTEED_DELIVERY) && request->backfillSince)
+  {
+    return false;
+  }
+
+  // Columnar batches and cursors can't be acknowledged message by message
+  if ((request->deliveryMode != Subscription::SubscriptionDeliveryModeMessage) &&
+      ((request->gdAckMode == Subscription::GdSubscriptionAckModeManual) ||
+       (request->gdAckOn == Subscription::GdSubscriptionAckOnResolve)))
+  {
+    return false;
+  }
+
   return true;
 }
 
@@ -394,6 +529,14 @@ void Session::CreateSubscriptionWorker(uv_work_t* req)
   CreateSubscriptionRequest* request = (CreateSubscriptionRequest*)req->data;
 
   Subscription* subscription = new Subscription(request->session);
+  subscription->SetDeliveryMode(request->deliveryMode);
+  subscription->SetAckOn(request->gdAckOn);
+  subscription->SetPauseBufferLimit((size_t)request->pauseBufferLimit);
+  subscription->SetWeight(request->weight);
+  subscription->SetPriority(request->priority);
+  subscription->SetTrackOrigins(request->trackOrigins);
+  subscription->SetBackfill(request->backfillSince, (size_t)request->backfillHoldLimit);
+
   TVA_STATUS rc = subscription->Start(request->topic, request->qos, request->name, request->gdAckMode);
   if (rc == TVA_OK)
   {
@@ -448,27 +591,57 @@ struct CreateReplayRequest
 {
   Session* session;
   Replay* replay;
-  char* topic;
+  std::vector<std::string> topics;
   TVA_UINT64 startTime;
   TVA_UINT64 endTime;
+  int weight;
+  double speed;
+  int highWaterMark;
+  int lowWaterMark;
+  int parallelism;
+  int progressInterval;
+  bool ordered;
+  char* cacheDir;
+  TVA_UINT32 pubId;
+  TVA_UINT32 sessionId;
+  TVA_UINT64 tsnStart;
+  TVA_UINT64 tsnEnd;
+  bool isResuming;
+  TVA_UINT64 resumeTime;
+  std::vector<ReplayPosition> resumeDelivered;
   TVA_STATUS result;
   Persistent<Function> complete;
 
   CreateReplayRequest()
   {
-    topic = NULL;
     startTime = 0;
     endTime = 0;
+    weight = 1;
+    speed = 0;
+    highWaterMark = REPLAY_DEFAULT_HIGH_WATER;
+    lowWaterMark = REPLAY_DEFAULT_LOW_WATER;
+    parallelism = 1;
+    progressInterval = 0;
+    ordered = true;
+    cacheDir = NULL;
+    pubId = TVA_REPLAY_PUBID_ANY;
+    sessionId = TVA_REPLAY_SESSIONID_ANY;
+    tsnStart = TVA_REPLAY_TSN_ANY;
+    tsnEnd = TVA_REPLAY_TSN_ANY;
+    isResuming = false;
+    resumeTime = 0;
   }
 
   ~CreateReplayRequest()
   {
-    if (topic) free(topic);
+    if (cacheDir) free(cacheDir);
     if (!complete.IsEmpty()) complete.Dispose();
   }
 };
 
+bool CreateReplayParseTopics(Local<Value> topics, CreateReplayRequest* request);
 bool CreateReplayParseOptions(Local<Object> options, CreateReplayRequest* request);
+bool CreateReplayParseCheckpoint(Local<Value> checkpoint, CreateReplayRequest* request);
 
 /*-----------------------------------------------------------------------------
  * Create a new replay
@@ -477,9 +650,24 @@ bool CreateReplayParseOptions(Local<Object> options, CreateReplayRequest* reques
  *     // Create replay complete
  * });
  *
+ * topic: a topic, or an array of topics merged by generation time
+ *
  * options = {
  *    startTime     : [beginning of the time range]           (Date, required)
  *    endTime       : [end of the time range]                 (Date, required)
+ *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+ *    speed         : [playback speed: x or 'max']            (number|string, optional (default: 'max'))
+ *    highWaterMark : [queue depth that pauses the replay]    (number, optional (default: 10000))
+ *    lowWaterMark  : [queue depth that resumes the replay]   (number, optional (default: 1000))
+ *    parallelism   : [time range split into n replays]       (number, optional (default: 1))
+ *    ordered       : [deliver in time order across ranges]   (boolean, optional (default: true))
+ *    cacheDir      : [replay cache directory]                (string, optional)
+ *    pubId         : [only this publisher's messages]        (number, optional)
+ *    sessionId     : [only this publisher session's messages] (number, optional)
+ *    tsnStart      : [first topic sequence number]           (number, optional)
+ *    tsnEnd        : [last topic sequence number]            (number, optional)
+ *    resumeFrom    : [replay.checkpoint() to resume after]   (Object, optional)
+ *    progressInterval : ['progress' event period, in ms]     (number, optional (default: none))
  * };
  */
 Handle<Value> Session::CreateReplay(const Arguments& args)
@@ -489,20 +677,24 @@ Handle<Value> Session::CreateReplay(const Arguments& args)
 
   // Arguments checking
   PARAM_REQ_NUM(3, args.Length());
-  PARAM_REQ_STRING(0, args);        // topic
   PARAM_REQ_OBJECT(1, args);        // options
   PARAM_REQ_FUNCTION(2, args);      // complete
 
   // Ready arguments
-  String::AsciiValue topic(args[0]->ToString());
   Local<Object> options = Local<Object>::Cast(args[1]);
   Local<Function> complete = Local<Function>::Cast(args[2]);
 
   CreateReplayRequest* request = new CreateReplayRequest();
   request->session = session;
-  request->topic = strdup(*topic);
   request->complete = Persistent<Function>::New(complete);
 
+  if (!CreateReplayParseTopics(args[0], request))
+  {
+    delete request;
+    ThrowException(Exception::TypeError(String::New("Incorrect arguments format - arg 0 should be a topic or an Array of topics")));
+    return scope.Close(Undefined());
+  }
+
   if (!CreateReplayParseOptions(options, request))
   {
     delete request;
@@ -524,9 +716,24 @@ Handle<Value> Session::CreateReplay(const Arguments& args)
  *
  * var replay = session.createReplaySync(topic, {options});
  *
+ * topic: a topic, or an array of topics merged by generation time
+ *
  * options = {
  *    startTime     : [beginning of the time range]           (Date, required)
  *    endTime       : [end of the time range]                 (Date, required)
+ *    weight        : [dispatch weight, messages per turn x]  (number, optional (default: 1))
+ *    speed         : [playback speed: x or 'max']            (number|string, optional (default: 'max'))
+ *    highWaterMark : [queue depth that pauses the replay]    (number, optional (default: 10000))
+ *    lowWaterMark  : [queue depth that resumes the replay]   (number, optional (default: 1000))
+ *    parallelism   : [time range split into n replays]       (number, optional (default: 1))
+ *    ordered       : [deliver in time order across ranges]   (boolean, optional (default: true))
+ *    cacheDir      : [replay cache directory]                (string, optional)
+ *    pubId         : [only this publisher's messages]        (number, optional)
+ *    sessionId     : [only this publisher session's messages] (number, optional)
+ *    tsnStart      : [first topic sequence number]           (number, optional)
+ *    tsnEnd        : [last topic sequence number]            (number, optional)
+ *    resumeFrom    : [replay.checkpoint() to resume after]   (Object, optional)
+ *    progressInterval : ['progress' event period, in ms]     (number, optional (default: none))
  * };
  */
 Handle<Value> Session::CreateReplaySync(const Arguments& args)
@@ -536,16 +743,19 @@ Handle<Value> Session::CreateReplaySync(const Arguments& args)
 
   // Arguments checking
   PARAM_REQ_NUM(2, args.Length());
-  PARAM_REQ_STRING(0, args);        // topic
   PARAM_REQ_OBJECT(1, args);        // options
 
   // Ready arguments
-  String::AsciiValue topic(args[0]->ToString());
   Local<Object> options = Local<Object>::Cast(args[1]);
 
   CreateReplayRequest request;
   request.session = session;
-  request.topic = strdup(*topic);
+
+  if (!CreateReplayParseTopics(args[0], &request))
+  {
+    ThrowException(Exception::TypeError(String::New("Incorrect arguments format - arg 0 should be a topic or an Array of topics")));
+    return scope.Close(Undefined());
+  }
 
   if (!CreateReplayParseOptions(options, &request))
   {
@@ -574,6 +784,36 @@ Handle<Value> Session::CreateReplaySync(const Arguments& args)
   return scope.Close(result);
 }
 
+/*-----------------------------------------------------------------------------
+ * Parse the topic, or topics
+ */
+bool CreateReplayParseTopics(Local<Value> topics, CreateReplayRequest* request)
+{
+  if (topics->IsString())
+  {
+    request->topics.push_back(*String::AsciiValue(topics));
+    return true;
+  }
+
+  if (!topics->IsArray())
+  {
+    return false;
+  }
+
+  const Local<Array> topicArray = Local<Array>::Cast(topics);
+  for (uint32_t i = 0; i < topicArray->Length(); i++)
+  {
+    if (!topicArray->Get(i)->IsString())
+    {
+      return false;
+    }
+
+    request->topics.push_back(*String::AsciiValue(topicArray->Get(i)));
+  }
+
+  return !request->topics.empty();
+}
+
 /*-----------------------------------------------------------------------------
  * Parse options
  */
@@ -598,9 +838,121 @@ bool CreateReplayParseOptions(Local<Object> options, CreateReplayRequest* reques
     {
       request->endTime = (TVA_UINT64)(optionValue->NumberValue() * 1000);
     }
+    else if (tva_str_casecmp(optionName, "weight") == 0)
+    {
+      request->weight = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "speed") == 0)
+    {
+      if (optionValue->IsString())
+      {
+        String::AsciiValue valueStr(optionValue);
+        if (tva_str_casecmp(*valueStr, "max") != 0)
+        {
+          return false;
+        }
+        request->speed = 0;
+      }
+      else
+      {
+        request->speed = optionValue->NumberValue();
+        if (!(request->speed > 0))
+        {
+          return false;
+        }
+      }
+    }
+    else if (tva_str_casecmp(optionName, "highWaterMark") == 0)
+    {
+      request->highWaterMark = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "lowWaterMark") == 0)
+    {
+      request->lowWaterMark = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "parallelism") == 0)
+    {
+      request->parallelism = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "progressInterval") == 0)
+    {
+      request->progressInterval = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "ordered") == 0)
+    {
+      request->ordered = optionValue->BooleanValue();
+    }
+    else if (tva_str_casecmp(optionName, "cacheDir") == 0)
+    {
+      String::AsciiValue valueStr(optionValue);
+      if (request->cacheDir) free(request->cacheDir);
+      request->cacheDir = strdup(*valueStr);
+    }
+    else if (tva_str_casecmp(optionName, "pubId") == 0)
+    {
+      request->pubId = optionValue->Uint32Value();
+    }
+    else if (tva_str_casecmp(optionName, "sessionId") == 0)
+    {
+      request->sessionId = optionValue->Uint32Value();
+    }
+    else if (tva_str_casecmp(optionName, "tsnStart") == 0)
+    {
+      request->tsnStart = (TVA_UINT64)optionValue->NumberValue();
+    }
+    else if (tva_str_casecmp(optionName, "tsnEnd") == 0)
+    {
+      request->tsnEnd = (TVA_UINT64)optionValue->NumberValue();
+    }
+    else if (tva_str_casecmp(optionName, "resumeFrom") == 0)
+    {
+      if (!CreateReplayParseCheckpoint(optionValue, request))
+      {
+        return false;
+      }
+    }
+  }
+
+  if ((request->startTime == 0) || (request->endTime == 0) || (request->weight < 1))
+  {
+    return false;
+  }
+
+  // Only the rest of the time range is replayed
+  if (request->isResuming)
+  {
+    if (request->resumeTime > request->endTime)
+    {
+      return false;
+    }
+
+    if (request->resumeTime > request->startTime)
+    {
+      request->startTime = request->resumeTime;
+    }
   }
 
-  if ((request->startTime == 0) || (request->endTime == 0))
+  // Every sub-range must cover at least a microsecond
+  if ((request->parallelism < 1) ||
+      ((request->parallelism > 1) && ((request->endTime < request->startTime) ||
+                                      ((request->endTime - request->startTime) < (TVA_UINT64)request->parallelism))))
+  {
+    return false;
+  }
+
+  if (request->progressInterval < 0)
+  {
+    return false;
+  }
+
+  // Pacing needs messages in time order
+  if (!request->ordered && ((request->parallelism > 1) || (request->topics.size() > 1)) && (request->speed > 0))
+  {
+    return false;
+  }
+
+  if ((request->highWaterMark < 0) || (request->lowWaterMark < 0) ||
+      ((request->highWaterMark > 0) && (request->lowWaterMark >= request->highWaterMark)))
   {
     return false;
   }
@@ -608,6 +960,61 @@ bool CreateReplayParseOptions(Local<Object> options, CreateReplayRequest* reques
   return true;
 }
 
+/*-----------------------------------------------------------------------------
+ * Parse a checkpoint returned by replay.checkpoint()
+ */
+bool CreateReplayParseCheckpoint(Local<Value> checkpoint, CreateReplayRequest* request)
+{
+  if (!checkpoint->IsObject())
+  {
+    return false;
+  }
+
+  // Microseconds, unlike the other times of the API
+  Local<Value> generationTimeUs = checkpoint->ToObject()->Get(String::NewSymbol("generationTimeUs"));
+  Local<Value> delivered = checkpoint->ToObject()->Get(String::NewSymbol("delivered"));
+  if (!generationTimeUs->IsNumber() || !(generationTimeUs->NumberValue() > 0) || !delivered->IsArray())
+  {
+    return false;
+  }
+
+  request->isResuming = true;
+  request->resumeTime = (TVA_UINT64)generationTimeUs->NumberValue();
+  request->resumeDelivered.clear();
+
+  const Local<Array> positions = Local<Array>::Cast(delivered);
+  for (uint32_t i = 0; i < positions->Length(); i++)
+  {
+    if (!positions->Get(i)->IsObject())
+    {
+      return false;
+    }
+
+    Local<Object> jsPosition = positions->Get(i)->ToObject();
+    Local<Value> topic = jsPosition->Get(String::NewSymbol("topic"));
+    if (!topic->IsString())
+    {
+      return false;
+    }
+
+    ReplayPosition position;
+    position.topic = *String::AsciiValue(topic);
+    position.hasOrigin = jsPosition->Get(String::NewSymbol("tsn"))->IsNumber();
+    position.pubId = 0;
+    position.sessionId = 0;
+    position.tsn = 0;
+    if (position.hasOrigin)
+    {
+      position.pubId = jsPosition->Get(String::NewSymbol("pubId"))->Uint32Value();
+      position.sessionId = jsPosition->Get(String::NewSymbol("sessionId"))->Uint32Value();
+      position.tsn = (TVA_UINT64)jsPosition->Get(String::NewSymbol("tsn"))->NumberValue();
+    }
+    request->resumeDelivered.push_back(position);
+  }
+
+  return true;
+}
+
 /*-----------------------------------------------------------------------------
  * Perform create replay
  */
@@ -616,27 +1023,42 @@ void Session::CreateReplayWorker(uv_work_t* req)
   CreateReplayRequest* request = (CreateReplayRequest*)req->data;
   Session* session = request->session;
   Replay* replay = new Replay(session);
+  replay->SetWeight(request->weight);
+  replay->SetSpeed(request->speed);
+  replay->SetProgressInterval((uint64_t)request->progressInterval);
+  replay->SetWaterMarks((size_t)request->highWaterMark, (size_t)request->lowWaterMark);
+
+  replay->SetOrdered(request->ordered);
+  if (request->isResuming)
+  {
+    replay->SetResumeFrom(request->resumeTime, request->resumeDelivered);
+  }
 
-  TVA_REPLAY_HANDLE replayHandle;
   TVA_REPLAY_REQ replayReq;
 
-  replayReq.pubId = TVA_REPLAY_PUBID_ANY;
-  replayReq.sessionId = TVA_REPLAY_SESSIONID_ANY;
-  replayReq.timeStart = request->startTime;
-  replayReq.timeEnd = request->endTime;
-  replayReq.tsnStart = TVA_REPLAY_TSN_ANY;
-  replayReq.tsnEnd = TVA_REPLAY_TSN_ANY;
-  tva_strncpy(replayReq.topic, request->topic, sizeof(replayReq.topic));
+  replayReq.pubId = request->pubId;
+  replayReq.sessionId = request->sessionId;
+  replayReq.tsnStart = request->tsnStart;
+  replayReq.tsnEnd = request->tsnEnd;
+
+  // The cache holds complete replays of a topic, narrowed replays bypass it
+  const char* cacheDir = request->cacheDir;
+  if ((request->pubId != TVA_REPLAY_PUBID_ANY) || (request->sessionId != TVA_REPLAY_SESSIONID_ANY) ||
+      (request->tsnStart != TVA_REPLAY_TSN_ANY) || (request->tsnEnd != TVA_REPLAY_TSN_ANY))
+  {
+    cacheDir = NULL;
+  }
+
+  TVA_STATUS rc = replay->Start(request->topics, request->startTime, request->endTime,
+                                request->parallelism, cacheDir, replayReq);
 
-  TVA_STATUS rc = tvaReplayHistCbNew(session->GetHandle(), Replay::MessageReceivedEvent, replay,
-                                     &replayReq, 0, &replayHandle);
   if (rc == TVA_OK)
   {
     request->replay = replay;
-    replay->SetHandle(replayHandle);
   }
   else
   {
+    // Releases the shards already started
     delete replay;
   }
 
@@ -0,0 +1,33 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <uv.h>
+#include "compat.h"
+
+/*-----------------------------------------------------------------------------
+ * Runtime statistics counter
+ *
+ * Can be updated from any thread without locking.  Reads are atomic, so never
+ * torn on 32 bit builds, but not ordered with respect to updates: counters
+ * are only used for reporting.
+ */
+class StatCounter
+{
+public:
+  StatCounter()
+  {
+    _value = 0;
+  }
+
+  inline void Add(int64_t value) { tva_atomic_add64(&_value, value); }
+  inline void Increment() { tva_atomic_add64(&_value, 1); }
+  inline void Decrement() { tva_atomic_add64(&_value, -1); }
+  inline int64_t Get() { return (int64_t)tva_atomic_read64(&_value); }
+
+private:
+  volatile int64_t _value;
+};
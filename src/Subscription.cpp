@@ -3,8 +3,10 @@
  */
 
 #include <stdlib.h>
+#include <limits>
 #include <string>
-#include "v8-convert.hpp"
+#include <map>
+#include <set>
 #include "DataTypes.h"
 #include "Helpers.h"
 #include "Session.h"
@@ -16,10 +18,33 @@ enum SubscriptionEvent
 {
   EVT_MESSAGE = 0,
   EVT_ACK,
-  EVT_STOP
+  EVT_STOP,
+  EVT_BATCH,
+  EVT_AGGREGATE,
+  EVT_ERROR
+};
+
+enum MessageInternalField
+{
+  MESSAGE_FIELD_ACK_HANDLE = 0,
+  MESSAGE_FIELD_SUBSCRIPTION,
+  MESSAGE_FIELD_COUNT
+};
+
+enum CursorProperty
+{
+  CURSOR_PROPERTY_TOPIC = 0,
+  CURSOR_PROPERTY_GENERATION_TIME,
+  CURSOR_PROPERTY_RECEIVE_TIME,
+  CURSOR_PROPERTY_LOSS_GAP,
+  CURSOR_PROPERTY_FIELD_COUNT
 };
 
 Persistent<Function> Subscription::constructor;
+Persistent<ObjectTemplate> Subscription::messageTemplate;
+Persistent<ObjectTemplate> Subscription::cursorTemplate;
+Persistent<Function> Subscription::ackDoneFunction;
+Persistent<Function> Subscription::bindFunction;
 
 /*-----------------------------------------------------------------------------
  * Initialize the Subscription module
@@ -33,10 +58,39 @@ void Subscription::Init(Handle<Object> target)
   t->InstanceTemplate()->SetInternalFieldCount(1);
 
   t->PrototypeTemplate()->Set(String::NewSymbol("on"), FunctionTemplate::New(On)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("onTopic"), FunctionTemplate::New(OnTopic)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("offTopic"), FunctionTemplate::New(OffTopic)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("acknowledge"), FunctionTemplate::New(AckMessage)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("ackUpTo"), FunctionTemplate::New(AckUpTo)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("stats"), FunctionTemplate::New(Stats)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("origins"), FunctionTemplate::New(Origins)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("aggregate"), FunctionTemplate::New(Aggregate)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("latencyStats"), FunctionTemplate::New(LatencyStats)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("resetLatencyStats"), FunctionTemplate::New(ResetLatencyStats)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("pause"), FunctionTemplate::New(Pause)->GetFunction());
+  t->PrototypeTemplate()->Set(String::NewSymbol("resume"), FunctionTemplate::New(Resume)->GetFunction());
   t->PrototypeTemplate()->Set(String::NewSymbol("stop"), FunctionTemplate::New(Stop)->GetFunction());
 
   constructor = Persistent<Function>::New(t->GetFunction());
+
+  messageTemplate = Persistent<ObjectTemplate>::New(ObjectTemplate::New());
+  messageTemplate->SetInternalFieldCount(MESSAGE_FIELD_COUNT);
+
+  cursorTemplate = Persistent<ObjectTemplate>::New(ObjectTemplate::New());
+  cursorTemplate->SetInternalFieldCount(1);
+  cursorTemplate->SetAccessor(String::NewSymbol("topic"), CursorGetProperty, 0, Int32::New(CURSOR_PROPERTY_TOPIC));
+  cursorTemplate->SetAccessor(String::NewSymbol("generationTime"), CursorGetProperty, 0, Int32::New(CURSOR_PROPERTY_GENERATION_TIME));
+  cursorTemplate->SetAccessor(String::NewSymbol("receiveTime"), CursorGetProperty, 0, Int32::New(CURSOR_PROPERTY_RECEIVE_TIME));
+  cursorTemplate->SetAccessor(String::NewSymbol("lossGap"), CursorGetProperty, 0, Int32::New(CURSOR_PROPERTY_LOSS_GAP));
+  cursorTemplate->SetAccessor(String::NewSymbol("fieldCount"), CursorGetProperty, 0, Int32::New(CURSOR_PROPERTY_FIELD_COUNT));
+  cursorTemplate->Set(String::NewSymbol("get"), FunctionTemplate::New(CursorGet));
+  cursorTemplate->Set(String::NewSymbol("getNumber"), FunctionTemplate::New(CursorGetNumber));
+  cursorTemplate->Set(String::NewSymbol("getName"), FunctionTemplate::New(CursorGetName));
+
+  // The 'done' callback given to listeners with ackOn 'resolve' is AckDone
+  // bound to the subscription and the message
+  ackDoneFunction = Persistent<Function>::New(FunctionTemplate::New(AckDone)->GetFunction());
+  bindFunction = Persistent<Function>::New(Local<Function>::Cast(ackDoneFunction->Get(String::NewSymbol("bind"))));
 }
 
 /*-----------------------------------------------------------------------------
@@ -81,20 +135,51 @@ Handle<Value> Subscription::NewInstance(Subscription* subscription)
  */
 Subscription::Subscription(Session* session)
 {
-  _async.data = this;
   _session = session;
+  _dispatcher = session->GetDispatcher();
   _handle = TVA_INVALID_HANDLE;
   _topic = NULL;
+  _ackOn = GdSubscriptionAckOnReturn;
+  _deliveryMode = SubscriptionDeliveryModeMessage;
+  _pauseBufferLimit = SUBSCRIPTION_DEFAULT_PAUSE_BUFFER_LIMIT;
+  _cursorEvent = NULL;
+  _isTrackingOrigins = false;
+  _aggregator = NULL;
+  _aggregateTimer.data = this;
+  _isAggregateTimerOpen = false;
+  _backfillHandle = TVA_INVALID_HANDLE;
+  _backfillContext.contextType = ReplayContextBackfill;
+  _backfillContext.subscription = this;
+  _backfillSince = 0;
+  _backfillHoldLimit = SUBSCRIPTION_DEFAULT_BACKFILL_HOLD_LIMIT;
+  _backfillStatus = TVA_OK;
+  _isBackfillTruncated = false;
+  _isBackfillErrorPending = false;
+  _backfillUntil = 0;
+  _isBackfilling = false;
+  _isDeduplicating = false;
+  _isPaused = false;
+  _peakQueueDepth = 0;
+  for (int i = 0; i < LatencyStageCount; i++)
+  {
+    _latency[i] = NULL;
+    _latencyResetsSeen[i] = 0;
+  }
+  _latencyResets = 0;
   _isInUse = false;
   uv_mutex_init(&_messageEventLock);
+  uv_mutex_init(&_originLock);
 
   EventEmitterConfiguration events[] = 
   {
     { EVT_MESSAGE,  "message" },
     { EVT_ACK,      "ack"     },
-    { EVT_STOP,     "stop"    }
+    { EVT_STOP,     "stop"    },
+    { EVT_BATCH,    "batch"   },
+    { EVT_AGGREGATE,"aggregate" },
+    { EVT_ERROR,    "error"   }
   };
-  SetValidEvents(3, events);
+  SetValidEvents(6, events);
 }
 
 Subscription::~Subscription()
@@ -104,7 +189,40 @@ Subscription::~Subscription()
     free(_topic);
   }
 
+  std::vector<Persistent<Function> > routes;
+  _topicRoutes.GetValues(routes);
+  for (size_t i = 0; i < routes.size(); i++)
+  {
+    routes[i].Dispose();
+  }
+
+  if (!_cursor.IsEmpty())
+  {
+    _cursor.Dispose();
+  }
+
+  if (_aggregator)
+  {
+    delete _aggregator;
+  }
+
+  for (int i = 0; i < LatencyStageCount; i++)
+  {
+    if (_latency[i])
+    {
+      delete _latency[i];
+    }
+  }
+
+  // Live messages still held when the subscription stopped during its backfill
+  for (size_t i = 0; i < _backfillHeld.size(); i++)
+  {
+    ReleaseMessageEvent(_backfillHeld[i]);
+    tvaReleaseMessageData(_backfillHeld[i].tvaMessage);
+  }
+
   uv_mutex_destroy(&_messageEventLock);
+  uv_mutex_destroy(&_originLock);
 }
 
 /*-----------------------------------------------------------------------------
@@ -114,6 +232,10 @@ TVA_STATUS Subscription::Start(char* topic, uint8_t qos, char* name, GdSubscript
 {
   TVA_STATUS rc;
   TVA_HANDLE subHandle = TVA_INVALID_HANDLE;
+
+  // Live messages are held from the start, so none fall between the backfill and them
+  _isBackfilling = (_backfillSince != 0);
+  _isDeduplicating = _isBackfilling;
   
   if (qos == TVA_QOS_GUARANTEED_DELIVERY)
   {
@@ -132,6 +254,15 @@ TVA_STATUS Subscription::Start(char* topic, uint8_t qos, char* name, GdSubscript
                                     GetSession()->GetHandle(), qos, true, cachePeriod, &subHandle);
   }
 
+  if ((rc == TVA_OK) && _isBackfilling)
+  {
+    rc = StartBackfill(topic);
+    if (rc != TVA_OK)
+    {
+      tvaTerminateSubscription(subHandle, TVA_INVALID_HANDLE);
+    }
+  }
+
   if (rc == TVA_OK)
   {
     _topic = strdup(topic);
@@ -184,6 +315,72 @@ Handle<Value> Subscription::On(const Arguments& args)
 }
 
 
+
+/*-----------------------------------------------------------------------------
+ * Route the messages of a topic or topic pattern to their own listener
+ *
+ * subscription.onTopic(topic, listener);
+ */
+Handle<Value> Subscription::OnTopic(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(2, args.Length());
+  PARAM_REQ_STRING(0, args);          // topic
+  PARAM_REQ_FUNCTION(1, args);        // handler
+
+  String::AsciiValue topic(args[0]->ToString());
+  Local<Function> handler = Local<Function>::Cast(args[1]);
+
+  if (!TopicTrie<Persistent<Function> >::IsValidPattern(*topic))
+  {
+    ThrowException(Exception::TypeError(String::New("Invalid topic")));
+    return scope.Close(Undefined());
+  }
+
+  // Columnar batches are not split by topic
+  if (subscription->GetDeliveryMode() == SubscriptionDeliveryModeColumnar)
+  {
+    ThrowException(Exception::Error(String::New("Topic listeners can't be used with columnar delivery")));
+    return scope.Close(Undefined());
+  }
+
+  Persistent<Function> previous;
+  if (subscription->_topicRoutes.Add(*topic, Persistent<Function>::New(handler), previous))
+  {
+    previous.Dispose();
+  }
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Remove a topic route
+ *
+ * subscription.offTopic(topic);
+ */
+Handle<Value> Subscription::OffTopic(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(1, args.Length());
+  PARAM_REQ_STRING(0, args);          // topic
+
+  String::AsciiValue topic(args[0]->ToString());
+
+  Persistent<Function> removed;
+  if (subscription->_topicRoutes.Remove(*topic, removed))
+  {
+    removed.Dispose();
+  }
+
+  return scope.Close(args.This());
+}
+
 /*****     MessageEvent     *****/
 
 /*-----------------------------------------------------------------------------
@@ -193,16 +390,57 @@ void Subscription::MessageReceivedEvent(TVA_MESSAGE* message, void* context)
 {
   Subscription* subscription = (Subscription*)context;
   MessageEvent messageEvent;
+  uint64_t callbackTime = uv_hrtime();
 
   TVA_STATUS rc = Subscription::ProcessRecievedMessage(message, messageEvent);
   if (rc == TVA_OK)
   {
+    messageEvent.callbackTime = callbackTime;
+    messageEvent.postTime = uv_hrtime();
+
+    if (message->msgReceiveTime >= message->msgGenerationTime)
+    {
+      subscription->RecordLatency(LatencyStageFabric, message->msgReceiveTime - message->msgGenerationTime);
+    }
+    subscription->RecordLatency(LatencyStageDecode, messageEvent.postTime - callbackTime);
+
+    subscription->_messagesIn.Increment();
+    subscription->_bytesIn.Add(messageEvent.payloadSize);
+    subscription->_lossGap.Add(message->topicSeqGap);
+
+    if (subscription->_isTrackingOrigins)
+    {
+      subscription->RecordOrigin(message);
+    }
+
+    // Held while the backfill runs, then dropped if the backfill delivered it
+    if (subscription->_isDeduplicating)
+    {
+      messageEvent.hasOrigin = GetMessageOrigin(message, messageEvent.pubId, messageEvent.sessionId, messageEvent.tsn);
+      if (subscription->HoldLiveMessageEvent(messageEvent))
+      {
+        return;
+      }
+    }
+
+    if (subscription->_aggregator)
+    {
+      subscription->_aggregator->Add(messageEvent, 0);
+    }
+
     if (!subscription->PostMessageEvent(messageEvent))
     {
       // Post failed, need to release the message
+      subscription->_drops.Increment();
+      ReleaseMessageEvent(messageEvent);
       tvaReleaseMessageData(message);
     }
   }
+  else
+  {
+    subscription->_decodeErrors.Increment();
+    tvaReleaseMessageData(message);
+  }
 }
 
 /*-----------------------------------------------------------------------------
@@ -213,16 +451,20 @@ TVA_STATUS Subscription::ProcessRecievedMessage(TVA_MESSAGE* message, MessageEve
   TVA_STATUS rc;
 
   messageEvent.tvaMessage = message;
+  messageEvent.topicName = message->topicName;
+  messageEvent.generationTime = message->msgGenerationTime;
+  messageEvent.receiveTime = message->msgReceiveTime;
+  messageEvent.lossGap = message->topicSeqGap;
+  messageEvent.isCached = false;
+  messageEvent.hasOrigin = false;
   messageEvent.jmsMessageType = 0;
+  messageEvent.payloadSize = 0;
 
   TVA_MESSAGE_DATA_HANDLE msgData = message->messageData;
   TVA_FIELD_ITERATOR_HANDLE fieldItr = NULL;
   TVA_MSG_FIELD_INFO fieldInfo;
 
-  if (TVA_MSG_ISLAST(message))
-  {
-    messageEvent.isLastMessage = true;
-  }
+  messageEvent.isLastMessage = (TVA_MSG_ISLAST(message)) ? true : false;
 
 #ifdef TVA_MSG_ISFROMJMS
   messageEvent.jmsMessageType = TVA_JMS_MSG_TYPE_MAP;
@@ -509,6 +751,7 @@ TVA_STATUS Subscription::ProcessRecievedMessage(TVA_MESSAGE* message, MessageEve
 
       if (rc == TVA_OK)
       {
+        messageEvent.payloadSize += GetMessageFieldDataSize(field);
         messageEvent.fieldData.push_back(field);
       }
 
@@ -526,168 +769,239 @@ TVA_STATUS Subscription::ProcessRecievedMessage(TVA_MESSAGE* message, MessageEve
     tvaReleaseMessageFieldIterator(fieldItr);
   }
 
+  if (rc != TVA_OK)
+  {
+    ReleaseMessageEvent(messageEvent);
+  }
+
   return rc;
 }
 
 /*-----------------------------------------------------------------------------
- * Create an object to be sent to JavaScript
+ * Release the data of a received message field
  */
-Local<Object> Subscription::CreateJsMessageObject(MessageEvent& messageEvent)
+void Subscription::ReleaseFieldValue(MessageFieldData& field)
+{
+  switch (field.type)
+  {
+  case MessageFieldDataTypeString:
+    tvaReleaseFieldValue(field.value.stringValue);
+    break;
+
+  case MessageFieldDataTypeStringArray:
+    {
+      TVA_STRING* arrayData = (TVA_STRING*)field.value.arrayValue;
+      for (int i = 0; i < field.count; i++)
+      {
+        tvaReleaseFieldValue(arrayData[i]);
+      }
+      tvaReleaseFieldValue(arrayData);
+    }
+    break;
+
+  case MessageFieldDataTypeBooleanArray:
+  case MessageFieldDataTypeInt16Array:
+  case MessageFieldDataTypeInt32Array:
+  case MessageFieldDataTypeInt64Array:
+  case MessageFieldDataTypeFloatArray:
+  case MessageFieldDataTypeDoubleArray:
+  case MessageFieldDataTypeDateArray:
+    tvaReleaseFieldValue(field.value.arrayValue);
+    break;
+
+  default:
+    break;
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Release the decoded field data of a message that won't reach JavaScript
+ */
+void Subscription::ReleaseMessageEvent(MessageEvent& messageEvent)
 {
-  Local<Object> fields = Object::New();
   while (!messageEvent.fieldData.empty())
   {
-    MessageFieldData field = messageEvent.fieldData.front();
+    ReleaseFieldValue(messageEvent.fieldData.front());
     messageEvent.fieldData.pop_front();
+  }
+}
 
-    switch (field.type)
-    {
-    case MessageFieldDataTypeBoolean:
-      fields->Set(String::NewSymbol(field.name), Boolean::New(field.value.boolValue));
-      break;
+/*-----------------------------------------------------------------------------
+ * Convert a received message field to a JavaScript value (releases the field
+ * data unless releaseData is false)
+ */
+Local<Value> Subscription::CreateJsFieldValue(MessageFieldData& field, bool releaseData)
+{
+  Local<Value> value;
 
-    case MessageFieldDataTypeInt32:
-      fields->Set(String::NewSymbol(field.name), Int32::New(field.value.int32Value));
-      break;
+  switch (field.type)
+  {
+  case MessageFieldDataTypeBoolean:
+    value = Local<Value>::New(Boolean::New(field.value.boolValue));
+    break;
 
-    case MessageFieldDataTypeNumber:
-      fields->Set(String::NewSymbol(field.name), Number::New(field.value.numberValue));
-      break;
+  case MessageFieldDataTypeInt32:
+    value = Int32::New(field.value.int32Value);
+    break;
 
-    case MessageFieldDataTypeDate:
-      fields->Set(String::NewSymbol(field.name), Date::New((double)(field.value.dateValue.timeInMicroSecs / 1000)));
-      break;
+  case MessageFieldDataTypeNumber:
+    value = Number::New(field.value.numberValue);
+    break;
 
-    case MessageFieldDataTypeString:
-      fields->Set(String::NewSymbol(field.name), String::New(field.value.stringValue));
-      tvaReleaseFieldValue(field.value.stringValue);
-      break;
+  case MessageFieldDataTypeDate:
+    value = Date::New((double)(field.value.dateValue.timeInMicroSecs / 1000));
+    break;
 
-    case MessageFieldDataTypeBooleanArray:
-      {
-        TVA_BOOLEAN* arrayData = (TVA_BOOLEAN*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Boolean::New((arrayData[i] != 0)));
-        }
+  case MessageFieldDataTypeString:
+    value = String::New(field.value.stringValue);
+    if (releaseData) tvaReleaseFieldValue(field.value.stringValue);
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeBooleanArray:
+    {
+      TVA_BOOLEAN* arrayData = (TVA_BOOLEAN*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Boolean::New((arrayData[i] != 0)));
       }
-      break;
 
-    case MessageFieldDataTypeInt16Array:
-      {
-        TVA_INT16* arrayData = (TVA_INT16*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Int32::New((int)arrayData[i]));
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeInt16Array:
+    {
+      TVA_INT16* arrayData = (TVA_INT16*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Int32::New((int)arrayData[i]));
       }
-      break;
 
-    case MessageFieldDataTypeInt32Array:
-      {
-        TVA_INT32* arrayData = (TVA_INT32*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Int32::New(arrayData[i]));
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeInt32Array:
+    {
+      TVA_INT32* arrayData = (TVA_INT32*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Int32::New(arrayData[i]));
       }
-      break;
 
-    case MessageFieldDataTypeInt64Array:
-      {
-        TVA_INT64* arrayData = (TVA_INT64*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Number::New((double)arrayData[i]));
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeInt64Array:
+    {
+      TVA_INT64* arrayData = (TVA_INT64*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Number::New((double)arrayData[i]));
       }
-      break;
 
-    case MessageFieldDataTypeFloatArray:
-      {
-        TVA_FLOAT* arrayData = (TVA_FLOAT*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Number::New((double)arrayData[i]));
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeFloatArray:
+    {
+      TVA_FLOAT* arrayData = (TVA_FLOAT*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Number::New((double)arrayData[i]));
       }
-      break;
 
-    case MessageFieldDataTypeDoubleArray:
-      {
-        TVA_DOUBLE* arrayData = (TVA_DOUBLE*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Number::New((double)arrayData[i]));
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeDoubleArray:
+    {
+      TVA_DOUBLE* arrayData = (TVA_DOUBLE*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Number::New((double)arrayData[i]));
       }
-      break;
 
-    case MessageFieldDataTypeDateArray:
-      {
-        TVA_DATE* arrayData = (TVA_DATE*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, Date::New((double)(arrayData[i].timeInMicroSecs / 1000)));
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeDateArray:
+    {
+      TVA_DATE* arrayData = (TVA_DATE*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, Date::New((double)(arrayData[i].timeInMicroSecs / 1000)));
       }
-      break;
 
-    case MessageFieldDataTypeStringArray:
-      {
-        TVA_STRING* arrayData = (TVA_STRING*)field.value.arrayValue;
-        Local<Array> fieldData = Array::New();
-        for (int i = 0; i < field.count; i++)
-        {
-          fieldData->Set(i, String::New(arrayData[i]));
-          tvaReleaseFieldValue(arrayData[i]);
-        }
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
 
-        fields->Set(String::NewSymbol(field.name), fieldData);
-        tvaReleaseFieldValue(arrayData);
+  case MessageFieldDataTypeStringArray:
+    {
+      TVA_STRING* arrayData = (TVA_STRING*)field.value.arrayValue;
+      Local<Array> fieldData = Array::New();
+      for (int i = 0; i < field.count; i++)
+      {
+        fieldData->Set(i, String::New(arrayData[i]));
+        if (releaseData) tvaReleaseFieldValue(arrayData[i]);
       }
-      break;
 
-    default:
-      break;
+      value = fieldData;
+      if (releaseData) tvaReleaseFieldValue(arrayData);
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return value;
+}
+
+/*-----------------------------------------------------------------------------
+ * Create an object to be sent to JavaScript
+ */
+Local<Object> Subscription::CreateJsMessageObject(MessageEvent& messageEvent)
+{
+  Local<Object> fields = Object::New();
+  while (!messageEvent.fieldData.empty())
+  {
+    MessageFieldData field = messageEvent.fieldData.front();
+    messageEvent.fieldData.pop_front();
+
+    // Cached field data belongs to the replay cache segment
+    Local<Value> value = CreateJsFieldValue(field, !messageEvent.isCached);
+    if (!value.IsEmpty())
+    {
+      fields->Set(String::NewSymbol(field.name), value);
     }
   }
 
-  Local<Object> message = Object::New();
-  message->Set(String::NewSymbol("topic"), String::New(messageEvent.tvaMessage->topicName), ReadOnly);
-  message->Set(String::NewSymbol("generationTime"), Date::New((double)(messageEvent.tvaMessage->msgGenerationTime / 1000)), ReadOnly);
-  message->Set(String::NewSymbol("receiveTime"), Date::New((double)(messageEvent.tvaMessage->msgReceiveTime / 1000)), ReadOnly);
-  message->Set(String::NewSymbol("lossGap"), Int32::New(messageEvent.tvaMessage->topicSeqGap), ReadOnly);
+  Local<Object> message = messageTemplate->NewInstance();
+  message->Set(String::NewSymbol("topic"), String::New(messageEvent.topicName), ReadOnly);
+  message->Set(String::NewSymbol("generationTime"), Date::New((double)(messageEvent.generationTime / 1000)), ReadOnly);
+  message->Set(String::NewSymbol("receiveTime"), Date::New((double)(messageEvent.receiveTime / 1000)), ReadOnly);
+  message->Set(String::NewSymbol("lossGap"), Int32::New(messageEvent.lossGap), ReadOnly);
   message->Set(String::NewSymbol("fields"), fields, ReadOnly);
-  message->Set(String::NewSymbol("reserved"), Number::New((double)((intptr_t)(messageEvent.tvaMessage))), ReadOnly);
 
 #ifdef TVA_MSG_ISFROMJMS
   if (messageEvent.jmsMessageType == TVA_JMS_MSG_TYPE_TEXT)
@@ -706,176 +1020,1660 @@ Local<Object> Subscription::CreateJsMessageObject(MessageEvent& messageEvent)
 }
 
 /*-----------------------------------------------------------------------------
- * Post async message received event to JavaScript
+ * Release the queued messages without delivering them, the subscription or
+ * the session's dispatcher stopped.  GD messages are not acknowledged, the
+ * application never saw them.
  */
-void Subscription::MessageAsyncEvent(uv_async_t* async, int status)
+void Subscription::DiscardEvents()
 {
-  HandleScope scope;
-  Subscription* subscription = (Subscription*)async->data;
-  MessageEvent messageEvent;
+  std::vector<MessageEvent> discarded;
 
-  Local<Object> context = Context::GetCurrent()->Global();
-  while (subscription->GetNextMessageEvent(messageEvent))
+  uv_mutex_lock(&_messageEventLock);
+  while (!_messageEventQueue.empty())
+  {
+    discarded.push_back(_messageEventQueue.front());
+    _messageEventQueue.pop();
+  }
+  uv_mutex_unlock(&_messageEventLock);
+
+  for (size_t i = 0; i < discarded.size(); i++)
   {
-    subscription->InvokeJsMessageEvent(context, messageEvent);
+    _drops.Increment();
+    ReleaseMessageEvent(discarded[i]);
+    tvaReleaseMessageData(discarded[i].tvaMessage);
   }
 }
 
 /*-----------------------------------------------------------------------------
- * Post async message received event to JavaScript
+ * Deliver received messages to JavaScript (called by the session dispatcher)
  */
-void Subscription::InvokeJsMessageEvent(Local<Object> context, MessageEvent& messageEvent)
+void Subscription::Dispatch(size_t maxEvents, uint64_t deadline)
 {
-  Local<Object> message = Subscription::CreateJsMessageObject(messageEvent);
-  Handle<Value> argv[] = { message };
-  
-  TryCatch tryCatch;
+  HandleScope scope;
+  MessageEvent messageEvent;
 
-  Emit(EVT_MESSAGE, 1, argv);
-  if (tryCatch.HasCaught())
+  Local<Object> context = Context::GetCurrent()->Global();
+  if (_aggregator && _aggregator->HasCompleted())
   {
-    node::FatalException(tryCatch);
+    InvokeJsAggregateEvent(context);
   }
 
-  if (_qos != TVA_QOS_GUARANTEED_DELIVERY)
+  // The backfill failed, the application learns of the history it misses
+  // before the live messages that follow
+  uv_mutex_lock(&_messageEventLock);
+  bool isBackfillErrorPending = _isBackfillErrorPending && !_isBackfilling;
+  _isBackfillErrorPending = _isBackfillErrorPending && !isBackfillErrorPending;
+  uv_mutex_unlock(&_messageEventLock);
+
+  if (isBackfillErrorPending)
   {
-    // Non-GD messages must be released.
-    tvaReleaseMessageData(messageEvent.tvaMessage);
+    TryCatch tryCatch;
+
+    Handle<Value> argv[] = { String::New(GetBackfillError()) };
+    Emit(EVT_ERROR, 1, argv);
+
+    if (tryCatch.HasCaught())
+    {
+      node::FatalException(tryCatch);
+    }
   }
-  else 
+
+  if (GetDeliveryMode() == SubscriptionDeliveryModeColumnar)
   {
-    // Is a GD message.  If ACK mode is "auto" acknowledge it now.
-    if (_ackMode == GdSubscriptionAckModeAuto)
+    std::vector<MessageEvent> messageEvents;
+    uint64_t drainTime = uv_hrtime();
+    while ((messageEvents.size() < maxEvents) && GetNextMessageEvent(messageEvent))
     {
-      tvagdMsgACK(messageEvent.tvaMessage);
+      messageEvents.push_back(messageEvent);
     }
-  }
-}
+
+    if (!messageEvents.empty())
+    {
+      InvokeJsColumnarEvent(context, messageEvents);
+
+      // The whole batch is handled by a single listener call
+      uint64_t completeTime = uv_hrtime();
+      for (size_t i = 0; i < messageEvents.size(); i++)
+      {
+        RecordLatency(LatencyStageQueue, drainTime - messageEvents[i].postTime);
+        RecordLatency(LatencyStageTotal, completeTime - messageEvents[i].callbackTime);
+      }
+      RecordLatency(LatencyStageHandler, completeTime - drainTime);
+    }
+  }
+  else
+  {
+    size_t count = 0;
+    while ((count < maxEvents) && GetNextMessageEvent(messageEvent))
+    {
+      uint64_t drainTime = uv_hrtime();
+      InvokeJsMessageEvent(context, messageEvent);
+
+      uint64_t completeTime = uv_hrtime();
+      RecordLatency(LatencyStageQueue, drainTime - messageEvent.postTime);
+      RecordLatency(LatencyStageHandler, completeTime - drainTime);
+      RecordLatency(LatencyStageTotal, completeTime - messageEvent.callbackTime);
+      count++;
+
+      // Out of time, the rest is delivered on a later turn
+      if (completeTime >= deadline)
+      {
+        break;
+      }
+    }
+  }
+
+  DrainComplete();
+}
+
+/*-----------------------------------------------------------------------------
+ * Post async message received event to JavaScript
+ */
+void Subscription::InvokeJsMessageEvent(Local<Object> context, MessageEvent& messageEvent)
+{
+  // Pick the listener before building the message, so messages nobody
+  // listens to are never converted
+  Persistent<Function> route;
+  bool isRouted = _topicRoutes.Match(messageEvent.tvaMessage->topicName, route);
+  if (!isRouted && (GetListenerCount(EVT_MESSAGE) == 0))
+  {
+    // A GD message is only acknowledged when acks follow the listener's
+    // return, otherwise it is left unacknowledged like any the application
+    // never acknowledged
+    ReleaseMessageEvent(messageEvent);
+    if ((_qos == TVA_QOS_GUARANTEED_DELIVERY) &&
+        (_ackMode == GdSubscriptionAckModeAuto) && (_ackOn == GdSubscriptionAckOnReturn))
+    {
+      _session->GetGdAcker()->Ack(messageEvent.tvaMessage);
+    }
+    else
+    {
+      tvaReleaseMessageData(messageEvent.tvaMessage);
+    }
+    return;
+  }
+
+  bool isCursor = (_deliveryMode == SubscriptionDeliveryModeCursor);
+  Local<Object> message = (isCursor) ? BeginCursor(messageEvent) : Subscription::CreateJsMessageObject(messageEvent);
+  Handle<Value> argv[] = { message, Undefined() };
+  int argc = 1;
+
+  if ((_qos == TVA_QOS_GUARANTEED_DELIVERY) && 
+      ((_ackMode == GdSubscriptionAckModeManual) || (_ackOn == GdSubscriptionAckOnResolve)))
+  {
+    // The message is acknowledged later, keep a handle to it
+    double handle = _ackHandles.Add(messageEvent.tvaMessage);
+    _ackOrder.push_back(handle);
+
+    message->SetInternalField(MESSAGE_FIELD_ACK_HANDLE, Number::New(handle));
+    message->SetInternalField(MESSAGE_FIELD_SUBSCRIPTION, External::New(this));
+
+    if (_ackMode == GdSubscriptionAckModeAuto)
+    {
+      Handle<Value> bindArgv[] = { handle_, message };
+      argv[1] = bindFunction->Call(ackDoneFunction, 2, bindArgv);
+      argc = 2;
+    }
+  }
+  
+  TryCatch tryCatch;
+
+  if (isRouted)
+  {
+    // The route may be removed by its own listener
+    Local<Function> handler = Local<Function>::New(route);
+    handler->Call(context, argc, argv);
+  }
+  else
+  {
+    Emit(EVT_MESSAGE, argc, argv);
+  }
+
+  if (isCursor)
+  {
+    EndCursor(messageEvent);
+  }
+
+  if (tryCatch.HasCaught())
+  {
+    node::FatalException(tryCatch);
+  }
+
+  CompleteMessageEvent(messageEvent);
+}
+
+/*-----------------------------------------------------------------------------
+ * Release or acknowledge a message once it has been delivered to JavaScript
+ */
+void Subscription::CompleteMessageEvent(MessageEvent& messageEvent)
+{
+  if (_qos != TVA_QOS_GUARANTEED_DELIVERY)
+  {
+    // Non-GD messages must be released.
+    tvaReleaseMessageData(messageEvent.tvaMessage);
+  }
+  else 
+  {
+    // Is a GD message.  If ACK mode is "auto" hand it to the session's acker now.
+    if ((_ackMode == GdSubscriptionAckModeAuto) && (_ackOn == GdSubscriptionAckOnReturn))
+    {
+      _session->GetGdAcker()->Ack(messageEvent.tvaMessage);
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Message 'done' callback when using ackOn 'resolve' with GD
+ *
+ * subscription.on('message', function (message, done) {
+ *     // Message handled, acknowledge it
+ *     done();
+ * });
+ */
+Handle<Value> Subscription::AckDone(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+  double handle;
+
+  // Nothing left to acknowledge once the subscription is stopped
+  if (!subscription->IsInUse() || !subscription->GetAckHandle(args[0], handle))
+  {
+    return scope.Close(Undefined());
+  }
+
+  TVA_MESSAGE* tvaMessage = subscription->_ackHandles.Remove(handle);
+  if (tvaMessage == NULL)
+  {
+    ThrowException(Exception::Error(String::New("Message already acknowledged")));
+    return scope.Close(Undefined());
+  }
+  subscription->TrimAckOrder();
+
+  subscription->_session->GetGdAcker()->Ack(tvaMessage);
+
+  return scope.Close(Undefined());
+}
+
+
+/*****     Cursor delivery     *****/
+
+/*-----------------------------------------------------------------------------
+ * Point the subscription's cursor at a message
+ */
+Local<Object> Subscription::BeginCursor(MessageEvent& messageEvent)
+{
+  if (_cursor.IsEmpty())
+  {
+    _cursor = Persistent<Object>::New(cursorTemplate->NewInstance());
+    _cursor->SetInternalField(0, External::New(this));
+  }
+
+  _cursorFields.clear();
+  std::list<MessageFieldData>::iterator fieldIterator;
+  for (fieldIterator = messageEvent.fieldData.begin(); fieldIterator != messageEvent.fieldData.end(); fieldIterator++)
+  {
+    _cursorFields.push_back(&(*fieldIterator));
+  }
+
+  _cursorEvent = &messageEvent;
+  return Local<Object>::New(_cursor);
+}
+
+/*-----------------------------------------------------------------------------
+ * Detach the cursor from its message and release the message fields
+ */
+void Subscription::EndCursor(MessageEvent& messageEvent)
+{
+  _cursorEvent = NULL;
+  _cursorFields.clear();
+  ReleaseMessageEvent(messageEvent);
+}
+
+/*-----------------------------------------------------------------------------
+ * Get the subscription of a cursor, throws if the cursor is not attached to a
+ * message
+ */
+Subscription* Subscription::GetCursorSubscription(Handle<Object> cursor)
+{
+  Subscription* subscription = (Subscription*)External::Unwrap(cursor->GetInternalField(0));
+  if (subscription->_cursorEvent == NULL)
+  {
+    ThrowException(Exception::Error(String::New("Cursor used outside of its message listener")));
+    return NULL;
+  }
+
+  return subscription;
+}
+
+/*-----------------------------------------------------------------------------
+ * Find a field of the current message by index or by name
+ */
+MessageFieldData* Subscription::GetCursorField(Subscription* subscription, Local<Value> key)
+{
+  if (key->IsNumber())
+  {
+    int32_t index = key->Int32Value();
+    if ((index >= 0) && ((size_t)index < subscription->_cursorFields.size()))
+    {
+      return subscription->_cursorFields[index];
+    }
+  }
+  else if (key->IsString())
+  {
+    String::AsciiValue name(key);
+    for (size_t i = 0; i < subscription->_cursorFields.size(); i++)
+    {
+      if (strcmp(subscription->_cursorFields[i]->name, *name) == 0)
+      {
+        return subscription->_cursorFields[i];
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Cursor message properties
+ */
+Handle<Value> Subscription::CursorGetProperty(Local<String> property, const AccessorInfo& info)
+{
+  HandleScope scope;
+  Subscription* subscription = GetCursorSubscription(info.Holder());
+  if (subscription == NULL)
+  {
+    return scope.Close(Undefined());
+  }
+
+  TVA_MESSAGE* tvaMessage = subscription->_cursorEvent->tvaMessage;
+  switch (info.Data()->Int32Value())
+  {
+  case CURSOR_PROPERTY_TOPIC:
+    return scope.Close(String::New(tvaMessage->topicName));
+
+  case CURSOR_PROPERTY_GENERATION_TIME:
+    return scope.Close(Number::New((double)(tvaMessage->msgGenerationTime / 1000)));
+
+  case CURSOR_PROPERTY_RECEIVE_TIME:
+    return scope.Close(Number::New((double)(tvaMessage->msgReceiveTime / 1000)));
+
+  case CURSOR_PROPERTY_LOSS_GAP:
+    return scope.Close(Int32::New(tvaMessage->topicSeqGap));
+
+  case CURSOR_PROPERTY_FIELD_COUNT:
+    return scope.Close(Int32::New((int32_t)subscription->_cursorFields.size()));
+  }
+
+  return scope.Close(Undefined());
+}
+
+/*-----------------------------------------------------------------------------
+ * Get a field value of the current message
+ *
+ * var value = cursor.get(nameOrIndex);
+ */
+Handle<Value> Subscription::CursorGet(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = GetCursorSubscription(args.Holder());
+  if (subscription == NULL)
+  {
+    return scope.Close(Undefined());
+  }
+
+  // The field data is released once the listener returns, not when read
+  MessageFieldData* field = GetCursorField(subscription, args[0]);
+  if (field)
+  {
+    Local<Value> value = CreateJsFieldValue(*field, false);
+    if (!value.IsEmpty())
+    {
+      return scope.Close(value);
+    }
+  }
+
+  return scope.Close(Undefined());
+}
+
+/*-----------------------------------------------------------------------------
+ * Get a numeric field value of the current message, without creating any
+ * object (dates are returned in ms since epoch, booleans as 0 or 1)
+ *
+ * var value = cursor.getNumber(nameOrIndex);
+ */
+Handle<Value> Subscription::CursorGetNumber(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = GetCursorSubscription(args.Holder());
+  if (subscription == NULL)
+  {
+    return scope.Close(Undefined());
+  }
+
+  MessageFieldData* field = GetCursorField(subscription, args[0]);
+  if (field)
+  {
+    switch (field->type)
+    {
+    case MessageFieldDataTypeBoolean:
+      return scope.Close(Int32::New((field->value.boolValue) ? 1 : 0));
+
+    case MessageFieldDataTypeInt32:
+      return scope.Close(Int32::New(field->value.int32Value));
+
+    case MessageFieldDataTypeNumber:
+      return scope.Close(Number::New(field->value.numberValue));
+
+    case MessageFieldDataTypeDate:
+      return scope.Close(Number::New((double)(field->value.dateValue.timeInMicroSecs / 1000)));
+
+    default:
+      break;
+    }
+  }
+
+  return scope.Close(Number::New(std::numeric_limits<double>::quiet_NaN()));
+}
+
+/*-----------------------------------------------------------------------------
+ * Get the name of a field of the current message
+ *
+ * var name = cursor.getName(index);
+ */
+Handle<Value> Subscription::CursorGetName(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = GetCursorSubscription(args.Holder());
+  if (subscription == NULL)
+  {
+    return scope.Close(Undefined());
+  }
+
+  MessageFieldData* field = (args[0]->IsNumber()) ? GetCursorField(subscription, args[0]) : NULL;
+  if (field)
+  {
+    return scope.Close(String::New(field->name));
+  }
+
+  return scope.Close(Undefined());
+}
+
+
+/*****     Columnar delivery     *****/
+
+struct ColumnarSchemaGroup
+{
+  std::vector<MessageEvent*> messageEvents;
+};
+
+/*-----------------------------------------------------------------------------
+ * Create a typed array (Float64Array, Int32Array, ...) and return its storage
+ */
+static Local<Object> NewTypedArray(const char* arrayType, int length, void** data)
+{
+  Local<Function> arrayConstructor = Local<Function>::Cast(Context::GetCurrent()->Global()->Get(String::NewSymbol(arrayType)));
+  Handle<Value> argv[1] = { Int32::New(length) };
+  Local<Object> array = arrayConstructor->NewInstance(1, argv);
+  *data = array->GetIndexedPropertiesExternalArrayData();
+  return array;
+}
+
+/*-----------------------------------------------------------------------------
+ * Build the schema key of a message: the field count, then every field's
+ * name, terminated, and type in order, so no two schemas share a key
+ */
+static void GetMessageSchemaKey(MessageEvent& messageEvent, std::string& key)
+{
+  size_t fieldCount = messageEvent.fieldData.size();
+  key.append((const char*)&fieldCount, sizeof(fieldCount));
+
+  std::list<MessageFieldData>::iterator fieldIterator;
+  for (fieldIterator = messageEvent.fieldData.begin(); 
+       fieldIterator != messageEvent.fieldData.end(); 
+       fieldIterator++)
+  {
+    key.append(fieldIterator->name);
+    key.push_back('\0');
+    key.push_back((char)('A' + fieldIterator->type));
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Post a drained set of messages to JavaScript as columnar batches, one 
+ * batch per message schema
+ */
+void Subscription::InvokeJsColumnarEvent(Local<Object> context, std::vector<MessageEvent>& messageEvents)
+{
+  // Group the messages by schema, keeping arrival order within each group
+  std::map<std::string, ColumnarSchemaGroup> schemaGroups;
+  std::vector<ColumnarSchemaGroup*> groupOrder;
+  for (size_t i = 0; i < messageEvents.size(); i++)
+  {
+    std::string key;
+    GetMessageSchemaKey(messageEvents[i], key);
+
+    ColumnarSchemaGroup& group = schemaGroups[key];
+    if (group.messageEvents.empty())
+    {
+      groupOrder.push_back(&group);
+    }
+    group.messageEvents.push_back(&messageEvents[i]);
+  }
+
+  for (size_t g = 0; g < groupOrder.size(); g++)
+  {
+    HandleScope scope;
+    std::vector<MessageEvent*>& group = groupOrder[g]->messageEvents;
+    int count = (int)group.size();
+
+    double* generationTimes;
+    double* receiveTimes;
+    int32_t* lossGaps;
+    Local<Array> topics = Array::New(count);
+    Local<Object> generationTime = NewTypedArray("Float64Array", count, (void**)&generationTimes);
+    Local<Object> receiveTime = NewTypedArray("Float64Array", count, (void**)&receiveTimes);
+    Local<Object> lossGap = NewTypedArray("Int32Array", count, (void**)&lossGaps);
+
+    for (int i = 0; i < count; i++)
+    {
+      TVA_MESSAGE* tvaMessage = group[i]->tvaMessage;
+      topics->Set(i, String::NewSymbol(tvaMessage->topicName));
+      generationTimes[i] = (double)tvaMessage->msgGenerationTime / 1000;
+      receiveTimes[i] = (double)tvaMessage->msgReceiveTime / 1000;
+      lossGaps[i] = tvaMessage->topicSeqGap;
+    }
+
+    // All messages in the group share a schema, so the first message describes the columns
+    std::vector<std::list<MessageFieldData>::iterator> fieldCursors(count);
+    for (int i = 0; i < count; i++)
+    {
+      fieldCursors[i] = group[i]->fieldData.begin();
+    }
+
+    Local<Object> fields = Object::New();
+    std::list<MessageFieldData>& schema = group[0]->fieldData;
+    std::list<MessageFieldData>::iterator schemaIterator;
+    for (schemaIterator = schema.begin(); schemaIterator != schema.end(); schemaIterator++)
+    {
+      MessageFieldDataType fieldType = schemaIterator->type;
+      Local<Object> column;
+
+      if ((fieldType == MessageFieldDataTypeBoolean) || (fieldType == MessageFieldDataTypeInt32) ||
+          (fieldType == MessageFieldDataTypeNumber) || (fieldType == MessageFieldDataTypeDate))
+      {
+        double* values;
+        column = NewTypedArray("Float64Array", count, (void**)&values);
+        for (int i = 0; i < count; i++)
+        {
+          MessageFieldData& field = *fieldCursors[i];
+          switch (fieldType)
+          {
+          case MessageFieldDataTypeBoolean:
+            values[i] = field.value.boolValue ? 1 : 0;
+            break;
+
+          case MessageFieldDataTypeInt32:
+            values[i] = (double)field.value.int32Value;
+            break;
+
+          case MessageFieldDataTypeDate:
+            values[i] = (double)field.value.dateValue.timeInMicroSecs / 1000;
+            break;
+
+          default:
+            values[i] = field.value.numberValue;
+            break;
+          }
+        }
+      }
+      else if (fieldType == MessageFieldDataTypeString)
+      {
+        // Values are not interned, distinct values (IDs, free text) would fill the symbol table
+        Local<Array> values = Array::New(count);
+        for (int i = 0; i < count; i++)
+        {
+          MessageFieldData& field = *fieldCursors[i];
+          values->Set(i, String::New(field.value.stringValue));
+          tvaReleaseFieldValue(field.value.stringValue);
+        }
+        column = values;
+      }
+      else
+      {
+        Local<Array> values = Array::New(count);
+        for (int i = 0; i < count; i++)
+        {
+          values->Set(i, CreateJsFieldValue(*fieldCursors[i]));
+        }
+        column = values;
+      }
+
+      fields->Set(String::NewSymbol(schemaIterator->name), column);
+
+      // Move every message in the group on to its next field
+      for (int i = 0; i < count; i++)
+      {
+        fieldCursors[i]++;
+      }
+    }
+
+    Local<Object> batch = Object::New();
+    batch->Set(String::NewSymbol("count"), Int32::New(count), ReadOnly);
+    batch->Set(String::NewSymbol("topic"), topics, ReadOnly);
+    batch->Set(String::NewSymbol("generationTime"), generationTime, ReadOnly);
+    batch->Set(String::NewSymbol("receiveTime"), receiveTime, ReadOnly);
+    batch->Set(String::NewSymbol("lossGap"), lossGap, ReadOnly);
+    batch->Set(String::NewSymbol("fields"), fields, ReadOnly);
+
+    Handle<Value> argv[] = { batch };
+
+    TryCatch tryCatch;
+
+    Emit(EVT_BATCH, 1, argv);
+    if (tryCatch.HasCaught())
+    {
+      node::FatalException(tryCatch);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+      group[i]->fieldData.clear();
+      CompleteMessageEvent(*group[i]);
+    }
+  }
+}
 
 
 /*****     AckMessage     *****/
 
-struct AckMessageRequest
+struct AckMessageRequest
+{
+  Subscription* subscription;
+  std::vector<TVA_MESSAGE*> tvaMessages;
+  std::vector<TVA_STATUS> results;
+  TVA_STATUS result;
+  Persistent<Value> origMessage;
+  Persistent<Function> complete;
+  bool isBatch;
+  bool perMessage;
+
+  AckMessageRequest()
+  {
+    result = TVA_OK;
+    isBatch = false;
+    perMessage = false;
+  }
+};
+
+/*-----------------------------------------------------------------------------
+ * Get the ack handle of a message delivered by this subscription
+ */
+bool Subscription::GetAckHandle(Local<Value> value, double& handle)
+{
+  if (!value->IsObject())
+  {
+    return false;
+  }
+
+  Local<Object> message = value->ToObject();
+  if ((message->InternalFieldCount() != MESSAGE_FIELD_COUNT) ||
+      (!message->GetInternalField(MESSAGE_FIELD_SUBSCRIPTION)->IsExternal()) ||
+      (External::Unwrap(message->GetInternalField(MESSAGE_FIELD_SUBSCRIPTION)) != this))
+  {
+    return false;
+  }
+
+  handle = message->GetInternalField(MESSAGE_FIELD_ACK_HANDLE)->NumberValue();
+  return true;
+}
+
+/*-----------------------------------------------------------------------------
+ * Drop acknowledged messages from the delivery order.  Those at the front go
+ * at once; those acknowledged out of order are compacted away once they
+ * outnumber the messages still unacknowledged, so the order stays within
+ * twice the unacknowledged messages.
+ */
+void Subscription::TrimAckOrder()
+{
+  while (!_ackOrder.empty() && (_ackHandles.Get(_ackOrder.front()) == NULL))
+  {
+    _ackOrder.pop_front();
+  }
+
+  if (_ackOrder.size() > (2 * _ackHandles.GetCount()) + SUBSCRIPTION_ACK_ORDER_SLACK)
+  {
+    size_t kept = 0;
+    for (size_t i = 0; i < _ackOrder.size(); i++)
+    {
+      if (_ackHandles.Get(_ackOrder[i]) != NULL)
+      {
+        _ackOrder[kept++] = _ackOrder[i];
+      }
+    }
+    _ackOrder.resize(kept);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Acknowledge received messages when using "manual" ack mode with GD
+ *
+ * subscription.acknowledge(message, function (err, message) {
+ *     // Message acknowledge complete
+ * });
+ *
+ * subscription.acknowledge([messages], {options}, function (err, messages) {
+ *     // All messages acknowledged
+ * });
+ */
+Handle<Value> Subscription::AckMessage(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(1, args.Length());
+  PARAM_REQ_OBJECT(0, args);        // message or array of messages
+
+  // Ready arguments
+  Local<Array> messages;
+  Local<Function> complete;
+  bool isBatch = args[0]->IsArray();
+  bool perMessage = false;
+
+  if (isBatch)
+  {
+    messages = Local<Array>::Cast(args[0]);
+  }
+  else
+  {
+    messages = Array::New(1);
+    messages->Set(0, args[0]);
+  }
+
+  for (int i = 1; i < args.Length(); i++)
+  {
+    if (args[i]->IsFunction())
+    {
+      complete = Local<Function>::Cast(args[i]);
+    }
+    else if (args[i]->IsObject())
+    {
+      Local<Value> optionValue = args[i]->ToObject()->Get(String::NewSymbol("perMessage"));
+      perMessage = (!optionValue->IsUndefined() && optionValue->BooleanValue());
+    }
+  }
+
+  // Look up all messages in the subscription's ack handle table before
+  // acknowledging any, so an invalid entry doesn't leave a partial batch
+  std::vector<double> handles(messages->Length());
+  std::set<double> seen;
+  for (uint32_t i = 0; i < messages->Length(); i++)
+  {
+    if (!subscription->GetAckHandle(messages->Get(i), handles[i]))
+    {
+      ThrowException(Exception::TypeError(String::New("Invalid message")));
+      return scope.Close(args.This());
+    }
+
+    if ((subscription->_ackHandles.Get(handles[i]) == NULL) || !seen.insert(handles[i]).second)
+    {
+      ThrowException(Exception::Error(String::New("Message already acknowledged")));
+      return scope.Close(args.This());
+    }
+  }
+
+  AckMessageRequest* request = new AckMessageRequest;
+  request->subscription = subscription;
+  request->isBatch = isBatch;
+  request->perMessage = perMessage;
+  request->origMessage = Persistent<Value>::New(args[0]);
+
+  for (size_t i = 0; i < handles.size(); i++)
+  {
+    request->tvaMessages.push_back(subscription->_ackHandles.Remove(handles[i]));
+  }
+  subscription->TrimAckOrder();
+
+  if (!complete.IsEmpty())
+  {
+    request->complete = Persistent<Function>::New(complete);
+  }
+
+  // Send data to worker thread
+  uv_work_t* req = new uv_work_t();
+  req->data = request;
+
+  uv_queue_work(uv_default_loop(), req, Subscription::AckWorker, Subscription::AckWorkerComplete);
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Acknowledge all outstanding messages up to and including the given message
+ * when using "manual" ack mode with GD
+ *
+ * subscription.ackUpTo(message, function (err, count) {
+ *     // Messages acknowledge complete
+ * });
+ */
+Handle<Value> Subscription::AckUpTo(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(1, args.Length());
+  PARAM_REQ_OBJECT(0, args);        // message
+
+  // Ready arguments
+  Local<Function> complete;
+  double lastHandle;
+
+  if ((args.Length() > 1) && args[1]->IsFunction())
+  {
+    complete = Local<Function>::Cast(args[1]);
+  }
+
+  if (!subscription->GetAckHandle(args[0], lastHandle))
+  {
+    ThrowException(Exception::TypeError(String::New("Invalid message")));
+    return scope.Close(args.This());
+  }
+
+  if (subscription->_ackHandles.Get(lastHandle) == NULL)
+  {
+    ThrowException(Exception::Error(String::New("Message already acknowledged")));
+    return scope.Close(args.This());
+  }
+
+  // Messages are acknowledged in the order they were delivered
+  AckMessageRequest* request = new AckMessageRequest;
+  request->subscription = subscription;
+  request->isBatch = true;
+
+  while (!subscription->_ackOrder.empty())
+  {
+    double handle = subscription->_ackOrder.front();
+    subscription->_ackOrder.pop_front();
+
+    TVA_MESSAGE* tvaMessage = subscription->_ackHandles.Remove(handle);
+    if (tvaMessage)
+    {
+      request->tvaMessages.push_back(tvaMessage);
+    }
+
+    if (handle == lastHandle)
+    {
+      break;
+    }
+  }
+  subscription->TrimAckOrder();
+
+  request->origMessage = Persistent<Value>::New(Integer::New((int32_t)request->tvaMessages.size()));
+
+  if (!complete.IsEmpty())
+  {
+    request->complete = Persistent<Function>::New(complete);
+  }
+
+  // Send data to worker thread
+  uv_work_t* req = new uv_work_t();
+  req->data = request;
+
+  uv_queue_work(uv_default_loop(), req, Subscription::AckWorker, Subscription::AckWorkerComplete);
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Perform GD message ACK
+ */
+void Subscription::AckWorker(uv_work_t* req)
+{
+  AckMessageRequest* request = (AckMessageRequest*)req->data;
+
+  request->results.resize(request->tvaMessages.size());
+  for (size_t i = 0; i < request->tvaMessages.size(); i++)
+  {
+    request->results[i] = tvagdMsgACK(request->tvaMessages[i]);
+    if ((request->results[i] != TVA_OK) && (request->result == TVA_OK))
+    {
+      request->result = request->results[i];
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * GD message ACK complete
+ */
+void Subscription::AckWorkerComplete(uv_work_t* req)
+{
+  HandleScope scope;
+
+  AckMessageRequest* request = (AckMessageRequest*)req->data;
+  delete req;
+
+  Handle<Value> argv[2];
+  if (request->result == TVA_OK)
+  {
+    argv[0] = Undefined();
+  }
+  else
+  {
+    argv[0] = String::New(tvaErrToStr(request->result));
+  }
+  argv[1] = request->origMessage;
+
+  TryCatch tryCatch;
+
+  if (!request->complete.IsEmpty())
+  {
+    request->complete->Call(Context::GetCurrent()->Global(), 2, argv);
+    request->complete.Dispose();
+  }
+
+  if (!request->isBatch)
+  {
+    request->subscription->Emit(EVT_ACK, 2, argv);
+  }
+  else if (request->perMessage)
+  {
+    Local<Array> messages = Local<Array>::Cast(request->origMessage);
+    for (uint32_t i = 0; i < messages->Length(); i++)
+    {
+      Handle<Value> ackArgv[2];
+      if (request->results[i] == TVA_OK)
+      {
+        ackArgv[0] = Undefined();
+      }
+      else
+      {
+        ackArgv[0] = String::New(tvaErrToStr(request->results[i]));
+      }
+      ackArgv[1] = messages->Get(i);
+
+      request->subscription->Emit(EVT_ACK, 2, ackArgv);
+    }
+  }
+
+  if (tryCatch.HasCaught())
+  {
+    node::FatalException(tryCatch);
+  }
+
+  request->origMessage.Dispose();
+
+  delete request;
+}
+
+
+/*****     Statistics     *****/
+
+/*-----------------------------------------------------------------------------
+ * Get the subscription's runtime statistics
+ *
+ * var stats = subscription.stats();
+ */
+Handle<Value> Subscription::Stats(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  size_t queueDepth;
+  size_t peakQueueDepth;
+  subscription->GetQueueDepth(queueDepth, peakQueueDepth);
+
+  // GD messages are outstanding until acknowledged, either still queued or
+  // delivered and waiting for a manual (or 'resolve') ack
+  size_t outstandingGd = 0;
+  if (subscription->_qos == TVA_QOS_GUARANTEED_DELIVERY)
+  {
+    outstandingGd = queueDepth + subscription->_ackHandles.GetCount();
+  }
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("messagesIn"), Number::New((double)subscription->_messagesIn.Get()));
+  result->Set(String::NewSymbol("bytesIn"), Number::New((double)subscription->_bytesIn.Get()));
+  result->Set(String::NewSymbol("decodeErrors"), Number::New((double)subscription->_decodeErrors.Get()));
+  result->Set(String::NewSymbol("lossGap"), Number::New((double)subscription->_lossGap.Get()));
+  result->Set(String::NewSymbol("drops"), Number::New((double)subscription->_drops.Get()));
+  result->Set(String::NewSymbol("queueDepth"), Number::New((double)queueDepth));
+  result->Set(String::NewSymbol("peakQueueDepth"), Number::New((double)peakQueueDepth));
+  result->Set(String::NewSymbol("outstandingGd"), Number::New((double)outstandingGd));
+  result->Set(String::NewSymbol("backfilledMessages"), Number::New((double)subscription->_backfilled.Get()));
+  result->Set(String::NewSymbol("backfillDuplicates"), Number::New((double)subscription->_backfillDuplicates.Get()));
+  if (subscription->_aggregator)
+  {
+    result->Set(String::NewSymbol("aggregateLateMessages"), Number::New((double)subscription->_aggregator->GetLateMessages()));
+  }
+  const char* backfillError = subscription->GetBackfillError();
+  if (backfillError)
+  {
+    result->Set(String::NewSymbol("backfillError"), String::New(backfillError));
+  }
+
+  return scope.Close(result);
+}
+
+
+/*****     Origins     *****/
+
+/*-----------------------------------------------------------------------------
+ * Get the publisher session and topic sequence number of a message (shared
+ * with Replay class), false when the Tervela API does not expose them
+ */
+bool Subscription::GetMessageOrigin(TVA_MESSAGE* message, TVA_UINT32& pubId, TVA_UINT32& sessionId, TVA_UINT64& tsn)
+{
+#ifdef HAVE_MESSAGE_ORIGIN
+  return ((tvaMsgInfoGet(message, TVA_MSGINFO_PUBID, &pubId, sizeof(pubId)) == TVA_OK) &&
+          (tvaMsgInfoGet(message, TVA_MSGINFO_SESSIONID, &sessionId, sizeof(sessionId)) == TVA_OK) &&
+          (tvaMsgInfoGet(message, TVA_MSGINFO_TSN, &tsn, sizeof(tsn)) == TVA_OK));
+#else
+  return false;
+#endif
+}
+
+/*-----------------------------------------------------------------------------
+ * Record the publisher session a message came from (Tervela thread)
+ */
+void Subscription::RecordOrigin(TVA_MESSAGE* message)
+{
+  TVA_UINT32 pubId;
+  TVA_UINT32 sessionId;
+  TVA_UINT64 tsn;
+
+  if (!GetMessageOrigin(message, pubId, sessionId, tsn))
+  {
+    return;
+  }
+
+  uint64_t key = ((uint64_t)pubId << 32) | sessionId;
+
+  uv_mutex_lock(&_originLock);
+  std::map<uint64_t, MessageOrigin>::iterator it = _origins.find(key);
+  if (it == _origins.end())
+  {
+    MessageOrigin origin;
+    origin.pubId = pubId;
+    origin.sessionId = sessionId;
+    origin.firstTsn = tsn;
+    origin.lastTsn = tsn;
+    origin.firstGenerationTime = message->msgGenerationTime;
+    origin.lastGenerationTime = message->msgGenerationTime;
+    origin.messages = 1;
+    _origins[key] = origin;
+  }
+  else
+  {
+    MessageOrigin& origin = it->second;
+    if (tsn > origin.lastTsn)
+    {
+      origin.lastTsn = tsn;
+      origin.lastGenerationTime = message->msgGenerationTime;
+    }
+    origin.messages++;
+  }
+  uv_mutex_unlock(&_originLock);
+}
+
+/*-----------------------------------------------------------------------------
+ * Get the publisher sessions messages were received from
+ *
+ * var origins = subscription.origins();
+ */
+Handle<Value> Subscription::Origins(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  std::vector<MessageOrigin> origins;
+  uv_mutex_lock(&subscription->_originLock);
+  std::map<uint64_t, MessageOrigin>::iterator it;
+  for (it = subscription->_origins.begin(); it != subscription->_origins.end(); it++)
+  {
+    origins.push_back(it->second);
+  }
+  uv_mutex_unlock(&subscription->_originLock);
+
+  Local<Array> result = Array::New((int)origins.size());
+  for (size_t i = 0; i < origins.size(); i++)
+  {
+    Local<Object> origin = Object::New();
+    origin->Set(String::NewSymbol("pubId"), Number::New((double)origins[i].pubId));
+    origin->Set(String::NewSymbol("sessionId"), Number::New((double)origins[i].sessionId));
+    origin->Set(String::NewSymbol("firstTsn"), Number::New((double)origins[i].firstTsn));
+    origin->Set(String::NewSymbol("lastTsn"), Number::New((double)origins[i].lastTsn));
+    origin->Set(String::NewSymbol("firstGenerationTime"), Date::New((double)(origins[i].firstGenerationTime / 1000)));
+    origin->Set(String::NewSymbol("lastGenerationTime"), Date::New((double)(origins[i].lastGenerationTime / 1000)));
+    origin->Set(String::NewSymbol("messages"), Number::New((double)origins[i].messages));
+    result->Set((uint32_t)i, origin);
+  }
+
+  return scope.Close(result);
+}
+
+
+/*****     Backfill     *****/
+
+/*-----------------------------------------------------------------------------
+ * Replay the topic's history from the backfill time until now, the live
+ * subscription is already holding its messages
+ */
+TVA_STATUS Subscription::StartBackfill(char* topic)
+{
+  TVA_REPLAY_REQ replayReq;
+
+  replayReq.pubId = TVA_REPLAY_PUBID_ANY;
+  replayReq.sessionId = TVA_REPLAY_SESSIONID_ANY;
+  replayReq.tsnStart = TVA_REPLAY_TSN_ANY;
+  replayReq.tsnEnd = TVA_REPLAY_TSN_ANY;
+  tva_strncpy(replayReq.topic, topic, sizeof(replayReq.topic));
+  replayReq.timeStart = _backfillSince;
+  replayReq.timeEnd = (TVA_UINT64)tva_time_now_us();
+  _backfillUntil = replayReq.timeEnd;
+
+  return tvaReplayHistCbNew(GetSession()->GetHandle(), Subscription::BackfillMessageReceivedEvent,
+                            &_backfillContext, &replayReq, 0, &_backfillHandle);
+}
+
+/*-----------------------------------------------------------------------------
+ * Process a message from the backfill replay (Tervela thread)
+ */
+void Subscription::BackfillMessageReceivedEvent(TVA_MESSAGE* message, void* context)
+{
+  Subscription* subscription = ((SubscriptionBackfill*)context)->subscription;
+  MessageEvent messageEvent;
+  uint64_t callbackTime = uv_hrtime();
+
+  TVA_STATUS rc = Subscription::ProcessRecievedMessage(message, messageEvent);
+  if (rc == TVA_OK)
+  {
+    messageEvent.callbackTime = callbackTime;
+    messageEvent.postTime = uv_hrtime();
+    messageEvent.hasOrigin = GetMessageOrigin(message, messageEvent.pubId, messageEvent.sessionId, messageEvent.tsn);
+
+    subscription->_bytesIn.Add(messageEvent.payloadSize);
+
+    bool isLastMessage = messageEvent.isLastMessage;
+    if (!subscription->PostBackfillMessageEvent(messageEvent))
+    {
+      // Cut short, the live messages have taken over
+      ReleaseMessageEvent(messageEvent);
+      tvaReleaseMessageData(messageEvent.tvaMessage);
+    }
+    else if (isLastMessage)
+    {
+      subscription->EndBackfill();
+    }
+  }
+  else
+  {
+    subscription->_decodeErrors.Increment();
+    tvaReleaseMessageData(message);
+  }
+}
+
+/*-----------------------------------------------------------------------------
+ * Backfill replay notification (Tervela thread), the replay ended without a
+ * last message, e.g. an empty range, or failed: live delivery starts anyway
+ */
+void Subscription::BackfillNotificationEvent(SubscriptionBackfill* backfill, TVA_STATUS status)
+{
+  Subscription* subscription = backfill->subscription;
+
+  uv_mutex_lock(&subscription->_messageEventLock);
+  if (!IsReplayEndStatus(status) && subscription->_isBackfilling)
+  {
+    subscription->_backfillStatus = status;
+    subscription->_isBackfillErrorPending = true;
+  }
+  uv_mutex_unlock(&subscription->_messageEventLock);
+
+  subscription->EndBackfill();
+}
+
+/*-----------------------------------------------------------------------------
+ * Queue a backfilled message, remembering how far the backfill got so the
+ * same messages can be dropped from the live subscription.  False once the
+ * backfill has ended, the message is not queued.
+ */
+bool Subscription::PostBackfillMessageEvent(MessageEvent& messageEvent)
 {
-  Subscription* subscription;
-  TVA_MESSAGE* tvaMessage;
-  TVA_STATUS result;
-  Persistent<Object> origMessage;
-  Persistent<Function> complete;
-};
+  uv_mutex_lock(&_messageEventLock);
+
+  if (!_isBackfilling)
+  {
+    uv_mutex_unlock(&_messageEventLock);
+    return false;
+  }
+
+  _backfilled.Increment();
+  if (_aggregator)
+  {
+    _aggregator->Add(messageEvent, 0);
+  }
+
+  if (messageEvent.hasOrigin)
+  {
+    TVA_UINT64& tsn = _backfillTsns[((uint64_t)messageEvent.pubId << 32) | messageEvent.sessionId];
+    if (messageEvent.tsn > tsn)
+    {
+      tsn = messageEvent.tsn;
+    }
+  }
+
+  // Live messages generated in the same microsecond are only told apart by
+  // how many the backfill delivered
+  std::map<std::string, BackfillPosition>::iterator it = _backfillTimes.find(messageEvent.topicName);
+  if (it == _backfillTimes.end())
+  {
+    BackfillPosition position = { messageEvent.generationTime, 1 };
+    _backfillTimes[messageEvent.topicName] = position;
+  }
+  else if (messageEvent.generationTime > it->second.generationTime)
+  {
+    it->second.generationTime = messageEvent.generationTime;
+    it->second.count = 1;
+  }
+  else if (messageEvent.generationTime == it->second.generationTime)
+  {
+    it->second.count++;
+  }
+
+  // The backfill starts with the subscription, before JavaScript has it, and
+  // is not limited by the pause buffer since nothing is lost by waiting
+  _messageEventQueue.push(messageEvent);
+  if (_isInUse && !_isPaused)
+  {
+    _dispatcher->Schedule(this);
+  }
+
+  if (_messageEventQueue.size() > _peakQueueDepth)
+  {
+    _peakQueueDepth = _messageEventQueue.size();
+  }
+
+  uv_mutex_unlock(&_messageEventLock);
+  return true;
+}
 
 /*-----------------------------------------------------------------------------
- * Acknowledge a received message when using "manual" ack mode with GD
+ * Hold a live message while the backfill runs, or drop it when the backfill
+ * already delivered it, false when it should be posted as usual.
  *
- * subscription.ackMessage(message, function (err) {
- *     // Message acknowledge complete
- * });
+ * Live messages are never dropped for the hold limit: once it is reached the
+ * backfill is cut short instead, the held messages are delivered and the
+ * history missed is reported with an 'error' event.
  */
-Handle<Value> Subscription::AckMessage(const Arguments& args)
+bool Subscription::HoldLiveMessageEvent(MessageEvent& messageEvent)
 {
-  HandleScope scope;
-  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+  std::vector<MessageEvent> duplicates;
+  bool isHeld = false;
+  bool isDuplicate = false;
 
-  // Arguments checking
-  PARAM_REQ_NUM(1, args.Length());
-  PARAM_REQ_OBJECT(0, args);        // message
+  uv_mutex_lock(&_messageEventLock);
+  if (_isBackfilling && (_backfillHeld.size() >= _backfillHoldLimit))
+  {
+    _isBackfillTruncated = true;
+    _isBackfillErrorPending = true;
+    SpliceBackfillHeld(duplicates);
+  }
 
-  // Ready arguments
-  Local<Object> message = Local<Object>::Cast(args[0]);
-  Local<Function> complete;
-  TVA_MESSAGE* tvaMessage = NULL;
+  if (_isBackfilling)
+  {
+    _backfillHeld.push_back(messageEvent);
+    isHeld = true;
+  }
+  else if (_isDeduplicating)
+  {
+    isDuplicate = IsBackfilled(messageEvent);
+  }
+  uv_mutex_unlock(&_messageEventLock);
 
-  if (args.Length() > 1)
+  if (isDuplicate)
   {
-    complete = Local<Function>::Cast(args[1]);
+    duplicates.push_back(messageEvent);
+  }
+
+  for (size_t i = 0; i < duplicates.size(); i++)
+  {
+    _backfillDuplicates.Increment();
+    ReleaseMessageEvent(duplicates[i]);
+    tvaReleaseMessageData(duplicates[i].tvaMessage);
+  }
+
+  return (isHeld || isDuplicate);
+}
+
+/*-----------------------------------------------------------------------------
+ * Was a live message delivered by the backfill (message event lock held)
+ *
+ * Publisher sessions are compared by sequence number, or topics by generation
+ * time when the Tervela API does not expose the message origin. Each is
+ * forgotten once the live messages have moved past the backfill, and all of
+ * them once a live message is generated well after the backfill's range, so
+ * publishers that went quiet are not compared forever.
+ */
+bool Subscription::IsBackfilled(MessageEvent& messageEvent)
+{
+  if (messageEvent.generationTime > _backfillUntil + SUBSCRIPTION_BACKFILL_DEDUP_GRACE)
+  {
+    _backfillTsns.clear();
+    _backfillTimes.clear();
+    _isDeduplicating = false;
+    return false;
   }
 
-  // Look for the reserved field in the message
-  std::vector<std::string> fieldNames = cvv8::CastFromJS<std::vector<std::string> >(message->GetPropertyNames());
-  for (size_t i = 0; i < fieldNames.size(); i++)
+  if (messageEvent.hasOrigin)
   {
-    char* fieldName = (char*)(fieldNames[i].c_str());
-    if (tva_str_casecmp(fieldName, "reserved") == 0)
+    std::map<uint64_t, TVA_UINT64>::iterator it =
+      _backfillTsns.find(((uint64_t)messageEvent.pubId << 32) | messageEvent.sessionId);
+    if (it != _backfillTsns.end())
     {
-      Local<Value> fieldValue = message->Get(String::NewSymbol(fieldName));
-      tvaMessage = (TVA_MESSAGE*)((intptr_t)fieldValue->NumberValue());
-      break;
+      if (messageEvent.tsn <= it->second)
+      {
+        return true;
+      }
+      _backfillTsns.erase(it);
+    }
+  }
+  else
+  {
+    std::map<std::string, BackfillPosition>::iterator it = _backfillTimes.find(messageEvent.topicName);
+    if (it != _backfillTimes.end())
+    {
+      if (messageEvent.generationTime < it->second.generationTime)
+      {
+        return true;
+      }
+
+      if ((messageEvent.generationTime == it->second.generationTime) && (it->second.count > 0))
+      {
+        it->second.count--;
+        return true;
+      }
     }
   }
 
-  if (tvaMessage == NULL)
+  _backfillTimes.erase(messageEvent.topicName);
+  _isDeduplicating = !(_backfillTsns.empty() && _backfillTimes.empty());
+  return false;
+}
+
+/*-----------------------------------------------------------------------------
+ * Splice the held live messages after the backfill (Tervela thread)
+ */
+void Subscription::EndBackfill()
+{
+  std::vector<MessageEvent> duplicates;
+
+  uv_mutex_lock(&_messageEventLock);
+  if (_isBackfilling)
   {
-    ThrowException(Exception::TypeError(String::New("Invalid message")));
-    return scope.Close(args.This());
+    SpliceBackfillHeld(duplicates);
   }
+  uv_mutex_unlock(&_messageEventLock);
 
-  // Send data to worker thread
-  AckMessageRequest* request = new AckMessageRequest;
-  request->subscription = subscription;
-  request->tvaMessage = tvaMessage;
-  request->origMessage = Persistent<Object>::New(message);
+  for (size_t i = 0; i < duplicates.size(); i++)
+  {
+    _backfillDuplicates.Increment();
+    ReleaseMessageEvent(duplicates[i]);
+    tvaReleaseMessageData(duplicates[i].tvaMessage);
+  }
+}
 
-  if (!complete.IsEmpty())
+/*-----------------------------------------------------------------------------
+ * End the backfill, queueing the held live messages it did not deliver and
+ * returning those it did (message event lock held)
+ */
+void Subscription::SpliceBackfillHeld(std::vector<MessageEvent>& duplicates)
+{
+  for (size_t i = 0; i < _backfillHeld.size(); i++)
   {
-    request->complete = Persistent<Function>::New(complete);
+    MessageEvent& messageEvent = _backfillHeld[i];
+    if (IsBackfilled(messageEvent))
+    {
+      duplicates.push_back(messageEvent);
+    }
+    else
+    {
+      if (_aggregator)
+      {
+        _aggregator->Add(messageEvent, 0);
+      }
+      _messageEventQueue.push(messageEvent);
+    }
   }
+  _backfillHeld.clear();
 
-  uv_work_t* req = new uv_work_t();
-  req->data = request;
+  _isBackfilling = false;
+  _isDeduplicating = !(_backfillTsns.empty() && _backfillTimes.empty());
 
-  uv_queue_work(uv_default_loop(), req, Subscription::AckWorker, Subscription::AckWorkerComplete);
+  if (_isInUse && !_isPaused && (!_messageEventQueue.empty() || _isBackfillErrorPending))
+  {
+    _dispatcher->Schedule(this);
+  }
 
-  return scope.Close(args.This());
+  if (_messageEventQueue.size() > _peakQueueDepth)
+  {
+    _peakQueueDepth = _messageEventQueue.size();
+  }
 }
 
 /*-----------------------------------------------------------------------------
- * Perform GD message ACK
+ * Get why the backfill failed, NULL if it did not
  */
-void Subscription::AckWorker(uv_work_t* req)
+const char* Subscription::GetBackfillError()
 {
-  AckMessageRequest* request = (AckMessageRequest*)req->data;
-  request->result = tvagdMsgACK(request->tvaMessage);
+  if (_isBackfillTruncated)
+  {
+    return "Backfill hold limit reached, the history was cut short";
+  }
+
+  if (_backfillStatus != TVA_OK)
+  {
+    return tvaErrToStr(_backfillStatus);
+  }
+
+  return NULL;
 }
 
+
+/*****     Aggregation     *****/
+
 /*-----------------------------------------------------------------------------
- * GD message ACK complete
+ * Aggregate the received messages into time buckets
+ *
+ * subscription.aggregate(spec);
  */
-void Subscription::AckWorkerComplete(uv_work_t* req)
+Handle<Value> Subscription::Aggregate(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  // Arguments checking
+  PARAM_REQ_NUM(1, args.Length());
+  PARAM_REQ_OBJECT(0, args);        // spec
+
+  if (subscription->_aggregator)
+  {
+    ThrowException(Exception::Error(String::New("Already aggregating")));
+    return scope.Close(Undefined());
+  }
+
+  // Live, the buckets are completed once their interval and grace period end
+  Aggregator* aggregator = new Aggregator(0);
+  if (!aggregator->Parse(args[0]->ToObject()))
+  {
+    delete aggregator;
+    ThrowException(Exception::TypeError(String::New("Invalid aggregation")));
+    return scope.Close(Undefined());
+  }
+
+  // Fully built before the Tervela threads see it
+  tva_memory_barrier();
+  subscription->_aggregator = aggregator;
+
+  uv_mutex_lock(&subscription->_messageEventLock);
+  if (subscription->_isInUse && !subscription->_isAggregateTimerOpen)
+  {
+    uv_timer_init(uv_default_loop(), &subscription->_aggregateTimer);
+    uv_timer_start(&subscription->_aggregateTimer, Subscription::AggregateTimerEvent,
+                   SUBSCRIPTION_AGGREGATE_EXPIRE_INTERVAL, SUBSCRIPTION_AGGREGATE_EXPIRE_INTERVAL);
+    subscription->_isAggregateTimerOpen = true;
+  }
+  uv_mutex_unlock(&subscription->_messageEventLock);
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Deliver the buckets of the intervals that have ended.  The backfill is
+ * aggregated as it is received, its buckets are only completed once it ends.
+ */
+void Subscription::AggregateTimerEvent(uv_timer_t* timer, int status)
 {
   HandleScope scope;
+  Subscription* subscription = (Subscription*)timer->data;
 
-  AckMessageRequest* request = (AckMessageRequest*)req->data;
-  delete req;
+  uv_mutex_lock(&subscription->_messageEventLock);
+  bool isBackfilling = subscription->_isBackfilling;
+  uv_mutex_unlock(&subscription->_messageEventLock);
 
-  Handle<Value> argv[2];
-  if (request->result == TVA_OK)
+  if (isBackfilling)
   {
-    argv[0] = Undefined();
+    return;
   }
-  else
+
+  subscription->_aggregator->Expire(tva_time_now_us());
+  if (subscription->_aggregator->HasCompleted())
   {
-    argv[0] = String::New(tvaErrToStr(request->result));
+    subscription->InvokeJsAggregateEvent(Context::GetCurrent()->Global());
   }
-  argv[1] = request->origMessage;
+}
 
-  TryCatch tryCatch;
+void Subscription::SubscriptionHandleCloseComplete(uv_handle_t* handle)
+{
+}
 
-  if (!request->complete.IsEmpty())
+/*-----------------------------------------------------------------------------
+ * Post the complete aggregation buckets to JavaScript
+ */
+void Subscription::InvokeJsAggregateEvent(Local<Object> context)
+{
+  HandleScope scope;
+
+  Local<Array> buckets = _aggregator->TakeCompleted();
+  if (buckets->Length() == 0)
   {
-    request->complete->Call(Context::GetCurrent()->Global(), 2, argv);
-    request->complete.Dispose();
+    return;
   }
 
-  request->subscription->Emit(EVT_ACK, 2, argv);
+  Handle<Value> argv[] = { buckets };
+
+  TryCatch tryCatch;
 
+  Emit(EVT_AGGREGATE, 1, argv);
   if (tryCatch.HasCaught())
   {
     node::FatalException(tryCatch);
   }
+}
 
-  request->origMessage.Dispose();
 
-  delete request;
+/*****     Latency statistics     *****/
+
+/*-----------------------------------------------------------------------------
+ * Record a latency of a stage, from the stage's thread only.  The histogram
+ * is allocated by the first latency recorded and reset by its writer once
+ * asked, so a reset never races the recording.
+ */
+void Subscription::RecordLatency(LatencyStage stage, uint64_t value)
+{
+  LatencyHistogram* histogram = _latency[stage];
+  if (!histogram)
+  {
+    histogram = new LatencyHistogram();
+    tva_memory_barrier();
+    _latency[stage] = histogram;
+  }
+
+  unsigned int resets = _latencyResets;
+  if (_latencyResetsSeen[stage] != resets)
+  {
+    histogram->Reset();
+    _latencyResetsSeen[stage] = resets;
+  }
+
+  histogram->Record(value);
+}
+
+/*-----------------------------------------------------------------------------
+ * Create a JavaScript summary of a latency histogram, values are divided by
+ * scale (e.g. 1000 to report nanoseconds in microseconds)
+ */
+Local<Object> Subscription::CreateJsLatencyObject(LatencyHistogram& histogram, double scale)
+{
+  HandleScope scope;
+
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("count"), Number::New((double)histogram.GetCount()));
+  result->Set(String::NewSymbol("min"), Number::New((double)histogram.GetMin() / scale));
+  result->Set(String::NewSymbol("max"), Number::New((double)histogram.GetMax() / scale));
+  result->Set(String::NewSymbol("mean"), Number::New(histogram.GetMean() / scale));
+  result->Set(String::NewSymbol("p50"), Number::New((double)histogram.GetPercentile(50) / scale));
+  result->Set(String::NewSymbol("p90"), Number::New((double)histogram.GetPercentile(90) / scale));
+  result->Set(String::NewSymbol("p99"), Number::New((double)histogram.GetPercentile(99) / scale));
+  result->Set(String::NewSymbol("p999"), Number::New((double)histogram.GetPercentile(99.9) / scale));
+
+  return scope.Close(result);
+}
+
+/*-----------------------------------------------------------------------------
+ * Create a JavaScript summary of a stage's latency histogram
+ */
+Local<Object> Subscription::CreateJsLatencyObject(LatencyStage stage, double scale)
+{
+  // Nothing recorded yet, or since the last reset
+  static LatencyHistogram empty;
+  LatencyHistogram* histogram = _latency[stage];
+  if (!histogram || (_latencyResetsSeen[stage] != _latencyResets))
+  {
+    return CreateJsLatencyObject(empty, scale);
+  }
+
+  return CreateJsLatencyObject(*histogram, scale);
+}
+
+/*-----------------------------------------------------------------------------
+ * Get the receive path latency histograms (microseconds)
+ *
+ * var stats = subscription.latencyStats();
+ */
+Handle<Value> Subscription::LatencyStats(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  // The fabric latency is recorded in microseconds, the other stages in nanoseconds
+  Local<Object> result = Object::New();
+  result->Set(String::NewSymbol("fabric"), subscription->CreateJsLatencyObject(LatencyStageFabric, 1));
+  result->Set(String::NewSymbol("decode"), subscription->CreateJsLatencyObject(LatencyStageDecode, 1000));
+  result->Set(String::NewSymbol("queue"), subscription->CreateJsLatencyObject(LatencyStageQueue, 1000));
+  result->Set(String::NewSymbol("handler"), subscription->CreateJsLatencyObject(LatencyStageHandler, 1000));
+  result->Set(String::NewSymbol("total"), subscription->CreateJsLatencyObject(LatencyStageTotal, 1000));
+
+  return scope.Close(result);
+}
+
+/*-----------------------------------------------------------------------------
+ * Reset the receive path latency histograms, each is cleared by its writer
+ * when it next records a latency
+ *
+ * subscription.resetLatencyStats();
+ */
+Handle<Value> Subscription::ResetLatencyStats(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  subscription->_latencyResets++;
+
+  return scope.Close(args.This());
+}
+
+
+/*****     Pause / Resume     *****/
+
+/*-----------------------------------------------------------------------------
+ * Pause delivery of messages to JavaScript
+ *
+ * subscription.pause();
+ */
+Handle<Value> Subscription::Pause(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  subscription->SetPaused(true);
+
+  return scope.Close(args.This());
+}
+
+/*-----------------------------------------------------------------------------
+ * Resume delivery of messages to JavaScript
+ *
+ * subscription.resume();
+ */
+Handle<Value> Subscription::Resume(const Arguments& args)
+{
+  HandleScope scope;
+  Subscription* subscription = ObjectWrap::Unwrap<Subscription>(args.This());
+
+  subscription->SetPaused(false);
+
+  return scope.Close(args.This());
 }
 
 
@@ -932,8 +2730,16 @@ TVA_STATUS Subscription::Stop(bool sessionClosing)
 {
   TVA_STATUS rc;
 
+  if (_backfillHandle != TVA_INVALID_HANDLE)
+  {
+    tvaReplayRelease(_backfillHandle);
+    _backfillHandle = TVA_INVALID_HANDLE;
+  }
+
   if (_qos == TVA_QOS_GUARANTEED_DELIVERY)
   {
+    // Let queued auto-ack messages be acknowledged before terminating
+    _session->GetGdAcker()->Flush();
     rc = tvagdSubTerm(_handle);
   }
   else
@@ -976,6 +2782,13 @@ void Subscription::StopWorkerComplete(uv_work_t* req)
     argv[0] = String::New(tvaErrToStr(request->result));
   }
 
+  // Buckets still open are complete once the subscription is stopped
+  if (request->subscription->_aggregator)
+  {
+    request->subscription->_aggregator->Flush();
+    request->subscription->InvokeJsAggregateEvent(Context::GetCurrent()->Global());
+  }
+
   TryCatch tryCatch;
 
   request->subscription->Emit(EVT_STOP, 1, argv);
@@ -989,7 +2802,3 @@ void Subscription::StopWorkerComplete(uv_work_t* req)
 
   delete request;
 }
-
-void Subscription::SubscriptionHandleCloseComplete(uv_handle_t* handle)
-{
-}
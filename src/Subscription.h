@@ -5,14 +5,69 @@
 #pragma once
 
 #include <vector>
+#include <deque>
+#include <map>
+#include <string>
 #include <v8.h>
 #include <node.h>
 #include "tvaClientAPI.h"
 #include "tvaClientAPIInterface.h"
+#include "tvaPEAPI.h"
 #include "DataTypes.h"
 #include "EventEmitter.h"
+#include "HandleTable.h"
+#include "LatencyHistogram.h"
+#include "StatCounter.h"
+#include "Dispatcher.h"
+#include "TopicTrie.h"
+#include "Aggregator.h"
 
-class Subscription: node::ObjectWrap, EventEmitter
+#define SUBSCRIPTION_DEFAULT_PAUSE_BUFFER_LIMIT   10000
+#define SUBSCRIPTION_DEFAULT_BACKFILL_HOLD_LIMIT  100000
+#define SUBSCRIPTION_AGGREGATE_EXPIRE_INTERVAL    100       // ms between checks for ended intervals
+#define SUBSCRIPTION_ACK_ORDER_SLACK              1024      // acknowledged entries kept before compacting
+#define SUBSCRIPTION_BACKFILL_DEDUP_GRACE         5000000   // us of generation time past the backfill's end
+
+/*-----------------------------------------------------------------------------
+ * How far a backfill got in a topic: its latest generation time, and the
+ * number of its messages generated at that time
+ */
+struct BackfillPosition
+{
+  TVA_UINT64 generationTime;
+  size_t count;
+};
+
+// Publisher identifiers of received messages, when the Tervela API exposes them
+#if defined(TVA_MSGINFO_PUBID) && defined(TVA_MSGINFO_SESSIONID) && defined(TVA_MSGINFO_TSN)
+#define HAVE_MESSAGE_ORIGIN
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Messages received from one publisher session
+ */
+struct MessageOrigin
+{
+  TVA_UINT32 pubId;
+  TVA_UINT32 sessionId;
+  TVA_UINT64 firstTsn;
+  TVA_UINT64 lastTsn;
+  TVA_UINT64 firstGenerationTime;
+  TVA_UINT64 lastGenerationTime;
+  uint64_t messages;
+};
+
+class Subscription;
+
+/*-----------------------------------------------------------------------------
+ * Replay handle context of a subscription's backfill
+ */
+struct SubscriptionBackfill: ReplayContext
+{
+  Subscription* subscription;
+};
+
+class Subscription: node::ObjectWrap, EventEmitter, DispatchTarget
 {
 public:
   enum GdSubscriptionAckMode
@@ -21,15 +76,40 @@ public:
     GdSubscriptionAckModeManual
   };
 
+  enum GdSubscriptionAckOn
+  {
+    GdSubscriptionAckOnReturn,
+    GdSubscriptionAckOnResolve
+  };
+
+  enum LatencyStage
+  {
+    LatencyStageFabric,
+    LatencyStageDecode,
+    LatencyStageQueue,
+    LatencyStageHandler,
+    LatencyStageTotal,
+    LatencyStageCount
+  };
+
+  enum SubscriptionDeliveryMode
+  {
+    SubscriptionDeliveryModeMessage,
+    SubscriptionDeliveryModeColumnar,
+    SubscriptionDeliveryModeCursor
+  };
+
   /*-----------------------------------------------------------------------------
    * Register for subscription events
    *
    * subscription.on(event, listener);
    *
    * Events / Listeners:
-   *   'message'              - Message received                        - function (message) { }
+   *   'message'              - Message received                        - function (message, [done]) { }
+   *   'batch'                - Columnar message batch received         - function (batch) { }
    *   'ack'                  - Message ack complete                    - function (err, message) { }
    *   'stop'                 - Subscription stopped                    - function (err) { }
+   *   'aggregate'            - Aggregation buckets complete            - function (buckets) { }
    *
    * message = {
    *     topic,                 (string : message topic)
@@ -37,16 +117,171 @@ public:
    *     receiveTime,           (Date : when the message was received)
    *     fields                 (Array : message fields list ([name]=value))
    * }
+   *
+   * batch = {
+   *     count,                 (Number : number of messages in the batch)
+   *     topic,                 (Array : message topics)
+   *     generationTime,        (Float64Array : generation times, ms since epoch)
+   *     receiveTime,           (Float64Array : receive times, ms since epoch)
+   *     lossGap,               (Int32Array : loss gaps)
+   *     fields                 (Object : one column per field ([name]=Float64Array|Array))
+   * }
+   *
+   * With the 'cursor' option the 'message' listener is given the same cursor
+   * object for every message, only valid until the listener returns:
+   *
+   * cursor = {
+   *     topic,                 (string : message topic)
+   *     generationTime,        (Number : when the message was sent by the publisher, ms since epoch)
+   *     receiveTime,           (Number : when the message was received, ms since epoch)
+   *     lossGap,               (Number : loss gap)
+   *     fieldCount,            (Number : number of fields)
+   *     get(nameOrIndex),      (Function : field value, undefined if not found)
+   *     getNumber(nameOrIndex),(Function : numeric field value, NaN if not found or not numeric)
+   *     getName(index)         (Function : field name)
+   * }
    */
   static v8::Handle<v8::Value> On(const v8::Arguments& args);
 
   /*-----------------------------------------------------------------------------
-   * Acknowledge a received message when using "manual" ack mode with GD
+   * Route the messages of a topic or topic pattern to their own listener
+   *
+   * subscription.onTopic(topic, listener);
+   *
+   * listener = function (message, [done]) { }
+   *
+   * In a pattern '*' matches one topic level and a last '>' level matches all
+   * the remaining levels.  A message goes to the listener of the most specific
+   * matching pattern, messages not routed go to the 'message' listeners.
+   */
+  static v8::Handle<v8::Value> OnTopic(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Remove a topic route
    *
-   * subscription.ackMessage(message, [callback]);
+   * subscription.offTopic(topic);
+   */
+  static v8::Handle<v8::Value> OffTopic(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Acknowledge received messages when using "manual" ack mode with GD
+   *
+   * subscription.acknowledge(message, [callback]);
+   * subscription.acknowledge([messages], [options], [callback]);
+   *
+   * options = {
+   *    perMessage    : [emit an 'ack' event per message],      (boolean, optional (default: false))
+   * };
    */
   static v8::Handle<v8::Value> AckMessage(const v8::Arguments& args);
 
+  /*-----------------------------------------------------------------------------
+   * Acknowledge all outstanding messages up to and including the given message
+   *
+   * subscription.ackUpTo(message, [callback]);
+   */
+  static v8::Handle<v8::Value> AckUpTo(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Pause delivery of messages to JavaScript, messages are buffered natively
+   *
+   * subscription.pause();
+   */
+  static v8::Handle<v8::Value> Pause(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Resume delivery of messages to JavaScript after a pause
+   *
+   * subscription.resume();
+   */
+  static v8::Handle<v8::Value> Resume(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Get the subscription's runtime statistics
+   *
+   * var stats = subscription.stats();
+   *
+   * stats = {
+   *     messagesIn,            (Number : messages received)
+   *     bytesIn,               (Number : decoded size of the received messages' fields)
+   *     decodeErrors,          (Number : messages that could not be decoded)
+   *     lossGap,               (Number : sum of the received messages' loss gaps)
+   *     drops,                 (Number : messages discarded before reaching JavaScript)
+   *     queueDepth,            (Number : messages waiting to be delivered to JavaScript)
+   *     peakQueueDepth,        (Number : highest queueDepth seen)
+   *     outstandingGd,         (Number : GD messages not yet acknowledged)
+   *     backfilledMessages,    (Number : messages received from the backfill replay)
+   *     backfillDuplicates,    (Number : live messages dropped as already backfilled)
+   *     backfillError          (String : why the backfill replay failed, only set if it did)
+   * }
+   */
+  static v8::Handle<v8::Value> Stats(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Get the publisher sessions messages were received from (subscriptions
+   * created with trackOrigins), to narrow replays to them
+   *
+   * var origins = subscription.origins();
+   *
+   * origins = [{
+   *     pubId,                 (Number : publisher id)
+   *     sessionId,             (Number : publisher session id)
+   *     firstTsn,              (Number : first topic sequence number received)
+   *     lastTsn,               (Number : last topic sequence number received)
+   *     firstGenerationTime,   (Date : generation time of the first message)
+   *     lastGenerationTime,    (Date : generation time of the last message)
+   *     messages               (Number : messages received)
+   * }]
+   */
+  static v8::Handle<v8::Value> Origins(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Aggregate the received messages into time buckets of their generation
+   * time, complete buckets are emitted with the 'aggregate' event
+   *
+   * subscription.aggregate(spec);
+   *
+   * spec = {
+   *    interval : [bucket length] (Number (ms) | String, e.g. '500ms', '1s', '5m')
+   *    key      : ['topic' or a field name to group by] (String, optional)
+   *    fields   : { name: [ops] } (Object, ops: 'count', 'first', 'last', 'min',
+   *               'max', 'sum', 'mean', 'wsum:<weight field>', 'wmean:<weight field>')
+   * }
+   *
+   * buckets = [{
+   *     key,                   (String : topic or key field value, null when not keyed)
+   *     start,                 (Date : start of the interval)
+   *     end,                   (Date : end of the interval)
+   *     count,                 (Number : messages in the bucket)
+   *     fields                 (Object : { name: { op: value } })
+   * }]
+   */
+  static v8::Handle<v8::Value> Aggregate(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Get the receive path latency histograms (microseconds)
+   *
+   * var stats = subscription.latencyStats();
+   *
+   * stats = {
+   *     fabric,                (Object : publisher generation to Tervela receive time)
+   *     decode,                (Object : Tervela callback to message queued)
+   *     queue,                 (Object : message queued to dequeued on the JavaScript thread)
+   *     handler,               (Object : dequeued to listener returned)
+   *     total                  (Object : Tervela callback to listener returned)
+   * }
+   *
+   * Each histogram is { count, min, max, mean, p50, p90, p99, p999 }
+   */
+  static v8::Handle<v8::Value> LatencyStats(const v8::Arguments& args);
+
+  /*-----------------------------------------------------------------------------
+   * Reset the receive path latency histograms
+   *
+   * subscription.resetLatencyStats();
+   */
+  static v8::Handle<v8::Value> ResetLatencyStats(const v8::Arguments& args);
+
   /*-----------------------------------------------------------------------------
    * Stop the subscription
    *
@@ -65,14 +300,31 @@ public:
 
   static TVA_STATUS ProcessRecievedMessage(TVA_MESSAGE* message, MessageEvent& messageEvent);
   static v8::Local<v8::Object> CreateJsMessageObject(MessageEvent& messageEvent);
+  static v8::Local<v8::Value> CreateJsFieldValue(MessageFieldData& field, bool releaseData = true);
+  static v8::Local<v8::Object> CreateJsLatencyObject(LatencyHistogram& histogram, double scale);
+  v8::Local<v8::Object> CreateJsLatencyObject(LatencyStage stage, double scale);
+  void RecordLatency(LatencyStage stage, uint64_t value);
+  static void ReleaseFieldValue(MessageFieldData& field);
+  static void ReleaseMessageEvent(MessageEvent& messageEvent);
+  static bool GetMessageOrigin(TVA_MESSAGE* message, TVA_UINT32& pubId, TVA_UINT32& sessionId, TVA_UINT64& tsn);
 
   inline Session* GetSession() { return _session; };
-  inline uv_async_t* GetAsyncObj() { return &_async; }
 
   inline TVA_SUBSCRIPTION_HANDLE GetHandle() { return _handle; }
   inline char* GetTopic() { return _topic; }
   inline TVA_UINT32 GetQos() { return _qos; }
   inline GdSubscriptionAckMode GetAckMode() { return _ackMode; }
+  inline void SetDeliveryMode(SubscriptionDeliveryMode mode) { _deliveryMode = mode; }
+  inline SubscriptionDeliveryMode GetDeliveryMode() { return _deliveryMode; }
+  inline void SetAckOn(GdSubscriptionAckOn ackOn) { _ackOn = ackOn; }
+
+  inline void SetPauseBufferLimit(size_t limit) { _pauseBufferLimit = limit; }
+  inline void SetTrackOrigins(bool trackOrigins) { _isTrackingOrigins = trackOrigins; }
+  inline void SetBackfill(TVA_UINT64 since, size_t holdLimit)
+  {
+    _backfillSince = since;
+    _backfillHoldLimit = holdLimit;
+  }
 
   inline bool PostMessageEvent(MessageEvent& messageEvent)
   {
@@ -80,9 +332,28 @@ public:
     uv_mutex_lock(&_messageEventLock);
     if (_isInUse)
     {
-      _messageEventQueue.push(messageEvent);
-      uv_async_send(GetAsyncObj());
-      posted = true;
+      // While paused BE/GC messages are buffered up to the limit, GD messages are
+      // throttled by the sender's ack window since nothing is acknowledged
+      // Nothing is queued once the session's dispatcher has stopped
+      if (!_isPaused)
+      {
+        if (_dispatcher->Schedule(this))
+        {
+          _messageEventQueue.push(messageEvent);
+          posted = true;
+        }
+      }
+      else if (_dispatcher->IsStarted() &&
+               ((_qos == TVA_QOS_GUARANTEED_DELIVERY) || (_messageEventQueue.size() < _pauseBufferLimit)))
+      {
+        _messageEventQueue.push(messageEvent);
+        posted = true;
+      }
+
+      if (_messageEventQueue.size() > _peakQueueDepth)
+      {
+        _peakQueueDepth = _messageEventQueue.size();
+      }
     }
     uv_mutex_unlock(&_messageEventLock);
     return posted;
@@ -93,7 +364,7 @@ public:
     bool result = false;
 
     uv_mutex_lock(&_messageEventLock);
-    if (!_messageEventQueue.empty())
+    if (!_isPaused && !_messageEventQueue.empty())
     {
       messageEvent = _messageEventQueue.front();
       _messageEventQueue.pop();
@@ -104,6 +375,41 @@ public:
     return result;
   }
 
+  inline void GetQueueDepth(size_t& depth, size_t& peakDepth)
+  {
+    uv_mutex_lock(&_messageEventLock);
+    depth = _messageEventQueue.size();
+    peakDepth = _peakQueueDepth;
+    uv_mutex_unlock(&_messageEventLock);
+  }
+
+  inline void SetPaused(bool paused)
+  {
+    uv_mutex_lock(&_messageEventLock);
+    _isPaused = paused;
+
+    // Messages buffered during the pause are drained in budgeted turns by the
+    // dispatcher, so a large backlog doesn't block the event loop
+    if (_isInUse && !paused && !_messageEventQueue.empty())
+    {
+      _dispatcher->Schedule(this);
+    }
+    uv_mutex_unlock(&_messageEventLock);
+  }
+
+  inline void DrainComplete()
+  {
+    uv_mutex_lock(&_messageEventLock);
+    if (_isInUse && !_isPaused && !_messageEventQueue.empty())
+    {
+      _dispatcher->Schedule(this);
+    }
+    uv_mutex_unlock(&_messageEventLock);
+  }
+
+  inline void SetWeight(int weight) { SetDispatchWeight(weight); }
+  inline void SetPriority(DispatchPriority priority) { SetDispatchPriority(priority); }
+
   inline bool IsInUse() { return _isInUse; }
   inline void MarkInUse(bool inUse)
   {
@@ -113,20 +419,43 @@ public:
     if (inUse)
     {
       Ref();
-      uv_async_init(uv_default_loop(), GetAsyncObj(), Subscription::MessageAsyncEvent);
+
+      // Backfilled messages may have been queued before JavaScript had the subscription
+      if (!_isPaused && !_messageEventQueue.empty())
+      {
+        _dispatcher->Schedule(this);
+      }
     }
     else
     {
-      uv_close((uv_handle_t*)GetAsyncObj(), Subscription::SubscriptionHandleCloseComplete);
+      _dispatcher->Cancel(this);
+
+      // Messages can no longer be acknowledged once the subscription is stopped
+      _ackHandles.Clear();
+      _ackOrder.clear();
+
+      if (_isAggregateTimerOpen)
+      {
+        uv_timer_stop(&_aggregateTimer);
+        uv_close((uv_handle_t*)&_aggregateTimer, Subscription::SubscriptionHandleCloseComplete);
+        _isAggregateTimerOpen = false;
+      }
 
       Unref();
       MakeWeak();
     }
 
     uv_mutex_unlock(&_messageEventLock);
+
+    // Never delivered now, the messages still queued are released
+    if (!inUse)
+    {
+      DiscardEvents();
+    }
   }
 
   TVA_STATUS Start(char* topic, uint8_t qos, char* name, GdSubscriptionAckMode gdAckMode);
+  static void BackfillNotificationEvent(SubscriptionBackfill* backfill, TVA_STATUS status);
   TVA_STATUS Stop(bool sessionClosing);
 
 private:
@@ -136,20 +465,89 @@ private:
   static void AckWorkerComplete(uv_work_t* req);
   static void StopWorker(uv_work_t* req);
   static void StopWorkerComplete(uv_work_t* req);
+  static void AggregateTimerEvent(uv_timer_t* timer, int status);
   static void SubscriptionHandleCloseComplete(uv_handle_t* handle);
   static void MessageReceivedEvent(TVA_MESSAGE* message, void* context);
-  static void MessageAsyncEvent(uv_async_t* async, int status);
+  static void BackfillMessageReceivedEvent(TVA_MESSAGE* message, void* context);
+  TVA_STATUS StartBackfill(char* topic);
+  bool PostBackfillMessageEvent(MessageEvent& messageEvent);
+  bool HoldLiveMessageEvent(MessageEvent& messageEvent);
+  bool IsBackfilled(MessageEvent& messageEvent);
+  void EndBackfill();
+  void SpliceBackfillHeld(std::vector<MessageEvent>& duplicates);
+  const char* GetBackfillError();
+  virtual void Dispatch(size_t maxEvents, uint64_t deadline);
+  virtual void DiscardEvents();
+  static v8::Handle<v8::Value> AckDone(const v8::Arguments& args);
   void InvokeJsMessageEvent(v8::Local<v8::Object> context, MessageEvent& messageEvent);
+  void InvokeJsColumnarEvent(v8::Local<v8::Object> context, std::vector<MessageEvent>& messageEvents);
+  void CompleteMessageEvent(MessageEvent& messageEvent);
+  v8::Local<v8::Object> BeginCursor(MessageEvent& messageEvent);
+  void EndCursor(MessageEvent& messageEvent);
+  static Subscription* GetCursorSubscription(v8::Handle<v8::Object> cursor);
+  static MessageFieldData* GetCursorField(Subscription* subscription, v8::Local<v8::Value> key);
+  static v8::Handle<v8::Value> CursorGetProperty(v8::Local<v8::String> property, const v8::AccessorInfo& info);
+  static v8::Handle<v8::Value> CursorGet(const v8::Arguments& args);
+  static v8::Handle<v8::Value> CursorGetNumber(const v8::Arguments& args);
+  static v8::Handle<v8::Value> CursorGetName(const v8::Arguments& args);
+  void RecordOrigin(TVA_MESSAGE* message);
+  void InvokeJsAggregateEvent(v8::Local<v8::Object> context);
+  bool GetAckHandle(v8::Local<v8::Value> value, double& handle);
+  void TrimAckOrder();
 
   static v8::Persistent<v8::Function> constructor;
+  static v8::Persistent<v8::ObjectTemplate> messageTemplate;
+  static v8::Persistent<v8::ObjectTemplate> cursorTemplate;
+  static v8::Persistent<v8::Function> ackDoneFunction;
+  static v8::Persistent<v8::Function> bindFunction;
 
   Session* _session;
+  Dispatcher* _dispatcher;
   TVA_SUBSCRIPTION_HANDLE _handle;
-  uv_async_t _async;
   std::queue<MessageEvent> _messageEventQueue;
   uv_mutex_t _messageEventLock;
+  HandleTable<TVA_MESSAGE> _ackHandles;
+  std::deque<double> _ackOrder;
+  TopicTrie<v8::Persistent<v8::Function> > _topicRoutes;
+  v8::Persistent<v8::Object> _cursor;
+  MessageEvent* _cursorEvent;
+  std::vector<MessageFieldData*> _cursorFields;
   char* _topic;
   TVA_UINT32 _qos;
   GdSubscriptionAckMode _ackMode;
+  GdSubscriptionAckOn _ackOn;
+  LatencyHistogram* volatile _latency[LatencyStageCount];  // NULL until a latency is recorded
+  volatile unsigned int _latencyResets;
+  unsigned int _latencyResetsSeen[LatencyStageCount];     // by the stage's (single) writer
+  StatCounter _messagesIn;
+  StatCounter _bytesIn;
+  StatCounter _decodeErrors;
+  StatCounter _lossGap;
+  StatCounter _drops;
+  size_t _peakQueueDepth;
+  SubscriptionDeliveryMode _deliveryMode;
+  size_t _pauseBufferLimit;
+  std::map<uint64_t, MessageOrigin> _origins;
+  uv_mutex_t _originLock;
+  bool _isTrackingOrigins;
+  Aggregator* _aggregator;
+  uv_timer_t _aggregateTimer;                   // completes the buckets of ended intervals
+  bool _isAggregateTimerOpen;
+  TVA_REPLAY_HANDLE _backfillHandle;
+  SubscriptionBackfill _backfillContext;
+  size_t _backfillHoldLimit;
+  TVA_STATUS _backfillStatus;
+  bool _isBackfillTruncated;                    // cut short by the hold limit
+  bool _isBackfillErrorPending;                 // the 'error' event is not emitted yet
+  TVA_UINT64 _backfillSince;                    // microseconds, 0 when not backfilling
+  TVA_UINT64 _backfillUntil;                    // microseconds, end of the backfill's range
+  std::vector<MessageEvent> _backfillHeld;      // live messages received during the backfill
+  std::map<uint64_t, TVA_UINT64> _backfillTsns; // highest backfilled tsn, by publisher session
+  std::map<std::string, BackfillPosition> _backfillTimes;   // latest backfilled generation time, by topic
+  StatCounter _backfilled;
+  StatCounter _backfillDuplicates;
+  bool _isBackfilling;
+  bool _isDeduplicating;
+  bool _isPaused;
   bool _isInUse;
 };
@@ -76,6 +76,10 @@ struct ConnectRequest
   char* gdClientName;
   int gdMaxOut;
   int timeout;
+  int drainMessages;
+  int drainTime;
+  bool isSpinMode;
+  int spinIdleTime;
   TVA_STATUS result;
   Persistent<Function> complete;
 
@@ -89,6 +93,10 @@ struct ConnectRequest
     gdClientName = NULL;
     gdMaxOut = 1000;
     timeout = 30000;
+    drainMessages = DISPATCHER_DEFAULT_DRAIN_MESSAGES;
+    drainTime = DISPATCHER_DEFAULT_DRAIN_TIME_US;
+    isSpinMode = false;
+    spinIdleTime = DISPATCHER_DEFAULT_SPIN_IDLE_US;
   }
 };
 
@@ -145,6 +153,10 @@ static ConnectConfigParam g_connectConfig[] =
  *     timeout        : [login timeout in seconds],             (integer, optional (default: 30))
  *     name           : [client name for GD operations],        (string, only required when using GD)
  *     gdMaxOut       : [GD publisher max outstanding]          (integer, only required when using GD (default: 1000))
+ *     drainMessages  : [max messages per subscription per turn] (integer, optional (default: 1000, 0: unlimited))
+ *     drainTime      : [max time per event loop turn in usec]  (integer, optional (default: 10000, 0: unlimited))
+ *     latencyMode    : [message wakeups: 'async'|'spin']       (string, optional (default: 'async'))
+ *     spinIdleTime   : [spin time without messages in usec]    (integer, optional (default: 1000))
  * };
  */
 Handle<Value> Connect(const Arguments& args)
@@ -192,6 +204,10 @@ Handle<Value> Connect(const Arguments& args)
  *     timeout        : [login timeout in seconds],             (integer, optional (default: 30))
  *     name           : [client name for GD operations],        (string, only required when using GD)
  *     gdMaxOut       : [GD publisher max outstanding]          (integer, only required when using GD (default: 1000))
+ *     drainMessages  : [max messages per subscription per turn] (integer, optional (default: 1000, 0: unlimited))
+ *     drainTime      : [max time per event loop turn in usec]  (integer, optional (default: 10000, 0: unlimited))
+ *     latencyMode    : [message wakeups: 'async'|'spin']       (string, optional (default: 'async'))
+ *     spinIdleTime   : [spin time without messages in usec]    (integer, optional (default: 1000))
  * };
  */
 Handle<Value> ConnectSync(const Arguments& args)
@@ -312,6 +328,34 @@ bool ConnectParseOptions(Local<Object> options, ConnectRequest* request)
     {
       request->gdMaxOut = optionValue->Int32Value();
     }
+    else if (tva_str_casecmp(optionName, "drainMessages") == 0)
+    {
+      request->drainMessages = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "drainTime") == 0)
+    {
+      request->drainTime = optionValue->Int32Value();
+    }
+    else if (tva_str_casecmp(optionName, "latencyMode") == 0)
+    {
+      String::AsciiValue val(optionValue->ToString());
+      if (tva_str_casecmp(*val, "spin") == 0)
+      {
+        request->isSpinMode = true;
+      }
+      else if (tva_str_casecmp(*val, "async") == 0)
+      {
+        request->isSpinMode = false;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else if (tva_str_casecmp(optionName, "spinIdleTime") == 0)
+    {
+      request->spinIdleTime = optionValue->Int32Value();
+    }
     else if (tva_str_casecmp(optionName, "config") == 0)
     {
       if (optionValue->IsObject())
@@ -415,6 +459,11 @@ bool ConnectParseOptions(Local<Object> options, ConnectRequest* request)
     return false;
   }
 
+  if ((request->drainMessages < 0) || (request->drainTime < 0) || (request->spinIdleTime < 0))
+  {
+    return false;
+  }
+
   return true;
 }
 
@@ -457,6 +506,8 @@ void ConnectWorker(uv_work_t* req)
       session->SetGdMaxOut(request->gdMaxOut);
     }
 
+    session->GetDispatcher()->SetDrainBudget((size_t)request->drainMessages, (uint64_t)request->drainTime);
+    session->GetDispatcher()->SetSpinMode(request->isSpinMode, (uint64_t)request->spinIdleTime);
     session->SetHandle(sessionHandle);
     request->session = session;
   } while(0);
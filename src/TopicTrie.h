@@ -0,0 +1,319 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*-----------------------------------------------------------------------------
+ * Map of topic patterns to values
+ *
+ * Topics are made of levels separated by '.'.  In a pattern a '*' level
+ * matches any single level and a '>' last level matches one or more trailing
+ * levels.  A topic resolves to the most specific matching pattern: at every
+ * level an exact match is preferred to '*', and '*' is preferred to '>'.
+ * Matching compares the topic's levels in place, without allocating.
+ *
+ * Not thread safe, only use from the JavaScript thread.
+ */
+template <class T>
+class TopicTrie
+{
+public:
+  TopicTrie()
+  {
+    _count = 0;
+  }
+
+  ~TopicTrie()
+  {
+    Clear();
+  }
+
+  /* Check a pattern is well formed (no empty level, '>' only last) */
+  static bool IsValidPattern(const char* pattern)
+  {
+    const char* level = pattern;
+    for (;;)
+    {
+      const char* end = strchr(level, '.');
+      size_t length = (end) ? (size_t)(end - level) : strlen(level);
+
+      if (length == 0)
+      {
+        return false;
+      }
+
+      if ((length == 1) && (level[0] == '>') && end)
+      {
+        return false;
+      }
+
+      if (!end)
+      {
+        return true;
+      }
+
+      level = end + 1;
+    }
+  }
+
+  /* Set the value of a pattern, returns true and the previous value if set */
+  bool Add(const char* pattern, T value, T& previous)
+  {
+    Node* node = &_root;
+    const char* level = pattern;
+    for (;;)
+    {
+      const char* end = strchr(level, '.');
+      size_t length = (end) ? (size_t)(end - level) : strlen(level);
+
+      size_t index = FindChildIndex(node, level, length);
+      if ((index == node->children.size()) || (CompareName(node->children[index].name, level, length) != 0))
+      {
+        NodeChild child;
+        child.name.assign(level, length);
+        child.node = new Node();
+        node->children.insert(node->children.begin() + index, child);
+      }
+      node = node->children[index].node;
+
+      if (!end)
+      {
+        break;
+      }
+      level = end + 1;
+    }
+
+    bool replaced = node->hasValue;
+    if (replaced)
+    {
+      previous = node->value;
+    }
+    else
+    {
+      _count++;
+    }
+
+    node->value = value;
+    node->hasValue = true;
+    return replaced;
+  }
+
+  /* Remove a pattern, returns true and its value if it was set */
+  bool Remove(const char* pattern, T& removed)
+  {
+    if (!Remove(&_root, pattern, removed))
+    {
+      return false;
+    }
+
+    _count--;
+    return true;
+  }
+
+  /* Find the value of the most specific pattern matching a topic */
+  inline bool Match(const char* topic, T& value)
+  {
+    if (_count == 0)
+    {
+      return false;
+    }
+
+    Node* node = Match(&_root, topic);
+    if (node)
+    {
+      value = node->value;
+      return true;
+    }
+
+    return false;
+  }
+
+  void GetValues(std::vector<T>& values)
+  {
+    GetValues(&_root, values);
+  }
+
+  void Clear()
+  {
+    DeleteChildren(&_root);
+    _count = 0;
+  }
+
+  inline bool IsEmpty() { return (_count == 0); }
+
+private:
+  struct Node;
+
+  struct NodeChild
+  {
+    std::string name;
+    Node* node;
+  };
+
+  /* Children are sorted by name, levels are few and lookups dominate */
+  struct Node
+  {
+    Node() : hasValue(false) {}
+
+    std::vector<NodeChild> children;
+    T value;
+    bool hasValue;
+  };
+
+  /* Compare a child's name to a level of a pattern or topic */
+  static inline int CompareName(const std::string& name, const char* level, size_t length)
+  {
+    size_t nameLength = name.size();
+    int result = memcmp(name.data(), level, (nameLength < length) ? nameLength : length);
+    if (result != 0)
+    {
+      return result;
+    }
+
+    return (nameLength < length) ? -1 : ((nameLength > length) ? 1 : 0);
+  }
+
+  /* Position of the first child not named before the level */
+  static size_t FindChildIndex(Node* node, const char* level, size_t length)
+  {
+    size_t low = 0;
+    size_t high = node->children.size();
+    while (low < high)
+    {
+      size_t middle = (low + high) / 2;
+      if (CompareName(node->children[middle].name, level, length) < 0)
+      {
+        low = middle + 1;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+
+    return low;
+  }
+
+  static inline Node* FindChild(Node* node, const char* level, size_t length)
+  {
+    size_t index = FindChildIndex(node, level, length);
+    if ((index < node->children.size()) && (CompareName(node->children[index].name, level, length) == 0))
+    {
+      return node->children[index].node;
+    }
+
+    return NULL;
+  }
+
+  /* Remove a pattern below a node, deleting the nodes left empty */
+  bool Remove(Node* node, const char* level, T& removed)
+  {
+    const char* end = strchr(level, '.');
+    size_t length = (end) ? (size_t)(end - level) : strlen(level);
+
+    size_t index = FindChildIndex(node, level, length);
+    if ((index == node->children.size()) || (CompareName(node->children[index].name, level, length) != 0))
+    {
+      return false;
+    }
+
+    Node* child = node->children[index].node;
+    if (end)
+    {
+      if (!Remove(child, end + 1, removed))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      if (!child->hasValue)
+      {
+        return false;
+      }
+
+      removed = child->value;
+      child->hasValue = false;
+    }
+
+    if (!child->hasValue && child->children.empty())
+    {
+      delete child;
+      node->children.erase(node->children.begin() + index);
+    }
+
+    return true;
+  }
+
+  Node* Match(Node* node, const char* level)
+  {
+    const char* end = strchr(level, '.');
+    size_t length = (end) ? (size_t)(end - level) : strlen(level);
+
+    // Exact level, then any single level
+    const char* candidates[2] = { level, "*" };
+    size_t lengths[2] = { length, 1 };
+    for (int i = 0; i < 2; i++)
+    {
+      Node* child = FindChild(node, candidates[i], lengths[i]);
+      if (child)
+      {
+        if (!end)
+        {
+          if (child->hasValue)
+          {
+            return child;
+          }
+        }
+        else
+        {
+          Node* result = Match(child, end + 1);
+          if (result)
+          {
+            return result;
+          }
+        }
+      }
+    }
+
+    // All remaining levels
+    Node* rest = FindChild(node, ">", 1);
+    if (rest && rest->hasValue)
+    {
+      return rest;
+    }
+
+    return NULL;
+  }
+
+  void GetValues(Node* node, std::vector<T>& values)
+  {
+    for (size_t i = 0; i < node->children.size(); i++)
+    {
+      Node* child = node->children[i].node;
+      if (child->hasValue)
+      {
+        values.push_back(child->value);
+      }
+      GetValues(child, values);
+    }
+  }
+
+  void DeleteChildren(Node* node)
+  {
+    for (size_t i = 0; i < node->children.size(); i++)
+    {
+      DeleteChildren(node->children[i].node);
+      delete node->children[i].node;
+    }
+    node->children.clear();
+  }
+
+  Node _root;
+  size_t _count;
+};
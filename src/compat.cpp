@@ -88,5 +88,74 @@ void uv_mutex_unlock(uv_mutex_t* mutex) {
   }
 }
 
+
+int uv_sem_init(uv_sem_t* sem, unsigned int value) {
+  return sem_init(sem, 0, value);
+}
+
+
+void uv_sem_destroy(uv_sem_t* sem) {
+  if (sem_destroy(sem))
+    abort();
+}
+
+
+void uv_sem_post(uv_sem_t* sem) {
+  if (sem_post(sem))
+    abort();
+}
+
+
+void uv_sem_wait(uv_sem_t* sem) {
+  int r;
+
+  do
+    r = sem_wait(sem);
+  while (r == -1 && errno == EINTR);
+
+  if (r)
+    abort();
+}
+
+
+struct thread_ctx {
+  void (*entry)(void* arg);
+  void* arg;
+};
+
+
+static void* uv__thread_start(void *ctx_v) {
+  struct thread_ctx ctx = *(struct thread_ctx*)ctx_v;
+  free(ctx_v);
+  ctx.entry(ctx.arg);
+  return 0;
+}
+
+
+int uv_thread_create(uv_thread_t *tid, void (*entry)(void *arg), void *arg) {
+  struct thread_ctx* ctx;
+
+  if ((ctx = (struct thread_ctx*)malloc(sizeof *ctx)) == NULL)
+    return -1;
+
+  ctx->entry = entry;
+  ctx->arg = arg;
+
+  if (pthread_create(tid, NULL, uv__thread_start, ctx)) {
+    free(ctx);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int uv_thread_join(uv_thread_t *tid) {
+  if (pthread_join(*tid, NULL))
+    return -1;
+  else
+    return 0;
+}
+
 #endif
 
@@ -7,8 +7,10 @@
 #ifdef MISSING_UV_THREADS
 
 #include <pthread.h>
+#include <semaphore.h>
 typedef pthread_t uv_thread_t;
 typedef pthread_mutex_t uv_mutex_t;
+typedef sem_t uv_sem_t;
 
 
 int uv_mutex_init(uv_mutex_t* mutex);
@@ -17,4 +19,60 @@ void uv_mutex_lock(uv_mutex_t* mutex);
 int uv_mutex_trylock(uv_mutex_t* mutex);
 void uv_mutex_unlock(uv_mutex_t* mutex);
 
+int uv_sem_init(uv_sem_t* sem, unsigned int value);
+void uv_sem_destroy(uv_sem_t* sem);
+void uv_sem_post(uv_sem_t* sem);
+void uv_sem_wait(uv_sem_t* sem);
+
+int uv_thread_create(uv_thread_t *tid, void (*entry)(void *arg), void *arg);
+int uv_thread_join(uv_thread_t *tid);
+
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Memory barrier and sleep helpers
+ */
+#if defined(WIN32)
+#define tva_memory_barrier()    MemoryBarrier()
+#define tva_sleep_ms(ms)        Sleep(ms)
+#else
+#include <unistd.h>
+#define tva_memory_barrier()    __sync_synchronize()
+#define tva_sleep_ms(ms)        usleep((ms) * 1000)
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Atomic counter helpers
+ */
+#if defined(WIN32)
+#define tva_atomic_add64(p, v)  InterlockedExchangeAdd64((volatile LONGLONG*)(p), (LONGLONG)(v))
+#define tva_atomic_cas32(p, o, n) (InterlockedCompareExchange((volatile LONG*)(p), (LONG)(n), (LONG)(o)) == (LONG)(o))
+#define tva_atomic_read64(p)    InterlockedCompareExchange64((volatile LONGLONG*)(p), 0, 0)
+#else
+#define tva_atomic_add64(p, v)  __sync_fetch_and_add((p), (v))
+#define tva_atomic_cas32(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define tva_atomic_read64(p)    __sync_fetch_and_add((p), 0)
+#endif
+
+/*-----------------------------------------------------------------------------
+ * Wall clock time, in microseconds since the epoch
+ */
+#if defined(WIN32)
+inline unsigned long long tva_time_now_us()
+{
+  FILETIME ft;
+  GetSystemTimeAsFileTime(&ft);
+
+  // 100ns intervals since 1601
+  unsigned long long t = ((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+  return (t - 116444736000000000ULL) / 10;
+}
+#else
+#include <sys/time.h>
+inline unsigned long long tva_time_now_us()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((unsigned long long)tv.tv_sec * 1000000) + tv.tv_usec;
+}
 #endif
@@ -0,0 +1,510 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "ReplayCache.h"
+
+#if defined(WIN32)
+#include <windows.h>
+#include <direct.h>
+#define tva_sleep_ms(ms)        Sleep(ms)
+#define tva_rmdir(path)         _rmdir(path)
+#define tva_getpid()            GetCurrentProcessId()
+#else
+#include <unistd.h>
+#define tva_sleep_ms(ms)        usleep((ms) * 1000)
+#define tva_rmdir(path)         rmdir(path)
+#define tva_getpid()            getpid()
+#endif
+
+#define TEST_TOPIC              "TEST.CACHE.A"
+#define TEST_START_TIME         1000000000000ULL    // microseconds
+#define TEST_RECORD_COUNT       3000                // spans a few index entries
+
+static int _failures = 0;
+static std::string _directory;
+
+#define CHECK(condition)                                                        \
+  if (!(condition)) {                                                           \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+    _failures++;                                                                \
+  }
+
+/*****     Helpers     *****/
+
+static bool FileExists(const std::string& path)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file)
+  {
+    fclose(file);
+  }
+
+  return (file != NULL);
+}
+
+/*-----------------------------------------------------------------------------
+ * Path of the complete segment of a time range, empty if there is none
+ */
+static std::string FindSegment(const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime)
+{
+  std::vector<ReplayCacheRange> ranges;
+  ReplayCachePlan(_directory.c_str(), topic, startTime, endTime, ranges);
+  return ((ranges.size() == 1) && (ranges[0].startTime == startTime) && (ranges[0].endTime == endTime)) ?
+         ranges[0].segmentPath : std::string();
+}
+
+/*-----------------------------------------------------------------------------
+ * Wait for the writer thread to publish a segment under its final name
+ */
+static std::string WaitForSegment(const char* topic, TVA_UINT64 startTime, TVA_UINT64 endTime)
+{
+  for (int i = 0; i < 500; i++)
+  {
+    std::string path = FindSegment(topic, startTime, endTime);
+    if (!path.empty())
+    {
+      return path;
+    }
+    tva_sleep_ms(10);
+  }
+
+  return std::string();
+}
+
+static bool CopyFile(const std::string& from, const std::string& to)
+{
+  FILE* in = fopen(from.c_str(), "rb");
+  FILE* out = fopen(to.c_str(), "wb");
+  bool isCopied = (in && out);
+
+  char buffer[65536];
+  size_t size;
+  while (isCopied && ((size = fread(buffer, 1, sizeof(buffer), in)) > 0))
+  {
+    isCopied = (fwrite(buffer, 1, size, out) == size);
+  }
+
+  if (in)
+  {
+    fclose(in);
+  }
+  if (out)
+  {
+    fclose(out);
+  }
+
+  return isCopied;
+}
+
+static bool Patch(const std::string& path, long offset, const void* data, size_t size)
+{
+  FILE* file = fopen(path.c_str(), "r+b");
+  if (file == NULL)
+  {
+    return false;
+  }
+
+  bool isPatched = (fseek(file, offset, SEEK_SET) == 0) && (fwrite(data, 1, size, file) == size);
+  fclose(file);
+  return isPatched;
+}
+
+static void FreeMessage(MessageEvent& messageEvent)
+{
+  std::vector<void*> allocations;
+  ReplayCacheSegment::GetAllocations(messageEvent, allocations);
+  for (size_t i = 0; i < allocations.size(); i++)
+  {
+    free(allocations[i]);
+  }
+  messageEvent.fieldData.clear();
+}
+
+static MessageFieldData* FindField(MessageEvent& messageEvent, const char* name)
+{
+  std::list<MessageFieldData>::iterator it;
+  for (it = messageEvent.fieldData.begin(); it != messageEvent.fieldData.end(); it++)
+  {
+    if (strcmp(it->name, name) == 0)
+    {
+      return &(*it);
+    }
+  }
+
+  return NULL;
+}
+
+/*-----------------------------------------------------------------------------
+ * Message i of a test segment, one field of each kind
+ */
+static char* _names[] = { (char*)"first", (char*)"second" };
+static double _doubles[] = { 1.5, -2.5, 3.25 };
+
+static void BuildMessage(int i, TVA_UINT64 generationTime, MessageEvent& messageEvent, char* text)
+{
+  messageEvent.tvaMessage = NULL;
+  messageEvent.topicName = TEST_TOPIC;
+  messageEvent.generationTime = generationTime;
+  messageEvent.receiveTime = generationTime + 10;
+  messageEvent.lossGap = i % 3;
+  messageEvent.isCached = false;
+  messageEvent.hasOrigin = ((i % 2) == 0);
+  messageEvent.pubId = 7;
+  messageEvent.sessionId = 11;
+  messageEvent.tsn = (TVA_UINT64)i + 1;
+  messageEvent.jmsMessageType = 0;
+  messageEvent.isLastMessage = false;
+  messageEvent.fieldData.clear();
+
+  MessageFieldData field;
+  memset(&field, 0, sizeof(field));
+
+  strcpy(field.name, "flag");
+  field.type = MessageFieldDataTypeBoolean;
+  field.value.boolValue = ((i % 2) != 0);
+  messageEvent.fieldData.push_back(field);
+
+  strcpy(field.name, "count");
+  field.type = MessageFieldDataTypeInt32;
+  field.value.int32Value = i;
+  messageEvent.fieldData.push_back(field);
+
+  strcpy(field.name, "price");
+  field.type = MessageFieldDataTypeNumber;
+  field.value.numberValue = i * 0.5;
+  messageEvent.fieldData.push_back(field);
+
+  snprintf(text, 32, "message %d", i);
+  strcpy(field.name, "text");
+  field.type = MessageFieldDataTypeString;
+  field.value.stringValue = text;
+  messageEvent.fieldData.push_back(field);
+
+  strcpy(field.name, "names");
+  field.type = MessageFieldDataTypeStringArray;
+  field.count = 2;
+  field.value.arrayValue = _names;
+  messageEvent.fieldData.push_back(field);
+
+  strcpy(field.name, "values");
+  field.type = MessageFieldDataTypeDoubleArray;
+  field.count = 3;
+  field.value.arrayValue = _doubles;
+  messageEvent.fieldData.push_back(field);
+}
+
+/*-----------------------------------------------------------------------------
+ * Write a segment of messages spaced by a microsecond, generation times
+ * going backwards every 100 messages when not ordered
+ */
+static std::string WriteSegment(TVA_UINT64 startTime, TVA_UINT64 endTime, int count, bool isOrdered)
+{
+  ReplayCacheWriter writer(_directory.c_str(), TEST_TOPIC, startTime, endTime);
+  if (!writer.Open())
+  {
+    return std::string();
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    TVA_UINT64 generationTime = startTime + (TVA_UINT64)i;
+    if (!isOrdered && ((i % 100) == 99))
+    {
+      generationTime = startTime;
+    }
+
+    char text[32];
+    MessageEvent messageEvent;
+    BuildMessage(i, generationTime, messageEvent, text);
+    writer.Append(messageEvent);
+  }
+
+  writer.Complete();
+  return WaitForSegment(TEST_TOPIC, startTime, endTime);
+}
+
+
+/*****     Tests     *****/
+
+static void TestRoundTrip()
+{
+  TVA_UINT64 endTime = TEST_START_TIME + TEST_RECORD_COUNT;
+  std::string path = WriteSegment(TEST_START_TIME, endTime, TEST_RECORD_COUNT, true);
+  CHECK(!path.empty());
+  if (path.empty())
+  {
+    return;
+  }
+
+  ReplayCacheSegment segment;
+  CHECK(segment.Open(path.c_str(), TEST_TOPIC));
+  segment.Seek(TEST_START_TIME, endTime);
+
+  int count = 0;
+  MessageEvent messageEvent;
+  while (segment.Next(messageEvent))
+  {
+    CHECK(messageEvent.isCached);
+    CHECK(messageEvent.tvaMessage == NULL);
+    CHECK(strcmp(messageEvent.topicName, TEST_TOPIC) == 0);
+    CHECK(messageEvent.generationTime == TEST_START_TIME + (TVA_UINT64)count);
+    CHECK(messageEvent.receiveTime == messageEvent.generationTime + 10);
+    CHECK(messageEvent.lossGap == count % 3);
+    CHECK(messageEvent.hasOrigin == ((count % 2) == 0));
+    if (messageEvent.hasOrigin)
+    {
+      CHECK(messageEvent.pubId == 7);
+      CHECK(messageEvent.sessionId == 11);
+      CHECK(messageEvent.tsn == (TVA_UINT64)count + 1);
+    }
+    CHECK(messageEvent.fieldData.size() == 6);
+
+    MessageFieldData* field = FindField(messageEvent, "flag");
+    CHECK(field && (field->type == MessageFieldDataTypeBoolean) && (field->value.boolValue == ((count % 2) != 0)));
+    field = FindField(messageEvent, "count");
+    CHECK(field && (field->type == MessageFieldDataTypeInt32) && (field->value.int32Value == count));
+    field = FindField(messageEvent, "price");
+    CHECK(field && (field->type == MessageFieldDataTypeNumber) && (field->value.numberValue == count * 0.5));
+
+    char text[32];
+    snprintf(text, sizeof(text), "message %d", count);
+    field = FindField(messageEvent, "text");
+    CHECK(field && (field->type == MessageFieldDataTypeString) && (strcmp(field->value.stringValue, text) == 0));
+
+    field = FindField(messageEvent, "names");
+    CHECK(field && (field->type == MessageFieldDataTypeStringArray) && (field->count == 2));
+    if (field && (field->count == 2))
+    {
+      CHECK(strcmp(((TVA_STRING*)field->value.arrayValue)[0], "first") == 0);
+      CHECK(strcmp(((TVA_STRING*)field->value.arrayValue)[1], "second") == 0);
+    }
+
+    field = FindField(messageEvent, "values");
+    CHECK(field && (field->type == MessageFieldDataTypeDoubleArray) && (field->count == 3));
+    if (field && (field->count == 3))
+    {
+      CHECK(memcmp(field->value.arrayValue, _doubles, sizeof(_doubles)) == 0);
+    }
+
+    FreeMessage(messageEvent);
+    count++;
+  }
+
+  CHECK(count == TEST_RECORD_COUNT);
+  CHECK(segment.IsExhausted());
+  CHECK(!segment.IsCorrupt());
+
+  // Past the first index entries, and up to the end of a smaller range
+  TVA_UINT64 seekTime = TEST_START_TIME + 2500;
+  segment.Seek(seekTime, seekTime + 99);
+  count = 0;
+  while (segment.Next(messageEvent))
+  {
+    CHECK(messageEvent.generationTime == seekTime + (TVA_UINT64)count);
+    FreeMessage(messageEvent);
+    count++;
+  }
+  CHECK(count == 100);
+
+  // Before and after the records
+  segment.Seek(0, TEST_START_TIME);
+  count = 0;
+  while (segment.Next(messageEvent))
+  {
+    FreeMessage(messageEvent);
+    count++;
+  }
+  CHECK(count == 1);
+
+  segment.Seek(endTime, endTime);
+  CHECK(!segment.Next(messageEvent));
+  CHECK(!segment.IsCorrupt());
+
+  // Another topic or version is never read
+  ReplayCacheSegment other;
+  CHECK(!other.Open(path.c_str(), "TEST.CACHE.B"));
+
+  std::string copyPath = path + ".copy";
+  uint32_t version = REPLAY_CACHE_VERSION - 1;
+  CHECK(CopyFile(path, copyPath));
+  CHECK(Patch(copyPath, (long)offsetof(ReplayCacheHeader, version), &version, sizeof(version)));
+  ReplayCacheSegment older;
+  CHECK(!older.Open(copyPath.c_str(), TEST_TOPIC));
+  remove(copyPath.c_str());
+
+  remove(path.c_str());
+}
+
+static void TestUnordered()
+{
+  TVA_UINT64 startTime = TEST_START_TIME + 100000;
+  TVA_UINT64 endTime = startTime + 1000;
+  std::string path = WriteSegment(startTime, endTime, 1000, false);
+  CHECK(!path.empty());
+  if (path.empty())
+  {
+    return;
+  }
+
+  // Without index the whole segment is read, only the range is delivered
+  ReplayCacheSegment segment;
+  CHECK(segment.Open(path.c_str(), TEST_TOPIC));
+  segment.Seek(startTime + 500, endTime);
+
+  int count = 0;
+  MessageEvent messageEvent;
+  while (segment.Next(messageEvent))
+  {
+    CHECK(messageEvent.generationTime >= startTime + 500);
+    FreeMessage(messageEvent);
+    count++;
+  }
+  CHECK(count == 495);        // 500 to 999, without the 5 moved back to the start
+  CHECK(!segment.IsCorrupt());
+
+  remove(path.c_str());
+}
+
+/*-----------------------------------------------------------------------------
+ * Copy a segment and damage the copy at an offset, the copy must be rejected
+ * and removed once read
+ */
+static void CheckCorrupt(const std::string& path, long offset, const void* data, size_t size, const char* what)
+{
+  std::string copyPath = path + ".corrupt";
+  CHECK(CopyFile(path, copyPath));
+  CHECK(Patch(copyPath, offset, data, size));
+
+  ReplayCacheSegment segment;
+  if (!segment.Open(copyPath.c_str(), TEST_TOPIC))
+  {
+    // Rejected when opened
+    remove(copyPath.c_str());
+    return;
+  }
+
+  segment.Seek(0, (TVA_UINT64)-1);
+  int count = 0;
+  MessageEvent messageEvent;
+  while (segment.Next(messageEvent))
+  {
+    FreeMessage(messageEvent);
+    count++;
+  }
+
+  if (!segment.IsCorrupt() || FileExists(copyPath))
+  {
+    fprintf(stderr, "corrupt segment not rejected: %s\n", what);
+    _failures++;
+  }
+  CHECK(count < 10);
+
+  remove(copyPath.c_str());
+}
+
+static void TestCorrupt()
+{
+  TVA_UINT64 startTime = TEST_START_TIME + 200000;
+  TVA_UINT64 endTime = startTime + 10;
+  std::string path = WriteSegment(startTime, endTime, 10, true);
+  CHECK(!path.empty());
+  if (path.empty())
+  {
+    return;
+  }
+
+  long record = (long)sizeof(ReplayCacheHeader);
+  long field = record + (long)sizeof(ReplayCacheRecord) + 16;   // after the topic, padded
+  uint32_t value;
+
+  value = 4;
+  CheckCorrupt(path, record + (long)offsetof(ReplayCacheRecord, size), &value, sizeof(value), "record smaller than its header");
+  value = 0x7fffffff;
+  CheckCorrupt(path, record + (long)offsetof(ReplayCacheRecord, size), &value, sizeof(value), "record past the index");
+  value = 1000;
+  CheckCorrupt(path, record + (long)offsetof(ReplayCacheRecord, fieldCount), &value, sizeof(value), "more fields than the record holds");
+  value = 0x7fffffff;
+  CheckCorrupt(path, field + (long)offsetof(ReplayCacheField, size), &value, sizeof(value), "field past the record");
+  value = 99;
+  CheckCorrupt(path, field + (long)offsetof(ReplayCacheField, type), &value, sizeof(value), "unknown field type");
+
+  // Index pointing outside of the records
+  uint64_t offset = 0xffffffff;
+  ReplayCacheSegment segment;
+  CHECK(segment.Open(path.c_str(), TEST_TOPIC));
+  CheckCorrupt(path, (long)offsetof(ReplayCacheHeader, indexOffset), &offset, sizeof(offset), "index past the file");
+
+  // The original is intact
+  segment.Seek(startTime, endTime);
+  int count = 0;
+  MessageEvent messageEvent;
+  while (segment.Next(messageEvent))
+  {
+    FreeMessage(messageEvent);
+    count++;
+  }
+  CHECK(count == 10);
+  CHECK(!segment.IsCorrupt());
+
+  remove(path.c_str());
+}
+
+static void TestPlan()
+{
+  TVA_UINT64 startTime = TEST_START_TIME + 300000;
+  std::string first = WriteSegment(startTime + 100, startTime + 199, 10, true);
+  std::string second = WriteSegment(startTime + 150, startTime + 299, 10, true);
+  CHECK(!first.empty() && !second.empty());
+
+  // Live, first segment, the rest of the second one, live
+  std::vector<ReplayCacheRange> ranges;
+  ReplayCachePlan(_directory.c_str(), TEST_TOPIC, startTime, startTime + 399, ranges);
+  CHECK(ranges.size() == 4);
+  if (ranges.size() == 4)
+  {
+    CHECK((ranges[0].startTime == startTime) && (ranges[0].endTime == startTime + 99) && ranges[0].segmentPath.empty());
+    CHECK((ranges[1].startTime == startTime + 100) && (ranges[1].endTime == startTime + 199) && (ranges[1].segmentPath == first));
+    CHECK((ranges[2].startTime == startTime + 200) && (ranges[2].endTime == startTime + 299) && (ranges[2].segmentPath == second));
+    CHECK((ranges[3].startTime == startTime + 300) && (ranges[3].endTime == startTime + 399) && ranges[3].segmentPath.empty());
+  }
+
+  // Other topics are never planned from these segments
+  ranges.clear();
+  ReplayCachePlan(_directory.c_str(), "TEST.CACHE.B", startTime, startTime + 399, ranges);
+  CHECK((ranges.size() == 1) && ranges[0].segmentPath.empty());
+
+  remove(first.c_str());
+  remove(second.c_str());
+}
+
+int main()
+{
+  char directory[64];
+  snprintf(directory, sizeof(directory), "ReplayCacheTest.%d", (int)tva_getpid());
+  _directory = directory;
+
+  ReplayCacheWriter::Init();
+
+  TestRoundTrip();
+  TestUnordered();
+  TestCorrupt();
+  TestPlan();
+
+  tva_rmdir(_directory.c_str());
+
+  if (_failures > 0)
+  {
+    fprintf(stderr, "ReplayCacheTest: %d check(s) failed\n", _failures);
+    return 1;
+  }
+
+  printf("ReplayCacheTest: ok\n");
+  return 0;
+}
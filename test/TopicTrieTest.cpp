@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) 2012 Tervela.  All rights reserved.
+ */
+
+#include <stdio.h>
+#include <algorithm>
+#include "TopicTrie.h"
+
+static int _failures = 0;
+
+#define CHECK(condition)                                                        \
+  if (!(condition)) {                                                           \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+    _failures++;                                                                \
+  }
+
+/*-----------------------------------------------------------------------------
+ * Value of the pattern matching a topic, -1 when none matches
+ */
+static int Match(TopicTrie<int>& trie, const char* topic)
+{
+  int value;
+  return (trie.Match(topic, value)) ? value : -1;
+}
+
+static bool Add(TopicTrie<int>& trie, const char* pattern, int value)
+{
+  int previous;
+  return trie.Add(pattern, value, previous);
+}
+
+static void TestValidPatterns()
+{
+  CHECK(TopicTrie<int>::IsValidPattern("A"));
+  CHECK(TopicTrie<int>::IsValidPattern("A.B.C"));
+  CHECK(TopicTrie<int>::IsValidPattern("A.*.C"));
+  CHECK(TopicTrie<int>::IsValidPattern("A.>"));
+  CHECK(TopicTrie<int>::IsValidPattern(">"));
+  CHECK(!TopicTrie<int>::IsValidPattern(""));
+  CHECK(!TopicTrie<int>::IsValidPattern("A..C"));
+  CHECK(!TopicTrie<int>::IsValidPattern(".A"));
+  CHECK(!TopicTrie<int>::IsValidPattern("A."));
+  CHECK(!TopicTrie<int>::IsValidPattern("A.>.C"));
+}
+
+static void TestEmpty()
+{
+  TopicTrie<int> trie;
+  CHECK(trie.IsEmpty());
+  CHECK(Match(trie, "A.B") == -1);
+
+  int removed;
+  CHECK(!trie.Remove("A.B", removed));
+}
+
+static void TestExactAndWildcards()
+{
+  TopicTrie<int> trie;
+  Add(trie, "MD.NYSE.IBM", 1);
+  Add(trie, "MD.*.IBM", 2);
+  Add(trie, "MD.>", 3);
+  CHECK(!trie.IsEmpty());
+
+  CHECK(Match(trie, "MD.NYSE.IBM") == 1);
+  CHECK(Match(trie, "MD.LSE.IBM") == 2);
+  CHECK(Match(trie, "MD.LSE.VOD") == 3);
+  CHECK(Match(trie, "MD.NYSE") == 3);
+  CHECK(Match(trie, "MD.NYSE.IBM.BID") == 3);
+
+  // '>' needs at least one more level, levels are whole names
+  CHECK(Match(trie, "MD") == -1);
+  CHECK(Match(trie, "MDX.NYSE.IBM") == -1);
+  CHECK(Match(trie, "MD.NYSE.IB") == 3);
+  CHECK(Match(trie, "OTHER.NYSE.IBM") == -1);
+}
+
+static void TestMostSpecific()
+{
+  TopicTrie<int> trie;
+  Add(trie, "A.*.C", 1);
+  Add(trie, "A.B.>", 2);
+  Add(trie, "A.B.C.D", 3);
+
+  // An exact level is preferred, even over a longer wildcard match below it
+  CHECK(Match(trie, "A.B.C") == 2);
+  CHECK(Match(trie, "A.X.C") == 1);
+
+  // An exact level that leads nowhere falls back to '*'
+  TopicTrie<int> fallback;
+  Add(fallback, "A.B.C", 1);
+  Add(fallback, "A.*.D", 2);
+  Add(fallback, ">", 3);
+  CHECK(Match(fallback, "A.B.C") == 1);
+  CHECK(Match(fallback, "A.B.D") == 2);
+  CHECK(Match(fallback, "A.B.E") == 3);
+  CHECK(Match(fallback, "Z") == 3);
+
+  // A pattern that is only a prefix of the topic does not match it
+  TopicTrie<int> prefix;
+  Add(prefix, "A.B", 1);
+  CHECK(Match(prefix, "A.B.C") == -1);
+  CHECK(Match(prefix, "A") == -1);
+}
+
+static void TestReplaceAndRemove()
+{
+  TopicTrie<int> trie;
+  int previous = 0;
+  CHECK(!trie.Add("A.B", 1, previous));
+  CHECK(trie.Add("A.B", 2, previous));
+  CHECK(previous == 1);
+  CHECK(Match(trie, "A.B") == 2);
+
+  Add(trie, "A.B.C", 3);
+  Add(trie, "A.*", 4);
+
+  int removed = 0;
+  CHECK(trie.Remove("A.B", removed));
+  CHECK(removed == 2);
+  CHECK(!trie.Remove("A.B", removed));
+  CHECK(Match(trie, "A.B") == 4);
+  CHECK(Match(trie, "A.B.C") == 3);
+
+  // Removing a pattern that only exists as a prefix of another is a no-op
+  CHECK(!trie.Remove("A", removed));
+  CHECK(!trie.Remove("A.B.C.D", removed));
+  CHECK(Match(trie, "A.B.C") == 3);
+
+  CHECK(trie.Remove("A.B.C", removed));
+  CHECK(removed == 3);
+  CHECK(trie.Remove("A.*", removed));
+  CHECK(removed == 4);
+  CHECK(trie.IsEmpty());
+  CHECK(Match(trie, "A.B") == -1);
+}
+
+static void TestValues()
+{
+  TopicTrie<int> trie;
+  Add(trie, "A", 1);
+  Add(trie, "A.B", 2);
+  Add(trie, "A.*.C", 3);
+  Add(trie, "B.>", 4);
+
+  std::vector<int> values;
+  trie.GetValues(values);
+  std::sort(values.begin(), values.end());
+  CHECK(values.size() == 4);
+  for (size_t i = 0; i < values.size(); i++)
+  {
+    CHECK(values[i] == (int)i + 1);
+  }
+
+  trie.Clear();
+  CHECK(trie.IsEmpty());
+  values.clear();
+  trie.GetValues(values);
+  CHECK(values.empty());
+  CHECK(Match(trie, "A.B") == -1);
+}
+
+int main()
+{
+  TestValidPatterns();
+  TestEmpty();
+  TestExactAndWildcards();
+  TestMostSpecific();
+  TestReplaceAndRemove();
+  TestValues();
+
+  if (_failures > 0)
+  {
+    fprintf(stderr, "TopicTrieTest: %d check(s) failed\n", _failures);
+    return 1;
+  }
+
+  printf("TopicTrieTest: ok\n");
+  return 0;
+}